@@ -0,0 +1,231 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2017-2019 Michael O and contributors
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+
+    Additional permission under GNU GPL version 3 section 7
+
+    If you modify this Program, or any covered work, by linking or
+    combining it with NVIDIA Corporation's libraries from the
+    NVIDIA CUDA Toolkit and/or the NVIDIA CUDA Deep Neural
+    Network library and/or the NVIDIA TensorRT inference library
+    (or a modified version of those libraries), containing parts covered
+    by the terms of the respective license agreement, the licensors of
+    this Program grant you additional permission to convey the resulting
+    work.
+*/
+
+#include "BatchController.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <sstream>
+
+#include <boost/format.hpp>
+
+/// Weight of the latest sample in the moving averages of the arrival rate and the service times
+static constexpr auto AVERAGE_WEIGHT = 0.2;
+/// The arrival rate is sampled at most this often
+static constexpr auto ARRIVAL_SAMPLE_MS = 5.0;
+/// Evaluations the latency histogram holds before it decays
+static constexpr auto LATENCY_WINDOW = 4096.0;
+/// Evaluations between two adjustments of the budget
+static constexpr auto ADJUST_INTERVAL = size_t{256};
+/// The budget is lowered this much at once when the p99 misses the target, and raised slowly while well below it
+static constexpr auto BUDGET_DECREASE = 0.8;
+static constexpr auto BUDGET_INCREASE = 1.05;
+static constexpr auto MIN_BUDGET_SCALE = 0.1;
+
+BatchController::BatchController(const size_t max_batch_size, const int workers)
+    : m_max_batch_size(std::max(max_batch_size, size_t{1})), m_workers(std::max(workers, 1)),
+      m_sampled_at(std::chrono::steady_clock::now()), m_service_ms(m_max_batch_size + 1, 0.0),
+      m_batch_sizes(m_max_batch_size + 1, 0), m_latencies(LATENCY_BUCKETS, 0.0)
+{
+}
+
+int BatchController::latency_bucket(const double latency_ms)
+{
+    if (latency_ms <= LATENCY_BASE_MS)
+        return 0;
+
+    const auto bucket = static_cast<int>(std::log(latency_ms / LATENCY_BASE_MS) / std::log(LATENCY_GROWTH)) + 1;
+    return std::min(bucket, LATENCY_BUCKETS - 1);
+}
+
+double BatchController::latency_bucket_limit_ms(const int bucket)
+{
+    return LATENCY_BASE_MS * std::pow(LATENCY_GROWTH, bucket);
+}
+
+void BatchController::update_arrival_rate(const std::chrono::steady_clock::time_point now)
+{
+    const auto elapsed_ms = std::chrono::duration<double, std::milli>(now - m_sampled_at).count();
+    if (elapsed_ms < ARRIVAL_SAMPLE_MS)
+        return;
+
+    const auto arrivals = m_arrivals.load(std::memory_order_relaxed);
+    const auto rate = (arrivals - m_sampled_arrivals) * 1000.0 / elapsed_ms;
+    m_arrival_rate += AVERAGE_WEIGHT * (rate - m_arrival_rate);
+    m_sampled_arrivals = arrivals;
+    m_sampled_at = now;
+}
+
+double BatchController::service_ms(const size_t size) const
+{
+    auto below = size;
+    while (below > 0 && m_service_ms[below] == 0.0)
+        below--;
+
+    auto above = size;
+    while (above <= m_max_batch_size && m_service_ms[above] == 0.0)
+        above++;
+
+    if (below > 0 && above <= m_max_batch_size && below != above)
+        return m_service_ms[below] + (m_service_ms[above] - m_service_ms[below]) * (size - below) / (above - below);
+
+    // Past the largest measured size assume the time grows with the size, below the smallest one that it does not shrink
+    if (below > 0)
+        return m_service_ms[below] * size / below;
+    if (above <= m_max_batch_size)
+        return m_service_ms[above];
+
+    return 0.0;
+}
+
+BatchController::Decision BatchController::decide(const size_t queued, const double target_ms)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    update_arrival_rate(std::chrono::steady_clock::now());
+    m_target_ms = target_ms;
+
+    const auto budget_ms = target_ms * m_budget_scale;
+
+    // The largest batch whose remaining evaluations arrive and run within the budget
+    auto batch_size = size_t{1};
+    for (auto size = size_t{1}; size <= m_max_batch_size; size++)
+    {
+        auto fill_ms = 0.0;
+        if (size > queued)
+            fill_ms = m_arrival_rate > 0.0 ? (size - queued) * 1000.0 / m_arrival_rate : std::numeric_limits<double>::infinity();
+
+        if (fill_ms + service_ms(size) <= budget_ms)
+            batch_size = size;
+    }
+
+    // Small batches that cannot keep up with the arrivals only let the queue grow, trade latency for throughput then
+    while (batch_size < m_max_batch_size && service_ms(batch_size) > 0.0
+           && m_workers * batch_size * 1000.0 / service_ms(batch_size) < m_arrival_rate)
+        batch_size++;
+
+    const auto timeout_ms = std::max(budget_ms - service_ms(batch_size), 0.0);
+    m_last_decision = Decision{batch_size, timeout_ms};
+
+    return m_last_decision;
+}
+
+void BatchController::record_batch(const size_t size, const double service_ms, const std::vector<double>& latencies_ms, const double target_ms)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    if (size >= 1 && size <= m_max_batch_size)
+    {
+        auto& average = m_service_ms[size];
+        average = average == 0.0 ? service_ms : average + AVERAGE_WEIGHT * (service_ms - average);
+        m_batch_sizes[size]++;
+    }
+
+    for (const auto latency : latencies_ms)
+        m_latencies[latency_bucket(latency)] += 1.0;
+    m_latency_count += latencies_ms.size();
+
+    if (m_latency_count >= LATENCY_WINDOW)
+    {
+        for (auto& count : m_latencies)
+            count /= 2.0;
+        m_latency_count /= 2.0;
+    }
+
+    m_evaluations_since_adjust += latencies_ms.size();
+    if (m_evaluations_since_adjust >= ADJUST_INTERVAL)
+    {
+        m_evaluations_since_adjust = 0;
+
+        const auto p99 = latency_p99_locked();
+        if (p99 > target_ms)
+            m_budget_scale = std::max(m_budget_scale * BUDGET_DECREASE, MIN_BUDGET_SCALE);
+        else if (p99 < BUDGET_DECREASE * target_ms)
+            m_budget_scale = std::min(m_budget_scale * BUDGET_INCREASE, 1.0);
+    }
+}
+
+double BatchController::latency_p99_locked() const
+{
+    if (m_latency_count == 0.0)
+        return 0.0;
+
+    auto below = 0.0;
+    for (auto bucket = 0; bucket < LATENCY_BUCKETS; bucket++)
+    {
+        below += m_latencies[bucket];
+        if (below >= 0.99 * m_latency_count)
+            return latency_bucket_limit_ms(bucket);
+    }
+
+    return latency_bucket_limit_ms(LATENCY_BUCKETS - 1);
+}
+
+double BatchController::latency_p99_ms() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return latency_p99_locked();
+}
+
+std::pair<std::uint64_t, std::uint64_t> BatchController::batch_totals() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto batches = std::uint64_t{0};
+    auto evaluations = std::uint64_t{0};
+
+    for (auto size = size_t{1}; size <= m_max_batch_size; size++)
+    {
+        batches += m_batch_sizes[size];
+        evaluations += size * m_batch_sizes[size];
+    }
+
+    return {batches, evaluations};
+}
+
+std::string BatchController::report() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    std::ostringstream out;
+
+    out << boost::format("target p99 %.1f ms, measured p99 %.1f ms, budget %.1f ms, arrivals %.0f/s\n")
+        % m_target_ms % latency_p99_locked() % (m_target_ms * m_budget_scale) % m_arrival_rate;
+    out << boost::format("decision: batch %d, timeout %.2f ms\n") % m_last_decision.batch_size % m_last_decision.timeout_ms;
+
+    out << "batch sizes:";
+    for (auto size = size_t{1}; size <= m_max_batch_size; size++)
+        out << boost::format(" %d:%d") % size % m_batch_sizes[size];
+    out << "\n";
+
+    out << "service ms:";
+    for (auto size = size_t{1}; size <= m_max_batch_size; size++)
+        if (m_service_ms[size] > 0.0)
+            out << boost::format(" %d:%.2f") % size % m_service_ms[size];
+
+    return out.str();
+}
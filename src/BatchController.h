@@ -0,0 +1,134 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2017-2019 Michael O and contributors
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+
+    Additional permission under GNU GPL version 3 section 7
+
+    If you modify this Program, or any covered work, by linking or
+    combining it with NVIDIA Corporation's libraries from the
+    NVIDIA CUDA Toolkit and/or the NVIDIA CUDA Deep Neural
+    Network library and/or the NVIDIA TensorRT inference library
+    (or a modified version of those libraries), containing parts covered
+    by the terms of the respective license agreement, the licensors of
+    this Program grant you additional permission to convey the resulting
+    work.
+*/
+
+#ifndef BATCHCONTROLLER_H_INCLUDED
+#define BATCHCONTROLLER_H_INCLUDED
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+/// Decides how the workers of a batching backend form their batches. It tracks the arrival rate of evaluations, the
+/// service time of every batch size and the latency of the completed evaluations, then picks the largest batch that can
+/// fill up and run within the latency budget. The budget starts at the p99 target and shrinks while the measured p99
+/// misses it. Only a backend that forms batches itself needs one: the lanes of a CompositePipe and the workers of an
+/// InferenceServer hand single evaluations to a pipe, whose own controller batches them.
+class BatchController
+{
+public:
+
+	struct Decision
+	{
+		/// Take a batch as soon as this many evaluations are queued
+		size_t batch_size;
+		/// Wait at most this long for them, then take whatever is queued
+		double timeout_ms;
+	};
+
+	/// Workers is the number of batches the backend can run at once
+	BatchController(size_t max_batch_size, int workers);
+
+	BatchController(const BatchController&) = delete;
+	BatchController& operator=(const BatchController&) = delete;
+
+	/// Called for every evaluation entering the queue
+	void record_arrival()
+	{
+		m_arrivals.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	/// Called by a worker about to form a batch, queued is the current queue depth
+	Decision decide(size_t queued, double target_ms);
+
+	/// Called by a worker once a batch completed, with the time from taking the batch to handing back the outputs and the
+	/// latency of each of its evaluations since they were queued
+	void record_batch(size_t size, double service_ms, const std::vector<double>& latencies_ms, double target_ms);
+
+	/// Latency below which 99% of the recent evaluations completed
+	double latency_p99_ms() const;
+
+	/// Human readable state: the last decision, the measured rates and the histogram of batch sizes, without a final newline
+	std::string report() const;
+
+	/// Batches taken so far and the evaluations they held
+	std::pair<std::uint64_t, std::uint64_t> batch_totals() const;
+
+	size_t max_batch_size() const
+	{
+		return m_max_batch_size;
+	}
+
+private:
+
+	/// Latency buckets grow by LATENCY_GROWTH from LATENCY_BASE_MS, enough for several seconds
+	static constexpr auto LATENCY_BUCKETS = 64;
+	static constexpr auto LATENCY_BASE_MS = 0.05;
+	static constexpr auto LATENCY_GROWTH = 1.2;
+
+	static int latency_bucket(double latency_ms);
+	static double latency_bucket_limit_ms(int bucket);
+
+	/// Estimated time to run a batch of the size, from the measured neighbouring sizes
+	double service_ms(size_t size) const;
+	double latency_p99_locked() const;
+	void update_arrival_rate(std::chrono::steady_clock::time_point now);
+
+	const size_t m_max_batch_size;
+	const int m_workers;
+
+	std::atomic<std::uint64_t> m_arrivals{0};
+
+	mutable std::mutex m_mutex;
+
+	std::uint64_t m_sampled_arrivals{0};
+	std::chrono::steady_clock::time_point m_sampled_at;
+	double m_arrival_rate{0.0};
+
+	/// Moving average of the service time per batch size, zero while unmeasured
+	std::vector<double> m_service_ms;
+	/// Batches taken per size, the index is the size
+	std::vector<std::uint64_t> m_batch_sizes;
+
+	/// Decaying histogram of the latencies, halved whenever it holds LATENCY_WINDOW evaluations
+	std::vector<double> m_latencies;
+	double m_latency_count{0.0};
+	size_t m_evaluations_since_adjust{0};
+
+	/// Fraction of the target used as budget, lowered while the p99 misses the target
+	double m_budget_scale{1.0};
+	double m_target_ms{0.0};
+	Decision m_last_decision{1, 0.0};
+};
+
+#endif
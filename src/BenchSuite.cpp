@@ -0,0 +1,392 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2017-2019 Michael O and contributors
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+
+    Additional permission under GNU GPL version 3 section 7
+
+    If you modify this Program, or any covered work, by linking or
+    combining it with NVIDIA Corporation's libraries from the
+    NVIDIA CUDA Toolkit and/or the NVIDIA CUDA Deep Neural
+    Network library and/or the NVIDIA TensorRT inference library
+    (or a modified version of those libraries), containing parts covered
+    by the terms of the respective license agreement, the licensors of
+    this Program grant you additional permission to convey the resulting
+    work.
+*/
+
+#include "config.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <ctime>
+#include <fstream>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include <vector>
+
+#include <boost/format.hpp>
+
+#ifdef __linux__
+#include <dirent.h>
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#include "BenchSuite.h"
+#include "GTP.h"
+#include "SGFTree.h"
+#include "SMP.h"
+#include "UCTNode.h"
+#include "UCTSearch.h"
+
+namespace
+{
+    std::string json_string(const std::string& text)
+	{
+        auto result = std::string("\"");
+        for (const auto c : text)
+		{
+            if (c == '"' || c == '\\')
+                result += '\\';
+            result += c;
+        }
+        return result + "\"";
+    }
+
+    /// Nearest rank percentile of sorted values
+    double percentile(const std::vector<double>& sorted, const double fraction)
+	{
+        const auto rank = static_cast<size_t>(std::ceil(fraction * sorted.size()));
+        return sorted[std::max(rank, size_t{1}) - 1];
+    }
+
+    bool is_absolute(const std::string& path)
+	{
+        return (!path.empty() && (path[0] == '/' || path[0] == '\\')) || (path.size() > 1 && path[1] == ':');
+    }
+
+    /// Data TLB load misses of all threads of the process from construction on, through the Linux performance
+    /// counters. Unavailable on other systems, without a hardware counter or when perf_event_paranoid forbids it.
+    class TlbMissCounter
+	{
+    public:
+
+        TlbMissCounter()
+		{
+#ifdef __linux__
+            perf_event_attr attributes{};
+            attributes.size = sizeof(attributes);
+            attributes.type = PERF_TYPE_HW_CACHE;
+            attributes.config = PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+            attributes.exclude_kernel = 1;
+            attributes.exclude_hv = 1;
+
+            // One counter per thread, the search and evaluation threads all exist before the search starts
+            const auto tasks = opendir("/proc/self/task");
+            if (!tasks)
+                return;
+
+            auto available = true;
+            while (const auto task = readdir(tasks))
+			{
+                if (task->d_name[0] == '.')
+                    continue;
+
+                const auto thread = std::atoi(task->d_name);
+                const auto descriptor = static_cast<int>(syscall(__NR_perf_event_open, &attributes, thread, -1, -1, 0));
+                if (descriptor < 0)
+				{
+                    available = false;
+                    break;
+                }
+                m_descriptors.emplace_back(descriptor);
+            }
+            closedir(tasks);
+
+            if (!available)
+                close_all();
+#endif
+        }
+
+        ~TlbMissCounter()
+		{
+            close_all();
+        }
+
+        TlbMissCounter(const TlbMissCounter&) = delete;
+        TlbMissCounter& operator=(const TlbMissCounter&) = delete;
+
+        /// Misses counted so far, -1 when not available
+        std::int64_t read() const
+		{
+            if (m_descriptors.empty())
+                return -1;
+
+            auto total = std::int64_t{0};
+#ifdef __linux__
+            for (const auto descriptor : m_descriptors)
+			{
+                auto count = std::uint64_t{0};
+                if (::read(descriptor, &count, sizeof(count)) != sizeof(count))
+                    return -1;
+                total += static_cast<std::int64_t>(count);
+            }
+#endif
+            return total;
+        }
+
+    private:
+
+        void close_all()
+		{
+#ifdef __linux__
+            for (const auto descriptor : m_descriptors)
+                close(descriptor);
+#endif
+            m_descriptors.clear();
+        }
+
+        std::vector<int> m_descriptors;
+    };
+
+    const char* placement_name(const SMP::Placement placement)
+	{
+        switch (placement)
+		{
+            case SMP::Placement::CORES: return "cores";
+            case SMP::Placement::NODES: return "nodes";
+            default: return "none";
+        }
+    }
+
+    const char* huge_pages_name(const SMP::HugePages mode)
+	{
+        switch (mode)
+		{
+            case SMP::HugePages::TRANSPARENT: return "transparent";
+            case SMP::HugePages::EXPLICIT: return "explicit";
+            default: return "off";
+        }
+    }
+}
+
+BenchSuite::BenchSuite(const std::string& filename) : m_filename(filename)
+{
+    std::ifstream file(filename);
+    if (!file)
+        throw std::runtime_error("cannot open " + filename);
+
+    const auto separator = filename.find_last_of("/\\");
+    const auto directory = separator == std::string::npos ? std::string() : filename.substr(0, separator + 1);
+
+    auto line = std::string();
+    auto line_number = 0;
+
+    while (std::getline(file, line))
+	{
+        line_number++;
+        std::istringstream line_stream(line);
+        auto name = std::string();
+        auto source = std::string();
+
+        if (!(line_stream >> name) || name[0] == '#')
+            continue;
+
+        const auto where = filename + ":" + std::to_string(line_number);
+        line_stream >> source;
+
+        try
+		{
+            if (source == "moves")
+			{
+                m_positions.push_back({name, load_moves(line_stream)});
+            }
+			else if (source == "sgf")
+			{
+                auto path = std::string();
+                auto movenum = 999;
+                line_stream >> path;
+                if (!(line_stream >> movenum))
+                    movenum = 999;
+
+                if (path.empty())
+                    throw std::runtime_error("missing SGF file");
+                if (!is_absolute(path))
+                    path = directory + path;
+
+                m_positions.push_back({name, load_sgf(path, movenum)});
+            }
+			else
+			{
+                throw std::runtime_error("unknown source \"" + source + "\", expected moves or sgf");
+            }
+        }
+		catch (const std::exception& exception)
+		{
+            throw std::runtime_error(where + ": " + exception.what());
+        }
+    }
+
+    if (m_positions.empty())
+        throw std::runtime_error(filename + " has no positions");
+}
+
+GameState BenchSuite::load_moves(std::istream& moves)
+{
+    GameState state;
+    state.init_game(BOARD_SIZE, KOMI);
+
+    auto color = std::string();
+    auto vertex = std::string();
+    while (moves >> color >> vertex)
+	{
+        if (!state.play_text(color, vertex))
+            throw std::runtime_error("illegal move " + color + " " + vertex);
+    }
+
+    return state;
+}
+
+GameState BenchSuite::load_sgf(const std::string& filename, const int movenum)
+{
+    auto sgf_tree = std::make_unique<SGFTree>();
+    sgf_tree->load_from_file(filename);
+
+    return sgf_tree->follow_mainline_state(movenum - 1);
+}
+
+BenchSuite::Measurement BenchSuite::search(Network& network, const Position& position)
+{
+    auto game = position.state;
+    // Infinite time, the visit limit stops the search
+    game.set_time_control(0, 1, 0, 0);
+    network.nn_cache_clear();
+
+    auto measurement = Measurement();
+    measurement.before = network.get_statistics();
+    const auto tree_before = UCTNodePointer::get_exact_tree_size();
+
+    auto search = std::make_unique<UCTSearch>(game, network);
+    const TlbMissCounter tlb_misses;
+    const auto start = std::chrono::steady_clock::now();
+    search->think(game.get_to_move());
+    measurement.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    measurement.tlb_misses = tlb_misses.read();
+
+    // The tree only grows during a search, it is at its largest when the search returns
+    const auto tree_after = UCTNodePointer::get_exact_tree_size();
+    measurement.tree_bytes = tree_after > tree_before ? tree_after - tree_before : 0;
+    measurement.playouts = search->get_playouts();
+    measurement.after = network.get_statistics();
+
+    return measurement;
+}
+
+std::string BenchSuite::report_position(const Position& position, const std::vector<Measurement>& measurements)
+{
+    auto seconds = 0.0;
+    auto playouts = std::uint64_t{0};
+    auto evaluations = std::uint64_t{0};
+    auto cache_lookups = std::uint64_t{0};
+    auto cache_hits = std::uint64_t{0};
+    auto batched_evaluations = std::uint64_t{0};
+    auto batch_capacity = std::uint64_t{0};
+    auto peak_tree_bytes = size_t{0};
+    auto tlb_misses = std::int64_t{0};
+    auto latencies_ms = std::vector<double>();
+
+    for (const auto& measurement : measurements)
+	{
+        seconds += measurement.seconds;
+        playouts += measurement.playouts;
+        evaluations += measurement.after.evaluations - measurement.before.evaluations;
+        cache_lookups += measurement.after.cache_lookups - measurement.before.cache_lookups;
+        cache_hits += measurement.after.cache_hits - measurement.before.cache_hits;
+        batched_evaluations += measurement.after.batches.evaluations - measurement.before.batches.evaluations;
+        batch_capacity += measurement.after.batches.capacity - measurement.before.batches.capacity;
+        peak_tree_bytes = std::max(peak_tree_bytes, measurement.tree_bytes);
+        tlb_misses = tlb_misses < 0 || measurement.tlb_misses < 0 ? -1 : tlb_misses + measurement.tlb_misses;
+        latencies_ms.emplace_back(1000.0 * measurement.seconds);
+    }
+
+    std::sort(begin(latencies_ms), end(latencies_ms));
+
+    // Backends that do not batch have no fill to report
+    const auto batch_fill = batch_capacity == 0 ? std::string("null") : str(boost::format("%.3f") % (static_cast<double>(batched_evaluations) / batch_capacity));
+    const auto cache_hit_rate = cache_lookups == 0 ? 0.0 : static_cast<double>(cache_hits) / cache_lookups;
+    // Without performance counters there are no misses to report
+    const auto tlb_misses_per_playout = tlb_misses < 0 || playouts == 0 ? std::string("null") : str(boost::format("%.1f") % (static_cast<double>(tlb_misses) / playouts));
+
+    std::ostringstream out;
+    out << "    {\n";
+    out << "      \"name\": " << json_string(position.name) << ",\n";
+    out << "      \"move_number\": " << position.state.get_move_number() << ",\n";
+    out << "      \"to_move\": \"" << (position.state.get_to_move() == FastBoard::BLACK ? "b" : "w") << "\",\n";
+    out << "      \"repeats\": " << measurements.size() << ",\n";
+    out << boost::format("      \"nodes_per_second\": %.1f,\n") % (playouts / seconds);
+    out << boost::format("      \"nn_evals_per_second\": %.1f,\n") % (evaluations / seconds);
+    out << boost::format("      \"cache_hit_rate\": %.4f,\n") % cache_hit_rate;
+    out << "      \"peak_tree_bytes\": " << peak_tree_bytes << ",\n";
+    out << "      \"batch_fill\": " << batch_fill << ",\n";
+    out << "      \"dtlb_misses_per_playout\": " << tlb_misses_per_playout << ",\n";
+    out << boost::format("      \"think_ms_p50\": %.3f,\n") % percentile(latencies_ms, 0.5);
+    out << boost::format("      \"think_ms_p99\": %.3f\n") % percentile(latencies_ms, 0.99);
+    out << "    }";
+
+    return out.str();
+}
+
+std::string BenchSuite::run(Network& network, const int repeats) const
+{
+    char date[32];
+    const auto now = std::time(nullptr);
+    std::strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%S", std::localtime(&now));
+
+    std::ostringstream out;
+    out << "{\n";
+    out << "  \"context\": {\n";
+    out << "    \"date\": \"" << date << "\",\n";
+    out << "    \"suite\": " << json_string(m_filename) << ",\n";
+    out << "    \"weights\": " << json_string(cfg_weights_file) << ",\n";
+    out << "    \"board_size\": " << BOARD_SIZE << ",\n";
+    out << "    \"visits\": " << cfg_max_visits << ",\n";
+    out << "    \"threads\": " << cfg_num_threads << ",\n";
+    out << "    \"pin_threads\": \"" << placement_name(SMP::get_placement()) << "\",\n";
+    out << "    \"huge_pages\": \"" << huge_pages_name(SMP::get_huge_pages()) << "\",\n";
+    out << "    \"numa_nodes\": " << SMP::get_num_nodes() << ",\n";
+    out << "    \"repeats\": " << repeats << "\n";
+    out << "  },\n";
+    out << "  \"positions\": [\n";
+
+    for (auto i = size_t{0}; i < m_positions.size(); i++)
+	{
+        auto measurements = std::vector<Measurement>();
+        for (auto repeat = 0; repeat < repeats; repeat++)
+            measurements.emplace_back(search(network, m_positions[i]));
+
+        out << report_position(m_positions[i], measurements) << (i + 1 < m_positions.size() ? ",\n" : "\n");
+    }
+
+    out << "  ]\n";
+    out << "}\n";
+
+    return out.str();
+}
@@ -0,0 +1,97 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2017-2019 Michael O and contributors
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+
+    Additional permission under GNU GPL version 3 section 7
+
+    If you modify this Program, or any covered work, by linking or
+    combining it with NVIDIA Corporation's libraries from the
+    NVIDIA CUDA Toolkit and/or the NVIDIA CUDA Deep Neural
+    Network library and/or the NVIDIA TensorRT inference library
+    (or a modified version of those libraries), containing parts covered
+    by the terms of the respective license agreement, the licensors of
+    this Program grant you additional permission to convey the resulting
+    work.
+*/
+
+#ifndef BENCHSUITE_H_INCLUDED
+#define BENCHSUITE_H_INCLUDED
+
+#include "config.h"
+
+#include <cstdint>
+#include <istream>
+#include <string>
+#include <vector>
+
+#include "GameState.h"
+#include "Network.h"
+
+/// End-to-end search benchmark over a fixed suite of positions, the regression gate of performance work. Every position
+/// is searched from a fresh tree and an empty cache with the visit limit and threads of the configuration.
+///
+/// A suite file has one position per line, a name followed by where the position comes from:
+///
+///     # Comment
+///     opening   moves b e5 w c3 b g7
+///     ko-fight  sgf games/ko.sgf 41
+///
+/// "moves" plays GTP colors and vertices from the empty board, "sgf" follows the main line of a game up to the given
+/// move, or to its end without one. Relative paths start at the directory of the suite file.
+class BenchSuite
+{
+public:
+
+    /// Suite of the repository, bench/suite.txt, relative to a build directory next to src or to src itself
+    static constexpr auto DEFAULT_FILE = "../src/bench/suite.txt";
+
+    /// Load the positions of a suite file, throws std::runtime_error on a line it cannot read
+    explicit BenchSuite(const std::string& filename);
+
+    /// Search every position the given number of times, returns the report as JSON
+    std::string run(Network& network, int repeats) const;
+
+private:
+
+    struct Position
+    {
+        std::string name;
+        GameState state;
+    };
+
+    struct Measurement
+    {
+        double seconds;
+        int playouts;
+        size_t tree_bytes;
+        /// Data TLB load misses during the search, -1 without performance counters
+        std::int64_t tlb_misses;
+        Network::Statistics before;
+        Network::Statistics after;
+    };
+
+    static GameState load_moves(std::istream& moves);
+    static GameState load_sgf(const std::string& filename, int movenum);
+
+    static Measurement search(Network& network, const Position& position);
+    static std::string report_position(const Position& position, const std::vector<Measurement>& measurements);
+
+    std::string m_filename;
+    std::vector<Position> m_positions;
+	
+};
+
+#endif
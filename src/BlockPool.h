@@ -0,0 +1,179 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2017-2019 Michael O and contributors
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+
+    Additional permission under GNU GPL version 3 section 7
+
+    If you modify this Program, or any covered work, by linking or
+    combining it with NVIDIA Corporation's libraries from the
+    NVIDIA CUDA Toolkit and/or the NVIDIA CUDA Deep Neural
+    Network library and/or the NVIDIA TensorRT inference library
+    (or a modified version of those libraries), containing parts covered
+    by the terms of the respective license agreement, the licensors of
+    this Program grant you additional permission to convey the resulting
+    work.
+*/
+
+#ifndef BLOCKPOOL_H_INCLUDED
+#define BLOCKPOOL_H_INCLUDED
+
+#include "config.h"
+
+#include <cstddef>
+#include <mutex>
+#include <new>
+
+#include "SMP.h"
+
+/// Storage for the objects the search allocates by the million, tree nodes and cache entries. With huge pages on, the
+/// blocks are carved from huge page chunks so a tree of several GiB needs a few thousand TLB entries instead of a
+/// million. With huge pages off it is the heap.
+///
+/// Chunks are never returned to the system, a freed block is only ever reused by the next allocation of the same type.
+/// The memory of a pool is thus the peak number of its live blocks, which the tree size and cache limits bound, and
+/// memory freed when the tree is pruned or the cache shrinks stays with the process. Blocks of one chunk are spread
+/// over the free lists of every thread, so telling when a whole chunk is free would cost a count per chunk on every
+/// allocation.
+template <typename T>
+class BlockPool
+{
+public:
+
+	/// Blocks a thread keeps for itself before handing some back to the shared list
+	static constexpr size_t MAX_CACHED = 256;
+
+	/// Blocks moved between a thread and the shared list at a time
+	static constexpr size_t BATCH = 64;
+
+	static void* allocate()
+	{
+		if (SMP::get_huge_pages() == SMP::HugePages::OFF)
+			return ::operator new(sizeof(T));
+
+		auto& cache = local_cache();
+		if (!cache.head)
+			refill(cache);
+
+		const auto block = cache.head;
+		cache.head = block->next;
+		cache.count--;
+		return block;
+	}
+
+	static void deallocate(void* pointer)
+	{
+		if (SMP::get_huge_pages() == SMP::HugePages::OFF)
+		{
+			::operator delete(pointer);
+			return;
+		}
+
+		auto& cache = local_cache();
+		const auto block = static_cast<Block*>(pointer);
+		block->next = cache.head;
+		cache.head = block;
+		if (++cache.count > MAX_CACHED)
+			give_back(cache, BATCH);
+	}
+
+private:
+
+	union Block
+	{
+		Block* next;
+		alignas(T) unsigned char storage[sizeof(T)];
+	};
+
+	/// Free blocks of one thread, returned to the shared list when it exits
+	struct LocalCache
+	{
+		Block* head{nullptr};
+		size_t count{0};
+
+		~LocalCache()
+		{
+			give_back(*this, count);
+		}
+	};
+
+	/// Free blocks of all threads and the chunk new blocks are cut from, leaked on purpose so that threads exiting
+	/// during static destruction can still return their blocks
+	struct Shared
+	{
+		std::mutex mutex;
+		Block* head{nullptr};
+		unsigned char* next{nullptr};
+		unsigned char* end{nullptr};
+	};
+
+	static Shared& shared()
+	{
+		static auto state = new Shared();
+		return *state;
+	}
+
+	static LocalCache& local_cache()
+	{
+		static thread_local LocalCache cache;
+		return cache;
+	}
+
+	static void refill(LocalCache& cache)
+	{
+		auto& state = shared();
+		std::lock_guard<std::mutex> lock(state.mutex);
+
+		while (state.head && cache.count < BATCH)
+		{
+			const auto block = state.head;
+			state.head = block->next;
+			block->next = cache.head;
+			cache.head = block;
+			cache.count++;
+		}
+
+		while (cache.count < BATCH)
+		{
+			if (state.next + sizeof(Block) > state.end)
+			{
+				state.next = static_cast<unsigned char*>(SMP::allocate_pages(SMP::HUGE_PAGE_SIZE));
+				state.end = state.next + SMP::HUGE_PAGE_SIZE;
+			}
+			const auto block = reinterpret_cast<Block*>(state.next);
+			state.next += sizeof(Block);
+			block->next = cache.head;
+			cache.head = block;
+			cache.count++;
+		}
+	}
+
+	static void give_back(LocalCache& cache, size_t count)
+	{
+		auto& state = shared();
+		std::lock_guard<std::mutex> lock(state.mutex);
+
+		for (; count > 0 && cache.head; count--)
+		{
+			const auto block = cache.head;
+			cache.head = block->next;
+			block->next = state.head;
+			state.head = block;
+			cache.count--;
+		}
+	}
+};
+
+#endif
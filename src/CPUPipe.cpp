@@ -29,6 +29,9 @@
 
 #include "config.h"
 
+#include <algorithm>
+#include <cassert>
+
 #ifdef __APPLE__
 #include <Accelerate/Accelerate.h>
 #endif
@@ -41,10 +44,17 @@
 #ifndef USE_BLAS
 #include <Eigen/Dense>
 #endif
+#if defined(__AVX2__) || defined(__AVX512F__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
 
 #include "CPUPipe.h"
 #include "Network.h"
 #include "Im2Col.h"
+#include "SMP.h"
+#include "Trace.h"
 
 #ifndef USE_BLAS
 // Eigen helpers
@@ -57,53 +67,32 @@ using ConstEigenMatrixMap = Eigen::Map<const Eigen::Matrix<T, Eigen::Dynamic, Ei
 
 void CPUPipe::initialize(const int channels)
 {
-    m_input_channels = channels;
+    // The number of filters comes with the weights
+    (void)channels;
 }
 
+template <int M>
 void CPUPipe::winograd_transform_in(const std::vector<float>& in, std::vector<float>& V, const int channels)
 {
+    using Transform = WinogradTransform<M>;
+    constexpr auto ALPHA = Transform::ALPHA;
+
     constexpr auto W = BOARD_SIZE;
     constexpr auto H = BOARD_SIZE;
-    constexpr auto W_TILES = WINOGRAD_W_TILES;
-    constexpr auto P = WINOGRAD_P;
+    constexpr auto W_TILES = winograd_tiles(BOARD_SIZE, M);
+    constexpr auto P = W_TILES * W_TILES;
 
-    constexpr auto W_PAD = 2 + WINOGRAD_M * W_TILES;
+    constexpr auto W_PAD = 2 + M * W_TILES;
 
     constexpr auto buffer_size = 32;
 
     std::array<std::array<float, W_PAD>, W_PAD> in_pad{0.0f};
 
-    std::array<float, buffer_size * WINOGRAD_ALPHA * WINOGRAD_ALPHA> buffer{};
+    std::array<float, buffer_size * ALPHA * ALPHA> buffer{};
     auto buffer_offset = 0;
     auto buffer_entries = 0;
 
-
-    // multiple vector [i0..i5] by Bt and produce [o0..o5]
-    // const auto Bt = std::array<float, WINOGRAD_TILE>
-    //           {1.0f,  0.0f,     -5.0f/2.0f,  0.0f,      1.0f, 0.0f,
-    //            0.0f, -SQ2,      -2.0f,       SQ2/2.0f,  1.0f, 0.0f,
-    //            0.0f,  SQ2,      -2.0f,      -SQ2/2.0f,  1.0f, 0.0f,
-    //            0.0f, -SQ2/2.0f, -1.0f/2.0f,  SQ2,       1.0f, 0.0f,
-    //            0.0f,  SQ2/2.0f, -1.0f/2.0f, -SQ2,       1.0f, 0.0f,
-    //            0.0f,  1.0f,      0.0f,      -5.0f/2.0f, 0.0f, 1.0f};
-
-    const auto multiply_bt = [](float & o0, float & o1, float & o2, float & o3, float & o4, float & o5, const float i0, const float i1, const float i2, const float i3, const float i4, const float i5)
-	{
-		const auto i3_m1 = i1 * -SQ2 + i3 * (SQ2 / 2.0f);
-		const auto i4_m2 = i2 * -2.0f + i4 * 1.0f;
-
-        o0 = i0 + i2 * (-5.0f/2.0f) + i4;
-        o1 = i3_m1 + i4_m2;
-        o2 = -i3_m1 + i4_m2;
-
-		const auto i3_m1_2 = i3 * (SQ2) + i1 * (-SQ2/2.0f);
-		const auto i4_m2_2 = i2 * (-1.0f/2.0f) + i4;
-
-        o3 = i3_m1_2 + i4_m2_2;
-        o4 = -i3_m1_2 + i4_m2_2;
-
-        o5 = i1 + i3 * (-5.0f/2.0f) + i5;
-    };
+    using WinogradLine = std::array<float, ALPHA>;
 
     for (auto ch = 0; ch < channels; ch++) 
 	{
@@ -115,54 +104,38 @@ void CPUPipe::winograd_transform_in(const std::vector<float>& in, std::vector<fl
         for (auto block_y = 0; block_y < W_TILES; block_y++) 
 		{
             // Tiles overlap by 2
-            const auto yin = WINOGRAD_M * block_y;
+            const auto yin = M * block_y;
         	
             for (auto block_x = 0; block_x < W_TILES; block_x++) 
 			{
-                const auto xin = WINOGRAD_M * block_x;
-#define DECL_T1(XX) \
-                float T1_##XX##_0, T1_##XX##_1, T1_##XX##_2, T1_##XX##_3, T1_##XX##_4, T1_##XX##_5;
-                DECL_T1(0)
-                DECL_T1(1)
-                DECL_T1(2)
-                DECL_T1(3)
-                DECL_T1(4)
-                DECL_T1(5)
+                const auto xin = M * block_x;
+
+                // Calculates transpose(B).x, stored transposed so that the rows are contiguous for the second pass
+                std::array<WinogradLine, ALPHA> T1;
+            	
+                for (auto col = 0; col < ALPHA; col++) 
+				{
+                    WinogradLine column;
+                    WinogradLine out;
+                	
+                    for (auto row = 0; row < ALPHA; row++)
+                        column[row] = in_pad[yin + row][xin + col];
+                	
+                    Transform::multiply_bt(out.data(), column.data());
+                	
+                    for (auto row = 0; row < ALPHA; row++)
+                        T1[row][col] = out[row];
+                }
 
                 // Calculates transpose(B).x.B
-#define MULTIPLY_BT(XX) \
-                multiply_bt( \
-                    T1_0_##XX, T1_1_##XX, T1_2_##XX, T1_3_##XX, T1_4_##XX, T1_5_##XX, \
-                    in_pad[yin + 0][xin + (XX)], \
-                    in_pad[yin + 1][xin + (XX)], \
-                    in_pad[yin + 2][xin + (XX)], \
-                    in_pad[yin + 3][xin + (XX)], \
-                    in_pad[yin + 4][xin + (XX)], \
-                    in_pad[yin + 5][xin + (XX)] \
-                );
-                MULTIPLY_BT(0)
-                MULTIPLY_BT(1)
-                MULTIPLY_BT(2)
-                MULTIPLY_BT(3)
-                MULTIPLY_BT(4)
-                MULTIPLY_BT(5)
-
-#define MULTIPLY_B(XX) \
-                multiply_bt( \
-                    buffer[buffer_size * ((XX) * WINOGRAD_ALPHA + 0) + buffer_entries], \
-                    buffer[buffer_size * ((XX) * WINOGRAD_ALPHA + 1) + buffer_entries], \
-                    buffer[buffer_size * ((XX) * WINOGRAD_ALPHA + 2) + buffer_entries], \
-                    buffer[buffer_size * ((XX) * WINOGRAD_ALPHA + 3) + buffer_entries], \
-                    buffer[buffer_size * ((XX) * WINOGRAD_ALPHA + 4) + buffer_entries], \
-                    buffer[buffer_size * ((XX) * WINOGRAD_ALPHA + 5) + buffer_entries], \
-                    T1_##XX##_0, T1_##XX##_1, T1_##XX##_2, T1_##XX##_3, T1_##XX##_4, T1_##XX##_5 \
-                );
-                MULTIPLY_B(0)
-                MULTIPLY_B(1)
-                MULTIPLY_B(2)
-                MULTIPLY_B(3)
-                MULTIPLY_B(4)
-                MULTIPLY_B(5)
+                for (auto row = 0; row < ALPHA; row++) 
+				{
+                    WinogradLine out;
+                    Transform::multiply_bt(out.data(), T1[row].data());
+                	
+                    for (auto col = 0; col < ALPHA; col++)
+                        buffer[buffer_size * (row * ALPHA + col) + buffer_entries] = out[col];
+                }
 
                 if (buffer_entries == 0)
                     buffer_offset = ch * P + block_y * W_TILES + block_x;
@@ -171,7 +144,7 @@ void CPUPipe::winograd_transform_in(const std::vector<float>& in, std::vector<fl
 
                 if (buffer_entries >= buffer_size || (ch == channels - 1 && block_x == W_TILES - 1 && block_y == W_TILES - 1))
 				{
-                    for (auto i = 0; i < WINOGRAD_ALPHA * WINOGRAD_ALPHA; i++) 
+                    for (auto i = 0; i < ALPHA * ALPHA; i++) 
 					{
                         for (auto entry = 0; entry < buffer_entries; entry++)
                             V[i * channels * P + buffer_offset + entry] = buffer[i * buffer_size + entry];
@@ -184,86 +157,184 @@ void CPUPipe::winograd_transform_in(const std::vector<float>& in, std::vector<fl
     }
 }
 
-void CPUPipe::winograd_sgemm(const std::vector<float>& U, const std::vector<float>& V, std::vector<float>& M, const int C, const int K)
+// One vector register of output channels for the Winograd SGEMM, the widest the build targets
+struct ScalarVector
+{
+    using type = float;
+    static constexpr auto WIDTH = 1;
+
+    static type zero() { return 0.0f; }
+    static type load(const float* const data) { return *data; }
+    static type broadcast(const float* const data) { return *data; }
+    static type multiply_add(const type a, const type b, const type c) { return a * b + c; }
+    static void store(float* const data, const type a) { *data = a; }
+};
+
+#if defined(__AVX512F__)
+struct SgemmVector
+{
+    using type = __m512;
+    static constexpr auto WIDTH = 16;
+
+    static type zero() { return _mm512_setzero_ps(); }
+    static type load(const float* const data) { return _mm512_loadu_ps(data); }
+    static type broadcast(const float* const data) { return _mm512_set1_ps(*data); }
+    static type multiply_add(const type a, const type b, const type c) { return _mm512_fmadd_ps(a, b, c); }
+    static void store(float* const data, const type a) { _mm512_storeu_ps(data, a); }
+};
+#elif defined(__AVX2__) && (defined(__FMA__) || defined(_MSC_VER))
+struct SgemmVector
+{
+    using type = __m256;
+    static constexpr auto WIDTH = 8;
+
+    static type zero() { return _mm256_setzero_ps(); }
+    static type load(const float* const data) { return _mm256_loadu_ps(data); }
+    static type broadcast(const float* const data) { return _mm256_broadcast_ss(data); }
+    static type multiply_add(const type a, const type b, const type c) { return _mm256_fmadd_ps(a, b, c); }
+    static void store(float* const data, const type a) { _mm256_storeu_ps(data, a); }
+};
+#elif defined(__ARM_NEON)
+struct SgemmVector
+{
+    using type = float32x4_t;
+    static constexpr auto WIDTH = 4;
+
+    static type zero() { return vdupq_n_f32(0.0f); }
+    static type load(const float* const data) { return vld1q_f32(data); }
+    static type broadcast(const float* const data) { return vld1q_dup_f32(data); }
+    static type multiply_add(const type a, const type b, const type c) { return vmlaq_f32(c, a, b); }
+    static void store(float* const data, const type a) { vst1q_f32(data, a); }
+};
+#else
+using SgemmVector = ScalarVector;
+#endif
+
+// Tiles per register block, all 9 tiles of a 9x9 board at once
+static constexpr auto SGEMM_BLOCK_P = 9;
+
+// Register block of M_out, BLOCK_P tiles by one vector of output channels accumulated over every input channel
+// U rows are [c][k] and V rows are [c][p], so every input channel loads one vector of U and broadcasts BLOCK_P values of V
+template <typename Vector, int BLOCK_P>
+static void sgemm_block(const int C, const int K, const int P, const float* const U, const float* const V, float* const M_out)
+{
+    typename Vector::type acc[BLOCK_P];
+	
+    for (auto p = 0; p < BLOCK_P; p++)
+        acc[p] = Vector::zero();
+
+    for (auto c = 0; c < C; c++) 
+	{
+        const auto u = Vector::load(U + c * K);
+        const auto v = V + c * P;
+    	
+        for (auto p = 0; p < BLOCK_P; p++)
+            acc[p] = Vector::multiply_add(Vector::broadcast(v + p), u, acc[p]);
+    }
+
+    float out[Vector::WIDTH];
+	
+    for (auto p = 0; p < BLOCK_P; p++) 
+	{
+        Vector::store(out, acc[p]);
+    	
+        for (auto k = 0; k < Vector::WIDTH; k++)
+            M_out[k * P + p] = out[k];
+    }
+}
+
+// Every register block of the tiles in [p_begin, p_begin + BLOCK_P), the output channels past the last full vector are done one by one
+template <int BLOCK_P>
+static void sgemm_blocks(const int C, const int K, const int P, const int p_begin, const float* const U, const float* const V, float* const M_out)
+{
+    auto k = 0;
+	
+    for (; k + SgemmVector::WIDTH <= K; k += SgemmVector::WIDTH)
+        sgemm_block<SgemmVector, BLOCK_P>(C, K, P, U + k, V + p_begin, M_out + k * P + p_begin);
+
+    // Fewer than a vector, counting the tail instead of running k up to K keeps the loop visibly bounded for the compiler
+    const auto tail = K - k;
+    for (auto i = 0; i < tail; i++, k++)
+        sgemm_block<ScalarVector, BLOCK_P>(C, K, P, U + k, V + p_begin, M_out + k * P + p_begin);
+}
+
+template <int M>
+void CPUPipe::winograd_sgemm(const std::vector<float>& U, const std::vector<float>& V, std::vector<float>& M_out, const int C, const int K)
 {
-    constexpr auto P = WINOGRAD_P;
+    constexpr auto ALPHA = WinogradTransform<M>::ALPHA;
+    constexpr auto P = winograd_tiles(BOARD_SIZE, M) * winograd_tiles(BOARD_SIZE, M);
+    constexpr auto P_REMAINDER = P % SGEMM_BLOCK_P;
 
-    for (auto b = 0; b < WINOGRAD_TILE; b++) 
+    // The matrices are too small for the blocking of a general SGEMM to pay off, the tiles fit in registers as they are
+    for (auto b = 0; b < ALPHA * ALPHA; b++) 
 	{
         const auto offset_u = b * K * C;
         const auto offset_v = b * C * P;
         const auto offset_m = b * K * P;
-#ifdef USE_BLAS
-        cblas_sgemm(CblasRowMajor, CblasTrans, CblasNoTrans, K, P, C, 1.0f, &U[offset_u], K, &V[offset_v], P, 0.0f, &M[offset_m], P);
-#else
-        auto C_mat = EigenMatrixMap<float>(M.data() + offset_m, P, K);
-        C_mat.noalias() = ConstEigenMatrixMap<float>(V.data() + offset_v, P, C) * ConstEigenMatrixMap<float>(U.data() + offset_u, K, C).transpose();
-#endif
+
+        auto p = 0;
+    	
+        for (; p + SGEMM_BLOCK_P <= P; p += SGEMM_BLOCK_P)
+            sgemm_blocks<SGEMM_BLOCK_P>(C, K, P, p, &U[offset_u], &V[offset_v], &M_out[offset_m]);
+    	
+        if (P_REMAINDER != 0)
+            sgemm_blocks<P_REMAINDER == 0 ? 1 : P_REMAINDER>(C, K, P, p, &U[offset_u], &V[offset_v], &M_out[offset_m]);
     }
 }
 
-void CPUPipe::winograd_transform_out(const std::vector<float>& M, std::vector<float>& Y, const int K)
+template <int M>
+void CPUPipe::winograd_transform_out(const std::vector<float>& M_in, std::vector<float>& Y, const int K)
 {
+    using Transform = WinogradTransform<M>;
+    constexpr auto ALPHA = Transform::ALPHA;
+
     constexpr auto W = BOARD_SIZE;
     constexpr auto H = BOARD_SIZE;
-    constexpr auto W_TILES = WINOGRAD_W_TILES;
-    constexpr auto P = WINOGRAD_P;
-
-    // multiple vector [i0..i5] by At and produce [o0..o3]
-    // const auto At = std::array<float, WINOGRAD_ALPHA * WINOGRAD_M>
-    //       {1.0f, 1.0f,      1.0f,       1.0f,      1.0f,     0.0f,
-    //        0.0f, SQ2/2.0f, -SQ2/2.0f,   SQ2,      -SQ2,      0.0f,
-    //        0.0f, 1.0f/2.0f, 1.0f/2.0f,  2.0f,      2.0f,     0.0f,
-    //        0.0f, SQ2/4.0f, -SQ2/4.0f,   2.0f*SQ2, -2.0f*SQ2, 1.0f};
-    
-    const auto multiply_at = [](float & o0, float & o1, float & o2, float & o3, const float i0, const float i1, const float i2, const float i3, const float i4, const float i5)
-	{
-	    const auto t1_p2 = (i1 + i2) * (1.0f / 2.0f);
-	    const auto t1_m2 = (i1 - i2) * (SQ2/4.0f);
-	    const auto t3_p4 = i3 + i4;
-	    const auto t3_m4 = (i3 - i4) * (SQ2);
-
-        o0 = i0 + t1_p2 + t1_p2 + t3_p4;
-        o1 = t1_m2 + t1_m2 + t3_m4;
-        o2 = t1_p2 + t3_p4 + t3_p4;
-        o3 = t1_m2 + t3_m4 + t3_m4 + i5;
-    };
+    constexpr auto W_TILES = winograd_tiles(BOARD_SIZE, M);
+    constexpr auto P = W_TILES * W_TILES;
 
     for (auto k = 0; k < K; k++) 
 	{
         for (auto block_x = 0; block_x < W_TILES; block_x++) 
 		{
-            const auto x = WINOGRAD_M * block_x;
+            const auto x = M * block_x;
         	
             for (auto block_y = 0; block_y < W_TILES; block_y++) 
 			{
-                const auto y = WINOGRAD_M * block_y;
+                const auto y = M * block_y;
                 const auto b = block_y * W_TILES + block_x;
-            	
-                using WinogradTile = std::array<std::array<float, WINOGRAD_ALPHA>, WINOGRAD_ALPHA>;
+
+                // Columns of the tile, temp_m[nu][xi] is element (xi, nu)
+                using WinogradTile = std::array<std::array<float, ALPHA>, ALPHA>;
                 WinogradTile temp_m;
             	
-                for (auto xi = 0; xi < WINOGRAD_ALPHA; xi++)
+                for (auto xi = 0; xi < ALPHA; xi++)
 				{
-                    for (auto nu = 0; nu < WINOGRAD_ALPHA; nu++) 
-                        temp_m[xi][nu] = M[(xi*WINOGRAD_ALPHA + nu)*K*P + k*P + b];
+                    for (auto nu = 0; nu < ALPHA; nu++) 
+                        temp_m[nu][xi] = M_in[(xi*ALPHA + nu)*K*P + k*P + b];
                 }
             	
-                std::array<std::array<float, WINOGRAD_ALPHA>, WINOGRAD_M> temp{};
-                std::array<std::array<float, WINOGRAD_M>, WINOGRAD_M> o{};
+                std::array<std::array<float, ALPHA>, M> temp{};
+                std::array<std::array<float, M>, M> o{};
 
                 // Calculates transpose(A).temp_m.A
-                for (auto j = 0; j < WINOGRAD_ALPHA; j++)
-                    multiply_at(temp[0][j], temp[1][j], temp[2][j], temp[3][j], temp_m[0][j], temp_m[1][j], temp_m[2][j], temp_m[3][j], temp_m[4][j], temp_m[5][j]);
+                for (auto j = 0; j < ALPHA; j++)
+				{
+                    std::array<float, M> out;
+                    Transform::multiply_at(out.data(), temp_m[j].data());
+                	
+                    for (auto i = 0; i < M; i++)
+                        temp[i][j] = out[i];
+                }
 
-                for (auto i = 0; i < WINOGRAD_M; i++)
-                    multiply_at(o[i][0], o[i][1], o[i][2], o[i][3], temp[i][0], temp[i][1], temp[i][2], temp[i][3], temp[i][4], temp[i][5]);
+                for (auto i = 0; i < M; i++)
+                    Transform::multiply_at(o[i].data(), temp[i].data());
 
                 const auto y_ind = k * H * W + y * W + x;
             	
-                for (auto i = 0; i < WINOGRAD_M; i++) 
+                for (auto i = 0; i < M; i++) 
 				{
-                    for (auto j = 0; j < WINOGRAD_M; j++) 
+                    for (auto j = 0; j < M; j++) 
 					{
                         if (y + i < H && x + j < W)
                             Y[y_ind + i * W + j] = o[i][j];
@@ -274,31 +345,46 @@ void CPUPipe::winograd_transform_out(const std::vector<float>& M, std::vector<fl
     }
 }
 
-void CPUPipe::winograd_convolve3(const int outputs, const std::vector<float>& input, const std::vector<float>& U, std::vector<float>& V, std::vector<float>& M, std::vector<float>& output)
+template <int M>
+void CPUPipe::winograd_convolve3(const int outputs, const std::vector<float>& input, const std::vector<float>& U, std::vector<float>& V, std::vector<float>& M_buffer, std::vector<float>& output)
 {
-
-    constexpr unsigned int filter_len = WINOGRAD_ALPHA * WINOGRAD_ALPHA;
+    constexpr auto ALPHA = WinogradTransform<M>::ALPHA;
+    constexpr unsigned int filter_len = ALPHA * ALPHA;
     const auto input_channels = U.size() / (outputs * filter_len);
 
-    winograd_transform_in(input, V, static_cast<int>(input_channels));
-    winograd_sgemm(U, V, M, static_cast<int>(input_channels), outputs);
-    winograd_transform_out(M, output, outputs);
+    winograd_transform_in<M>(input, V, static_cast<int>(input_channels));
+    winograd_sgemm<M>(U, V, M_buffer, static_cast<int>(input_channels), outputs);
+    winograd_transform_out<M>(M_buffer, output, outputs);
 }
 
-template<unsigned int filter_size>
+// Every tile size, for the tests
+template void CPUPipe::winograd_convolve3<2>(int outputs, const std::vector<float>& input, const std::vector<float>& U, std::vector<float>& V, std::vector<float>& M_buffer, std::vector<float>& output);
+template void CPUPipe::winograd_convolve3<3>(int outputs, const std::vector<float>& input, const std::vector<float>& U, std::vector<float>& V, std::vector<float>& M_buffer, std::vector<float>& output);
+template void CPUPipe::winograd_convolve3<4>(int outputs, const std::vector<float>& input, const std::vector<float>& U, std::vector<float>& V, std::vector<float>& M_buffer, std::vector<float>& output);
+template void CPUPipe::winograd_sgemm<WINOGRAD_M>(const std::vector<float>& U, const std::vector<float>& V, std::vector<float>& M_out, int C, int K);
+
+template<unsigned int filter_size, int board_size>
 void convolve(const size_t outputs, const std::vector<float>& input, const std::vector<float>& weights,const std::vector<float>& biases, std::vector<float>& output)
 {
-    // The size of the board is defined at compile time
-    constexpr unsigned int width = BOARD_SIZE;
-    constexpr unsigned int height = BOARD_SIZE;
+    // The size of the board is a template parameter so that every loop bound is known at compile time
+    constexpr unsigned int width = board_size;
+    constexpr unsigned int height = board_size;
     constexpr auto num_intersections = width * height;
     constexpr auto filter_len = filter_size * filter_size;
     const auto input_channels = weights.size() / (biases.size() * filter_len);
     const auto filter_dim = filter_len * input_channels;
     assert(outputs * num_intersections == output.size());
 
-    std::vector<float> col(filter_dim * width * height);
-    im2col<filter_size>(static_cast<int>(input_channels), input, col);
+    // A 1x1 filter multiplies the input as it is, larger ones need it rearranged
+    std::vector<float> col;
+    auto col_data = input.data();
+	
+    if (filter_size != 1) 
+	{
+        col.resize(filter_dim * width * height);
+        im2col<filter_size, board_size>(static_cast<int>(input_channels), input, col);
+        col_data = col.data();
+    }
 
     // Weight shape (output, input, filter_size, filter_size)
     // 96 18 3 3
@@ -317,11 +403,11 @@ void convolve(const size_t outputs, const std::vector<float>& input, const std::
                 // M        N            K
                 outputs, num_intersections, filter_dim,
                 1.0f, &weights[0], filter_dim,
-                &col[0], num_intersections,
+                col_data, num_intersections,
                 0.0f, &output[0], num_intersections);
 #else
     auto C_mat = EigenMatrixMap<float>(output.data(), num_intersections, outputs);
-    C_mat.noalias() = ConstEigenMatrixMap<float>(col.data(), num_intersections, filter_dim) * ConstEigenMatrixMap<float>(weights.data(), filter_dim, outputs);
+    C_mat.noalias() = ConstEigenMatrixMap<float>(col_data, num_intersections, filter_dim) * ConstEigenMatrixMap<float>(weights.data(), filter_dim, outputs);
 #endif
 
     for (unsigned int o = 0; o < outputs; o++) 
@@ -358,52 +444,224 @@ void batch_norm(const size_t channels, std::vector<float>& data, const float* co
     }
 }
 
-void CPUPipe::forward(const std::vector<float>& input, std::vector<float>& output_pol, std::vector<float>& output_val)
+void CPUPipe::sparse_input_convolve3(const Weights& weights, const std::vector<float>& input, std::vector<float>& output)
 {
+    constexpr auto num_intersections = BOARD_SIZE * BOARD_SIZE;
+    const auto outputs = weights.input_channels;
+    const auto constant_planes_begin = weights.input_planes - CONSTANT_INPUT_PLANES;
+
+    // Accumulated intersection major so that every tap is a contiguous vector add over the output channels
+    auto acc = std::vector<float>(num_intersections * outputs, 0.0f);
+
+    for (auto plane = 0; plane < weights.input_planes; plane++) 
+	{
+        const auto plane_input = &input[plane * num_intersections];
+
+        // The side to move planes are either empty or full, a full one is a precomputed constant
+        if (plane >= constant_planes_begin && std::all_of(plane_input, plane_input + num_intersections, [](const float value) { return value == 1.0f; })) 
+		{
+            const auto constant_conv = &weights.constant_planes_conv[(plane - constant_planes_begin) * num_intersections * outputs];
+        	
+            for (auto i = 0; i < num_intersections * outputs; i++)
+                acc[i] += constant_conv[i];
+        	
+            continue;
+        }
+
+        // Stones are sparse, only the occupied intersections spread their filter taps to their neighbours
+        for (auto intersection = 0; intersection < num_intersections; intersection++) 
+		{
+            const auto value = plane_input[intersection];
+        	
+            if (value == 0.0f)
+                continue;
+
+            const auto input_y = intersection / BOARD_SIZE;
+            const auto input_x = intersection % BOARD_SIZE;
+
+            for (auto filter_y = 0; filter_y < 3; filter_y++) 
+			{
+                const auto y = input_y - filter_y + 1;
+            	
+                if (y < 0 || y >= BOARD_SIZE)
+                    continue;
+
+                for (auto filter_x = 0; filter_x < 3; filter_x++) 
+				{
+                    const auto x = input_x - filter_x + 1;
+                	
+                    if (x < 0 || x >= BOARD_SIZE)
+                        continue;
+
+                    const auto taps = &weights.input_taps[((plane * 3 + filter_y) * 3 + filter_x) * outputs];
+                    const auto out = &acc[(y * BOARD_SIZE + x) * outputs];
+                	
+                    for (auto o = 0; o < outputs; o++)
+                        out[o] += value * taps[o];
+                }
+            }
+        }
+    }
+
+    // Back to the channel major layout of the rest of the tower
+    for (auto intersection = 0; intersection < num_intersections; intersection++) 
+	{
+        for (auto o = 0; o < outputs; o++)
+            output[o * num_intersections + intersection] = acc[intersection * outputs + o];
+    }
+}
+
+void CPUPipe::forward_board(const std::vector<float>& input, std::vector<float>& output_pol, std::vector<float>& output_val)
+{
+    constexpr auto num_intersections = BOARD_SIZE * BOARD_SIZE;
+    constexpr auto M = winograd_select_m(BOARD_SIZE);
+    constexpr auto TILE = (M + 2) * (M + 2);
+    constexpr auto P = winograd_tiles(BOARD_SIZE, M) * winograd_tiles(BOARD_SIZE, M);
+
     // Input convolution
-    constexpr auto P = WINOGRAD_P;
     // Calculate output channels
-    const auto output_channels = m_input_channels;
+    // Kept alive until the forward is done, even if push_weights publishes a new network meanwhile
+    const auto pipe_weights = std::atomic_load(&m_weights);
+    const auto output_channels = pipe_weights->input_channels;
+    const auto& weights = pipe_weights->local_tower();
+    const auto residual_blocks = static_cast<int>(weights.m_conv_weights.size() / 2);
 	
     // Input_channels is the maximum number of input channels of any convolution
     // Residual blocks are identical, but the first convolution might be bigger when the network has very few filters
     const auto input_channels = std::max(static_cast<size_t>(output_channels), static_cast<size_t>(Network::INPUT_CHANNELS));
-    auto conv_out = std::vector<float>(output_channels * NUM_INTERSECTIONS);
-
-    auto V = std::vector<float>(WINOGRAD_TILE * input_channels * P);
-    auto M = std::vector<float>(WINOGRAD_TILE * output_channels * P);
 
-    winograd_convolve3(output_channels, input, m_weights->m_conv_weights[0], V, M, conv_out);
-    batch_norm<NUM_INTERSECTIONS>(output_channels, conv_out, m_weights->m_batchnorm_means[0].data(), m_weights->m_batchnorm_stddevs[0].data());
+    // Buffers of the thread, only allocated again when a network with more filters is loaded
+    thread_local std::vector<float> conv_out, conv_in, res, V, M_buffer;
+    conv_out.resize(output_channels * num_intersections);
+    conv_in.resize(output_channels * num_intersections);
+    res.resize(output_channels * num_intersections);
+    V.resize(TILE * input_channels * P);
+    M_buffer.resize(TILE * output_channels * P);
+
+    // The stone planes are binary, on a mostly empty board only the stones need to be convolved
+    const auto stone_values = static_cast<size_t>(pipe_weights->input_planes - CONSTANT_INPUT_PLANES) * num_intersections;
+    const auto stones = std::count_if(input.begin(), input.begin() + stone_values, [](const float value) { return value != 0.0f; });
+	
+    if (pipe_weights->input_taps.empty() || stones > SPARSE_INPUT_MAX_OCCUPANCY * stone_values)
+        winograd_convolve3<M>(output_channels, input, weights.m_conv_weights[0], V, M_buffer, conv_out);
+    else
+        sparse_input_convolve3(*pipe_weights, input, conv_out);
+	
+    batch_norm<num_intersections>(output_channels, conv_out, weights.m_batchnorm_means[0].data(), weights.m_batchnorm_stddevs[0].data());
 
     // Residual tower
-    auto conv_in = std::vector<float>(output_channels * NUM_INTERSECTIONS);
-    auto res = std::vector<float>(output_channels * NUM_INTERSECTIONS);
-    for (auto i = size_t{1}; i < m_weights->m_conv_weights.size(); i += 2) 
+    for (auto block = 0; block < residual_blocks; block++) 
 	{
-        // auto output_channels = m_input_channels;
+        const auto i = size_t{1} + 2 * block;
+    	
         std::swap(conv_out, conv_in);
-        winograd_convolve3(output_channels, conv_in, m_weights->m_conv_weights[i], V, M, conv_out);
-        batch_norm<NUM_INTERSECTIONS>(output_channels, conv_out, m_weights->m_batchnorm_means[i].data(), m_weights->m_batchnorm_stddevs[i].data());
+        winograd_convolve3<M>(output_channels, conv_in, weights.m_conv_weights[i], V, M_buffer, conv_out);
+        batch_norm<num_intersections>(output_channels, conv_out, weights.m_batchnorm_means[i].data(), weights.m_batchnorm_stddevs[i].data());
 
         std::swap(conv_in, res);
         std::swap(conv_out, conv_in);
-        winograd_convolve3(output_channels, conv_in, m_weights->m_conv_weights[i + 1], V, M, conv_out);
-        batch_norm<NUM_INTERSECTIONS>(output_channels, conv_out, m_weights->m_batchnorm_means[i + 1].data(), m_weights->m_batchnorm_stddevs[i + 1].data(),res.data());
+        winograd_convolve3<M>(output_channels, conv_in, weights.m_conv_weights[i + 1], V, M_buffer, conv_out);
+        batch_norm<num_intersections>(output_channels, conv_out, weights.m_batchnorm_means[i + 1].data(), weights.m_batchnorm_stddevs[i + 1].data(),res.data());
     }
 	
-    convolve<1>(Network::OUTPUTS_POLICY, conv_out, m_conv_pol_weights, m_conv_pol_bias, output_pol);
-    convolve<1>(Network::OUTPUTS_VALUE, conv_out, m_conv_val_weights, m_conv_val_bias, output_val);
+    convolve<1, BOARD_SIZE>(Network::OUTPUTS_POLICY, conv_out, pipe_weights->conv_pol_weights, pipe_weights->conv_pol_bias, output_pol);
+    convolve<1, BOARD_SIZE>(Network::OUTPUTS_VALUE, conv_out, pipe_weights->conv_val_weights, pipe_weights->conv_val_bias, output_val);
 }
 
-void CPUPipe::push_weights(unsigned int /*filter_size*/, unsigned int /*channels*/, const unsigned int outputs, const std::shared_ptr<const ForwardPipeWeights> weights)
+const ForwardPipe::ForwardPipeWeights& CPUPipe::Weights::local_tower() const
 {
-    m_weights = weights;
+    const auto node = SMP::current_node();
+    return *node_towers[node < node_towers.size() ? node : 0];
+}
+
+void CPUPipe::forward(const std::vector<float>& input, std::vector<float>& output_pol, std::vector<float>& output_val)
+{
+    const Trace::Scope trace("CPUPipe::forward");
+    forward_board(input, output_pol, output_val);
+}
+
+void CPUPipe::push_weights(const unsigned int filter_size, const unsigned int channels, const unsigned int outputs, const std::shared_ptr<const ForwardPipeWeights> weights)
+{
+    // The filters must have been transformed for the tile size of this board
+    assert(filter_size == static_cast<unsigned int>(WINOGRAD_ALPHA));
+    (void)filter_size;
+
+    // Can be called again with a new network, which may also have a different number of filters
+    auto pipe_weights = std::make_shared<Weights>();
+    pipe_weights->input_channels = static_cast<int>(outputs);
+    pipe_weights->input_planes = static_cast<int>(channels);
+
+    // Threads pinned to several nodes each read a copy of the tower first touched on their own node
+    auto& node_towers = pipe_weights->node_towers;
+    if (SMP::get_placement() != SMP::Placement::NONE && SMP::get_num_nodes() > 1)
+	{
+        for (auto node = size_t{0}; node < SMP::get_num_nodes(); node++)
+            SMP::run_on_node(node, [&] { node_towers.emplace_back(std::make_shared<const ForwardPipeWeights>(*weights)); });
+    }
+    else
+	{
+        node_towers.emplace_back(weights);
+    }
 
     // Output head convolutions
-    m_conv_pol_weights = weights->m_conv_pol_weights;
-    m_conv_pol_bias.resize(m_conv_pol_weights.size() / outputs, 0.0f);
-    m_conv_val_weights = weights->m_conv_val_weights;
-    m_conv_val_bias.resize(m_conv_val_weights.size() / outputs, 0.0f);
+    pipe_weights->conv_pol_weights = weights->m_conv_pol_weights;
+    pipe_weights->conv_pol_bias.assign(weights->m_conv_pol_weights.size() / outputs, 0.0f);
+    pipe_weights->conv_val_weights = weights->m_conv_val_weights;
+    pipe_weights->conv_val_bias.assign(weights->m_conv_val_weights.size() / outputs, 0.0f);
+
+    // Sparse input convolution, the filters go from [output][plane][row][column] to [plane][row][column][output]
+    const auto& input_weights = weights->m_conv_input_weights;
+    if (input_weights.size() == size_t{outputs} * channels * 9)
+        prepare_sparse_input(*pipe_weights, input_weights);
+
+    std::atomic_store(&m_weights, std::shared_ptr<const Weights>(std::move(pipe_weights)));
 }
 
+void CPUPipe::prepare_sparse_input(Weights& pipe_weights, const std::vector<float>& input_weights)
+{
+    const auto outputs = static_cast<size_t>(pipe_weights.input_channels);
+    const auto channels = static_cast<size_t>(pipe_weights.input_planes);
+    auto& input_taps = pipe_weights.input_taps;
+    auto& constant_planes_conv = pipe_weights.constant_planes_conv;
+
+    input_taps.resize(input_weights.size());
+    for (auto o = size_t{0}; o < outputs; o++) 
+	{
+        for (auto tap = size_t{0}; tap < channels * 9; tap++)
+            input_taps[tap * outputs + o] = input_weights[o * channels * 9 + tap];
+    }
+
+    // Convolution of an all ones plane, only the taps that stay on the board count
+    const auto num_intersections = NUM_INTERSECTIONS;
+    constant_planes_conv.assign(CONSTANT_INPUT_PLANES * num_intersections * outputs, 0.0f);
+	
+    for (auto constant_plane = 0; constant_plane < CONSTANT_INPUT_PLANES; constant_plane++) 
+	{
+        const auto plane = pipe_weights.input_planes - CONSTANT_INPUT_PLANES + constant_plane;
+    	
+        for (auto y = 0; y < BOARD_SIZE; y++) 
+		{
+            for (auto x = 0; x < BOARD_SIZE; x++) 
+			{
+                const auto out = &constant_planes_conv[(constant_plane * num_intersections + y * BOARD_SIZE + x) * outputs];
+            	
+                for (auto filter_y = 0; filter_y < 3; filter_y++) 
+				{
+                    for (auto filter_x = 0; filter_x < 3; filter_x++) 
+					{
+                        const auto input_y = y + filter_y - 1;
+                        const auto input_x = x + filter_x - 1;
+                    	
+                        if (input_y < 0 || input_y >= BOARD_SIZE || input_x < 0 || input_x >= BOARD_SIZE)
+                            continue;
+
+                        const auto taps = &input_taps[((plane * 3 + filter_y) * 3 + filter_x) * outputs];
+                    	
+                        for (auto o = size_t{0}; o < outputs; o++)
+                            out[o] += taps[o];
+                    }
+                }
+            }
+        }
+    }
+}
@@ -30,34 +30,71 @@
 #ifndef CPUPIPE_H_INCLUDED
 #define CPUPIPE_H_INCLUDED
 
+#include <memory>
 #include <vector>
 
 #include "ForwardPipe.h"
+#include "Winograd.h"
 
 /// TODO
 class CPUPipe : public ForwardPipe
 {
 public:
 
+	/// The last input planes tell the side to move, they are all zeros or all ones
+	static constexpr auto CONSTANT_INPUT_PLANES = 2;
+	/// Above this fraction of nonzero stone plane values the Winograd input convolution is faster than the sparse one
+	static constexpr auto SPARSE_INPUT_MAX_OCCUPANCY = 0.15f;
+
 	void initialize(int channels) override;
 	void forward(const std::vector<float>& input, std::vector<float>& output_pol, std::vector<float>& output_val) override;
 	void push_weights(unsigned int filter_size, unsigned int channels, unsigned int outputs, std::shared_ptr<const ForwardPipeWeights> weights) override;
+
+	/// 3x3 convolution with Winograd F(MxM, 3x3), U holds the filters transformed by Network::winograd_transform_f<M>
+	template <int M = WINOGRAD_M>
+	static void winograd_convolve3(int outputs, const std::vector<float>& input, const std::vector<float>& U, std::vector<float>& V, std::vector<float>& M_buffer, std::vector<float>& output);
+
+	/// M_out[b] = transpose(U[b]).V[b] for every Winograd tile element b, with U[b] as [C][K], V[b] as [C][P] and M_out[b] as [K][P]
+	template <int M = WINOGRAD_M>
+	static void winograd_sgemm(const std::vector<float>& U, const std::vector<float>& V, std::vector<float>& M_out, int C, int K);
 	
 private:
 
-	int m_input_channels = 0;
+	/// Everything a forward reads, never modified once published
+	struct Weights
+	{
+		int input_channels = 0;
+		int input_planes = 0;
 
-	static void winograd_transform_in(const std::vector<float>& in, std::vector<float>& V, int channels);
-	static void winograd_sgemm(const std::vector<float>& U, const std::vector<float>& V, std::vector<float>& M, int C, int K);
-	static void winograd_transform_out(const std::vector<float>& M, std::vector<float>& Y, int K);
-	static void winograd_convolve3(int outputs, const std::vector<float>& input, const std::vector<float>& U, std::vector<float>& V, std::vector<float>& M, std::vector<float>& output);
+		/// Input + residual block tower, one copy per NUMA node when the threads are pinned
+		std::vector<std::shared_ptr<const ForwardPipeWeights>> node_towers;
+
+		/// Input convolution filters as [plane][row][column][output], every tap is a contiguous vector over the output channels
+		std::vector<float> input_taps;
+		/// Input convolution of the side to move planes when they are all ones, as [plane][intersection][output]
+		std::vector<float> constant_planes_conv;
 
-    /// Input + residual block tower
-    std::shared_ptr<const ForwardPipeWeights> m_weights;
+		std::vector<float> conv_pol_weights;
+		std::vector<float> conv_val_weights;
+		std::vector<float> conv_pol_bias;
+		std::vector<float> conv_val_bias;
 
-    std::vector<float> m_conv_pol_weights;
-    std::vector<float> m_conv_val_weights;
-    std::vector<float> m_conv_pol_bias;
-    std::vector<float> m_conv_val_bias;
+		/// Tower of the node the calling thread runs on
+		const ForwardPipeWeights& local_tower() const;
+	};
+
+	/// Only accessed through std::atomic_load and std::atomic_store, push_weights publishes a complete new set while
+	/// the forwards in flight keep reading the one they started with
+	std::shared_ptr<const Weights> m_weights;
+
+	/// Transposed input filters and the convolution of the constant planes, for sparse_input_convolve3
+	static void prepare_sparse_input(Weights& pipe_weights, const std::vector<float>& input_weights);
+	static void sparse_input_convolve3(const Weights& weights, const std::vector<float>& input, std::vector<float>& output);
+	void forward_board(const std::vector<float>& input, std::vector<float>& output_pol, std::vector<float>& output_val);
+
+	template <int M>
+	static void winograd_transform_in(const std::vector<float>& in, std::vector<float>& V, int channels);
+	template <int M>
+	static void winograd_transform_out(const std::vector<float>& M_in, std::vector<float>& Y, int K);
 };
 #endif
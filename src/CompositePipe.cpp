@@ -0,0 +1,223 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2017-2019 Michael O and contributors
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+
+    Additional permission under GNU GPL version 3 section 7
+
+    If you modify this Program, or any covered work, by linking or
+    combining it with NVIDIA Corporation's libraries from the
+    NVIDIA CUDA Toolkit and/or the NVIDIA CUDA Deep Neural
+    Network library and/or the NVIDIA TensorRT inference library
+    (or a modified version of those libraries), containing parts covered
+    by the terms of the respective license agreement, the licensors of
+    this Program grant you additional permission to convey the resulting
+    work.
+*/
+
+#include "CompositePipe.h"
+
+#include <algorithm>
+#include <chrono>
+#include <limits>
+#include <utility>
+
+/// Weight of the latest evaluation in the moving average of a backend speed, the first evaluations are averaged evenly
+static constexpr auto SPEED_AVERAGE_WEIGHT = 0.05;
+/// Requests after which an idle backend that was not picked gets one, about one evaluation in this many is spent on
+/// correcting the speed of a slower backend
+static constexpr auto PROBE_INTERVAL = size_t{64};
+
+CompositePipe::CompositePipe(std::vector<Backend> backends, clock_function clock) : m_clock(std::move(clock))
+{
+    for (auto& backend : backends)
+        m_lanes.emplace_back(std::make_unique<Lane>(std::move(backend)));
+
+    for (auto& lane : m_lanes)
+        for (auto i = 0; i < lane->backend.batch_size; i++)
+            m_workers.emplace_back(&CompositePipe::worker, this, std::ref(*lane));
+}
+
+CompositePipe::~CompositePipe()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_running = false;
+    }
+
+    for (auto& lane : m_lanes)
+        lane->cv.notify_all();
+
+    for (auto& worker : m_workers)
+        worker.join();
+}
+
+void CompositePipe::initialize(const int channels)
+{
+    for (auto& lane : m_lanes)
+        lane->backend.pipe->initialize(channels);
+}
+
+bool CompositePipe::needs_autodetect()
+{
+    for (auto& lane : m_lanes)
+        if (lane->backend.pipe->needs_autodetect())
+            return true;
+
+    return false;
+}
+
+void CompositePipe::push_weights(const unsigned int filter_size, const unsigned int channels, const unsigned int outputs, const std::shared_ptr<const ForwardPipeWeights> weights)
+{
+    for (auto& lane : m_lanes)
+        lane->backend.pipe->push_weights(filter_size, channels, outputs, weights);
+}
+
+double CompositePipe::steady_clock()
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+double CompositePipe::Lane::throughput() const
+{
+    if (evaluations == 0)
+        return std::numeric_limits<double>::infinity();
+
+    return backend.batch_size / seconds_per_evaluation;
+}
+
+void CompositePipe::dispatch()
+{
+    while (m_queue.size() > m_wakeups)
+	{
+        Lane* fastest = nullptr;
+        Lane* unpicked = nullptr;
+
+        for (auto& lane : m_lanes)
+		{
+            if (lane->idle == 0)
+                continue;
+
+            if (fastest == nullptr || lane->throughput() > fastest->throughput())
+                fastest = lane.get();
+            if (m_dispatches - lane->last_dispatch >= PROBE_INTERVAL && (unpicked == nullptr || lane->last_dispatch < unpicked->last_dispatch))
+                unpicked = lane.get();
+        }
+
+        // Every worker is busy, the first one to finish takes the request
+        if (fastest == nullptr)
+            return;
+
+        const auto lane = unpicked != nullptr ? unpicked : fastest;
+        lane->last_dispatch = ++m_dispatches;
+        lane->idle--;
+        lane->wakeups++;
+        m_wakeups++;
+        lane->cv.notify_one();
+    }
+}
+
+void CompositePipe::forward(const std::vector<float>& input, std::vector<float>& output_pol, std::vector<float>& output_val)
+{
+    Request request(input, output_pol, output_val);
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_queue.push_back(&request);
+    dispatch();
+
+    request.done_cv.wait(lock, [&request] { return request.done; });
+}
+
+void CompositePipe::worker(Lane& lane)
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+
+    while (true)
+	{
+        // Wait unless a request is left over that no other worker was woken for
+        if (m_queue.size() <= m_wakeups)
+		{
+            lane.idle++;
+            lane.cv.wait(lock, [this, &lane] { return !m_running || lane.wakeups > 0; });
+
+            if (!m_running)
+                return;
+
+            lane.wakeups--;
+            m_wakeups--;
+        }
+
+        if (!m_running)
+            return;
+
+        auto& request = *m_queue.front();
+        m_queue.pop_front();
+        lock.unlock();
+
+        const auto start = m_clock();
+        lane.backend.pipe->forward(request.input, request.output_pol, request.output_val);
+        const auto seconds = m_clock() - start;
+
+        lock.lock();
+        request.done = true;
+        request.done_cv.notify_one();
+
+        lane.evaluations++;
+        const auto weight = std::max(SPEED_AVERAGE_WEIGHT, 1.0 / lane.evaluations);
+        lane.seconds_per_evaluation += weight * (seconds - lane.seconds_per_evaluation);
+    }
+}
+
+std::string CompositePipe::get_batching_report()
+{
+    auto report = std::string();
+    for (auto& lane : m_lanes)
+    {
+        const auto lane_report = lane->backend.pipe->get_batching_report();
+        if (lane_report.empty())
+            continue;
+
+        if (!report.empty())
+            report += "\n";
+        report += lane->backend.name + ":\n" + lane_report;
+    }
+
+    return report;
+}
+
+ForwardPipe::BatchStatistics CompositePipe::get_batch_statistics()
+{
+    auto statistics = BatchStatistics();
+    for (auto& lane : m_lanes)
+    {
+        const auto lane_statistics = lane->backend.pipe->get_batch_statistics();
+        statistics.batches += lane_statistics.batches;
+        statistics.evaluations += lane_statistics.evaluations;
+        statistics.capacity += lane_statistics.capacity;
+    }
+
+    return statistics;
+}
+
+std::vector<CompositePipe::BackendStatistics> CompositePipe::get_statistics()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto statistics = std::vector<BackendStatistics>{};
+
+    for (auto& lane : m_lanes)
+        statistics.push_back({lane->backend.name, lane->evaluations, lane->evaluations == 0 ? 0.0 : lane->throughput()});
+
+    return statistics;
+}
@@ -0,0 +1,138 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2017-2019 Michael O and contributors
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+
+    Additional permission under GNU GPL version 3 section 7
+
+    If you modify this Program, or any covered work, by linking or
+    combining it with NVIDIA Corporation's libraries from the
+    NVIDIA CUDA Toolkit and/or the NVIDIA CUDA Deep Neural
+    Network library and/or the NVIDIA TensorRT inference library
+    (or a modified version of those libraries), containing parts covered
+    by the terms of the respective license agreement, the licensors of
+    this Program grant you additional permission to convey the resulting
+    work.
+*/
+
+#ifndef COMPOSITEPIPE_H_INCLUDED
+#define COMPOSITEPIPE_H_INCLUDED
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "ForwardPipe.h"
+
+/// Spreads the evaluations over several backends, for instance the host cores next to the GPUs. Requests wait in one
+/// shared queue and go to the backend with the highest measured throughput that has an idle worker, so a slower backend
+/// only gets work when the faster ones are saturated. A backend that has not been picked for a while gets one request,
+/// so that a single slow measurement does not keep it idle for good.
+class CompositePipe : public ForwardPipe
+{
+public:
+
+	struct Backend
+	{
+		std::string name;
+		std::unique_ptr<ForwardPipe> pipe;
+		/// Evaluations it runs at once, an OpenCL pipe needs enough of them in flight to fill its batches
+		int batch_size;
+	};
+
+	struct BackendStatistics
+	{
+		std::string name;
+		size_t evaluations;
+		/// Measured over its recent evaluations, assuming all of its batch is in flight
+		double evaluations_per_second;
+	};
+
+	/// Seconds since an arbitrary origin, the tests replace it to measure fixed evaluation times
+	using clock_function = std::function<double()>;
+
+	explicit CompositePipe(std::vector<Backend> backends, clock_function clock = steady_clock);
+	~CompositePipe() override;
+
+	void initialize(int channels) override;
+	bool needs_autodetect() override;
+	std::string get_batching_report() override;
+	BatchStatistics get_batch_statistics() override;
+	void forward(const std::vector<float>& input, std::vector<float>& output_pol, std::vector<float>& output_val) override;
+	void push_weights(unsigned int filter_size, unsigned int channels, unsigned int outputs, std::shared_ptr<const ForwardPipeWeights> weights) override;
+
+	std::vector<BackendStatistics> get_statistics();
+
+	static double steady_clock();
+
+private:
+
+	struct Request
+	{
+		Request(const std::vector<float>& input, std::vector<float>& output_pol, std::vector<float>& output_val) : input(input), output_pol(output_pol), output_val(output_val) {}
+
+		const std::vector<float>& input;
+		std::vector<float>& output_pol;
+		std::vector<float>& output_val;
+		std::condition_variable done_cv;
+		bool done{false};
+	};
+
+	/// A backend and its workers, all counters are protected by m_mutex
+	struct Lane
+	{
+		explicit Lane(Backend&& backend) : backend(std::move(backend)) {}
+
+		/// Evaluations per second, a backend that was never measured comes first so that it gets measured
+		double throughput() const;
+
+		Backend backend;
+		std::condition_variable cv;
+		/// Workers waiting for a request
+		int idle{0};
+		/// Workers woken for a request that did not take it yet
+		int wakeups{0};
+		size_t evaluations{0};
+		/// Moving average of the time one worker takes for an evaluation
+		double seconds_per_evaluation{0.0};
+		/// Value of m_dispatches when it was last picked
+		size_t last_dispatch{0};
+	};
+
+	void worker(Lane& lane);
+	/// Wake the workers for the queued requests no worker was woken for yet, m_mutex must be held
+	void dispatch();
+
+	clock_function m_clock;
+	std::mutex m_mutex;
+	bool m_running{true};
+	std::deque<Request*> m_queue;
+	/// Sum of the wakeups of every lane
+	size_t m_wakeups{0};
+	/// Requests handed to a lane so far
+	size_t m_dispatches{0};
+	std::vector<std::unique_ptr<Lane>> m_lanes;
+
+	/// Last member, so that everything they use exists before they start
+	std::vector<std::thread> m_workers;
+};
+
+#endif
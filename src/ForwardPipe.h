@@ -30,7 +30,10 @@
 #ifndef FORWARDPIPE_H_INCLUDED
 #define FORWARDPIPE_H_INCLUDED
 
+#include <cstdint>
+#include <cstring>
 #include <memory>
+#include <string>
 #include <vector>
 
 /// TODO
@@ -49,6 +52,9 @@ public:
         std::vector<std::vector<float>> m_batchnorm_means;
         std::vector<std::vector<float>> m_batchnorm_stddevs;
 
+        // Input convolution filters before the Winograd transform, the input planes are binary so a backend can skip the empty intersections
+        std::vector<float> m_conv_input_weights;
+
         // Policy head
     	
         std::vector<float> m_conv_pol_weights;
@@ -56,9 +62,42 @@ public:
 
         std::vector<float> m_conv_val_weights;
         std::vector<float> m_conv_val_bias;
+
+        /// FNV-1a hash of every weight, tells whether two processes loaded the same network
+        std::uint64_t fingerprint() const
+        {
+            auto hash = std::uint64_t{14695981039346656037ULL};
+            const auto add = [&hash](const std::vector<float>& values)
+            {
+                for (const auto value : values)
+                {
+                    auto bits = std::uint32_t{};
+                    std::memcpy(&bits, &value, sizeof(bits));
+                    hash = (hash ^ bits) * 1099511628211ULL;
+                }
+            };
+
+            for (const auto* layers : { &m_conv_weights, &m_conv_biases, &m_batchnorm_means, &m_batchnorm_stddevs })
+                for (const auto& layer : *layers)
+                    add(layer);
+
+            for (const auto* values : { &m_conv_pol_weights, &m_conv_pol_bias, &m_conv_val_weights, &m_conv_val_bias })
+                add(*values);
+
+            return hash;
+        }
     	
     };
 
+	/// Batches run by a batching backend and the evaluations they held, all zeros for the others
+	struct BatchStatistics
+	{
+		std::uint64_t batches{0};
+		std::uint64_t evaluations{0};
+		/// Evaluations the batches could have held at the maximum batch size
+		std::uint64_t capacity{0};
+	};
+
     virtual ~ForwardPipe() = default;
 
     virtual void initialize(int channels) = 0;
@@ -67,6 +106,17 @@ public:
     {
 	    return false;
     }
+
+	/// How a batching backend forms its batches, empty for the others, without a final newline
+    virtual std::string get_batching_report()
+    {
+	    return std::string();
+    }
+
+    virtual BatchStatistics get_batch_statistics()
+    {
+	    return BatchStatistics();
+    }
 	
     virtual void forward(const std::vector<float>& input, std::vector<float>& output_pol, std::vector<float>& output_val) = 0;
     virtual void push_weights(unsigned int filter_size, unsigned int channels, unsigned int outputs, std::shared_ptr<const ForwardPipeWeights> weights) = 0;
@@ -0,0 +1,319 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2017-2019 Michael O and contributors
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+
+    Additional permission under GNU GPL version 3 section 7
+
+    If you modify this Program, or any covered work, by linking or
+    combining it with NVIDIA Corporation's libraries from the
+    NVIDIA CUDA Toolkit and/or the NVIDIA CUDA Deep Neural
+    Network library and/or the NVIDIA TensorRT inference library
+    (or a modified version of those libraries), containing parts covered
+    by the terms of the respective license agreement, the licensors of
+    this Program grant you additional permission to convey the resulting
+    work.
+*/
+
+#include "ForwardQueue.h"
+
+#include <algorithm>
+#include <cassert>
+#include <limits>
+#include <thread>
+
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+#else
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#endif
+
+/// Passed as timeout to sleep until woken up
+static constexpr auto NO_TIMEOUT = -1;
+
+#ifdef __linux__
+
+/// Sleep while the word holds the expected value, for at most timeout_us, wakeups can be spurious
+static void wait_word(std::atomic<std::uint32_t>& word, const std::uint32_t expected, const long long timeout_us)
+{
+    auto timeout = timespec{};
+    timeout.tv_sec = static_cast<time_t>(timeout_us / 1000000);
+    timeout.tv_nsec = static_cast<long>(timeout_us % 1000000) * 1000L;
+
+    syscall(SYS_futex, reinterpret_cast<std::uint32_t*>(&word), FUTEX_WAIT_PRIVATE, expected,
+            timeout_us == NO_TIMEOUT ? nullptr : &timeout, nullptr, 0);
+}
+
+static void wake_word(std::atomic<std::uint32_t>& word, const int count)
+{
+    syscall(SYS_futex, reinterpret_cast<std::uint32_t*>(&word), FUTEX_WAKE_PRIVATE, count, nullptr, nullptr, 0);
+}
+
+#else
+
+/// Without futexes the words are hashed on a few condition variables, a waker locks the bucket after changing the word
+/// and a waiter checks the word under that lock, so no wakeup gets lost
+struct WaitBucket
+{
+    std::mutex mutex;
+    std::condition_variable cv;
+};
+
+static WaitBucket& wait_bucket(const std::atomic<std::uint32_t>& word)
+{
+    static WaitBucket buckets[16];
+    return buckets[std::hash<const void*>()(&word) % 16];
+}
+
+static void wait_word(std::atomic<std::uint32_t>& word, const std::uint32_t expected, const long long timeout_us)
+{
+    auto& bucket = wait_bucket(word);
+    std::unique_lock<std::mutex> lock(bucket.mutex);
+    if (word.load() != expected)
+        return;
+
+    if (timeout_us == NO_TIMEOUT)
+        bucket.cv.wait(lock);
+    else
+        bucket.cv.wait_for(lock, std::chrono::microseconds(timeout_us));
+}
+
+static void wake_word(std::atomic<std::uint32_t>& word, int)
+{
+    auto& bucket = wait_bucket(word);
+    {
+        std::lock_guard<std::mutex> lock(bucket.mutex);
+    }
+    bucket.cv.notify_all();
+}
+
+#endif
+
+static size_t round_up_power_of_two(const size_t value)
+{
+    auto result = size_t{1};
+    while (result < value)
+        result <<= 1;
+
+    return result;
+}
+
+ForwardQueue::Ring::Ring(const size_t capacity) : m_cells(capacity), m_mask(capacity - 1)
+{
+    assert((capacity & m_mask) == 0);
+    for (auto i = size_t{0}; i < capacity; i++)
+        m_cells[i].sequence.store(i, std::memory_order_relaxed);
+}
+
+bool ForwardQueue::Ring::push(const std::uint32_t value)
+{
+    auto position = m_tail.load(std::memory_order_relaxed);
+    while (true)
+    {
+        auto& cell = m_cells[position & m_mask];
+        const auto sequence = cell.sequence.load(std::memory_order_acquire);
+        const auto lap = static_cast<std::intptr_t>(sequence) - static_cast<std::intptr_t>(position);
+
+        if (lap == 0)
+        {
+            if (m_tail.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+            {
+                cell.value = value;
+                cell.sequence.store(position + 1, std::memory_order_release);
+                return true;
+            }
+        }
+        else if (lap < 0)
+            return false;
+        else
+            position = m_tail.load(std::memory_order_relaxed);
+    }
+}
+
+bool ForwardQueue::Ring::pop(std::uint32_t& value)
+{
+    auto position = m_head.load(std::memory_order_relaxed);
+    while (true)
+    {
+        auto& cell = m_cells[position & m_mask];
+        const auto sequence = cell.sequence.load(std::memory_order_acquire);
+        const auto lap = static_cast<std::intptr_t>(sequence) - static_cast<std::intptr_t>(position + 1);
+
+        if (lap == 0)
+        {
+            if (m_head.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+            {
+                value = cell.value;
+                cell.sequence.store(position + m_mask + 1, std::memory_order_release);
+                return true;
+            }
+        }
+        else if (lap < 0)
+            return false;
+        else
+            position = m_head.load(std::memory_order_relaxed);
+    }
+}
+
+ForwardQueue::ForwardQueue(const size_t capacity)
+    : m_slots(round_up_power_of_two(std::max(capacity, size_t{1}))), m_free(m_slots.size()), m_queue(m_slots.size())
+{
+    for (auto i = size_t{0}; i < m_slots.size(); i++)
+        m_free.push(static_cast<std::uint32_t>(i));
+}
+
+void ForwardQueue::submit(const std::vector<float>& input, std::vector<float>& output_pol, std::vector<float>& output_val)
+{
+    auto index = std::uint32_t{0};
+    while (!m_free.pop(index))
+    {
+        // Every slot is in use, sleep until one is released
+        m_sleeping_callers.fetch_add(1);
+        const auto released = m_released.load();
+        if (m_free.pop(index))
+        {
+            m_sleeping_callers.fetch_sub(1);
+            break;
+        }
+        wait_word(m_released, released, NO_TIMEOUT);
+        m_sleeping_callers.fetch_sub(1);
+    }
+
+    auto& slot = m_slots[index];
+    slot.request = Request{&input, &output_pol, &output_val};
+    slot.queued_at = std::chrono::steady_clock::now();
+    slot.state.store(QUEUED, std::memory_order_relaxed);
+
+    // The ring holds at most every slot, so it cannot be full
+    m_queue.push(index);
+    m_queued.fetch_add(1);
+    if (m_sleeping_workers.load() > 0)
+        wake_word(m_queued, std::numeric_limits<int>::max());
+
+    auto state = static_cast<std::uint32_t>(QUEUED);
+    if (slot.state.compare_exchange_strong(state, SLEEPING, std::memory_order_acquire))
+    {
+        do
+            wait_word(slot.state, SLEEPING, NO_TIMEOUT);
+        while (slot.state.load(std::memory_order_acquire) != DONE);
+    }
+
+    release(index);
+}
+
+void ForwardQueue::release(const std::uint32_t slot)
+{
+    m_slots[slot].state.store(FREE, std::memory_order_relaxed);
+    m_free.push(slot);
+
+    m_released.fetch_add(1);
+    if (m_sleeping_callers.load() > 0)
+        wake_word(m_released, std::numeric_limits<int>::max());
+}
+
+bool ForwardQueue::wait_for(const size_t count, const double timeout_ms)
+{
+    const auto deadline = std::chrono::steady_clock::now()
+        + std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double, std::milli>(timeout_ms));
+    while (true)
+    {
+        const auto queued = m_queued.load();
+        if (queued >= count)
+            return true;
+        if (closed())
+            return false;
+
+        const auto remaining = std::chrono::duration_cast<std::chrono::microseconds>(
+            deadline - std::chrono::steady_clock::now()).count();
+        if (remaining <= 0)
+            return false;
+
+        // Announce the sleep before checking the count again, a producer bumps the count before it checks for sleepers
+        m_sleeping_workers.fetch_add(1);
+        if (m_queued.load() == queued && !closed())
+            wait_word(m_queued, queued, remaining);
+        m_sleeping_workers.fetch_sub(1);
+    }
+}
+
+size_t ForwardQueue::pop(std::vector<std::uint32_t>& slots, const size_t min_count, const size_t max_count)
+{
+    assert(min_count >= 1 && min_count <= max_count);
+
+    // Reserve the requests first so that a worker never takes part of a batch it then has to give back
+    auto queued = m_queued.load(std::memory_order_relaxed);
+    auto count = size_t{0};
+    do
+    {
+        if (queued < min_count)
+            return 0;
+        count = std::min(static_cast<size_t>(queued), max_count);
+    }
+    while (!m_queued.compare_exchange_weak(queued, static_cast<std::uint32_t>(queued - count), std::memory_order_acquire));
+
+    for (auto i = size_t{0}; i < count; i++)
+    {
+        // A reserved request is in the ring, though the producer of an earlier position may still be writing it
+        auto index = std::uint32_t{0};
+        while (!m_queue.pop(index))
+            std::this_thread::yield();
+        slots.push_back(index);
+    }
+
+    m_batches.fetch_add(1, std::memory_order_relaxed);
+    return count;
+}
+
+double ForwardQueue::complete(const std::uint32_t slot)
+{
+    auto& entry = m_slots[slot];
+
+    const auto latency = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - entry.queued_at).count();
+    m_evaluations.fetch_add(1, std::memory_order_relaxed);
+    m_total_latency_ns.fetch_add(latency, std::memory_order_relaxed);
+    auto max_latency = m_max_latency_ns.load(std::memory_order_relaxed);
+    while (latency > max_latency && !m_max_latency_ns.compare_exchange_weak(max_latency, latency, std::memory_order_relaxed));
+
+    // The caller may release the slot as soon as it sees DONE, do not touch the slot afterwards except for waking
+    if (entry.state.exchange(DONE, std::memory_order_acq_rel) == SLEEPING)
+        wake_word(entry.state, 1);
+
+    return latency / 1e6;
+}
+
+void ForwardQueue::close()
+{
+    // A worker that checked the flag just before may still go to sleep, but only until its timeout
+    m_closed.store(true, std::memory_order_release);
+    wake_word(m_queued, std::numeric_limits<int>::max());
+}
+
+ForwardQueue::Statistics ForwardQueue::get_statistics() const
+{
+    auto statistics = Statistics{};
+    statistics.evaluations = m_evaluations.load(std::memory_order_relaxed);
+    statistics.batches = m_batches.load(std::memory_order_relaxed);
+    if (statistics.evaluations > 0)
+        statistics.mean_latency_ms = m_total_latency_ns.load(std::memory_order_relaxed) / 1e6 / statistics.evaluations;
+    statistics.max_latency_ms = m_max_latency_ns.load(std::memory_order_relaxed) / 1e6;
+
+    return statistics;
+}
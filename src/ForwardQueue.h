@@ -0,0 +1,164 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2017-2019 Michael O and contributors
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+
+    Additional permission under GNU GPL version 3 section 7
+
+    If you modify this Program, or any covered work, by linking or
+    combining it with NVIDIA Corporation's libraries from the
+    NVIDIA CUDA Toolkit and/or the NVIDIA CUDA Deep Neural
+    Network library and/or the NVIDIA TensorRT inference library
+    (or a modified version of those libraries), containing parts covered
+    by the terms of the respective license agreement, the licensors of
+    this Program grant you additional permission to convey the resulting
+    work.
+*/
+
+#ifndef FORWARDQUEUE_H_INCLUDED
+#define FORWARDQUEUE_H_INCLUDED
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/// Bounded multi producer multi consumer queue of evaluation requests for the batching pipes. Requests live in slots
+/// allocated once, the workers move slot indices only and a caller sleeps on a word of its own slot until the outputs are
+/// written, so queuing an evaluation takes no lock and no allocation.
+class ForwardQueue
+{
+public:
+
+	struct Request
+	{
+		const std::vector<float>* input;
+		std::vector<float>* output_pol;
+		std::vector<float>* output_val;
+	};
+
+	struct Statistics
+	{
+		size_t evaluations;
+		size_t batches;
+		/// From the submission of a request to its completion
+		double mean_latency_ms;
+		double max_latency_ms;
+	};
+
+	/// The capacity is rounded up to a power of two, callers beyond it wait for a slot to be released
+	explicit ForwardQueue(size_t capacity);
+
+	ForwardQueue(const ForwardQueue&) = delete;
+	ForwardQueue& operator=(const ForwardQueue&) = delete;
+
+	/// Queue an evaluation and block until a worker completed it
+	void submit(const std::vector<float>& input, std::vector<float>& output_pol, std::vector<float>& output_val);
+
+	/// Requests queued and not taken by a worker yet
+	size_t size() const
+	{
+		return m_queued.load(std::memory_order_acquire);
+	}
+
+	/// Sleep until at least count requests are queued, the queue is closed or timeout_ms passed. Returns whether count
+	/// requests are queued
+	bool wait_for(size_t count, double timeout_ms);
+	/// Take up to max_count queued requests, appending their slots, only if at least min_count are queued. Returns the
+	/// number taken
+	size_t pop(std::vector<std::uint32_t>& slots, size_t min_count, size_t max_count);
+
+	const Request& request(const std::uint32_t slot) const
+	{
+		return m_slots[slot].request;
+	}
+
+	/// Hand the outputs of a taken request back to its caller, returns the time since it was queued in milliseconds
+	double complete(std::uint32_t slot);
+
+	/// Wake up the sleeping workers, wait_for returns at once afterwards
+	void close();
+
+	bool closed() const
+	{
+		return m_closed.load(std::memory_order_acquire);
+	}
+
+	Statistics get_statistics() const;
+
+private:
+
+	/// A caller announces SLEEPING before it waits, so a worker only makes a system call to wake a caller that sleeps
+	enum SlotState : std::uint32_t
+	{
+		FREE, QUEUED, SLEEPING, DONE
+	};
+
+	struct Slot
+	{
+		std::atomic<std::uint32_t> state{FREE};
+		Request request;
+		std::chrono::steady_clock::time_point queued_at;
+	};
+
+	/// Bounded ring of slot indices after Dmitry Vyukov. Each cell has a sequence number telling whether it is full for
+	/// the lap of a given position, so producers and consumers only contend on their own end
+	class Ring
+	{
+	public:
+
+		explicit Ring(size_t capacity);
+
+		/// Fails when full
+		bool push(std::uint32_t value);
+		/// Fails when empty
+		bool pop(std::uint32_t& value);
+
+	private:
+
+		struct Cell
+		{
+			std::atomic<size_t> sequence;
+			std::uint32_t value;
+		};
+
+		std::vector<Cell> m_cells;
+		size_t m_mask;
+		std::atomic<size_t> m_tail{0};
+		std::atomic<size_t> m_head{0};
+	};
+
+	void release(std::uint32_t slot);
+
+	std::vector<Slot> m_slots;
+	Ring m_free;
+	Ring m_queue;
+
+	/// Counts the requests in m_queue, workers reserve from it before popping and sleep on it
+	std::atomic<std::uint32_t> m_queued{0};
+	std::atomic<int> m_sleeping_workers{0};
+	/// Bumped on every released slot, callers finding no free slot sleep on it
+	std::atomic<std::uint32_t> m_released{0};
+	std::atomic<int> m_sleeping_callers{0};
+	std::atomic<bool> m_closed{false};
+
+	std::atomic<size_t> m_evaluations{0};
+	std::atomic<size_t> m_batches{0};
+	std::atomic<std::int64_t> m_total_latency_ns{0};
+	std::atomic<std::int64_t> m_max_latency_ns{0};
+};
+
+#endif
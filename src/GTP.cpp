@@ -48,6 +48,7 @@
 #include "GameState.h"
 #include "Network.h"
 #include "SGFTree.h"
+#include "Trace.h"
 #include "Training.h"
 #include "UCTSearch.h"
 #include "Utils.h"
@@ -60,6 +61,7 @@ bool cfg_gtp_mode;
 bool cfg_allow_pondering;
 unsigned int cfg_num_threads;
 unsigned int cfg_batch_size;
+std::atomic<float> cfg_batch_latency_target;
 int cfg_max_playouts;
 int cfg_max_visits;
 size_t cfg_max_memory;
@@ -76,8 +78,10 @@ std::uint64_t cfg_rng_seed;
 bool cfg_dumb_pass;
 #ifdef USE_OPENCL
 std::vector<int> cfg_gpus;
+std::vector<unsigned int> cfg_tune_batch_sizes;
 bool cfg_sgemm_exhaustive;
 bool cfg_tune_only;
+unsigned int cfg_cpu_assist;
 #ifdef USE_HALF
 precision_t cfg_precision;
 #endif
@@ -96,7 +100,18 @@ FILE* cfg_logfile_handle;
 bool cfg_quiet;
 std::string cfg_options_str;
 bool cfg_benchmark;
+std::string cfg_match_weights_file;
+int cfg_match_games;
+int cfg_match_parallel;
+std::string cfg_bench_suite_file;
+int cfg_bench_repeats;
+std::string cfg_replay_file;
+bool cfg_replay_max_speed;
+std::string cfg_trace_file;
 bool cfg_cpu_only;
+#ifdef USE_INFERENCE_SERVER
+std::string cfg_infer_server;
+#endif
 AnalyzeTags cfg_analyze_tags;
 
 /* Parses tags for the lz-analyze GTP command and friends */
@@ -322,6 +337,10 @@ bool AnalyzeTags::has_move_restrictions() const
 }
 
 std::unique_ptr<Network> GTP::s_network;
+std::future<std::unique_ptr<Network>> GTP::s_pending_network;
+std::string GTP::s_pending_weights_file;
+Time GTP::s_pending_weights_start;
+Time GTP::s_pending_weights_ready;
 
 void GTP::initialize(std::unique_ptr<Network>&& network)
 {
@@ -352,6 +371,8 @@ void GTP::setup_default_parameters()
     cfg_num_threads = 1;
     // We will re-calculate this on Leela.cpp
     cfg_batch_size = 1;
+    // p99 latency of an evaluation the batching backends aim for, in milliseconds
+    cfg_batch_latency_target = 10.0f;
 
     cfg_max_memory = UCTSearch::DEFAULT_MAX_MEMORY;
     cfg_max_playouts = UCTSearch::UNLIMITED_PLAYOUTS;
@@ -364,8 +385,10 @@ void GTP::setup_default_parameters()
     cfg_weights_file = leelaz_file("best-network");
 #ifdef USE_OPENCL
     cfg_gpus = { };
+    cfg_tune_batch_sizes = { };
     cfg_sgemm_exhaustive = false;
     cfg_tune_only = false;
+    cfg_cpu_assist = 0;
 
 #ifdef USE_HALF
     cfg_precision = precision_t::AUTO;
@@ -390,11 +413,22 @@ void GTP::setup_default_parameters()
     cfg_logfile_handle = nullptr;
     cfg_quiet = false;
     cfg_benchmark = false;
+    cfg_match_weights_file = "";
+    cfg_match_games = 400;
+    cfg_match_parallel = 2;
+    cfg_bench_suite_file = "";
+    cfg_bench_repeats = 5;
+    cfg_replay_file = "";
+    cfg_replay_max_speed = false;
+    cfg_trace_file = "";
 #ifdef USE_CPU_ONLY
     cfg_cpu_only = true;
 #else
     cfg_cpu_only = false;
 #endif
+#ifdef USE_INFERENCE_SERVER
+    cfg_infer_server = "";
+#endif
 
     cfg_analyze_tags = AnalyzeTags{};
 
@@ -442,7 +476,10 @@ const std::string GTP::s_commands[] = {
     "lz-analyze",
     "lz-genmove_analyze",
     "lz-memory_report",
+    "lz-batching",
     "lz-setoption",
+    "lz-load_weights",
+    "lz-trace",
     "gomill-explain_last_move",
     ""
 };
@@ -491,15 +528,21 @@ std::string GTP::get_life_list(const GameState & game, const bool live)
 
 void GTP::execute(GameState & game, const std::string& x_input)
 {
+    const Trace::Scope trace("GTP::execute");
     std::string input;
     static auto search = std::make_unique<UCTSearch>(game, *s_network);
 
     auto transform_lowercase = true;
 
     // Required on Unix systems
-    if (x_input.find("loadsgf") != std::string::npos)
+    if (x_input.find("loadsgf") != std::string::npos || x_input.find("lz-load_weights") != std::string::npos || x_input.find("lz-trace") != std::string::npos)
         transform_lowercase = false;
 
+    // Swap in weights loaded by lz-load_weights once they are ready, this is always between searches. The tree holds
+    // priors and values of the previous network, start a new one as clear_board does
+    if (commit_pending_weights(false))
+        search = std::make_unique<UCTSearch>(game, *s_network);
+
     // Eat empty lines, simple preprocessing, lower case
     for (unsigned int tmp = 0; tmp < x_input.size(); tmp++) 
 	{
@@ -650,7 +693,7 @@ void GTP::execute(GameState & game, const std::string& x_input)
         Training::clear_training();
         game.reset_game();
         search = std::make_unique<UCTSearch>(game, *s_network);
-        assert(UCTNodePointer::get_tree_size() == 0);
+        assert(UCTNodePointer::get_exact_tree_size() == 0);
         gtp_printf(id, "");
         return;
     }
@@ -1478,7 +1521,7 @@ void GTP::execute(GameState & game, const std::string& x_input)
 	if (command.find("lz-memory_report") == 0) 
 	{
         auto base_memory = get_base_memory();
-        auto tree_size = add_overhead(UCTNodePointer::get_tree_size());
+        auto tree_size = add_overhead(UCTNodePointer::get_exact_tree_size());
         auto cache_size = add_overhead(s_network->get_estimated_cache_size());
 
         auto total = base_memory + tree_size + cache_size;
@@ -1487,18 +1530,152 @@ void GTP::execute(GameState & game, const std::string& x_input)
         return;
     }
 
+	if (command.find("lz-batching") == 0) 
+	{
+        std::istringstream command_stream(command);
+        std::string tmp, option;
+        float target;
+
+		// Eat lz-batching
+        command_stream >> tmp >> option;
+
+        if (!option.empty())
+		{
+            command_stream >> target;
+            if (option != "target" || command_stream.fail() || target <= 0.0f)
+			{
+                gtp_fail_printf(id, "syntax not understood: lz-batching [target <milliseconds>]");
+                return;
+            }
+            cfg_batch_latency_target = target;
+        }
+
+        const auto report = s_network->get_batching_report();
+        if (report.empty())
+            gtp_printf(id, "target p99 %.1f ms, the backend does not batch", cfg_batch_latency_target.load());
+        else
+            gtp_printf(id, "%s", report.c_str());
+        return;
+    }
+
 	if (command.find("lz-setoption") == 0) 
         return execute_setoption(*search, id, command);
 
+	if (command.find("lz-trace") == 0) 
+	{
+        std::istringstream command_stream(command);
+        std::string tmp, action, filename;
+
+		// Eat lz-trace
+        command_stream >> tmp >> action >> filename;
+
+        if (action == "start" && filename.empty())
+		{
+            Trace::start();
+            gtp_printf(id, "");
+        }
+		else if (action == "stop" && !filename.empty())
+		{
+            Trace::stop();
+            if (Trace::write(filename))
+                gtp_printf(id, "");
+            else
+                gtp_fail_printf(id, "cannot write %s", filename.c_str());
+        }
+		else
+		{
+            gtp_fail_printf(id, "syntax not understood: lz-trace start | lz-trace stop <file>");
+        }
+        return;
+    }
+
 	if (command.find("gomill-explain_last_move") == 0) 
 	{
         gtp_printf(id, "%s\n", search->explain_last_think().c_str());
         return;
     }
+
+	if (command.find("lz-load_weights") == 0) 
+	{
+        std::istringstream command_stream(command);
+        std::string tmp, filename;
+
+		// Eat lz-load_weights
+        command_stream >> tmp;
+        command_stream >> filename;
+
+        if (command_stream.fail()) 
+		{
+            gtp_fail_printf(id, "Missing filename.");
+            return;
+        }
+
+#ifdef USE_INFERENCE_SERVER
+        // The tower is evaluated by the server, it would not match the new heads
+        if (!cfg_infer_server.empty())
+		{
+            gtp_fail_printf(id, "weights are loaded by the inference server");
+            return;
+        }
+#endif
+
+        if (!std::ifstream(filename).good()) 
+		{
+            gtp_fail_printf(id, "cannot open file");
+            return;
+        }
+
+		// Only one load at a time, the previous one is committed first
+        if (commit_pending_weights(true))
+            search = std::make_unique<UCTSearch>(game, *s_network);
+
+        // Parsing and transforming the weights is the slow part and needs no device, do it while the engine keeps serving commands
+        s_pending_weights_file = filename;
+        s_pending_weights_start = Time();
+        s_pending_network = std::async(std::launch::async, [filename]
+		{
+            auto network = Network::prepare_weights(filename);
+            s_pending_weights_ready = Time();
+            return network;
+        });
+
+        gtp_printf(id, "");
+        return;
+    }
 	
     gtp_fail_printf(id, "unknown command");
 }
 
+bool GTP::commit_pending_weights(const bool wait)
+{
+    if (!s_pending_network.valid())
+        return false;
+
+    // Still loading, keep serving with the current network
+    if (!wait && s_pending_network.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+        return false;
+
+    auto prepared = s_pending_network.get();
+
+    if (prepared == nullptr) 
+	{
+        myprintf("Failed to load weights from %s, keeping the current network.\n", s_pending_weights_file.c_str());
+        return false;
+    }
+
+    s_network->swap_weights(*prepared);
+    cfg_weights_file = s_pending_weights_file;
+
+    // The new network can have a different size, redistribute the memory between tree and cache
+    bool result;
+    std::string message;
+    std::tie(result, message) = set_max_memory(cfg_max_memory, cfg_max_cache_ratio_percent);
+    myprintf("%s\n", message.c_str());
+
+    myprintf("Loaded weights from %s, ready in %.2f seconds.\n", s_pending_weights_file.c_str(), Time::time_difference_seconds(s_pending_weights_start, s_pending_weights_ready));
+    return true;
+}
+
 std::pair<std::string, std::string> GTP::parse_option(std::istringstream& is)
 {
     std::string token, name, value;
@@ -30,12 +30,15 @@
 #ifndef GTP_H_INCLUDED
 #define GTP_H_INCLUDED
 
+#include <atomic>
 #include <cstdio>
+#include <future>
 #include <string>
 #include <vector>
 
 #include "Network.h"
 #include "GameState.h"
+#include "Timing.h"
 #include "UCTSearch.h"
 
 struct MoveToAvoid
@@ -85,6 +88,8 @@ extern bool cfg_gtp_mode;
 extern bool cfg_allow_pondering;
 extern unsigned int cfg_num_threads;
 extern unsigned int cfg_batch_size;
+/// Set by the GTP thread while the batching workers read it
+extern std::atomic<float> cfg_batch_latency_target;
 extern int cfg_max_playouts;
 extern int cfg_max_visits;
 extern size_t cfg_max_memory;
@@ -101,8 +106,10 @@ extern std::uint64_t cfg_rng_seed;
 extern bool cfg_dumb_pass;
 #ifdef USE_OPENCL
 extern std::vector<int> cfg_gpus;
+extern std::vector<unsigned int> cfg_tune_batch_sizes;
 extern bool cfg_sgemm_exhaustive;
 extern bool cfg_tune_only;
+extern unsigned int cfg_cpu_assist;
 #ifdef USE_HALF
 enum class precision_t {
     AUTO, SINGLE, HALF
@@ -124,7 +131,18 @@ extern FILE* cfg_logfile_handle;
 extern bool cfg_quiet;
 extern std::string cfg_options_str;
 extern bool cfg_benchmark;
+extern std::string cfg_match_weights_file;
+extern int cfg_match_games;
+extern int cfg_match_parallel;
+extern std::string cfg_bench_suite_file;
+extern int cfg_bench_repeats;
+extern std::string cfg_replay_file;
+extern bool cfg_replay_max_speed;
+extern std::string cfg_trace_file;
 extern bool cfg_cpu_only;
+#ifdef USE_INFERENCE_SERVER
+extern std::string cfg_infer_server;
+#endif
 extern AnalyzeTags cfg_analyze_tags;
 
 static constexpr size_t MiB = 1024LL * 1024LL;
@@ -153,6 +171,16 @@ private:
     static const std::string s_commands[];
     static const std::string s_options[];
     static std::pair<std::string, std::string> parse_option(std::istringstream& is);
+
+    // Weights being prepared in the background by lz-load_weights
+    static std::future<std::unique_ptr<Network>> s_pending_network;
+    static std::string s_pending_weights_file;
+    static Time s_pending_weights_start;
+    // Set by the loading thread once the weights are prepared, read after the future is ready
+    static Time s_pending_weights_ready;
+    // Whether a new network was swapped in, the tree of the previous one must not be searched further
+    static bool commit_pending_weights(bool wait);
+
     static std::pair<bool, std::string> set_max_memory( size_t max_memory, int cache_size_ratio_percent);
     static void execute_setoption(UCTSearch& search, int id, const std::string& command);
 
@@ -34,11 +34,21 @@
 #include <vector>
 #include <algorithm>
 
-template <unsigned long filter_size>
+template <unsigned long filter_size, int board_size = BOARD_SIZE>
 void im2col(const int channels, const std::vector<float>& input, std::vector<float>& output)
 {
-    constexpr unsigned int height = BOARD_SIZE;
-    constexpr unsigned int width = BOARD_SIZE;
+    constexpr unsigned int height = board_size;
+    constexpr unsigned int width = board_size;
+    constexpr auto num_intersections = board_size * board_size;
+
+    // A 1x1 filter needs no rearranging
+    if (filter_size == 1)
+	{
+        const auto out_size = size_t{channels * static_cast<size_t>(num_intersections)};
+        assert(output.size() == out_size);
+        std::copy(begin(input), begin(input) + out_size, begin(output));
+        return;
+    }
 
     constexpr int pad = (filter_size / 2);
     constexpr unsigned int output_h = height + 2 * pad - filter_size  + 1;
@@ -47,7 +57,7 @@ void im2col(const int channels, const std::vector<float>& input, std::vector<flo
     auto data_im = input.data();
     auto data_col = output.data();
 
-    for (auto channel = channels; channel--; data_im += NUM_INTERSECTIONS) 
+    for (auto channel = channels; channel--; data_im += num_intersections) 
 	{
         for (unsigned int kernel_row = 0; kernel_row < filter_size; kernel_row++) 
 		{
@@ -82,12 +92,4 @@ void im2col(const int channels, const std::vector<float>& input, std::vector<flo
     }
 }
 
-template <>
-inline void im2col<1>(const int channels, const std::vector<float>& input, std::vector<float>& output)
-{
-	const auto out_size = size_t{channels * static_cast<size_t>(NUM_INTERSECTIONS)};
-    assert(output.size() == out_size);
-    std::copy(begin(input), begin(input) + out_size, begin(output));
-}
-
 #endif
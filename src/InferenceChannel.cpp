@@ -0,0 +1,272 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2017-2019 Michael O and contributors
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+
+    Additional permission under GNU GPL version 3 section 7
+
+    If you modify this Program, or any covered work, by linking or
+    combining it with NVIDIA Corporation's libraries from the
+    NVIDIA CUDA Toolkit and/or the NVIDIA CUDA Deep Neural
+    Network library and/or the NVIDIA TensorRT inference library
+    (or a modified version of those libraries), containing parts covered
+    by the terms of the respective license agreement, the licensors of
+    this Program grant you additional permission to convey the resulting
+    work.
+*/
+
+#include "config.h"
+
+#ifdef USE_INFERENCE_SERVER
+#include "InferenceChannel.h"
+
+#include <boost/format.hpp>
+#include <cerrno>
+#include <climits>
+#include <cstring>
+#include <fcntl.h>
+#include <linux/futex.h>
+#include <new>
+#include <signal.h>
+#include <stdexcept>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+namespace
+{
+    std::runtime_error system_error(const std::string& what, const std::string& name)
+	{
+        return std::runtime_error(boost::str(boost::format("%s %s: %s") % what % name % std::strerror(errno)));
+    }
+
+    /// Exclusive lock on a file next to the segment name, held while a server replaces, creates or unlinks the segment.
+    /// The file itself is never removed, a process could otherwise lock a file that is no longer the one in use
+    class NameLock
+	{
+    public:
+
+        explicit NameLock(const std::string& name)
+		{
+            const auto path = "/tmp/" + name.substr(name.find_first_not_of('/')) + ".lock";
+
+            m_fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+            if (m_fd < 0)
+                throw system_error("cannot open lock file", path);
+
+            while (flock(m_fd, LOCK_EX) != 0)
+			{
+                if (errno != EINTR)
+				{
+                    const auto error = system_error("cannot lock", path);
+                    close(m_fd);
+                    throw error;
+                }
+            }
+        }
+
+        ~NameLock()
+		{
+            // Closing the last descriptor releases the lock
+            close(m_fd);
+        }
+
+        NameLock(const NameLock&) = delete;
+        NameLock& operator=(const NameLock&) = delete;
+
+    private:
+
+        int m_fd;
+    };
+
+    /// Throw if a segment of that name belongs to a server that is still running, a stale one is left alone
+    void check_no_running_server(const std::string& name)
+	{
+        const auto fd = shm_open(name.c_str(), O_RDONLY, 0);
+        if (fd < 0)
+            return;
+
+        struct stat status;
+        if (fstat(fd, &status) != 0 || static_cast<size_t>(status.st_size) < sizeof(InferenceChannel::Header))
+		{
+            close(fd);
+            return;
+        }
+
+        const auto memory = mmap(nullptr, sizeof(InferenceChannel::Header), PROT_READ, MAP_SHARED, fd, 0);
+        close(fd);
+        if (memory == MAP_FAILED)
+            throw system_error("cannot map shared memory", name);
+
+        const auto& header = *static_cast<const InferenceChannel::Header*>(memory);
+        const auto ready = header.magic.load(std::memory_order_acquire) == InferenceChannel::MAGIC;
+        const auto pid = header.server_pid;
+        munmap(memory, sizeof(InferenceChannel::Header));
+
+        // The pid is written before the magic, a server without it is still starting or already shutting down
+        if (InferenceChannel::process_alive(pid))
+            throw std::runtime_error(boost::str(boost::format("inference server %s is %s in process %d")
+                % name % (ready ? "already running" : "starting or stopping") % pid));
+    }
+}
+
+InferenceChannel::InferenceChannel(std::string name, void* memory, const size_t size, const bool owner) : m_name(std::move(name)), m_memory(memory), m_size(size), m_owner(owner)
+{
+    m_header = static_cast<Header*>(memory);
+    m_slots = reinterpret_cast<Slot*>(static_cast<char*>(memory) + sizeof(Header));
+}
+
+InferenceChannel::~InferenceChannel()
+{
+    if (m_owner)
+	{
+        // Clients still attached keep their mapping, new ones will not find a dead server
+        m_header->magic.store(0);
+
+        try
+		{
+            const NameLock lock(m_name);
+
+            // A server that found this one dead may have replaced the segment already, its own must stay
+            const auto fd = shm_open(m_name.c_str(), O_RDONLY, 0);
+            if (fd >= 0)
+			{
+                struct stat status;
+                const auto ours = fstat(fd, &status) == 0 && status.st_dev == m_device && status.st_ino == m_inode;
+                close(fd);
+
+                if (ours)
+                    shm_unlink(m_name.c_str());
+            }
+        }
+    	catch (const std::runtime_error&)
+		{
+            // Without the lock the segment is left behind, the next server replaces it as a stale one
+        }
+    }
+
+    munmap(m_memory, m_size);
+}
+
+size_t InferenceChannel::segment_size(const int slots)
+{
+    return sizeof(Header) + slots * sizeof(Slot);
+}
+
+std::unique_ptr<InferenceChannel> InferenceChannel::create(const std::string& name, const int slots, const int channels, const std::uint64_t fingerprint)
+{
+    // Two servers starting together would otherwise both find no running server and unlink each other's segment
+    const NameLock lock(name);
+
+    check_no_running_server(name);
+    shm_unlink(name.c_str());
+
+    const auto fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+    if (fd < 0)
+        throw system_error("cannot create shared memory", name);
+
+    struct stat status;
+    const auto size = segment_size(slots);
+    if (fstat(fd, &status) != 0 || ftruncate(fd, static_cast<off_t>(size)) != 0)
+	{
+        close(fd);
+        shm_unlink(name.c_str());
+        throw system_error("cannot size shared memory", name);
+    }
+
+    const auto memory = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (memory == MAP_FAILED)
+	{
+        shm_unlink(name.c_str());
+        throw system_error("cannot map shared memory", name);
+    }
+
+    // The fresh segment is zero filled, which is FREE and unclaimed for every slot
+    const auto header = new (memory) Header{};
+    header->version = VERSION;
+    header->board_size = BOARD_SIZE;
+    header->slots = static_cast<std::uint32_t>(slots);
+    header->channels = static_cast<std::uint32_t>(channels);
+    header->fingerprint = fingerprint;
+    header->server_pid = getpid();
+    header->magic.store(MAGIC, std::memory_order_release);
+
+    auto channel = std::unique_ptr<InferenceChannel>(new InferenceChannel(name, memory, size, true));
+    channel->m_device = status.st_dev;
+    channel->m_inode = status.st_ino;
+
+    return channel;
+}
+
+std::unique_ptr<InferenceChannel> InferenceChannel::open(const std::string& name)
+{
+    const auto fd = shm_open(name.c_str(), O_RDWR, 0);
+    if (fd < 0)
+        throw system_error("cannot open inference server", name);
+
+    struct stat status;
+    if (fstat(fd, &status) != 0 || static_cast<size_t>(status.st_size) < sizeof(Header))
+	{
+        close(fd);
+        throw std::runtime_error("inference server " + name + " is not ready");
+    }
+
+    const auto size = static_cast<size_t>(status.st_size);
+    const auto memory = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (memory == MAP_FAILED)
+        throw system_error("cannot map inference server", name);
+
+    auto channel = std::unique_ptr<InferenceChannel>(new InferenceChannel(name, memory, size, false));
+    const auto& header = channel->header();
+
+    if (header.magic.load(std::memory_order_acquire) != MAGIC)
+        throw std::runtime_error("inference server " + name + " is not ready");
+    if (header.version != VERSION || header.board_size != BOARD_SIZE || size < segment_size(static_cast<int>(header.slots)))
+        throw std::runtime_error("inference server " + name + " was built for another board size or version");
+
+    return channel;
+}
+
+bool InferenceChannel::server_alive() const
+{
+    return m_header->magic.load(std::memory_order_acquire) == MAGIC && process_alive(m_header->server_pid);
+}
+
+void InferenceChannel::wait(std::atomic<std::uint32_t>& word, const std::uint32_t expected, const int timeout_ms)
+{
+    auto timeout = timespec{};
+    timeout.tv_sec = timeout_ms / 1000;
+    timeout.tv_nsec = (timeout_ms % 1000) * 1000000L;
+
+    // Not FUTEX_PRIVATE, the word is shared between processes
+    syscall(SYS_futex, reinterpret_cast<std::uint32_t*>(&word), FUTEX_WAIT, expected, &timeout, nullptr, 0);
+}
+
+void InferenceChannel::wake(std::atomic<std::uint32_t>& word, const int count)
+{
+    syscall(SYS_futex, reinterpret_cast<std::uint32_t*>(&word), FUTEX_WAKE, count, nullptr, nullptr, 0);
+}
+
+bool InferenceChannel::process_alive(const std::int32_t pid)
+{
+    return pid > 0 && (kill(pid, 0) == 0 || errno != ESRCH);
+}
+
+#endif
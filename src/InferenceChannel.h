@@ -0,0 +1,152 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2017-2019 Michael O and contributors
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+
+    Additional permission under GNU GPL version 3 section 7
+
+    If you modify this Program, or any covered work, by linking or
+    combining it with NVIDIA Corporation's libraries from the
+    NVIDIA CUDA Toolkit and/or the NVIDIA CUDA Deep Neural
+    Network library and/or the NVIDIA TensorRT inference library
+    (or a modified version of those libraries), containing parts covered
+    by the terms of the respective license agreement, the licensors of
+    this Program grant you additional permission to convey the resulting
+    work.
+*/
+
+#ifndef INFERENCECHANNEL_H_INCLUDED
+#define INFERENCECHANNEL_H_INCLUDED
+
+#include "config.h"
+
+#ifdef USE_INFERENCE_SERVER
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <sys/types.h>
+
+#include "Network.h"
+
+/// Shared memory segment between a leelaz-infer server and the engines it evaluates for: a header followed by request
+/// slots, each holding the input planes of one evaluation and the outputs of the tower. Waiting is done on futexes inside
+/// the segment, so a request costs no syscall when the other side is already awake.
+class InferenceChannel
+{
+public:
+
+	/// Identifies a ready segment, the server writes it last
+	static constexpr std::uint32_t MAGIC = 0x4c5a4946;
+	/// Bumped on every change of the layout below
+	static constexpr std::uint32_t VERSION = 2;
+
+	static constexpr auto INPUT_SIZE = Network::INPUT_CHANNELS * NUM_INTERSECTIONS;
+	static constexpr auto POLICY_SIZE = Network::OUTPUTS_POLICY * NUM_INTERSECTIONS;
+	static constexpr auto VALUE_SIZE = Network::OUTPUTS_VALUE * NUM_INTERSECTIONS;
+
+	/// Life of a slot, the client owns it while WRITING and DONE, the server while RUNNING. A client claims the owner of
+	/// a free slot before leaving FREE and clears it last, so that every slot out of FREE has a known owner
+	enum SlotState : std::uint32_t
+	{
+		FREE, WRITING, QUEUED, RUNNING, DONE
+	};
+
+	struct Header
+	{
+		std::atomic<std::uint32_t> magic;
+		std::uint32_t version;
+		std::uint32_t board_size;
+		std::uint32_t slots;
+		/// Network of the server, a client must have loaded the same one since it evaluates the heads itself
+		std::uint32_t channels;
+		std::uint64_t fingerprint;
+		std::int32_t server_pid;
+		/// Bumped on every queued request, the idle server threads wait on it
+		alignas(64) std::atomic<std::uint32_t> queued;
+		/// Bumped on every released slot, clients finding no free slot wait on it
+		alignas(64) std::atomic<std::uint32_t> released;
+	};
+
+	struct alignas(64) Slot
+	{
+		/// The client waits on it for its result
+		std::atomic<std::uint32_t> state;
+		/// Process that claimed the slot, 0 when unclaimed, to recover the slot if that process dies
+		std::atomic<std::int32_t> owner;
+		float input[INPUT_SIZE];
+		float policy[POLICY_SIZE];
+		float value[VALUE_SIZE];
+	};
+
+	static_assert(sizeof(std::atomic<std::uint32_t>) == sizeof(std::uint32_t) && ATOMIC_INT_LOCK_FREE == 2, "futexes need plain 32 bit atomics");
+	static_assert(sizeof(std::atomic<std::int32_t>) == sizeof(std::int32_t), "slot owners are shared between processes");
+
+	/// Create the segment for a server, replacing a stale one left by a crashed server of the same name. Throws if a
+	/// server of that name is still running, its clients would otherwise lose it
+	static std::unique_ptr<InferenceChannel> create(const std::string& name, int slots, int channels, std::uint64_t fingerprint);
+	/// Attach to the segment of a running server, throws if there is none
+	static std::unique_ptr<InferenceChannel> open(const std::string& name);
+
+	~InferenceChannel();
+
+	InferenceChannel(const InferenceChannel&) = delete;
+	InferenceChannel& operator=(const InferenceChannel&) = delete;
+
+	Header& header() const
+	{
+		return *m_header;
+	}
+	
+	Slot& slot(const int index) const
+	{
+		return m_slots[index];
+	}
+
+	int slot_count() const
+	{
+		return static_cast<int>(m_header->slots);
+	}
+
+	/// Whether the process that created the segment is still running
+	bool server_alive() const;
+
+	/// Sleep while the word holds the expected value, for at most timeout_ms, wakeups can be spurious
+	static void wait(std::atomic<std::uint32_t>& word, std::uint32_t expected, int timeout_ms);
+	/// Wake up to count threads sleeping on the word, in any process
+	static void wake(std::atomic<std::uint32_t>& word, int count);
+	/// Whether the process exists, for the owner of a slot or the server
+	static bool process_alive(std::int32_t pid);
+
+private:
+
+	InferenceChannel(std::string name, void* memory, size_t size, bool owner);
+
+	static size_t segment_size(int slots);
+
+	std::string m_name;
+	void* m_memory;
+	size_t m_size;
+	/// The server unlinks the segment when it goes away, if the name still refers to the one it created
+	bool m_owner;
+	dev_t m_device{0};
+	ino_t m_inode{0};
+	Header* m_header;
+	Slot* m_slots;
+};
+
+#endif
+#endif
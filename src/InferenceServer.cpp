@@ -0,0 +1,151 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2017-2019 Michael O and contributors
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+
+    Additional permission under GNU GPL version 3 section 7
+
+    If you modify this Program, or any covered work, by linking or
+    combining it with NVIDIA Corporation's libraries from the
+    NVIDIA CUDA Toolkit and/or the NVIDIA CUDA Deep Neural
+    Network library and/or the NVIDIA TensorRT inference library
+    (or a modified version of those libraries), containing parts covered
+    by the terms of the respective license agreement, the licensors of
+    this Program grant you additional permission to convey the resulting
+    work.
+*/
+
+#include "config.h"
+
+#ifdef USE_INFERENCE_SERVER
+#include "InferenceServer.h"
+
+#include <algorithm>
+#include <climits>
+#include <utility>
+
+#include "Utils.h"
+
+/// Idle workers wake up this often to look for abandoned slots and to notice stop()
+static constexpr auto IDLE_TIMEOUT_MS = 100;
+
+InferenceServer::InferenceServer(const std::string& name, const int slots, const int channels, const std::uint64_t fingerprint, forward_function forward, const int threads)
+	: m_channel(InferenceChannel::create(name, slots, channels, fingerprint)), m_forward(std::move(forward))
+{
+    for (auto i = 0; i < threads; i++)
+        m_workers.emplace_back(&InferenceServer::worker, this, i);
+}
+
+InferenceServer::~InferenceServer()
+{
+    stop();
+}
+
+void InferenceServer::stop()
+{
+    m_stop = true;
+    InferenceChannel::wake(m_channel->header().queued, INT_MAX);
+
+    for (auto& worker : m_workers)
+        if (worker.joinable())
+            worker.join();
+}
+
+int InferenceServer::take_request()
+{
+    const auto slots = m_channel->slot_count();
+    const auto start = static_cast<int>(m_next_slot.load(std::memory_order_relaxed) % slots);
+
+    for (auto i = 0; i < slots; i++)
+	{
+        const auto index = (start + i) % slots;
+        auto expected = static_cast<std::uint32_t>(InferenceChannel::QUEUED);
+
+        if (m_channel->slot(index).state.compare_exchange_strong(expected, InferenceChannel::RUNNING, std::memory_order_acquire))
+		{
+            m_next_slot.store(static_cast<std::uint32_t>(index + 1), std::memory_order_relaxed);
+            return index;
+        }
+    }
+
+    return -1;
+}
+
+void InferenceServer::recover_abandoned_slots()
+{
+    auto released = false;
+
+    for (auto index = 0; index < m_channel->slot_count(); index++)
+	{
+        auto& slot = m_channel->slot(index);
+        auto owner = slot.owner.load(std::memory_order_acquire);
+        auto state = slot.state.load(std::memory_order_acquire);
+
+        // A running slot belongs to a worker and comes back as DONE, every other claimed slot is left to its owner alone
+        if (owner == 0 || state == InferenceChannel::RUNNING || InferenceChannel::process_alive(owner))
+            continue;
+
+        // Nobody else touches the slot of a dead owner, but a worker may have taken it since it was QUEUED
+        if (slot.state.compare_exchange_strong(state, InferenceChannel::FREE) && slot.owner.compare_exchange_strong(owner, 0))
+		{
+            Utils::myprintf("Recovered slot %d of exited process %d.\n", index, owner);
+            released = true;
+        }
+    }
+
+    if (released)
+	{
+        m_channel->header().released.fetch_add(1);
+        InferenceChannel::wake(m_channel->header().released, INT_MAX);
+    }
+}
+
+void InferenceServer::worker(const int index)
+{
+    auto& header = m_channel->header();
+    auto input = std::vector<float>(InferenceChannel::INPUT_SIZE);
+    auto policy = std::vector<float>(InferenceChannel::POLICY_SIZE);
+    auto value = std::vector<float>(InferenceChannel::VALUE_SIZE);
+
+    while (!m_stop)
+	{
+        // Read the counter before scanning, a request queued after the scan changes it and the wait returns at once
+        const auto queued = header.queued.load(std::memory_order_acquire);
+        const auto request = take_request();
+
+        if (request < 0)
+		{
+            InferenceChannel::wait(header.queued, queued, IDLE_TIMEOUT_MS);
+            
+            if (index == 0 && header.queued.load() == queued)
+                recover_abandoned_slots();
+            
+            continue;
+        }
+
+        auto& slot = m_channel->slot(request);
+        std::copy(slot.input, slot.input + InferenceChannel::INPUT_SIZE, input.begin());
+
+        m_forward(input, policy, value);
+
+        std::copy(policy.begin(), policy.end(), slot.policy);
+        std::copy(value.begin(), value.end(), slot.value);
+        ++m_evaluations;
+        slot.state.store(InferenceChannel::DONE, std::memory_order_release);
+        InferenceChannel::wake(slot.state, INT_MAX);
+    }
+}
+
+#endif
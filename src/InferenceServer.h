@@ -0,0 +1,86 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2017-2019 Michael O and contributors
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+
+    Additional permission under GNU GPL version 3 section 7
+
+    If you modify this Program, or any covered work, by linking or
+    combining it with NVIDIA Corporation's libraries from the
+    NVIDIA CUDA Toolkit and/or the NVIDIA CUDA Deep Neural
+    Network library and/or the NVIDIA TensorRT inference library
+    (or a modified version of those libraries), containing parts covered
+    by the terms of the respective license agreement, the licensors of
+    this Program grant you additional permission to convey the resulting
+    work.
+*/
+
+#ifndef INFERENCESERVER_H_INCLUDED
+#define INFERENCESERVER_H_INCLUDED
+
+#include "config.h"
+
+#ifdef USE_INFERENCE_SERVER
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "InferenceChannel.h"
+
+/// Evaluates the requests of every engine attached to a shared memory channel. Each worker thread takes one request at a
+/// time and runs it through the forward function, concurrent calls are what fills the batches of an OpenCL pipe.
+class InferenceServer
+{
+public:
+
+	/// Tower and head convolutions of raw input planes, the contract of ForwardPipe::forward
+	using forward_function = std::function<void(const std::vector<float>&, std::vector<float>&, std::vector<float>&)>;
+
+	InferenceServer(const std::string& name, int slots, int channels, std::uint64_t fingerprint, forward_function forward, int threads);
+	~InferenceServer();
+
+	/// Let the workers finish their current request and return, the channel goes away with the server
+	void stop();
+	/// Requests evaluated since the start
+	std::uint64_t get_evaluations() const
+	{
+		return m_evaluations.load();
+	}
+
+private:
+
+	void worker(int index);
+	/// Claim the next queued slot, -1 if there is none
+	int take_request();
+	/// Free the slots of clients that died without releasing them
+	void recover_abandoned_slots();
+
+	std::unique_ptr<InferenceChannel> m_channel;
+	forward_function m_forward;
+	std::atomic<bool> m_stop{false};
+	/// Where the next scan for queued slots starts, so that no slot waits behind the others
+	std::atomic<std::uint32_t> m_next_slot{0};
+	std::atomic<std::uint64_t> m_evaluations{0};
+
+	/// Last member, so that everything they use exists before they start
+	std::vector<std::thread> m_workers;
+};
+
+#endif
+#endif
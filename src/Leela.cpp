@@ -41,12 +41,16 @@
 #include <string>
 #include <vector>
 
+#include "BenchSuite.h"
 #include "GTP.h"
 #include "GameState.h"
+#include "Match.h"
 #include "Network.h"
 #include "SMP.h"
 #include "Random.h"
+#include "Replay.h"
 #include "ThreadPool.h"
+#include "Trace.h"
 #include "Utils.h"
 #include "Zobrist.h"
 
@@ -63,6 +67,13 @@ static void license_blurb()
         PROGRAM_VERSION);
 }
 
+static void write_trace()
+{
+    Trace::stop();
+    if (!Trace::write(cfg_trace_file))
+        myprintf_error("Cannot write the trace to %s.\n", cfg_trace_file.c_str());
+}
+
 static void calculate_thread_count_cpu(boost::program_options::variables_map & vm)
 {
     // If we are CPU-based, there is no point using more than the number of CPUs
@@ -153,6 +164,12 @@ static void parse_commandline(int argc, char *argv[])
         ("gtp,g", "Enable GTP mode.")
         ("threads,t", po::value<unsigned int>()->default_value(0),
                       "Number of threads to use. Select 0 to let leela-zero pick a reasonable default.")
+        ("pin-threads", po::value<std::string>()->default_value("none"),
+                        "[none|cores|nodes] Pin search and evaluation threads to a core each, or spread them over the NUMA nodes. "
+                        "Pinned evaluation threads on several nodes get a copy of the weights on their own node.")
+        ("huge-pages", po::value<std::string>()->default_value("off"),
+                       "[off|transparent|explicit] Back the search tree and the cache with huge pages, "
+                       "transparent ones or the reserved pool of the system. Their memory is kept for reuse until exit.")
         ("playouts,p", po::value<int>(),
                        "Weaken engine by limiting the number of playouts. "
                        "Requires --noponder.")
@@ -165,6 +182,10 @@ static void parse_commandline(int argc, char *argv[])
                         "-1 uses 10 but scales for handicap.")
         ("weights,w", po::value<std::string>()->default_value(cfg_weights_file), "File with network weights.")
         ("logfile,l", po::value<std::string>(), "File to log input/output to.")
+        ("trace", po::value<std::string>(), "Record a timeline of the search and the evaluations, written at exit to this file as Chrome trace JSON.")
+        ("capture", po::value<std::string>(), "Record the GTP session with timestamps to this file, for --replay.")
+        ("replay", po::value<std::string>(), "Feed a session recorded with --capture to the engine, print the latency of every command and exit.")
+        ("replay-speed", po::value<std::string>()->default_value("original"), "[original|max] Send the commands of --replay at their recorded times, or without the idle time between them.")
         ("quiet,q", "Disable all diagnostic output.")
         ("timemanage", po::value<std::string>()->default_value("auto"),
                        "[auto|on|off|fast|no_pruning] Enable time management features.\n"
@@ -176,8 +197,17 @@ static void parse_commandline(int argc, char *argv[])
         ("noponder", "Disable thinking on opponent's time.")
         ("benchmark", "Test network and exit. Default args:\n-v3200 --noponder "
                       "-m0 -t1 -s1.")
+        ("bench-suite", po::value<std::string>()->implicit_value(BenchSuite::DEFAULT_FILE), "Search every position of this suite file, print a JSON report of the search speed and exit. "
+                        "Without a file, the suite of the repository. Same default args as --benchmark.")
+        ("bench-repeats", po::value<int>()->default_value(cfg_bench_repeats), "Searches of every position of --bench-suite, for the latency percentiles.")
+        ("match", po::value<std::string>(), "Play a match of --weights against the network in this file and exit.")
+        ("match-games", po::value<int>()->default_value(cfg_match_games), "Maximum number of games of the match, it stops earlier when the SPRT is decided.")
+        ("match-parallel", po::value<int>()->default_value(cfg_match_parallel), "Games of the match played at once, their searches share the thread pool and fill the same batches.")
 #ifndef USE_CPU_ONLY
         ("cpu-only", "Use CPU-only implementation and do not use OpenCL device(s).")
+#endif
+#ifdef USE_INFERENCE_SERVER
+        ("infer-server", po::value<std::string>()->implicit_value(INFERENCE_SERVER_NAME), "Forward the network evaluations to the leelaz-infer server with this name, it must run the same weights.")
 #endif
         ;
 #ifdef USE_OPENCL
@@ -186,7 +216,10 @@ static void parse_commandline(int argc, char *argv[])
         ("gpu",  po::value<std::vector<int> >(), "ID of the OpenCL device(s) to use (disables autodetection).")
         ("full-tuner", "Try harder to find an optimal OpenCL tuning.")
         ("tune-only", "Tune OpenCL only and then exit.")
+        ("tune-batchsize", po::value<std::vector<unsigned int> >(), "With --tune-only, also tune for this batch size. Can be repeated.")
         ("batchsize", po::value<unsigned int>()->default_value(0), "Max batch size.  Select 0 to let leela-zero pick a reasonable default.")
+        ("batch-latency", po::value<float>()->default_value(cfg_batch_latency_target.load()), "p99 latency in milliseconds of an evaluation, batches are formed as large as this allows.")
+        ("cpu-assist", po::value<unsigned int>()->default_value(0), "Also evaluate on this many CPU threads, they take the evaluations the saturated OpenCL devices cannot.")
 #ifdef USE_HALF
         ("precision", po::value<std::string>(), "Floating-point precision (single/half/auto).\n" "Default is to auto which automatically determines which one to use.")
 #endif
@@ -218,7 +251,8 @@ static void parse_commandline(int argc, char *argv[])
     po::options_description ignore("Ignored options");
 #ifndef USE_OPENCL
     ignore.add_options()
-        ("batchsize", po::value<unsigned int>()->default_value(1), "Max batch size.");
+        ("batchsize", po::value<unsigned int>()->default_value(1), "Max batch size.")
+        ("batch-latency", po::value<float>(), "p99 latency in milliseconds of an evaluation.");
 #endif
     po::options_description h_desc("Hidden options");
     h_desc.add_options()
@@ -276,7 +310,7 @@ static void parse_commandline(int argc, char *argv[])
         cfg_quiet = true;
 
 	// Set this early to avoid unnecessary output
-    if (vm.count("benchmark"))
+    if (vm.count("benchmark") || vm.count("bench-suite"))
         cfg_quiet = true;  
 
 #ifdef USE_TUNER
@@ -307,6 +341,57 @@ static void parse_commandline(int argc, char *argv[])
         cfg_logfile_handle = fopen(cfg_logfile.c_str(), "a");
     }
 
+    if (vm.count("trace")) 
+	{
+        cfg_trace_file = vm["trace"].as<std::string>();
+        Trace::start();
+        std::atexit(write_trace);
+    }
+
+    if (vm.count("capture")) 
+	{
+        const auto capture_file = vm["capture"].as<std::string>();
+        if (!start_capture(capture_file)) 
+		{
+            printf("Cannot write the session capture to %s.\n", capture_file.c_str());
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    if (vm.count("replay")) 
+	{
+        cfg_replay_file = vm["replay"].as<std::string>();
+        const auto speed = vm["replay-speed"].as<std::string>();
+        if (speed != "original" && speed != "max") 
+		{
+            printf("Invalid replay speed %s, expected original or max.\n", speed.c_str());
+            exit(EXIT_FAILURE);
+        }
+        cfg_replay_max_speed = speed == "max";
+    }
+
+    const auto placement = vm["pin-threads"].as<std::string>();
+    if (placement == "cores")
+        SMP::set_placement(SMP::Placement::CORES);
+    else if (placement == "nodes")
+        SMP::set_placement(SMP::Placement::NODES);
+    else if (placement != "none") 
+	{
+        printf("Invalid thread placement %s, expected none, cores or nodes.\n", placement.c_str());
+        exit(EXIT_FAILURE);
+    }
+
+    const auto huge_pages = vm["huge-pages"].as<std::string>();
+    if (huge_pages == "transparent")
+        SMP::set_huge_pages(SMP::HugePages::TRANSPARENT);
+    else if (huge_pages == "explicit")
+        SMP::set_huge_pages(SMP::HugePages::EXPLICIT);
+    else if (huge_pages != "off") 
+	{
+        printf("Invalid huge page mode %s, expected off, transparent or explicit.\n", huge_pages.c_str());
+        exit(EXIT_FAILURE);
+    }
+
     cfg_weights_file = vm["weights"].as<std::string>();
     if (vm["weights"].defaulted() && !boost::filesystem::exists(cfg_weights_file)) 
 	{
@@ -323,6 +408,10 @@ static void parse_commandline(int argc, char *argv[])
         cfg_gpus = vm["gpu"].as<std::vector<int> >();
     }
 
+    if (vm.count("tune-batchsize")) {
+        cfg_tune_batch_sizes = vm["tune-batchsize"].as<std::vector<unsigned int> >();
+    }
+
     if (vm.count("full-tuner")) {
         cfg_sgemm_exhaustive = true;
 
@@ -375,6 +464,10 @@ static void parse_commandline(int argc, char *argv[])
 #else
     cfg_cpu_only = true;
 #endif
+#ifdef USE_INFERENCE_SERVER
+    if (vm.count("infer-server"))
+        cfg_infer_server = vm["infer-server"].as<std::string>();
+#endif
 
     if (cfg_cpu_only)
 	{
@@ -385,6 +478,14 @@ static void parse_commandline(int argc, char *argv[])
 #ifdef USE_OPENCL
         calculate_thread_count_gpu(vm);
         myprintf("Using OpenCL batch size of %d\n", cfg_batch_size);
+
+        // The CPU threads only get work when the devices have a full load, the search needs threads for both
+        cfg_cpu_assist = vm["cpu-assist"].as<unsigned int>();
+        if (vm["threads"].as<unsigned int>() == 0)
+            cfg_num_threads = std::min(cfg_num_threads + cfg_cpu_assist, static_cast<unsigned int>(MAX_CPUS));
+
+        if (vm["batch-latency"].as<float>() > 0.0f)
+            cfg_batch_latency_target = vm["batch-latency"].as<float>();
 #endif
     }
     myprintf("Using %d thread(s).\n", cfg_num_threads);
@@ -487,11 +588,11 @@ static void parse_commandline(int argc, char *argv[])
             cfg_lag_buffer_cs = lagbuffer;
         }
     }
-    if (vm.count("benchmark")) 
+    if (vm.count("benchmark") || vm.count("bench-suite")) 
 	{
         // These must be set later to override default arguments.
         cfg_allow_pondering = false;
-        cfg_benchmark = true;
+        cfg_benchmark = vm.count("benchmark") > 0;
 		// Not much of a benchmark if random was used.
         cfg_noise = false;  
         cfg_random_cnt = 0;
@@ -504,6 +605,24 @@ static void parse_commandline(int argc, char *argv[])
             cfg_max_visits = 3200; 
     }
 
+    if (vm.count("bench-suite")) 
+	{
+        cfg_bench_suite_file = vm["bench-suite"].as<std::string>();
+        cfg_bench_repeats = std::max(1, vm["bench-repeats"].as<int>());
+    }
+
+    if (vm.count("match")) 
+	{
+        cfg_match_weights_file = vm["match"].as<std::string>();
+        cfg_match_games = vm["match-games"].as<int>();
+        cfg_match_parallel = std::max(1, vm["match-parallel"].as<int>());
+        cfg_allow_pondering = false;
+
+		// Same visits as the validation matches unless given
+        if (!vm.count("playouts") && !vm.count("visits"))
+            cfg_max_visits = 3200; 
+    }
+
     // Do not lower the expected eval for root moves that are likely not
     // the best if we have introduced noise there exactly to explore more
     cfg_fpu_root_reduction = cfg_noise ? 0.0f : cfg_fpu_reduction;
@@ -530,7 +649,8 @@ static void initialize_network()
 // Setup global objects after command line has been parsed
 void init_global_objects()
 {
-    thread_pool.initialize(cfg_num_threads);
+    for (size_t i = 0; i < cfg_num_threads; i++)
+        thread_pool.add_thread([i] { SMP::pin_current_thread(i); });
 
     // Use deterministic random numbers for hashing
     const auto rng = std::make_unique<Random>(5489);
@@ -559,6 +679,50 @@ void benchmark(GameState& game)
     search->think(FastBoard::WHITE);
 }
 
+int replay(GameState& game)
+{
+    try 
+	{
+        const Replay replay(cfg_replay_file);
+        const auto report = replay.run(game, cfg_replay_max_speed);
+        myprintf_error("%s", report.c_str());
+    }
+	catch (const std::exception& exception) 
+	{
+        printf("Cannot replay the session: %s\n", exception.what());
+        return EXIT_FAILURE;
+    }
+    return 0;
+}
+
+int bench_suite()
+{
+    try 
+	{
+        const BenchSuite suite(cfg_bench_suite_file);
+        std::cout << suite.run(*GTP::s_network, cfg_bench_repeats);
+    }
+	catch (const std::exception& exception) 
+	{
+        printf("Cannot run the benchmark suite: %s\n", exception.what());
+        return EXIT_FAILURE;
+    }
+    return 0;
+}
+
+void match()
+{
+	// The opponent shares the thread pool and keeps its own cache
+    auto opponent = std::make_unique<Network>();
+    const auto playouts = std::min(cfg_max_playouts, cfg_max_visits);
+    opponent->initialize(playouts, cfg_match_weights_file);
+
+    Match match;
+    const auto first = match.add_network(cfg_weights_file, *GTP::s_network);
+    const auto second = match.add_network(cfg_match_weights_file, *opponent);
+    match.play(first, second, cfg_match_games, cfg_match_parallel);
+}
+
 int main(int argc, char *argv[])
 {
     // Set up engine parameters
@@ -576,7 +740,7 @@ int main(int argc, char *argv[])
     setbuf(stdin, nullptr);
 #endif
 
-    if (!cfg_gtp_mode && !cfg_benchmark)
+    if (!cfg_gtp_mode && !cfg_benchmark && cfg_bench_suite_file.empty() && cfg_replay_file.empty())
         license_blurb();
 
     init_global_objects();
@@ -593,6 +757,18 @@ int main(int argc, char *argv[])
         return 0;
     }
 
+    if (!cfg_bench_suite_file.empty())
+        return bench_suite();
+
+    if (!cfg_replay_file.empty())
+        return replay(*main_game);
+
+    if (!cfg_match_weights_file.empty()) 
+	{
+        match();
+        return 0;
+    }
+
     for (;;) 
 	{
         if (!cfg_gtp_mode) 
@@ -0,0 +1,221 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2017-2019 Michael O and contributors
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+
+    Additional permission under GNU GPL version 3 section 7
+
+    If you modify this Program, or any covered work, by linking or
+    combining it with NVIDIA Corporation's libraries from the
+    NVIDIA CUDA Toolkit and/or the NVIDIA CUDA Deep Neural
+    Network library and/or the NVIDIA TensorRT inference library
+    (or a modified version of those libraries), containing parts covered
+    by the terms of the respective license agreement, the licensors of
+    this Program grant you additional permission to convey the resulting
+    work.
+*/
+
+#include "config.h"
+
+#include <algorithm>
+#include <boost/filesystem.hpp>
+#include <boost/program_options.hpp>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#ifdef USE_INFERENCE_SERVER
+#include <signal.h>
+#endif
+
+#include "GTP.h"
+#include "InferenceServer.h"
+#include "Network.h"
+#include "SMP.h"
+#include "Utils.h"
+
+using namespace Utils;
+
+/*
+    leelaz-infer owns the network of every leelaz started with --infer-server on the same host. The engines keep their
+    search and heads, the towers of all of them run here and fill the batches of one OpenCL context.
+*/
+
+#ifdef USE_INFERENCE_SERVER
+struct ServerOptions
+{
+    std::string name{INFERENCE_SERVER_NAME};
+    int slots{INFERENCE_SERVER_SLOTS};
+};
+
+static ServerOptions parse_commandline(int argc, char *argv[])
+{
+    namespace po = boost::program_options;
+
+    po::options_description desc("leelaz-infer options");
+    desc.add_options()
+        ("help,h", "Show commandline options.")
+        ("weights,w", po::value<std::string>()->default_value(cfg_weights_file), "File with network weights.")
+        ("name", po::value<std::string>()->default_value(INFERENCE_SERVER_NAME), "Shared memory name the engines connect to with --infer-server.")
+        ("slots", po::value<int>()->default_value(INFERENCE_SERVER_SLOTS), "Evaluations in flight at once over all the engines.")
+        ("threads,t", po::value<unsigned int>()->default_value(0), "Evaluations run at once. Select 0 for the number of CPUs, or twice the batch size per GPU.")
+        ("logfile,l", po::value<std::string>(), "File to log to.")
+        ("quiet,q", "Disable all diagnostic output.")
+#ifndef USE_CPU_ONLY
+        ("cpu-only", "Use CPU-only implementation and do not use OpenCL device(s).")
+#endif
+#ifdef USE_OPENCL
+        ("gpu", po::value<std::vector<int>>(), "ID of the OpenCL device(s) to use (disables autodetection).")
+        ("batchsize", po::value<unsigned int>()->default_value(5), "Max batch size.")
+#ifdef USE_HALF
+        ("precision", po::value<std::string>(), "Floating-point precision (single/half/auto).")
+#endif
+#endif
+        ;
+
+    po::variables_map vm;
+    try
+	{
+        po::store(po::parse_command_line(argc, argv, desc), vm);
+        po::notify(vm);
+    }
+	catch (const boost::program_options::error& e)
+	{
+        printf("ERROR: %s\n", e.what());
+        std::cout << desc << std::endl;
+        exit(EXIT_FAILURE);
+    }
+
+    if (vm.count("help"))
+	{
+        std::cout << desc << std::endl;
+        exit(EXIT_SUCCESS);
+    }
+
+    if (vm.count("quiet"))
+        cfg_quiet = true;
+
+    if (vm.count("logfile"))
+	{
+        cfg_logfile = vm["logfile"].as<std::string>();
+        cfg_logfile_handle = fopen(cfg_logfile.c_str(), "a");
+    }
+
+    cfg_weights_file = vm["weights"].as<std::string>();
+    if (vm["weights"].defaulted() && !boost::filesystem::exists(cfg_weights_file))
+	{
+        printf("A network weights file is required to use the program.\n");
+        printf("By default, leelaz-infer looks for it in %s.\n", cfg_weights_file.c_str());
+        exit(EXIT_FAILURE);
+    }
+
+    auto options = ServerOptions{};
+    options.name = vm["name"].as<std::string>();
+    options.slots = std::max(1, vm["slots"].as<int>());
+
+#ifdef USE_OPENCL
+    if (vm.count("cpu-only"))
+        cfg_cpu_only = true;
+
+    if (vm.count("gpu"))
+        cfg_gpus = vm["gpu"].as<std::vector<int>>();
+
+    cfg_batch_size = std::max(1u, vm["batchsize"].as<unsigned int>());
+#ifdef USE_HALF
+    if (vm.count("precision"))
+	{
+        const auto precision = vm["precision"].as<std::string>();
+        if (precision == "single")
+            cfg_precision = precision_t::SINGLE;
+        else if (precision == "half")
+            cfg_precision = precision_t::HALF;
+        else if (precision != "auto")
+		{
+            printf("Unexpected option for --precision, expecting single/half/auto\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+#endif
+#endif
+
+    // Enough evaluations at once to keep every batch full while the previous one is read back
+    cfg_num_threads = vm["threads"].as<unsigned int>();
+    if (cfg_num_threads == 0)
+	{
+        if (cfg_cpu_only)
+            cfg_num_threads = static_cast<unsigned>(std::min(SMP::get_num_cpus(), size_t{MAX_CPUS}));
+#ifdef USE_OPENCL
+        else
+            cfg_num_threads = static_cast<unsigned>(cfg_batch_size * std::max(size_t{1}, cfg_gpus.size()) * 2);
+#endif
+    }
+
+    return options;
+}
+
+int main(int argc, char *argv[])
+{
+    GTP::setup_default_parameters();
+    const auto options = parse_commandline(argc, argv);
+
+    setbuf(stdout, nullptr);
+    setbuf(stderr, nullptr);
+
+    // Only the main thread takes the termination signals, the workers are started after this
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+
+    auto network = std::make_unique<Network>();
+    network->initialize(0, cfg_weights_file);
+
+    auto server = std::unique_ptr<InferenceServer>{};
+    try
+	{
+        server = std::make_unique<InferenceServer>(options.name, options.slots, network->get_channels(), network->get_weights_fingerprint(),
+            [&network](const std::vector<float>& input, std::vector<float>& output_pol, std::vector<float>& output_val)
+			{
+                network->forward(input, output_pol, output_val);
+            }, static_cast<int>(cfg_num_threads));
+    }
+	catch (const std::runtime_error& error)
+	{
+        myprintf("%s\n", error.what());
+        return EXIT_FAILURE;
+    }
+
+    myprintf("Serving %s on %s with %d slot(s) and %d thread(s).\n", cfg_weights_file.c_str(), options.name.c_str(), options.slots, cfg_num_threads);
+
+    auto signal = 0;
+    sigwait(&signals, &signal);
+
+    server->stop();
+    myprintf("Stopped after %llu evaluations.\n", static_cast<unsigned long long>(server->get_evaluations()));
+
+    return EXIT_SUCCESS;
+}
+#else
+int main()
+{
+    printf("leelaz-infer needs POSIX shared memory and futexes, it is only available on Linux.\n");
+    return EXIT_FAILURE;
+}
+#endif
@@ -0,0 +1,238 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2017-2019 Michael O and contributors
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+
+    Additional permission under GNU GPL version 3 section 7
+
+    If you modify this Program, or any covered work, by linking or
+    combining it with NVIDIA Corporation's libraries from the
+    NVIDIA CUDA Toolkit and/or the NVIDIA CUDA Deep Neural
+    Network library and/or the NVIDIA TensorRT inference library
+    (or a modified version of those libraries), containing parts covered
+    by the terms of the respective license agreement, the licensors of
+    this Program grant you additional permission to convey the resulting
+    work.
+*/
+
+#include "config.h"
+
+#include <algorithm>
+#include <cmath>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "Match.h"
+#include "GameState.h"
+#include "Random.h"
+#include "UCTSearch.h"
+#include "Utils.h"
+
+using namespace Utils;
+
+constexpr double Match::SPRT_ELO0;
+constexpr double Match::SPRT_ELO1;
+constexpr double Match::SPRT_ALPHA;
+constexpr double Match::SPRT_BETA;
+constexpr int Match::OPENING_MOVES;
+
+size_t Match::add_network(const std::string& name, Network& network)
+{
+    m_players.push_back({name, &network});
+    return m_players.size() - 1;
+}
+
+void Match::play(const size_t first, const size_t second, const int games, const int parallel)
+{
+    auto& first_network = *m_players.at(first).network;
+    auto& second_network = *m_players.at(second).network;
+    // The same file can play itself, tell the players apart in the log
+    const auto first_name = m_players[first].name + (m_players[first].name == m_players[second].name ? " (1)" : "");
+    const auto second_name = m_players[second].name + (m_players[first].name == m_players[second].name ? " (2)" : "");
+
+    const auto lower_bound = std::log(SPRT_BETA / (1.0 - SPRT_ALPHA));
+    const auto upper_bound = std::log((1.0 - SPRT_BETA) / SPRT_ALPHA);
+
+    // Everything below is shared by the drivers and protected by the mutex
+    std::mutex mutex;
+    auto next_pair = 0;
+    auto played = 0;
+    auto wins = 0;
+    auto losses = 0;
+    auto draws = 0;
+    auto decided = false;
+
+    // Record a finished game, false once the SPRT is decided and no more games count
+    const auto record = [&](const int winner, const bool first_is_black)
+	{
+        std::lock_guard<std::mutex> lock(mutex);
+        if (decided)
+            return false;
+
+        if (winner == FastBoard::EMPTY)
+            ++draws;
+        else if ((winner == FastBoard::BLACK) == first_is_black)
+            ++wins;
+        else
+            ++losses;
+        ++played;
+
+        const auto llr = get_llr(wins, losses, draws);
+        myprintf("Game %d: %s %d - %d %s (%d draws), LLR %.2f [%.2f, %.2f]\n", played, first_name.c_str(), wins, losses, second_name.c_str(), draws, llr, lower_bound, upper_bound);
+
+        if (llr >= upper_bound)
+		{
+            myprintf("SPRT accepted: %s is stronger than %s.\n", first_name.c_str(), second_name.c_str());
+            decided = true;
+        }
+        else if (llr <= lower_bound)
+		{
+            myprintf("SPRT rejected: %s is not stronger than %s.\n", first_name.c_str(), second_name.c_str());
+            decided = true;
+        }
+
+        return !decided;
+    };
+
+    // Each driver plays whole pairs, the games still running when the SPRT is decided are not counted
+    const auto driver = [&]
+	{
+        for (;;)
+		{
+            auto pair = 0;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (decided || 2 * next_pair >= games)
+                    return;
+                pair = next_pair++;
+            }
+
+            const auto opening = random_opening(first_network);
+
+			// Alternate colors so that neither network keeps the first move advantage
+            for (auto game = 2 * pair; game < std::min(2 * pair + 2, games); ++game)
+			{
+                const auto first_is_black = game % 2 == 0;
+                const auto winner = first_is_black ? play_game(opening, first_network, second_network) : play_game(opening, second_network, first_network);
+
+                if (!record(winner, first_is_black))
+                    return;
+            }
+        }
+    };
+
+    auto drivers = std::vector<std::thread>{};
+    for (auto i = 0; i < std::max(1, parallel); ++i)
+        drivers.emplace_back(driver);
+    for (auto& thread : drivers)
+        thread.join();
+
+    if (!decided)
+        myprintf("SPRT undecided after %d games.\n", played);
+}
+
+GameState Match::random_opening(Network& network)
+{
+    GameState game;
+    game.init_game(BOARD_SIZE, KOMI);
+
+    for (auto move = 0; move < OPENING_MOVES; ++move)
+	{
+        const auto to_move = game.get_to_move();
+        const auto result = network.get_output(&game, Network::RANDOM_SYMMETRY);
+
+        auto candidates = std::vector<std::pair<float, int>>();
+        auto policy_sum = 0.0f;
+        for (auto i = 0; i < NUM_INTERSECTIONS; i++)
+		{
+            const auto vertex = game.board.get_vertex(i % BOARD_SIZE, i / BOARD_SIZE);
+            if (game.is_move_legal(to_move, vertex))
+			{
+                policy_sum += result.policy[i];
+                candidates.emplace_back(policy_sum, vertex);
+            }
+        }
+
+        if (candidates.empty())
+            break;
+
+        const auto pick = std::uniform_real_distribution<float>(0.0f, policy_sum)(Random::get_rng());
+        auto chosen = candidates.back().second;
+        for (const auto& candidate : candidates)
+		{
+            if (pick < candidate.first)
+			{
+                chosen = candidate.second;
+                break;
+            }
+        }
+        game.play_move(chosen);
+    }
+
+    return game;
+}
+
+int Match::play_game(const GameState& opening, Network& black, Network& white)
+{
+    auto game = opening;
+
+	// Infinite time, the searches are bounded by the visits and playouts limits
+    game.set_time_control(0, 1, 0, 0);
+
+	// Each side keeps its own tree and evaluates with its own network and cache
+    auto black_search = std::make_unique<UCTSearch>(game, black);
+    auto white_search = std::make_unique<UCTSearch>(game, white);
+
+	// Guard against games that never end
+    const auto max_moves = static_cast<size_t>(NUM_INTERSECTIONS * 3);
+
+    while (!game.has_resigned() && game.get_passes() < 2 && game.get_move_number() < max_moves) 
+	{
+        const auto color = game.get_to_move();
+        auto& search = color == FastBoard::BLACK ? black_search : white_search;
+
+        const auto move = search->think(color);
+        game.play_move(move);
+    }
+
+    if (game.has_resigned())
+        return game.get_who_resigned() == FastBoard::BLACK ? FastBoard::WHITE : FastBoard::BLACK;
+
+    const auto score = game.final_score();
+    if (score > 0.0f)
+        return FastBoard::BLACK;
+	
+    if (score < 0.0f)
+        return FastBoard::WHITE;
+	
+    return FastBoard::EMPTY;
+}
+
+double Match::get_llr(const int wins, const int losses, const int draws)
+{
+	// Bernoulli model where a draw counts as half a win and half a loss
+    const auto score_from_elo = [](const double elo) { return 1.0 / (1.0 + std::pow(10.0, -elo / 400.0)); };
+    const auto p0 = score_from_elo(SPRT_ELO0);
+    const auto p1 = score_from_elo(SPRT_ELO1);
+
+    const auto won = wins + 0.5 * draws;
+    const auto lost = losses + 0.5 * draws;
+
+    return won * std::log(p1 / p0) + lost * std::log((1.0 - p1) / (1.0 - p0));
+}
@@ -0,0 +1,86 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2017-2019 Michael O and contributors
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+
+    Additional permission under GNU GPL version 3 section 7
+
+    If you modify this Program, or any covered work, by linking or
+    combining it with NVIDIA Corporation's libraries from the
+    NVIDIA CUDA Toolkit and/or the NVIDIA CUDA Deep Neural
+    Network library and/or the NVIDIA TensorRT inference library
+    (or a modified version of those libraries), containing parts covered
+    by the terms of the respective license agreement, the licensors of
+    this Program grant you additional permission to convey the resulting
+    work.
+*/
+
+#ifndef MATCH_H_INCLUDED
+#define MATCH_H_INCLUDED
+
+#include "config.h"
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "GameState.h"
+#include "Network.h"
+
+/// Head-to-head match between networks resident in the same process
+class Match
+{
+public:
+
+    /// SPRT hypotheses in Elo and error rates, the same defaults as the validation tool
+    static constexpr double SPRT_ELO0 = 0.0;
+    static constexpr double SPRT_ELO1 = 35.0;
+    static constexpr double SPRT_ALPHA = 0.05;
+    static constexpr double SPRT_BETA = 0.05;
+
+    /// Moves sampled from the policy of the first network to start every pair of games, the searches are deterministic and
+    /// would otherwise repeat the same two games
+    static constexpr int OPENING_MOVES = 4;
+
+    /// Register a network as a player under a display name and return its index, the match does not take ownership
+    size_t add_network(const std::string& name, Network& network);
+
+    /// Play up to the given number of games between the two players, stopping early once the SPRT is decided. Both games of
+    /// a pair start from the same random opening with the colors swapped. Up to parallel pairs are played at once, each
+    /// from its own thread, so that the searches of both networks share the thread pool and evaluate concurrently
+    void play(size_t first, size_t second, int games, int parallel);
+
+private:
+
+    struct Player
+	{
+        std::string name;
+        Network* network;
+    };
+
+    /// Play the opening moves, each sampled from the raw policy
+    static GameState random_opening(Network& network);
+
+    /// Play a single game from the opening and return the winner color, or FastBoard::EMPTY on a draw
+    static int play_game(const GameState& opening, Network& black, Network& white);
+
+    /// Log likelihood ratio of the SPRT given the first network wins, losses and draws
+    static double get_llr(int wins, int losses, int draws);
+
+    std::vector<Player> m_players;
+	
+};
+
+#endif
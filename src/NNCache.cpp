@@ -27,9 +27,12 @@
     work.
 */
 
+#include <algorithm>
+#include <cassert>
 #include <memory>
 
 #include "NNCache.h"
+#include "BlockPool.h"
 #include "Utils.h"
 #include "UCTSearch.h"
 #include "GTP.h"
@@ -40,24 +43,43 @@ const size_t NNCache::ENTRY_SIZE;
 
 NNCache::NNCache(const int size) : m_size(size) {}
 
+void* NNCache::Entry::operator new(const size_t size)
+{
+	assert(size == sizeof(Entry));
+	(void)size;
+	return BlockPool<Entry>::allocate();
+}
+
+void NNCache::Entry::operator delete(void* pointer)
+{
+	BlockPool<Entry>::deallocate(pointer);
+}
+
 void NNCache::insert(std::uint64_t hash, const Netresult& result)
 {
 	std::lock_guard<std::mutex> lock(m_mutex);
 
-	// Already in the cache
-	if (m_cache.find(hash) != m_cache.end())
+	// Already in the cache or caching disabled
+	if (m_size == 0 || m_cache.find(hash) != m_cache.end())
 		return;
 
-	m_cache.emplace(hash, std::make_unique<Entry>(result));
-	m_order.push_back(hash);
+	auto entry = std::make_unique<Entry>(result);
+	const auto entry_pointer = entry.get();
+	m_cache.emplace(hash, std::move(entry));
 	++m_inserts;
 
-	// If the cache is too large, remove the oldest entry
-	if (m_order.size() > m_size)
+	// Room left, the entry just joins the clock
+	if (m_clock.size() < m_size)
 	{
-		m_cache.erase(m_order.front());
-		m_order.pop_front();
+		m_clock.push_back({hash, entry_pointer});
+		return;
 	}
+
+	// Otherwise it takes the place of the victim, right behind the hand so that it gets a full turn before being considered
+	const auto victim = find_victim();
+	m_cache.erase(m_clock[victim].hash);
+	m_clock[victim] = {hash, entry_pointer};
+	m_hand = (victim + 1) % m_clock.size();
 }
 
 bool NNCache::lookup(const std::uint64_t hash, Netresult & result)
@@ -76,20 +98,45 @@ bool NNCache::lookup(const std::uint64_t hash, Netresult & result)
     // Found
     ++m_hits;
     result = entry->result;
+    entry->referenced = true;
 	
     return true;
 }
 
+size_t NNCache::find_victim()
+{
+	// Terminates within two turns, the first one clears every referenced bit, slots freed by a resize are skipped
+	while (m_clock[m_hand].entry == nullptr || m_clock[m_hand].entry->referenced)
+	{
+		if (m_clock[m_hand].entry != nullptr)
+			m_clock[m_hand].entry->referenced = false;
+		
+		m_hand = (m_hand + 1) % m_clock.size();
+	}
+
+	return m_hand;
+}
+
 void NNCache::resize(const int size)
 {
+	std::lock_guard<std::mutex> lock(m_mutex);
     m_size = size;
 
-	// Remove elements until the requested size is obtained
-    while (m_order.size() > m_size) 
+	if (m_clock.size() <= m_size)
+		return;
+	
+	// Evict until the requested size is obtained, the freed slots are dropped afterwards
+	for (auto excess = m_clock.size() - m_size; excess > 0; excess--)
 	{
-        m_cache.erase(m_order.front());
-        m_order.pop_front();
-    }
+		const auto victim = find_victim();
+		m_cache.erase(m_clock[victim].hash);
+		m_clock[victim].entry = nullptr;
+	}
+
+	// Keep the clock order, starting from the hand
+	std::rotate(m_clock.begin(), m_clock.begin() + m_hand, m_clock.end());
+	m_clock.erase(std::remove_if(m_clock.begin(), m_clock.end(), [](const Slot& slot) { return slot.entry == nullptr; }), m_clock.end());
+	m_hand = 0;
 }
 
 void NNCache::set_size_from_playouts(const int max_playouts)
@@ -106,8 +153,10 @@ void NNCache::set_size_from_playouts(const int max_playouts)
 
 void NNCache::clear()
 {
+	std::lock_guard<std::mutex> lock(m_mutex);
     m_cache.clear();
-    m_order.clear();
+    m_clock.clear();
+    m_hand = 0;
 }
 
 void NNCache::dump_statistics() const
@@ -117,5 +166,5 @@ void NNCache::dump_statistics() const
 
 size_t NNCache::get_estimated_size() const
 {
-    return m_order.size() * ENTRY_SIZE;
+    return m_clock.size() * ENTRY_SIZE;
 }
@@ -33,10 +33,11 @@
 #include "config.h"
 
 #include <array>
-#include <deque>
+#include <cstdint>
 #include <memory>
 #include <mutex>
 #include <unordered_map>
+#include <vector>
 
 /// Base class for the neural network cache
 class NNCache
@@ -64,12 +65,13 @@ public:
         }
     };
 
-    static constexpr size_t ENTRY_SIZE = sizeof(Netresult) + sizeof(std::uint64_t) + sizeof(std::unique_ptr<Netresult>);
+    /// Result and referenced bit, map key and pointer, clock slot
+    static constexpr size_t ENTRY_SIZE = sizeof(Netresult) + sizeof(bool) + sizeof(std::uint64_t) + sizeof(std::unique_ptr<Netresult>) + sizeof(std::uint64_t) + sizeof(void*);
 
 	/// Size of ~ 208MiB
     explicit NNCache(int size = MAX_CACHE_COUNT); 
 
-	/// Insert a new entry into the cache
+	/// Insert a new entry into the cache, when full an entry that was not hit since the clock hand last passed it is evicted
 	void insert(std::uint64_t hash, const Netresult& result);
 	/// Try to find an existing entry in the cache, returns false if not found
 	bool lookup(std::uint64_t hash, Netresult & result);
@@ -108,14 +110,31 @@ private:
     struct Entry
 	{
 		explicit Entry(const Netresult& r): result(r) {}
+		/// Entries come from a BlockPool, backed by huge pages when enabled
+		static void* operator new(size_t size);
+		static void operator delete(void* pointer);
 		/// Size of ~ 1.4KiB
-    	Netresult result;  
+    	Netresult result;
+		/// Set by every hit, gives the entry a second chance when the clock hand reaches it
+		bool referenced{false};
     };
 
+	/// Position of an entry on the clock
+	struct Slot
+	{
+		std::uint64_t hash;
+		Entry* entry;
+	};
+
     /// Map from hash to (features, result)
-    std::unordered_map<std::uint64_t, std::unique_ptr<const Entry>> m_cache;
-    /// Order in which entries were added to the map
-    std::deque<size_t> m_order;
+    std::unordered_map<std::uint64_t, std::unique_ptr<Entry>> m_cache;
+    /// Entries in the order the clock hand visits them
+    std::vector<Slot> m_clock;
+	/// Next slot the clock hand looks at for eviction
+	size_t m_hand{0};
+
+	/// Advance the clock hand to the first entry not hit since the last pass, clearing the referenced bits on the way
+	size_t find_victim();
 };
 
 #endif
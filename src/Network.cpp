@@ -33,15 +33,20 @@
 #include <array>
 #include <cassert>
 #include <cmath>
+#include <cstdint>
+#include <cstring>
 #include <iterator>
 #include <memory>
 #include <sstream>
+#include <stdexcept>
 #include <string>
+#include <tuple>
 #include <boost/format.hpp>
 #include <boost/spirit/home/x3.hpp>
 
 #include "Network.h"
 #include "CPUPipe.h"
+#include "CompositePipe.h"
 #include "FastBoard.h"
 #include "FastState.h"
 #include "FullBoard.h"
@@ -49,6 +54,7 @@
 #include "GTP.h"
 #include "NNCache.h"
 #include "Random.h"
+#include "RemotePipe.h"
 #include "ThreadPool.h"
 #include "Timing.h"
 #include "Utils.h"
@@ -78,20 +84,21 @@
 namespace x3 = boost::spirit::x3;
 using namespace Utils;
 
-#ifndef USE_BLAS
-// Eigen helpers
-
-template <typename T>
-using EigenVectorMap = Eigen::Map<Eigen::Matrix<T, Eigen::Dynamic, 1>>;
-template <typename T>
-using ConstEigenVectorMap = Eigen::Map<const Eigen::Matrix<T, Eigen::Dynamic, 1>>;
-template <typename T>
-using ConstEigenMatrixMap = Eigen::Map<const Eigen::Matrix<T, Eigen::Dynamic, Eigen::Dynamic>>;
-#endif
 
 /// Symmetry helper
 static std::array<std::array<int, NUM_INTERSECTIONS>, Network::NUM_SYMMETRIES> symmetry_nn_idx_table;
 
+/// Fully connected weights are stored as [input][output], so that every active input adds one contiguous row
+template <size_t Inputs, size_t Outputs>
+static void transpose_fully_connected(const std::vector<float>& weights, std::array<float, Inputs * Outputs>& transposed)
+{
+    for (auto o = size_t{0}; o < Outputs; o++) 
+	{
+        for (auto i = size_t{0}; i < Inputs; i++)
+            transposed[i * Outputs + o] = weights[o * Inputs + i];
+    }
+}
+
 float Network::benchmark_time(int centiseconds)
 {
     const auto cpu_count = cfg_num_threads;
@@ -104,30 +111,36 @@ float Network::benchmark_time(int centiseconds)
     state.init_game(BOARD_SIZE, KOMI);
 
     // As a sanity run, try one run with self check.
-    // Isn't enough to guarantee correctness but better than nothing plus for large nets self-check takes a while (1~3 eval per second)
+    // Isn't enough to guarantee correctness but better than nothing, it is verified in the background while the benchmark runs
     get_output(&state, ensemble::RANDOM_SYMMETRY, -1, false, true, true);
 
     const Time start;
-    for (auto i = size_t{0}; i < cpu_count; i++) 
+    thread_group.add_tasks(cpu_count, [this, &run_count, start, centiseconds, state]()
 	{
-        thread_group.add_task([this, &run_count, start, centiseconds, state]()
+        while (true) 
 		{
-            while (true) 
-			{
-                ++run_count;
-            	
-                get_output(&state, ensemble::RANDOM_SYMMETRY, -1, false);
-                const Time end;
-                const auto elapsed = Time::time_difference_centiseconds(start, end);
-            	
-                if (elapsed >= centiseconds)
-                    break;
-            }
-        });
-    }
+            ++run_count;
+        	
+            get_output(&state, ensemble::RANDOM_SYMMETRY, -1, false);
+            const Time end;
+            const auto elapsed = Time::time_difference_centiseconds(start, end);
+        	
+            if (elapsed >= centiseconds)
+                break;
+        }
+    });
 	
     thread_group.wait_all();
 
+#ifdef USE_OPENCL_SELFCHECK
+    // The sanity run was verified in the background while benchmarking, a mismatch still fails the benchmark
+    if (m_selfcheck != nullptr) 
+	{
+        m_selfcheck->wait_idle();
+        m_selfcheck->rethrow_failure();
+    }
+#endif
+
     const Time end;
     const auto elapsed = Time::time_difference_centiseconds(start, end);
 
@@ -143,18 +156,15 @@ void Network::benchmark(const GameState* const state, const int iterations)
     ThreadGroup tg(thread_pool);
     std::atomic<int> run_count{0};
 
-    for (auto i = size_t{0}; i < cpu_count; i++) 
+    tg.add_tasks(cpu_count, [this, &run_count, iterations, state]() 
 	{
-        tg.add_task([this, &run_count, iterations, state]() 
+        while (run_count < iterations) 
 		{
-            while (run_count < iterations) 
-			{
-                ++run_count;
-            	
-                get_output(state, ensemble::RANDOM_SYMMETRY, -1, false);
-            }
-        });
-    }
+            ++run_count;
+        	
+            get_output(state, ensemble::RANDOM_SYMMETRY, -1, false);
+        }
+    });
 	
     tg.wait_all();
 
@@ -173,21 +183,18 @@ void process_bn_var(container& weights)
         w = 1.0f / std::sqrt(w + epsilon);
 }
 
+template <int M>
 std::vector<float> Network::winograd_transform_f(const std::vector<float>& f, const int outputs, const int channels)
 {
-    // F(4x4, 3x3) Winograd filter transformation
+    // F(MxM, 3x3) Winograd filter transformation
     // Transpose(G.dot(f).dot(G.transpose()))
     // U matrix is transposed for better memory layout in SGEMM
-    auto U = std::vector<float>(WINOGRAD_TILE * outputs * channels);
-    const auto G = std::array<float, 3 * WINOGRAD_ALPHA>
-                    { 1.0f,        0.0f,      0.0f,
-                      -2.0f/3.0f, -SQ2/3.0f, -1.0f/3.0f,
-                      -2.0f/3.0f,  SQ2/3.0f, -1.0f/3.0f,
-                      1.0f/6.0f,   SQ2/6.0f,  1.0f/3.0f,
-                      1.0f/6.0f,  -SQ2/6.0f,  1.0f/3.0f,
-                      0.0f,        0.0f,      1.0f};
+    constexpr auto ALPHA = WinogradTransform<M>::ALPHA;
+	
+    auto U = std::vector<float>(ALPHA * ALPHA * outputs * channels);
+    constexpr auto G = WinogradTransform<M>::G();
 
-    auto temp = std::array<float, 3 * WINOGRAD_ALPHA>{};
+    auto temp = std::array<float, 3 * ALPHA>{};
 
     constexpr auto max_buffer_size = 8;
     auto buffer_size = max_buffer_size;
@@ -195,7 +202,7 @@ std::vector<float> Network::winograd_transform_f(const std::vector<float>& f, co
     if (outputs % buffer_size != 0)
         buffer_size = 1;
 
-    std::array<float, max_buffer_size * WINOGRAD_ALPHA * WINOGRAD_ALPHA> buffer{};
+    std::array<float, max_buffer_size * ALPHA * ALPHA> buffer{};
 
     for (auto channel = 0; channel < channels; channel++) 
 	{
@@ -205,7 +212,7 @@ std::vector<float> Network::winograd_transform_f(const std::vector<float>& f, co
 			{
                 const auto output = output_per_buffer * buffer_size + buffer_line;
 
-                for (auto i = 0; i < WINOGRAD_ALPHA; i++) 
+                for (auto i = 0; i < ALPHA; i++) 
 				{
                     for (auto j = 0; j < 3; j++)
 					{
@@ -219,21 +226,21 @@ std::vector<float> Network::winograd_transform_f(const std::vector<float>& f, co
                     }
                 }
 
-                for (auto xi = 0; xi < WINOGRAD_ALPHA; xi++) 
+                for (auto xi = 0; xi < ALPHA; xi++) 
 				{
-                    for (auto nu = 0; nu < WINOGRAD_ALPHA; nu++) 
+                    for (auto nu = 0; nu < ALPHA; nu++) 
 					{
                         auto acc = 0.0f;
                     	
                         for (auto k = 0; k < 3; k++) 
                             acc += temp[xi *3 + k] * G[nu * 3 + k];
                     	
-                        buffer[(xi * WINOGRAD_ALPHA + nu) * buffer_size + buffer_line] = acc;
+                        buffer[(xi * ALPHA + nu) * buffer_size + buffer_line] = acc;
                     }
                 }
             }
         	
-            for (auto i = 0; i < WINOGRAD_ALPHA * WINOGRAD_ALPHA; i++) 
+            for (auto i = 0; i < ALPHA * ALPHA; i++) 
 			{
                 for (auto entry = 0; entry < buffer_size; entry++)
 				{
@@ -248,6 +255,10 @@ std::vector<float> Network::winograd_transform_f(const std::vector<float>& f, co
     return U;
 }
 
+template std::vector<float> Network::winograd_transform_f<2>(const std::vector<float>& f, int outputs, int channels);
+template std::vector<float> Network::winograd_transform_f<3>(const std::vector<float>& f, int outputs, int channels);
+template std::vector<float> Network::winograd_transform_f<4>(const std::vector<float>& f, int outputs, int channels);
+
 std::pair<int, int> Network::load_v1_network(std::istream& wt_file)
 {
     // Count size of the network
@@ -363,7 +374,7 @@ std::pair<int, int> Network::load_v1_network(std::istream& wt_file)
 					myprintf("The weights file is not for %dx%d boards.\n", BOARD_SIZE, BOARD_SIZE);
                     return {0, 0};
 				}
-                std::copy(cbegin(weights), cend(weights), begin(m_ip_pol_w));
+                transpose_fully_connected<OUTPUTS_POLICY * NUM_INTERSECTIONS, POTENTIAL_MOVES>(weights, m_ip_pol_w);
             	break;
             	
                 case  5:
@@ -387,7 +398,12 @@ std::pair<int, int> Network::load_v1_network(std::istream& wt_file)
             	break;
             	
                 case 10:
-            	std::copy(cbegin(weights), cend(weights), begin(m_ip1_val_w));
+            	if (weights.size() != OUTPUTS_VALUE * NUM_INTERSECTIONS * VALUE_LAYER)
+				{
+					myprintf("The weights file is not for %dx%d boards.\n", BOARD_SIZE, BOARD_SIZE);
+                    return {0, 0};
+				}
+            	transpose_fully_connected<OUTPUTS_VALUE * NUM_INTERSECTIONS, VALUE_LAYER>(weights, m_ip1_val_w);
             	break;
             	
                 case 11:
@@ -591,6 +607,61 @@ void Network::select_precision(const int channels)
 }
 #endif
 
+std::pair<int, int> Network::load_weights(const std::string& weights_file)
+{
+    m_fwd_weights = std::make_shared<forward_pipe_weights>();
+
+    // Load network from file
+    size_t channels, residual_blocks;
+    std::tie(channels, residual_blocks) = load_network_file(weights_file);
+    if (channels == 0)
+        return {0, 0};
+
+    auto weight_index = size_t{0};
+    // Input convolution
+    m_fwd_weights->m_conv_input_weights = m_fwd_weights->m_conv_weights[weight_index];
+	
+    // Winograd transform convolution weights
+    m_fwd_weights->m_conv_weights[weight_index] = winograd_transform_f(m_fwd_weights->m_conv_weights[weight_index], static_cast<int>(channels), INPUT_CHANNELS);
+    weight_index++;
+
+    // Residual block convolutions
+    for (auto i = size_t{0}; i < residual_blocks * 2; i++) 
+	{
+        m_fwd_weights->m_conv_weights[weight_index] = winograd_transform_f(m_fwd_weights->m_conv_weights[weight_index], static_cast<int>(channels), static_cast<int>(channels));
+        weight_index++;
+    }
+
+    // Biases are not calculated and are typically zero but some networks might still have non-zero biases.
+    // Move biases to batch-norm means to make the output match without having to separately add the biases.
+    const auto bias_size = m_fwd_weights->m_conv_biases.size();
+    for (auto i = size_t{0}; i < bias_size; i++) 
+	{
+	    const auto means_size = m_fwd_weights->m_batchnorm_means[i].size();
+        for (auto j = size_t{0}; j < means_size; j++) 
+		{
+            m_fwd_weights->m_batchnorm_means[i][j] -= m_fwd_weights->m_conv_biases[i][j];
+            m_fwd_weights->m_conv_biases[i][j] = 0.0f;
+        }
+    }
+
+    for (auto i = size_t{0}; i < m_bn_val_w1.size(); i++) 
+	{
+        m_bn_val_w1[i] -= m_fwd_weights->m_conv_val_bias[i];
+        m_fwd_weights->m_conv_val_bias[i] = 0.0f;
+    }
+
+    for (auto i = size_t{0}; i < m_bn_pol_w1.size(); i++) 
+	{
+        m_bn_pol_w1[i] -= m_fwd_weights->m_conv_pol_bias[i];
+        m_fwd_weights->m_conv_pol_bias[i] = 0.0f;
+    }
+
+    m_channels = static_cast<int>(channels);
+
+    return {static_cast<int>(channels), static_cast<int>(residual_blocks)};
+}
+
 void Network::initialize(const int playouts, const std::string & weights_file) {
 #ifdef USE_BLAS
 #ifndef __APPLE__
@@ -610,8 +681,6 @@ void Network::initialize(const int playouts, const std::string & weights_file) {
     myprintf("BLAS Core: built-in Eigen %d.%d.%d library.\n", EIGEN_WORLD_VERSION, EIGEN_MAJOR_VERSION, EIGEN_MINOR_VERSION);
 #endif
 
-    m_fwd_weights = std::make_shared<forward_pipe_weights>();
-
     // Make a guess at a good size as long as the user doesn't explicitly set a maximum memory usage.
     m_nn_cache.set_size_from_playouts(playouts);
 
@@ -629,75 +698,75 @@ void Network::initialize(const int playouts, const std::string & weights_file) {
     }
 
     // Load network from file
-    size_t channels, residual_blocks;
-    std::tie(channels, residual_blocks) = load_network_file(weights_file);
-    if (channels == 0) {
+    if (load_weights(weights_file).first == 0) {
         exit(EXIT_FAILURE);
     }
 
-    auto weight_index = size_t{0};
-    // Input convolution
-    // Winograd transform convolution weights
-    m_fwd_weights->m_conv_weights[weight_index] = winograd_transform_f(m_fwd_weights->m_conv_weights[weight_index], static_cast<int>(channels), INPUT_CHANNELS);
-    weight_index++;
+    m_weights_fingerprint = m_fwd_weights->fingerprint();
 
-    // Residual block convolutions
-    for (auto i = size_t{0}; i < residual_blocks * 2; i++) 
+#ifdef USE_INFERENCE_SERVER
+    // The server runs the tower, only the heads are evaluated here
+    if (!cfg_infer_server.empty())
 	{
-        m_fwd_weights->m_conv_weights[weight_index] = winograd_transform_f(m_fwd_weights->m_conv_weights[weight_index], static_cast<int>(channels), static_cast<int>(channels));
-        weight_index++;
-    }
+        myprintf("Forwarding evaluations to inference server %s.\n", cfg_infer_server.c_str());
 
-    // Biases are not calculated and are typically zero but some networks might still have non-zero biases.
-    // Move biases to batch-norm means to make the output match without having to separately add the biases.
-    const auto bias_size = m_fwd_weights->m_conv_biases.size();
-    for (auto i = size_t{0}; i < bias_size; i++) 
-	{
-	    const auto means_size = m_fwd_weights->m_batchnorm_means[i].size();
-        for (auto j = size_t{0}; j < means_size; j++) 
+        try
 		{
-            m_fwd_weights->m_batchnorm_means[i][j] -= m_fwd_weights->m_conv_biases[i][j];
-            m_fwd_weights->m_conv_biases[i][j] = 0.0f;
+            m_forward = init_net(m_channels, std::make_unique<RemotePipe>(cfg_infer_server));
+        }
+		catch (const std::runtime_error& error)
+		{
+            myprintf("%s\n", error.what());
+            exit(EXIT_FAILURE);
         }
-    }
-
-    for (auto i = size_t{0}; i < m_bn_val_w1.size(); i++) 
-	{
-        m_bn_val_w1[i] -= m_fwd_weights->m_conv_val_bias[i];
-        m_fwd_weights->m_conv_val_bias[i] = 0.0f;
-    }
 
-    for (auto i = size_t{0}; i < m_bn_pol_w1.size(); i++) 
-	{
-        m_bn_pol_w1[i] -= m_fwd_weights->m_conv_pol_bias[i];
-        m_fwd_weights->m_conv_pol_bias[i] = 0.0f;
+        get_estimated_size();
+        m_fwd_weights.reset();
+        return;
     }
+#endif
 
 #ifdef USE_OPENCL
     if (cfg_cpu_only)
 	{
         myprintf("Initializing CPU-only evaluation.\n");
-        m_forward = init_net(static_cast<int>(channels), std::make_unique<CPUPipe>());
+        m_forward = init_net(m_channels, std::make_unique<CPUPipe>());
     }
 	else 
 	{
 #ifdef USE_OPENCL_SELFCHECK
         // Initialize CPU reference first, so that we can self-check when doing fp16 vs. fp32 detections
-        m_forward_cpu = init_net(static_cast<int>(channels), std::make_unique<CPUPipe>());
+        m_forward_cpu = init_net(m_channels, std::make_unique<CPUPipe>());
+        m_selfcheck = std::make_unique<SelfCheck>([this](const SelfCheck::Job& job)
+		{
+            compare_net_outputs(job.result, get_output_from_planes(*m_forward_cpu, job.input_data, job.symmetry));
+        });
 #endif
 #ifdef USE_HALF
         // HALF support is enabled, and we are using the GPU.
         // Select the precision to use at runtime.
-        select_precision(static_cast<int>(channels));
+        select_precision(m_channels);
 #else
         myprintf("Initializing OpenCL (single precision).\n");
-        m_forward = init_net(channels, std::make_unique<OpenCLScheduler<float>>());
+        m_forward = init_net(m_channels, std::make_unique<OpenCLScheduler<float>>());
 #endif
+
+        if (cfg_cpu_assist > 0)
+		{
+            myprintf("Assisting the OpenCL device(s) with %d CPU thread(s).\n", cfg_cpu_assist);
+
+            // Enough evaluations in flight on the devices to fill a batch while the previous one is read back
+            const auto gpus = std::max(cfg_gpus.size(), size_t{1});
+            auto backends = std::vector<CompositePipe::Backend>{};
+            backends.push_back({"OpenCL", std::move(m_forward), static_cast<int>(cfg_batch_size * gpus * 2)});
+            backends.push_back({"CPU", init_net(m_channels, std::make_unique<CPUPipe>()), static_cast<int>(cfg_cpu_assist)});
+            m_forward = std::make_unique<CompositePipe>(std::move(backends));
+        }
     }
 
 #else
     myprintf("Initializing CPU-only evaluation.\n");
-    m_forward = init_net(static_cast<int>(channels), std::make_unique<CPUPipe>());
+    m_forward = init_net(m_channels, std::make_unique<CPUPipe>());
 #endif
 
     // Need to estimate size before clearing up the pipe.
@@ -705,66 +774,55 @@ void Network::initialize(const int playouts, const std::string & weights_file) {
     m_fwd_weights.reset();
 }
 
-template<unsigned int Inputs,
-         unsigned int Outputs,
-         bool ReLu,
-         size_t W>
-std::vector<float> inner_product(const std::vector<float>& input, const std::array<float, W>& weights, const std::array<float, Outputs>& biases)
+std::unique_ptr<Network> Network::prepare_weights(const std::string& weights_file)
 {
-    std::vector<float> output(Outputs);
+    auto prepared = std::make_unique<Network>();
 
-#ifdef USE_BLAS
-    cblas_sgemv(CblasRowMajor, CblasNoTrans,
-                // M     K
-                outputs, inputs,
-                1.0f, &weights[0], inputs,
-                &input[0], 1,
-                0.0f, &output[0], 1);
-#else
-    EigenVectorMap<float> y(output.data(), Outputs);
-    y.noalias() = ConstEigenMatrixMap<float>(weights.data(), Inputs, Outputs).transpose() * ConstEigenVectorMap<float>(input.data(), Inputs);
-#endif
-    const auto lambda_ReLU = [](const auto val) { return (val > 0.0f) ? val : 0.0f; };
-	
-    for (unsigned int i = 0; i < Outputs; i++) 
-{
-        auto val = biases[i] + output[i];
-    	
-        if (ReLu)
-            val = lambda_ReLU(val);
-    	
-        output[i] = val;
-    }
+    if (prepared->load_weights(weights_file).first == 0)
+        return nullptr;
 
-    return output;
+    return prepared;
 }
 
-template <size_t spatial_size>
-void batch_norm(const size_t channels, std::vector<float>& data, const float* const means, const float* const std_divs, const float* const eltwise = nullptr)
+void Network::swap_weights(Network& prepared)
 {
-    const auto lambda_ReLU = [](const auto val) { return (val > 0.0f) ? val : 0.0f; };
-	
-    for (auto channel = size_t{0}; channel < channels; ++channel) 
-	{
-        const auto mean = means[channel];
-        const auto scale_std_div = std_divs[channel];
-        const auto arr = &data[channel * spatial_size];
+    assert(prepared.m_fwd_weights != nullptr);
 
-		// Classical BN
-        if (eltwise == nullptr) 
-		{
-            for (auto b = size_t{0}; b < spatial_size; b++)
-                arr[b] = lambda_ReLU(scale_std_div * (arr[b] - mean));
-        }
-		// BN + residual add
-    	else 
-		{
-            const auto res = &eltwise[channel * spatial_size];
-    		
-            for (auto b = size_t{0}; b < spatial_size; b++)
-                arr[b] = lambda_ReLU((scale_std_div * (arr[b] - mean)) + res[b]);
-        }
-    }
+#ifdef USE_OPENCL_SELFCHECK
+    // Pending self-checks were evaluated with the old weights and read the heads and the reference pipe
+    if (m_selfcheck != nullptr)
+        m_selfcheck->wait_idle();
+#endif
+
+    // Heads are evaluated on the host, copy them over
+    m_bn_pol_w1 = prepared.m_bn_pol_w1;
+    m_bn_pol_w2 = prepared.m_bn_pol_w2;
+    m_ip_pol_w = prepared.m_ip_pol_w;
+    m_ip_pol_b = prepared.m_ip_pol_b;
+    m_bn_val_w1 = prepared.m_bn_val_w1;
+    m_bn_val_w2 = prepared.m_bn_val_w2;
+    m_ip1_val_w = prepared.m_ip1_val_w;
+    m_ip1_val_b = prepared.m_ip1_val_b;
+    m_ip2_val_w = prepared.m_ip2_val_w;
+    m_ip2_val_b = prepared.m_ip2_val_b;
+    m_value_head_not_stm = prepared.m_value_head_not_stm;
+
+    // The tower goes to the already initialized pipes, no device or context setup is repeated
+    m_channels = prepared.m_channels;
+    m_weights_fingerprint = prepared.m_fwd_weights->fingerprint();
+    m_fwd_weights = std::move(prepared.m_fwd_weights);
+    m_forward->push_weights(WINOGRAD_ALPHA, INPUT_CHANNELS, m_channels, m_fwd_weights);
+#ifdef USE_OPENCL_SELFCHECK
+    if (m_forward_cpu != nullptr)
+        m_forward_cpu->push_weights(WINOGRAD_ALPHA, INPUT_CHANNELS, m_channels, m_fwd_weights);
+#endif
+
+    // Results of the previous network must never be served for the new one
+    m_nn_cache.clear();
+
+    estimated_size = 0;
+    get_estimated_size();
+    m_fwd_weights.reset();
 }
 
 #ifdef USE_OPENCL_SELFCHECK
@@ -799,25 +857,24 @@ void Network::compare_net_outputs(const netresult& data, const netresult& ref) c
 }
 #endif
 
-std::vector<float> softmax(const std::vector<float>& input, const float temperature = 1.0f)
+/// exp(x) as 2^n * exp(r) with x = n * ln(2) + r, without calls or branches so that a loop of it is vectorized
+static float vector_exp(float x)
 {
-    auto output = std::vector<float>{};
-    output.reserve(input.size());
-
-    const auto alpha = *std::max_element(cbegin(input), cend(input));
-    auto denominator = 0.0f;
+    constexpr auto log2e = 1.44269504f;
+    constexpr auto ln2_hi = 0.693145752f;
+    constexpr auto ln2_lo = 1.42860677e-6f;
 
-    for (const auto input_value : input) 
-	{
-        auto value = std::exp((input_value - alpha) / temperature);
-        denominator += value;
-        output.push_back(value);
-    }
+    x = std::min(std::max(x, -87.0f), 88.0f);
+	
+    const auto n = std::floor(x * log2e + 0.5f);
+    const auto r = x - n * ln2_hi - n * ln2_lo;
+    const auto p = 1.0f + r * (1.0f + r * (0.5f + r * (1.0f / 6.0f + r * (1.0f / 24.0f + r * (1.0f / 120.0f + r * (1.0f / 720.0f))))));
 
-    for (auto& out_value : output)
-        out_value /= denominator;
+    const auto exponent = static_cast<std::int32_t>(n + 127.0f) << 23;
+    float scale;
+    std::memcpy(&scale, &exponent, sizeof(scale));
 
-    return output;
+    return p * scale;
 }
 
 bool Network::probe_cache(const GameState* const state, netresult& result)
@@ -897,10 +954,13 @@ Network::netresult Network::get_output(const GameState* const state, const ensem
         // running both with a probability of 1/2000.
         // selfcheck is done here because this is the only place NN
         // evaluation is done on actual gameplay.
-        if (m_forward_cpu != nullptr && (force_selfcheck || Random::get_rng().random_fixed<SELFCHECK_PROBABILITY>() == 0)) 
+        // The reference evaluation runs on the verifier thread, a mismatch surfaces on the next evaluation.
+        if (m_selfcheck != nullptr) 
 		{
-			const auto result_ref = get_output_internal(state, rand_sym, true);
-            compare_net_outputs(result, result_ref);
+            m_selfcheck->rethrow_failure();
+        	
+            if (force_selfcheck || Random::get_rng().random_fixed<SELFCHECK_PROBABILITY>() == 0)
+                m_selfcheck->push({gather_features(state, static_cast<int>(rand_sym)), static_cast<int>(rand_sym), result}, force_selfcheck);
         }
 #else
         (void)force_selfcheck;
@@ -922,38 +982,107 @@ Network::netresult Network::get_output(const GameState* const state, const ensem
     return result;
 }
 
-Network::netresult Network::get_output_internal(const GameState* const state, const int symmetry, const bool selfcheck)
+Network::netresult Network::get_output_internal(const GameState* const state, const int symmetry)
 {
     assert(symmetry >= 0 && symmetry < NUM_SYMMETRIES);
-    constexpr auto width = BOARD_SIZE;
-    constexpr auto height = BOARD_SIZE;
 
-    const auto input_data = gather_features(state, symmetry);
-    std::vector<float> policy_data(OUTPUTS_POLICY * width * height);
-    std::vector<float> value_data(OUTPUTS_VALUE * width * height);
+    m_evaluations.fetch_add(1, std::memory_order_relaxed);
+    return get_output_from_planes(*m_forward, gather_features(state, symmetry), symmetry);
+}
+
+Network::netresult Network::get_output_from_planes(ForwardPipe& pipe, const std::vector<float>& input_data, const int symmetry)
+{
+    // Reused by every evaluation of the thread, the pipe interface takes vectors
+    thread_local std::vector<float> policy_data(OUTPUTS_POLICY * NUM_INTERSECTIONS);
+    thread_local std::vector<float> value_data(OUTPUTS_VALUE * NUM_INTERSECTIONS);
 	
-#ifdef USE_OPENCL_SELFCHECK
-    if (selfcheck)
-        m_forward_cpu->forward(input_data, policy_data, value_data);
-    else
-        m_forward->forward(input_data, policy_data, value_data);
-#else
-    m_forward->forward(input_data, policy_data, value_data);
-    (void) selfcheck;
-#endif
+    pipe.forward(input_data, policy_data, value_data);
 
-    // Get the moves
-    batch_norm<NUM_INTERSECTIONS>(OUTPUTS_POLICY, policy_data, m_bn_pol_w1.data(), m_bn_pol_w2.data());
-    const auto policy_out = inner_product<OUTPUTS_POLICY * NUM_INTERSECTIONS, POTENTIAL_MOVES, false>(policy_data, m_ip_pol_w, m_ip_pol_b);
-    const auto outputs = softmax(policy_out, cfg_softmax_temp);
+    netresult result;
+    evaluate_heads(policy_data.data(), value_data.data(), symmetry, result);
 
-    // Now get the value
-    batch_norm<NUM_INTERSECTIONS>(OUTPUTS_VALUE, value_data, m_bn_val_w1.data(), m_bn_val_w2.data());
-    const auto score_data = inner_product<OUTPUTS_VALUE * NUM_INTERSECTIONS, VALUE_LAYER, true>(value_data, m_ip1_val_w, m_ip1_val_b);
-    const auto score_out = inner_product<VALUE_LAYER, 1, false>(score_data, m_ip2_val_w, m_ip2_val_b);
+    return result;
+}
+
+void Network::forward(const std::vector<float>& input, std::vector<float>& output_pol, std::vector<float>& output_val)
+{
+    m_forward->forward(input, output_pol, output_val);
+}
+
+void Network::evaluate_heads(const float* const policy_data, const float* const value_data, const int symmetry, netresult& result) const
+{
+    const auto lambda_ReLU = [](const auto val) { return (val > 0.0f) ? val : 0.0f; };
+	
+    // Policy batch norm fused into the fully connected layer, after the ReLU only the active inputs add their row
+    auto policy_out = m_ip_pol_b;
+	
+    for (auto channel = size_t{0}; channel < OUTPUTS_POLICY; channel++) 
+	{
+        const auto mean = m_bn_pol_w1[channel];
+        const auto scale_std_div = m_bn_pol_w2[channel];
+    	
+        for (auto idx = size_t{0}; idx < NUM_INTERSECTIONS; idx++) 
+		{
+            const auto input = lambda_ReLU(scale_std_div * (policy_data[channel * NUM_INTERSECTIONS + idx] - mean));
+        	
+            if (input == 0.0f)
+                continue;
+
+            const auto row = &m_ip_pol_w[(channel * NUM_INTERSECTIONS + idx) * POTENTIAL_MOVES];
+        	
+            for (auto move = size_t{0}; move < POTENTIAL_MOVES; move++)
+                policy_out[move] += input * row[move];
+        }
+    }
+
+    // Softmax
+    const auto alpha = *std::max_element(cbegin(policy_out), cend(policy_out));
+    const auto inverse_temperature = 1.0f / cfg_softmax_temp;
+    auto denominator = 0.0f;
+	
+    for (auto& value : policy_out) 
+	{
+        value = vector_exp((value - alpha) * inverse_temperature);
+        denominator += value;
+    }
+
+    // Written straight into the result, undoing the symmetry of the input planes
+    const auto inverse_denominator = 1.0f / denominator;
+	
+    for (auto idx = size_t{0}; idx < NUM_INTERSECTIONS; idx++)
+        result.policy[symmetry_nn_idx_table[symmetry][idx]] = policy_out[idx] * inverse_denominator;
+	
+    result.policy_pass = policy_out[NUM_INTERSECTIONS] * inverse_denominator;
+
+    // Value batch norm fused into the first fully connected layer in the same way
+    auto value_hidden = m_ip1_val_b;
+	
+    for (auto channel = size_t{0}; channel < OUTPUTS_VALUE; channel++) 
+	{
+        const auto mean = m_bn_val_w1[channel];
+        const auto scale_std_div = m_bn_val_w2[channel];
+    	
+        for (auto idx = size_t{0}; idx < NUM_INTERSECTIONS; idx++) 
+		{
+            const auto input = lambda_ReLU(scale_std_div * (value_data[channel * NUM_INTERSECTIONS + idx] - mean));
+        	
+            if (input == 0.0f)
+                continue;
+
+            const auto row = &m_ip1_val_w[(channel * NUM_INTERSECTIONS + idx) * VALUE_LAYER];
+        	
+            for (auto neuron = size_t{0}; neuron < VALUE_LAYER; neuron++)
+                value_hidden[neuron] += input * row[neuron];
+        }
+    }
+
+    auto score_out = m_ip2_val_b[0];
+	
+    for (auto neuron = size_t{0}; neuron < VALUE_LAYER; neuron++)
+        score_out += lambda_ReLU(value_hidden[neuron]) * m_ip2_val_w[neuron];
 
     // Rescale the network output to prevent too high numbers but preserve its linearity
-    auto score = RESCALE_FACTOR * score_out[0];
+    auto score = RESCALE_FACTOR * score_out;
 
 	// The network output is trained to be between -1 and 1, clamp it if something is a bit wrong just to speed up things
 	if (score <= -1.0f)
@@ -973,20 +1102,7 @@ Network::netresult Network::get_output_internal(const GameState* const state, co
 
 	const auto new_range = new_max - new_min;
 
-	score = (score - old_min) * new_range / old_range + new_min;
-
-    netresult result;
-
-    for (auto idx = size_t{0}; idx < NUM_INTERSECTIONS; idx++) 
-	{
-        const auto sym_idx = symmetry_nn_idx_table[symmetry][idx];
-        result.policy[sym_idx] = outputs[idx];
-    }
-
-    result.policy_pass = outputs[NUM_INTERSECTIONS];
-    result.score = score;
-
-    return result;
+	result.score = (score - old_min) * new_range / old_range + new_min;
 }
 
 void Network::show_heatmap(const FastState* const state, const netresult& result, const bool top_moves)
@@ -1167,3 +1283,18 @@ void Network::nn_cache_clear()
 {
     m_nn_cache.clear();
 }
+
+std::string Network::get_batching_report()
+{
+    return m_forward->get_batching_report();
+}
+
+Network::Statistics Network::get_statistics()
+{
+    auto statistics = Statistics();
+    statistics.evaluations = m_evaluations.load(std::memory_order_relaxed);
+    std::tie(statistics.cache_hits, statistics.cache_lookups) = m_nn_cache.hit_rate();
+    statistics.batches = m_forward->get_batch_statistics();
+
+    return statistics;
+}
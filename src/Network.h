@@ -34,6 +34,8 @@
 
 #include <deque>
 #include <array>
+#include <atomic>
+#include <cstdint>
 #include <memory>
 #include <string>
 #include <utility>
@@ -42,25 +44,14 @@
 #include "NNCache.h"
 #include "GameState.h"
 #include "ForwardPipe.h"
+#include "SelfCheck.h"
+#include "Winograd.h"
 
 #ifdef USE_OPENCL
 #include "OpenCLScheduler.h"
 #endif
 
 
-// TODO: this must be documented, it's very hard to do so
-
-// Winograd filter transformation changes 3x3 filters to M + 3 - 1
-
-constexpr auto WINOGRAD_M = 4;
-constexpr auto WINOGRAD_ALPHA = WINOGRAD_M + 3 - 1;
-constexpr auto WINOGRAD_W_TILES = BOARD_SIZE / WINOGRAD_M + (BOARD_SIZE % WINOGRAD_M != 0);
-constexpr auto WINOGRAD_TILE = WINOGRAD_ALPHA * WINOGRAD_ALPHA;
-constexpr auto WINOGRAD_P = WINOGRAD_W_TILES * WINOGRAD_W_TILES;
-
-/// Square root of 2
-constexpr auto SQ2 = 1.4142135623730951f;
-
 class Network
 {
     using forward_pipe_weights = ForwardPipe::ForwardPipeWeights;
@@ -92,10 +83,27 @@ public:
     using policy_vertex_pair = std::pair<float,int>;
     using netresult = NNCache::Netresult;
 
+	/// Counters since the network was created, a benchmark takes their differences around a search
+	struct Statistics
+	{
+		/// Forward passes, every symmetry of an averaged evaluation counts
+		std::uint64_t evaluations{0};
+		int cache_lookups{0};
+		int cache_hits{0};
+		ForwardPipe::BatchStatistics batches;
+	};
+
     netresult get_output(const GameState* state, ensemble ensemble, int symmetry = -1, bool read_cache = true, bool write_cache = true, bool force_selfcheck = false);
 
     void initialize(int playouts, const std::string & weights_file);
 
+	/// Read and transform a weights file without touching any forward pipe, safe to run on a background thread.
+	/// Returns nullptr if the file could not be loaded.
+    static std::unique_ptr<Network> prepare_weights(const std::string& weights_file);
+	/// Replace the weights with the ones of a prepared network, reusing the initialized forward pipes.
+	/// Must be called between searches, when no evaluation is in flight.
+    void swap_weights(Network& prepared);
+
 	/// 
     float benchmark_time(int centiseconds);
 	///
@@ -104,20 +112,48 @@ public:
     static void show_heatmap(const FastState * state, const netresult & result, bool top_moves);
 
     static std::vector<float> gather_features(const GameState* state, int symmetry);
+    /// Transform 3x3 filters for the Winograd F(MxM, 3x3) convolution
+    template <int M = WINOGRAD_M>
+    static std::vector<float> winograd_transform_f(const std::vector<float>& f, int outputs, int channels);
+
     static std::pair<int, int> get_symmetry(const std::pair<int, int>& vertex, int symmetry, int board_size = BOARD_SIZE);
 
     size_t get_estimated_size();
     size_t get_estimated_cache_size() const;
     void nn_cache_resize(int max_count);
     void nn_cache_clear();
+	/// Batching decisions of the backend, empty when it does not batch
+    std::string get_batching_report();
+    Statistics get_statistics();
+
+	/// Residual tower and head convolutions of raw input planes, what leelaz-infer serves
+    void forward(const std::vector<float>& input, std::vector<float>& output_pol, std::vector<float>& output_val);
+	/// Policy and value heads on the outputs of the 1x1 head convolutions, without allocating
+	void evaluate_heads(const float* policy_data, const float* value_data, int symmetry, netresult& result) const;
+	/// Filters of the residual tower
+    int get_channels() const
+	{
+        return m_channels;
+    }
+	/// Identifies the loaded weights to the clients of an inference server
+    std::uint64_t get_weights_fingerprint() const
+	{
+        return m_weights_fingerprint;
+    }
 
 private:
 
 	std::unique_ptr<ForwardPipe> m_forward;
 	
 	NNCache m_nn_cache;
+	std::atomic<std::uint64_t> m_evaluations{ 0 };
 	size_t estimated_size{ 0 };
 
+	/// Filters of the residual tower of the loaded weights
+	int m_channels{ 0 };
+	/// ForwardPipeWeights::fingerprint of the loaded weights
+	std::uint64_t m_weights_fingerprint{ 0 };
+
 	// Residual tower
 	std::shared_ptr<forward_pipe_weights> m_fwd_weights;
 
@@ -125,6 +161,7 @@ private:
 	std::array<float, OUTPUTS_POLICY> m_bn_pol_w1 = {};
 	std::array<float, OUTPUTS_POLICY> m_bn_pol_w2 = {};
 
+	/// Fully connected layers are [input][output]
 	std::array<float, OUTPUTS_POLICY * NUM_INTERSECTIONS * POTENTIAL_MOVES> m_ip_pol_w = {};
 	std::array<float, POTENTIAL_MOVES> m_ip_pol_b = {};
 
@@ -142,10 +179,12 @@ private:
 	
     std::pair<int, int> load_v1_network(std::istream& wt_file);
     std::pair<int, int> load_network_file(const std::string& filename);
+    std::pair<int, int> load_weights(const std::string& weights_file);
 
-    static std::vector<float> winograd_transform_f(const std::vector<float>& f, int outputs, int channels);
 	
-	netresult get_output_internal(const GameState* state, int symmetry, bool selfcheck = false);
+	netresult get_output_internal(const GameState* state, int symmetry);
+	/// Forward the input planes of the given symmetry through a pipe and evaluate the heads
+	netresult get_output_from_planes(ForwardPipe& pipe, const std::vector<float>& input_data, int symmetry);
 
 	static void fill_input_plane_pair(const FullBoard& board, const std::vector<float>::iterator& black, const std::vector<float>::iterator& white, int symmetry);
     bool probe_cache(const GameState* state, netresult& result);
@@ -157,6 +196,8 @@ private:
 #ifdef USE_OPENCL_SELFCHECK
     void compare_net_outputs(const netresult& data, const netresult& ref) const;
     std::unique_ptr<ForwardPipe> m_forward_cpu;
+    /// Verifier thread of the reference pipe, declared after it so that it stops first
+    std::unique_ptr<SelfCheck> m_selfcheck;
 #endif
 
 };
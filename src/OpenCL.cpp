@@ -32,12 +32,17 @@
 #ifdef USE_OPENCL
 #include <cassert>
 #include <algorithm>
+#include <array>
 #include <boost/algorithm/string.hpp>
+#include <boost/filesystem.hpp>
 #include <boost/format.hpp>
+#include <chrono>
+#include <fstream>
 #include <iterator>
 #include <limits>
 #include <stdexcept>
 
+#include <cstdint>
 #include <cstdio>
 #include <iostream>
 #include <memory>
@@ -74,12 +79,25 @@ static const std::string sourceCode_tensorcore_test =
     #include "kernels/tensorcore_test.opencl"
 ;
 
+// Comma separated float literals for initializing a __constant array
+template <size_t N>
+static std::string cl_array_values(const std::array<float, N>& values) {
+    auto out = std::ostringstream{};
+    out.precision(9);
+    for (auto i = size_t{0}; i < N; i++) {
+        out << (i ? ", " : "") << std::showpoint << values[i] << "f";
+    }
+    return out.str();
+}
+
 static const std::string sourceCode_config = R"(
 #define BOARD_SIZE )" + std::to_string(BOARD_SIZE) +
 "\n#define NUM_INTERSECTIONS " + std::to_string(NUM_INTERSECTIONS) +
 "\n#define WINOGRAD_M " + std::to_string(WINOGRAD_M) +
 "\n#define WINOGRAD_ALPHA " + std::to_string(WINOGRAD_ALPHA) +
-"\n#define WTILES " + std::to_string(WINOGRAD_W_TILES);
+"\n#define WTILES " + std::to_string(WINOGRAD_W_TILES) +
+"\n#define WINOGRAD_BT " + cl_array_values(WinogradTransform<WINOGRAD_M>::Bt()) +
+"\n#define WINOGRAD_AT " + cl_array_values(WinogradTransform<WINOGRAD_M>::At()) + "\n";
 
 static const std::string sourceCode_convolve1 =
     #include "kernels/convolve1.opencl"
@@ -149,11 +167,27 @@ void OpenCL_Network<net_t>::forward(const std::vector<float>& input,
                              std::vector<float>& output_val,
                              OpenCLContext & opencl_context,
                              const int batch_size) {
+    enqueue_forward(input, opencl_context, batch_size);
+    finish_forward(output_pol, output_val, opencl_context);
+}
+
+template <typename net_t>
+void OpenCL_Network<net_t>::enqueue_forward(const std::vector<float>& input,
+                             OpenCLContext & opencl_context,
+                             const int batch_size) {
     constexpr auto tiles = WINOGRAD_P;
     constexpr auto one_plane = NUM_INTERSECTIONS * sizeof(net_t);
     const auto finalSize_pol = m_layers[m_layers.size()-2].outputs * one_plane;
     const auto finalSize_val = m_layers.back().outputs * one_plane;
 
+    if (opencl_context.m_generation != m_generation) {
+        // The weights were replaced since this context was set up, possibly
+        // with a different size or a rebuilt program.
+        opencl_context.m_is_initialized = false;
+        opencl_context.m_buffers_allocated = false;
+        opencl_context.m_generation = m_generation;
+    }
+
     m_opencl.ensure_context_initialized(opencl_context);
 
     if (!opencl_context.m_buffers_allocated) {
@@ -192,6 +226,9 @@ void OpenCL_Network<net_t>::forward(const std::vector<float>& input,
             m_opencl.m_context,
             CL_MEM_READ_WRITE | CL_MEM_HOST_NO_ACCESS, alloc_vm_size);
 
+        opencl_context.m_pinnedInBuffer = cl::Buffer(
+            m_opencl.m_context,
+            CL_MEM_READ_ONLY | CL_MEM_ALLOC_HOST_PTR, alloc_inSize);
         opencl_context.m_pinnedOutBuffer_pol = cl::Buffer(
             m_opencl.m_context,
             CL_MEM_WRITE_ONLY | CL_MEM_ALLOC_HOST_PTR, getOpenCL().m_batch_size * finalSize_pol);
@@ -208,11 +245,18 @@ void OpenCL_Network<net_t>::forward(const std::vector<float>& input,
     cl::Buffer & MBuffer = opencl_context.m_MBuffer;
     cl::CommandQueue & queue = opencl_context.m_commandqueue;
 
-    std::vector<net_t> net_t_input(input.size());
-    std::copy(begin(input), end(input), begin(net_t_input));
-
+    // Stage the input in host visible memory and copy it on the device, so
+    // the transfer does not depend on a host vector outliving this call.
     const auto inSize = sizeof(net_t) * input.size();
-    queue.enqueueWriteBuffer(inBuffer, CL_FALSE, 0, inSize, net_t_input.data());
+    auto pinnedInBufferHost = queue.enqueueMapBuffer(
+        opencl_context.m_pinnedInBuffer, CL_TRUE,
+        CL_MAP_WRITE, 0, inSize);
+    std::copy(begin(input), end(input),
+              static_cast<net_t*>(pinnedInBufferHost));
+    queue.enqueueUnmapMemObject(opencl_context.m_pinnedInBuffer,
+            pinnedInBufferHost);
+    queue.enqueueCopyBuffer(opencl_context.m_pinnedInBuffer, inBuffer,
+            0, 0, inSize);
 
     // Fused in_out transformation kernel is slower with big batch_sizes than
     // calling out and in transformations separately.
@@ -304,30 +348,43 @@ void OpenCL_Network<net_t>::forward(const std::vector<float>& input,
         }
     }
 
-    auto pinnedOutBufferHost_pol = queue.enqueueMapBuffer(
+    // The queue is in order, so the second mapping completing means the
+    // whole batch is done.
+    opencl_context.m_pinnedOutBufferHost_pol = queue.enqueueMapBuffer(
         opencl_context.m_pinnedOutBuffer_pol, CL_FALSE,
         CL_MAP_READ, 0, batch_size * finalSize_pol);
-    auto pinnedOutBufferHost_val = queue.enqueueMapBuffer(
+    opencl_context.m_pinnedOutBufferHost_val = queue.enqueueMapBuffer(
         opencl_context.m_pinnedOutBuffer_val, CL_FALSE,
-        CL_MAP_READ, 0, batch_size * finalSize_val);
+        CL_MAP_READ, 0, batch_size * finalSize_val,
+        nullptr, &opencl_context.m_output_ready);
+    queue.flush();
+}
+
+template <typename net_t>
+void OpenCL_Network<net_t>::finish_forward(std::vector<float>& output_pol,
+                             std::vector<float>& output_val,
+                             OpenCLContext & opencl_context) {
+    cl::CommandQueue & queue = opencl_context.m_commandqueue;
+    assert(opencl_context.m_pinnedOutBufferHost_pol != nullptr);
 
     {
-        // Finish call is usually a busy wait. When using multiple threads
+        // Waiting is usually a busy wait. When using multiple threads
         // use the lock to avoid busy waiting with all threads.
         std::lock_guard<std::mutex> lock(m_queue_finish_mutex);
-        queue.finish();
+        opencl_context.m_output_ready.wait();
     }
 
-    auto polptr = static_cast<net_t*>(pinnedOutBufferHost_pol);
-    auto valptr = static_cast<net_t*>(pinnedOutBufferHost_val);
+    auto polptr = static_cast<net_t*>(opencl_context.m_pinnedOutBufferHost_pol);
+    auto valptr = static_cast<net_t*>(opencl_context.m_pinnedOutBufferHost_val);
     std::copy(polptr, polptr + output_pol.size(), begin(output_pol));
     std::copy(valptr, valptr + output_val.size(), begin(output_val));
 
     queue.enqueueUnmapMemObject(opencl_context.m_pinnedOutBuffer_pol,
-            pinnedOutBufferHost_pol);
+            opencl_context.m_pinnedOutBufferHost_pol);
     queue.enqueueUnmapMemObject(opencl_context.m_pinnedOutBuffer_val,
-            pinnedOutBufferHost_val);
-
+            opencl_context.m_pinnedOutBufferHost_val);
+    opencl_context.m_pinnedOutBufferHost_pol = nullptr;
+    opencl_context.m_pinnedOutBufferHost_val = nullptr;
 }
 
 template <typename net_t>
@@ -854,27 +911,134 @@ OpenCL<net_t>::OpenCL(int gpu, bool silent) {
     }
 }
 
+// Compiled programs are kept in this directory next to the tuning file,
+// one file per key.
+static const auto PROGRAM_CACHE_DIR = std::string("leelaz_opencl_programs");
+// First line of a cached program, bumped when the file layout changes.
+static const auto PROGRAM_CACHE_MAGIC = std::string("leelaz-opencl-program 1");
+
+static std::uint64_t fnv1a(const std::string& text) {
+    auto hash = std::uint64_t{14695981039346656037ULL};
+    for (const auto c : text) {
+        hash = (hash ^ static_cast<unsigned char>(c)) * 1099511628211ULL;
+    }
+    return hash;
+}
+
 template <typename net_t>
-void OpenCL<net_t>::initialize(const int channels, size_t batch_size) {
-    m_batch_size = batch_size;
-    // Make program of the source code in the context
+std::string OpenCL<net_t>::program_cache_key(const std::string& source,
+                                             const std::string& args) {
+    // Anything that can change the binary: the device and its driver,
+    // the precision and tuners through the build arguments, and the kernels.
+    return m_device.getInfo<CL_DEVICE_VENDOR>() + ";"
+        + m_device.getInfo<CL_DEVICE_NAME>() + ";"
+        + m_device.getInfo<CL_DEVICE_VERSION>() + ";"
+        + m_device.getInfo<CL_DRIVER_VERSION>() + ";"
+        + args + ";"
+        + str(boost::format("%016x") % fnv1a(source));
+}
+
+template <typename net_t>
+std::string OpenCL<net_t>::program_cache_file(const std::string& key) {
+    auto dir = boost::filesystem::path(leelaz_file(PROGRAM_CACHE_DIR));
+    boost::filesystem::create_directories(dir);
+    dir /= str(boost::format("%016x.bin") % fnv1a(key));
+    return dir.string();
+}
+
+template <typename net_t>
+bool OpenCL<net_t>::load_program_binary(const std::string& key,
+                                        const std::string& args) {
     try {
-        m_program = cl::Program(m_context,
-                                sourceCode_common
-                                + sourceCode_config
-                                + sourceCode_convolve1
-                                + sourceCode_convolve3
-                                + sourceCode_sgemm);
-    } catch (const cl::Error &e) {
-        myprintf("Error getting kernels: %s: %d", e.what(), e.err());
-        throw std::runtime_error("Error getting OpenCL kernels.");
+        const auto filename = program_cache_file(key);
+        auto file = std::ifstream{filename, std::ios::binary};
+        if (!file.good()) {
+            return false;
+        }
+
+        auto magic = std::string{};
+        auto stored_key = std::string{};
+        std::getline(file, magic);
+        std::getline(file, stored_key);
+        if (magic != PROGRAM_CACHE_MAGIC || stored_key != key) {
+            return false;
+        }
+
+        auto binary = std::vector<unsigned char>(
+            std::istreambuf_iterator<char>(file),
+            std::istreambuf_iterator<char>());
+        if (binary.empty()) {
+            return false;
+        }
+
+        const auto devices = std::vector<cl::Device>{m_device};
+        const auto binaries = cl::Program::Binaries{binary};
+        auto program = cl::Program(m_context, devices, binaries);
+        program.build(args.c_str());
+        m_program = program;
+        return true;
+    } catch (const std::exception& e) {
+        // A stale or corrupt binary, or a driver that refuses binaries:
+        // fall back to the source and overwrite the cached file.
+        myprintf("Ignoring cached OpenCL program: %s\n", e.what());
+        return false;
     }
+}
+
+template <typename net_t>
+void OpenCL<net_t>::store_program_binary(const std::string& key) {
+    try {
+        const auto binaries = m_program.getInfo<CL_PROGRAM_BINARIES>();
+        if (binaries.size() != 1 || binaries[0].empty()) {
+            return;
+        }
+
+        // Write to a temporary name and rename, so that another process
+        // starting at the same time never reads half a file.
+        const auto filename = program_cache_file(key);
+        const auto temporary = filename + str(boost::format(".%016x")
+            % std::chrono::steady_clock::now().time_since_epoch().count());
+        {
+            auto file = std::ofstream{temporary, std::ios::binary};
+            file << PROGRAM_CACHE_MAGIC << "\n" << key << "\n";
+            file.write(reinterpret_cast<const char*>(binaries[0].data()),
+                       binaries[0].size());
+            if (!file.good()) {
+                file.close();
+                boost::filesystem::remove(temporary);
+                return;
+            }
+        }
+        boost::filesystem::rename(temporary, filename);
+    } catch (const std::exception& e) {
+        myprintf("Could not cache the OpenCL program: %s\n", e.what());
+    }
+}
+
+template <typename net_t>
+void OpenCL<net_t>::initialize(const int channels, size_t batch_size) {
+    m_batch_size = batch_size;
+    const auto source = sourceCode_common
+                        + sourceCode_config
+                        + sourceCode_convolve1
+                        + sourceCode_convolve3
+                        + sourceCode_sgemm;
 
     auto t = Tuner<net_t>(*this, m_context, m_device);
     if (m_tensorcore) {
         t.enable_tensorcore();
     }
 
+    // A tuning run can also cover other batch sizes, they are only
+    // stored in the tuner file for the runs that use them.
+    if (cfg_tune_only) {
+        for (const auto size : cfg_tune_batch_sizes) {
+            if (size > 0 && size != batch_size) {
+                t.load_sgemm_tuners(channels, size * WINOGRAD_P, channels, WINOGRAD_TILE);
+            }
+        }
+    }
+
     auto sgemm_tuners =
         t.load_sgemm_tuners(channels, batch_size * WINOGRAD_P, channels, WINOGRAD_TILE);
 
@@ -887,20 +1051,44 @@ void OpenCL<net_t>::initialize(const int channels, size_t batch_size) {
         return;
     }
 
-    // Build program for these specific devices
-    try {
-        std::string args = m_cl_args;
-        // Intel iGPUs need vector types for math for best performance
-        if (m_device.getInfo<CL_DEVICE_PREFERRED_VECTOR_WIDTH_FLOAT>() > 1) {
-            args += " -DWINOGRAD_SIMD";
-        }
-
-        args += sgemm_tuners;
-        m_program.build(args.c_str());
-    } catch (const cl::Error&) {
-        myprintf("Error building kernels: %s\n",
-                 m_program.getBuildInfo<CL_PROGRAM_BUILD_LOG>(m_device).c_str());
-        throw std::runtime_error("Error building OpenCL kernels.");
+    std::string args = m_cl_args;
+    // Intel iGPUs need vector types for math for best performance
+    if (m_device.getInfo<CL_DEVICE_PREFERRED_VECTOR_WIDTH_FLOAT>() > 1) {
+        args += " -DWINOGRAD_SIMD";
+    }
+    args += sgemm_tuners;
+
+    // Build program for these specific devices, or load the binary
+    // a previous run built with the same device, driver and arguments.
+    const auto build_start = std::chrono::steady_clock::now();
+    const auto cache_key = program_cache_key(source, args);
+    const auto cached = load_program_binary(cache_key, args);
+
+    if (!cached) {
+        // Make program of the source code in the context
+        try {
+            m_program = cl::Program(m_context, source);
+        } catch (const cl::Error &e) {
+            myprintf("Error getting kernels: %s: %d", e.what(), e.err());
+            throw std::runtime_error("Error getting OpenCL kernels.");
+        }
+
+        try {
+            m_program.build(args.c_str());
+        } catch (const cl::Error&) {
+            myprintf("Error building kernels: %s\n",
+                     m_program.getBuildInfo<CL_PROGRAM_BUILD_LOG>(m_device).c_str());
+            throw std::runtime_error("Error building OpenCL kernels.");
+        }
+    }
+
+    const auto build_seconds = std::chrono::duration<double>(
+        std::chrono::steady_clock::now() - build_start).count();
+    myprintf("OpenCL program %s in %.2f seconds.\n",
+             cached ? "loaded from the cache" : "built from source", build_seconds);
+
+    if (!cached) {
+        store_program_binary(cache_key);
     }
 
     OpenCLContext tdata;
@@ -76,9 +76,17 @@ private:
     cl::Buffer m_inBuffer2;
     cl::Buffer m_VBuffer;
     cl::Buffer m_MBuffer;
+    cl::Buffer m_pinnedInBuffer;
     cl::Buffer m_pinnedOutBuffer_pol;
     cl::Buffer m_pinnedOutBuffer_val;
     bool m_buffers_allocated{false};
+    // Host mappings of the output buffers of the batch that was enqueued
+    // but not yet finished, and the event signalling they are filled.
+    void* m_pinnedOutBufferHost_pol{nullptr};
+    void* m_pinnedOutBufferHost_val{nullptr};
+    cl::Event m_output_ready;
+    // Weights generation the kernels and buffers were set up for
+    size_t m_generation{0};
 };
 
 template <typename net_t>
@@ -145,12 +153,30 @@ public:
         return m_layers.size();
     }
 
+    // Drop all pushed layers so that a new network can be pushed.
+    // Contexts notice the new generation and rebuild their kernels and buffers.
+    void clear_layers() {
+        m_layers.clear();
+        m_generation++;
+    }
+
     void forward(const std::vector<float>& input,
             std::vector<float>& output_pol,
             std::vector<float>& output_val,
             OpenCLContext & opencl_context,
             const int batch_size = 1);
 
+    // forward() split in two halves so that a caller owning several
+    // contexts can keep one batch computing while it prepares the next
+    // one and reads back the previous one.  Every enqueue_forward()
+    // must be followed by a finish_forward() on the same context.
+    void enqueue_forward(const std::vector<float>& input,
+            OpenCLContext & opencl_context,
+            const int batch_size = 1);
+    void finish_forward(std::vector<float>& output_pol,
+            std::vector<float>& output_val,
+            OpenCLContext & opencl_context);
+
 private:
     using weight_slice_t = std::vector<cl::Buffer>::const_iterator;
 
@@ -187,6 +213,7 @@ private:
     // isn't busy wait so it should be better.
     std::mutex m_queue_finish_mutex;
     std::vector<Layer> m_layers;
+    size_t m_generation{0};
 };
 
 template <typename net_t>
@@ -209,6 +236,14 @@ public:
 private:
     void process_tuners(std::string tuners);
 
+    // On-disk cache of the built program, keyed by everything that
+    // influences the binary.
+    std::string program_cache_key(const std::string& source,
+                                  const std::string& args);
+    std::string program_cache_file(const std::string& key);
+    bool load_program_binary(const std::string& key, const std::string& args);
+    void store_program_binary(const std::string& key);
+
     size_t m_batch_size = 1;
     cl::Program m_program;
     std::string m_cl_args;
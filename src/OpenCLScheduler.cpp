@@ -32,7 +32,9 @@
 
 #include "GTP.h"
 #include "Random.h"
+#include "SMP.h"
 #include "Network.h"
+#include "Trace.h"
 #include "Utils.h"
 #include "OpenCLScheduler.h"
 
@@ -86,7 +88,8 @@ static std::vector<T> zeropad_U(const std::vector<float>& U,
 }
 
 template <typename net_t>
-OpenCLScheduler<net_t>::OpenCLScheduler() {
+OpenCLScheduler<net_t>::OpenCLScheduler()
+    : m_forward_queue(2 * MAX_CPUS) {
     // multi-gpu?
     auto gpus = cfg_gpus;
 
@@ -114,12 +117,21 @@ void OpenCLScheduler<net_t>::initialize(const int channels) {
     // Launch the worker threads.  Minimum 1 worker per GPU, but use enough threads
     // so that we can at least concurrently schedule something to the GPU.
     auto num_worker_threads = cfg_num_threads / cfg_batch_size / (m_opencl.size() + 1) + 1;
+    m_batch_controller = std::make_unique<BatchController>(
+        cfg_batch_size, num_worker_threads * m_opencl.size());
     auto gnum = 0;
+    // Workers are placed after the search threads.
+    auto worker = size_t{cfg_num_threads};
+    m_channels = channels;
     for (auto & opencl : m_opencl) {
         opencl->initialize(channels, cfg_batch_size);
 
         for (auto i = unsigned{0}; i < num_worker_threads; i++) {
-            auto t = std::thread(&OpenCLScheduler<net_t>::batch_worker, this, gnum);
+            auto t = std::thread([this, gnum, worker] {
+                SMP::pin_current_thread(worker);
+                batch_worker(gnum);
+            });
+            worker++;
             m_worker_threads.push_back(std::move(t));
         }
         gnum++;
@@ -134,14 +146,34 @@ void OpenCLScheduler<net_t>::initialize(const int channels) {
 
 template <typename net_t>
 OpenCLScheduler<net_t>::~OpenCLScheduler() {
-    {
-        std::unique_lock<std::mutex> lk(m_mutex);
-        m_running = false;
-    }
-    m_cv.notify_all();
+    m_forward_queue.close();
     for (auto & x : m_worker_threads) {
         x.join();
     }
+
+#ifndef NDEBUG
+    const auto stats = m_forward_queue.get_statistics();
+    myprintf("forward queue: %zu evals in %zu batches, latency %.2f ms mean %.2f ms max\n",
+             stats.evaluations, stats.batches,
+             stats.mean_latency_ms, stats.max_latency_ms);
+#endif
+}
+
+template<typename net_t>
+std::string OpenCLScheduler<net_t>::get_batching_report() {
+    return m_batch_controller ? m_batch_controller->report() : "";
+}
+
+template<typename net_t>
+ForwardPipe::BatchStatistics OpenCLScheduler<net_t>::get_batch_statistics() {
+    auto statistics = BatchStatistics();
+    if (m_batch_controller) {
+        const auto totals = m_batch_controller->batch_totals();
+        statistics.batches = totals.first;
+        statistics.evaluations = totals.second;
+        statistics.capacity = totals.first * m_batch_controller->max_batch_size();
+    }
+    return statistics;
 }
 
 template<typename net_t>
@@ -235,6 +267,19 @@ void OpenCLScheduler<net_t>::push_weights(
     unsigned int outputs,
     std::shared_ptr<const ForwardPipeWeights> weights) {
 
+    // This can be called again to replace the network between searches.
+    // The program and the SGEMM tuning depend on the number of filters,
+    // so only those are redone, the devices and contexts are kept.
+    for (const auto& opencl_net : m_networks) {
+        opencl_net->clear_layers();
+    }
+    if (outputs != m_channels) {
+        for (auto & opencl : m_opencl) {
+            opencl->initialize(outputs, cfg_batch_size);
+        }
+        m_channels = outputs;
+    }
+
     auto weight_index = size_t{0};
 
     // Winograd filter transformation changes filter size to 4x4
@@ -266,18 +311,9 @@ template <typename net_t>
 void OpenCLScheduler<net_t>::forward(const std::vector<float>& input,
                                      std::vector<float>& output_pol,
                                      std::vector<float>& output_val) {
-    auto entry = std::make_shared<ForwardQueueEntry>(input, output_pol, output_val);
-    std::unique_lock<std::mutex> lk(entry->mutex);
-    {
-        std::unique_lock<std::mutex> lk(m_mutex);
-        m_forward_queue.push_back(entry);
-
-        if (m_single_eval_in_progress.load()) {
-            m_waittime += 2;
-        }
-    }
-    m_cv.notify_one();
-    entry->cv.wait(lk);
+    const Trace::Scope trace("OpenCLScheduler::forward");
+    m_batch_controller->record_arrival();
+    m_forward_queue.submit(input, output_pol, output_val);
 }
 
 #ifndef NDEBUG
@@ -290,82 +326,114 @@ void OpenCLScheduler<net_t>::batch_worker(const size_t gnum) {
     constexpr auto out_pol_size = Network::OUTPUTS_POLICY * BOARD_SIZE * BOARD_SIZE;
     constexpr auto out_val_size = Network::OUTPUTS_VALUE * BOARD_SIZE * BOARD_SIZE;
 
-    OpenCLContext context;
+    // Two contexts, each with its own command queue and buffers, so that
+    // the next batch can be uploaded and enqueued while the previous one
+    // is still computing, and read back while the next one computes.
+    OpenCLContext contexts[2];
+    auto current = 0;
 
-    // batch scheduling heuristic.
+    // batch scheduling.
     // Returns the batch picked up from the queue (m_forward_queue)
-    // 1) Wait for m_waittime milliseconds for full batch
-    // 2) if we don't have a full batch then just do a single eval
-    //
-    // The purpose of m_waittime is to prevent the system from deadlocking
-    // because we were waiting for a job too long, while the job is never
-    // going to come due to a control dependency (e.g., evals stuck on a
-    // critical path).  To do so:
+    // 1) Ask the batch controller how many evals to wait for and how long,
+    //    from the arrival rate, the measured batch times and the p99 target
+    // 2) if we don't have that many after the timeout then just take
+    //    whatever is queued
     //
-    // 1) if we couldn't form a batch after waiting m_waittime ms, it means
-    // that we hit the critical path and should do scalar evals.
-    // Wait 1ms shorter next time.
+    // The timeout prevents the system from deadlocking because we were
+    // waiting for a job too long, while the job is never going to come
+    // due to a control dependency (e.g., evals stuck on a critical path).
     //
-    // 2) if we picked up a single eval, but were getting additional evals
-    // while that single eval was being processed, it means that we made
-    // the wrong decision.  Wait 2ms longer next time.
+    // While a batch of this worker is in flight we never wait: the evals
+    // we would wait for may well be stuck behind the results of that batch.
+    // Only a batch that is already queued is picked up, otherwise an
+    // empty list is returned so the batch in flight gets completed first.
 
-    auto pickup_task = [this] () {
-        std::list<std::shared_ptr<ForwardQueueEntry>> inputs;
-        size_t count = 0;
+    auto pickup_task = [this] (std::vector<std::uint32_t> & slots,
+                               const bool in_flight) {
+        Trace::Scope trace("pickup");
+        slots.clear();
 
-        std::unique_lock<std::mutex> lk(m_mutex);
         while (true) {
-            if (!m_running) return inputs;
+            if (m_forward_queue.closed()) return;
+
+            const auto decision = m_batch_controller->decide(
+                m_forward_queue.size(), cfg_batch_latency_target);
 
-            count = m_forward_queue.size();
-            if (count >= cfg_batch_size) {
-                count = cfg_batch_size;
-                break;
+            if (m_forward_queue.pop(slots, decision.batch_size, cfg_batch_size) > 0) {
+                trace.set_arg("batch", slots.size());
+                return;
             }
 
-            bool timeout = !m_cv.wait_for(
-                lk,
-                std::chrono::milliseconds(m_waittime),
-                [this] () {
-                    return !m_running || m_forward_queue.size() >= cfg_batch_size;
-                }
-            );
-
-            if (!m_forward_queue.empty()) {
-                if (timeout && m_single_eval_in_progress.exchange(true) == false) {
-                    // Waited long enough but couldn't form a batch.
-                    // Check if there is any other single eval in progress, and if not,
-                    // do one from this thread.
-                    if (m_waittime > 1) {
-                        m_waittime--;
-                    }
-                    count = 1;
-                    break;
-                }
+            if (in_flight) return;
+
+            bool timeout = !m_forward_queue.wait_for(decision.batch_size,
+                                                     decision.timeout_ms);
+
+            if (timeout && m_forward_queue.pop(slots, 1, cfg_batch_size) > 0) {
+                trace.set_arg("batch", slots.size());
+                return;
             }
         }
-        // Move 'count' evals from shared queue to local list.
-        auto end = begin(m_forward_queue);
-        std::advance(end, count);
-        std::move(begin(m_forward_queue), end, std::back_inserter(inputs));
-        m_forward_queue.erase(begin(m_forward_queue), end);
-
-        return inputs;
     };
 
     auto batch_input = std::vector<float>();
     auto batch_output_pol = std::vector<float>();
     auto batch_output_val = std::vector<float>();
 
+    // The batch enqueued on contexts[1 - current] whose results are
+    // not read back yet.
+    auto slots = std::vector<std::uint32_t>();
+    auto pending = std::vector<std::uint32_t>();
+    auto pending_since = std::chrono::steady_clock::time_point{};
+    auto latencies = std::vector<double>();
+
+    auto complete_pending = [&] () {
+        auto count = pending.size();
+        Trace::Scope trace("complete_batch");
+        trace.set_arg("batch", count);
+        batch_output_pol.resize(out_pol_size * count);
+        batch_output_val.resize(out_val_size * count);
+        m_networks[gnum]->finish_forward(
+            batch_output_pol, batch_output_val, contexts[1 - current]);
+
+        // Get output and copy back
+        latencies.clear();
+        auto index = size_t{0};
+        for (auto slot : pending) {
+            const auto & request = m_forward_queue.request(slot);
+            std::copy(begin(batch_output_pol) + out_pol_size * index,
+                      begin(batch_output_pol) + out_pol_size * (index + 1),
+                      begin(*request.output_pol));
+            std::copy(begin(batch_output_val) + out_val_size * index,
+                      begin(batch_output_val) + out_val_size * (index + 1),
+                      begin(*request.output_val));
+            latencies.push_back(m_forward_queue.complete(slot));
+            index++;
+        }
+        pending.clear();
+
+        const auto service_ms = std::chrono::duration<double, std::milli>(
+            std::chrono::steady_clock::now() - pending_since).count();
+        m_batch_controller->record_batch(count, service_ms, latencies,
+                                         cfg_batch_latency_target);
+    };
+
     while (true) {
-        auto inputs = pickup_task();
-        auto count = inputs.size();
+        pickup_task(slots, !pending.empty());
+        auto count = slots.size();
 
-        if (!m_running) {
+        if (m_forward_queue.closed()) {
+            if (!pending.empty()) {
+                complete_pending();
+            }
             return;
         }
 
+        if (count == 0) {
+            complete_pending();
+            continue;
+        }
+
 #ifndef NDEBUG
         if (count == 1) {
             batch_stats.single_evals++;
@@ -376,36 +444,30 @@ void OpenCLScheduler<net_t>::batch_worker(const size_t gnum) {
 
         // prepare input for forward() call
         batch_input.resize(in_size * count);
-        batch_output_pol.resize(out_pol_size * count);
-        batch_output_val.resize(out_val_size * count);
 
         auto index = size_t{0};
-        for (auto & x : inputs) {
-            std::unique_lock<std::mutex> lk(x->mutex);
-            std::copy(begin(x->in), end(x->in), begin(batch_input) + in_size * index);
+        for (auto slot : slots) {
+            const auto & input = *m_forward_queue.request(slot).input;
+            std::copy(begin(input), end(input), begin(batch_input) + in_size * index);
             index++;
         }
 
-        // run the NN evaluation
-        m_networks[gnum]->forward(
-            batch_input, batch_output_pol, batch_output_val, context, count);
-
-        // Get output and copy back
-        index = 0;
-        for (auto & x : inputs) {
-            std::copy(begin(batch_output_pol) + out_pol_size * index,
-                      begin(batch_output_pol) + out_pol_size * (index + 1),
-                      begin(x->out_p));
-            std::copy(begin(batch_output_val) + out_val_size * index,
-                      begin(batch_output_val) + out_val_size * (index + 1),
-                      begin(x->out_v));
-            x->cv.notify_all();
-            index++;
+        // start the NN evaluation, then read back the previous batch
+        // while this one computes
+        const auto started = std::chrono::steady_clock::now();
+        {
+            Trace::Scope trace("enqueue_forward");
+            trace.set_arg("batch", count);
+            m_networks[gnum]->enqueue_forward(
+                batch_input, contexts[current], count);
         }
 
-        if (count == 1) {
-            m_single_eval_in_progress = false;
+        if (!pending.empty()) {
+            complete_pending();
         }
+        std::swap(pending, slots);
+        pending_since = started;
+        current = 1 - current;
     }
 }
 
@@ -36,7 +36,9 @@
 #include <thread>
 
 #include "SMP.h"
+#include "BatchController.h"
 #include "ForwardPipe.h"
+#include "ForwardQueue.h"
 #include "OpenCL.h"
 #include "ThreadPool.h"
 
@@ -50,19 +52,6 @@ extern batch_stats_t batch_stats;
 
 template <typename net_t>
 class OpenCLScheduler : public ForwardPipe {
-    class ForwardQueueEntry {
-    public:
-        std::mutex mutex;
-        std::condition_variable cv;
-        const std::vector<float>& in;
-        std::vector<float>& out_p;
-        std::vector<float>& out_v;
-        ForwardQueueEntry(const std::vector<float>& input,
-                          std::vector<float>& output_pol,
-                          std::vector<float>& output_val)
-        : in(input), out_p(output_pol), out_v(output_val)
-          {}
-    };
 public:
     virtual ~OpenCLScheduler();
     OpenCLScheduler();
@@ -72,25 +61,20 @@ public:
                          std::vector<float>& output_pol,
                          std::vector<float>& output_val);
     virtual bool needs_autodetect();
+    virtual std::string get_batching_report();
+    virtual BatchStatistics get_batch_statistics();
     virtual void push_weights(unsigned int filter_size,
                               unsigned int channels,
                               unsigned int outputs,
                               std::shared_ptr<const ForwardPipeWeights> weights);
 private:
-    bool m_running = true;
+    // Filters the kernels were built and tuned for
+    unsigned int m_channels{0};
     std::vector<std::unique_ptr<OpenCL_Network<net_t>>> m_networks;
     std::vector<std::unique_ptr<OpenCL<net_t>>> m_opencl;
 
-    std::mutex m_mutex;
-    std::condition_variable m_cv;
-
-    // start with 10 milliseconds : lock protected
-    int m_waittime{10};
-
-    // set to true when single (non-batch) eval is in progress
-    std::atomic<bool> m_single_eval_in_progress{false};
-
-    std::list<std::shared_ptr<ForwardQueueEntry>> m_forward_queue;
+    std::unique_ptr<BatchController> m_batch_controller;
+    ForwardQueue m_forward_queue;
     std::list<std::thread> m_worker_threads;
 
     void batch_worker(const size_t gnum);
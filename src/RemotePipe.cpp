@@ -0,0 +1,128 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2017-2019 Michael O and contributors
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+
+    Additional permission under GNU GPL version 3 section 7
+
+    If you modify this Program, or any covered work, by linking or
+    combining it with NVIDIA Corporation's libraries from the
+    NVIDIA CUDA Toolkit and/or the NVIDIA CUDA Deep Neural
+    Network library and/or the NVIDIA TensorRT inference library
+    (or a modified version of those libraries), containing parts covered
+    by the terms of the respective license agreement, the licensors of
+    this Program grant you additional permission to convey the resulting
+    work.
+*/
+
+#include "config.h"
+
+#ifdef USE_INFERENCE_SERVER
+#include "RemotePipe.h"
+
+#include <algorithm>
+#include <atomic>
+#include <climits>
+#include <stdexcept>
+#include <unistd.h>
+
+/// A client waiting this long checks that the server is still there
+static constexpr auto SERVER_CHECK_MS = 1000;
+
+RemotePipe::RemotePipe(const std::string& name) : m_name(name), m_channel(InferenceChannel::open(name))
+{
+}
+
+void RemotePipe::initialize(const int channels)
+{
+    if (m_channel->header().channels != static_cast<std::uint32_t>(channels))
+        throw std::runtime_error("inference server " + m_name + " runs a network with another number of filters");
+}
+
+void RemotePipe::push_weights(unsigned int /*filter_size*/, unsigned int /*channels*/, const unsigned int outputs, const std::shared_ptr<const ForwardPipeWeights> weights)
+{
+    initialize(static_cast<int>(outputs));
+
+    if (m_channel->header().fingerprint != weights->fingerprint())
+        throw std::runtime_error("inference server " + m_name + " runs another network");
+}
+
+void RemotePipe::check_server() const
+{
+    if (!m_channel->server_alive())
+        throw std::runtime_error("inference server " + m_name + " exited");
+}
+
+InferenceChannel::Slot& RemotePipe::acquire_slot()
+{
+    static std::atomic<int> s_next_thread{0};
+    
+    // Every thread starts looking at its own slot, so that they rarely collide
+    thread_local auto start = s_next_thread++;
+
+    auto& header = m_channel->header();
+    const auto slots = m_channel->slot_count();
+
+    for (;;)
+	{
+        const auto released = header.released.load(std::memory_order_acquire);
+
+        for (auto i = 0; i < slots; i++)
+		{
+            auto& slot = m_channel->slot((start + i) % slots);
+            auto expected = std::int32_t{0};
+
+            // The owner is released after the state, so an unclaimed slot is always FREE
+            if (slot.owner.compare_exchange_strong(expected, getpid(), std::memory_order_acquire))
+			{
+                slot.state.store(InferenceChannel::WRITING, std::memory_order_relaxed);
+                return slot;
+            }
+        }
+
+        // Every slot is in flight, wait for one to be released
+        InferenceChannel::wait(header.released, released, SERVER_CHECK_MS);
+        if (header.released.load() == released)
+            check_server();
+    }
+}
+
+void RemotePipe::forward(const std::vector<float>& input, std::vector<float>& output_pol, std::vector<float>& output_val)
+{
+    auto& header = m_channel->header();
+    auto& slot = acquire_slot();
+
+    std::copy(input.begin(), input.end(), slot.input);
+    slot.state.store(InferenceChannel::QUEUED, std::memory_order_release);
+    header.queued.fetch_add(1, std::memory_order_release);
+    InferenceChannel::wake(header.queued, 1);
+
+    for (auto state = slot.state.load(std::memory_order_acquire); state != InferenceChannel::DONE; state = slot.state.load(std::memory_order_acquire))
+	{
+        InferenceChannel::wait(slot.state, state, SERVER_CHECK_MS);
+        if (slot.state.load(std::memory_order_acquire) == state)
+            check_server();
+    }
+
+    std::copy(slot.policy, slot.policy + InferenceChannel::POLICY_SIZE, output_pol.begin());
+    std::copy(slot.value, slot.value + InferenceChannel::VALUE_SIZE, output_val.begin());
+
+    slot.state.store(InferenceChannel::FREE, std::memory_order_release);
+    slot.owner.store(0, std::memory_order_release);
+    header.released.fetch_add(1, std::memory_order_release);
+    InferenceChannel::wake(header.released, 1);
+}
+
+#endif
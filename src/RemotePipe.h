@@ -0,0 +1,68 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2017-2019 Michael O and contributors
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+
+    Additional permission under GNU GPL version 3 section 7
+
+    If you modify this Program, or any covered work, by linking or
+    combining it with NVIDIA Corporation's libraries from the
+    NVIDIA CUDA Toolkit and/or the NVIDIA CUDA Deep Neural
+    Network library and/or the NVIDIA TensorRT inference library
+    (or a modified version of those libraries), containing parts covered
+    by the terms of the respective license agreement, the licensors of
+    this Program grant you additional permission to convey the resulting
+    work.
+*/
+
+#ifndef REMOTEPIPE_H_INCLUDED
+#define REMOTEPIPE_H_INCLUDED
+
+#include "config.h"
+
+#ifdef USE_INFERENCE_SERVER
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "ForwardPipe.h"
+#include "InferenceChannel.h"
+
+/// Forwards the evaluations to a leelaz-infer server over shared memory, the heads still run in this process
+class RemotePipe : public ForwardPipe
+{
+public:
+
+	/// Attach to the server, throws if it is not running
+	explicit RemotePipe(const std::string& name);
+
+	void initialize(int channels) override;
+	void forward(const std::vector<float>& input, std::vector<float>& output_pol, std::vector<float>& output_val) override;
+	/// The server owns the tower, this only checks that it runs the same network, throws otherwise
+	void push_weights(unsigned int filter_size, unsigned int channels, unsigned int outputs, std::shared_ptr<const ForwardPipeWeights> weights) override;
+
+private:
+
+	/// Claim a free slot, waiting for one if all are in flight
+	InferenceChannel::Slot& acquire_slot();
+	/// Throw if the server went away, called whenever a wait times out
+	void check_server() const;
+
+	std::string m_name;
+	std::unique_ptr<InferenceChannel> m_channel;
+};
+
+#endif
+#endif
@@ -0,0 +1,224 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2017-2019 Michael O and contributors
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+
+    Additional permission under GNU GPL version 3 section 7
+
+    If you modify this Program, or any covered work, by linking or
+    combining it with NVIDIA Corporation's libraries from the
+    NVIDIA CUDA Toolkit and/or the NVIDIA CUDA Deep Neural
+    Network library and/or the NVIDIA TensorRT inference library
+    (or a modified version of those libraries), containing parts covered
+    by the terms of the respective license agreement, the licensors of
+    this Program grant you additional permission to convey the resulting
+    work.
+*/
+
+#include "config.h"
+
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+
+#include <boost/format.hpp>
+
+#include "Replay.h"
+#include "GTP.h"
+#include "Utils.h"
+
+using namespace Utils;
+
+namespace
+{
+    using Clock = std::chrono::steady_clock;
+
+    double milliseconds(const Clock::duration duration)
+	{
+        return std::chrono::duration<double, std::milli>(duration).count();
+    }
+
+    Clock::time_point after(const Clock::time_point start, const double seconds)
+	{
+        return start + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(seconds));
+    }
+
+    /// Nearest rank percentile of sorted values
+    double percentile(const std::vector<double>& sorted, const double fraction)
+	{
+        const auto rank = static_cast<size_t>(std::ceil(fraction * sorted.size()));
+        return sorted[std::max(rank, size_t{1}) - 1];
+    }
+
+    std::string summary(const std::string& name, std::vector<double> values)
+	{
+        if (values.empty())
+            return str(boost::format("%s: none\n") % name);
+
+        std::sort(begin(values), end(values));
+        return str(boost::format("%s: p50 %.1f, p99 %.1f, max %.1f over %d commands\n")
+            % name % percentile(values, 0.5) % percentile(values, 0.99) % values.back() % values.size());
+    }
+
+    std::string format_ms(const double ms)
+	{
+        return ms < 0.0 ? std::string("-") : str(boost::format("%.1f") % ms);
+    }
+}
+
+Replay::Replay(const std::string& filename) : m_filename(filename)
+{
+    std::ifstream file(filename);
+    if (!file)
+        throw std::runtime_error("cannot open " + filename);
+
+    auto line = std::string();
+    while (std::getline(file, line))
+	{
+        // Output lines and comments only document the capture
+        if (line.compare(0, 2, "> ") != 0)
+            continue;
+
+        std::istringstream line_stream(line.substr(2));
+        auto command = Command();
+        if (!(line_stream >> command.seconds))
+            throw std::runtime_error("no timestamp in \"" + line + "\"");
+
+        line_stream.get();
+        std::getline(line_stream, command.text);
+        m_commands.emplace_back(command);
+    }
+}
+
+bool Replay::is_analysis(const std::string& command)
+{
+    return command.find("analyze") != std::string::npos;
+}
+
+bool Replay::ends_session(const std::string& command)
+{
+    std::istringstream command_stream(command);
+    auto word = std::string();
+    command_stream >> word;
+
+    // Skip the id
+    if (!word.empty() && std::isdigit(static_cast<unsigned char>(word[0])))
+        command_stream >> word;
+
+    std::transform(begin(word), end(word), begin(word), [](const unsigned char c) { return static_cast<char>(std::tolower(c)); });
+    return word == "quit" || word == "exit";
+}
+
+std::string Replay::run(GameState& game, const bool max_speed) const
+{
+    std::mutex mutex;
+    auto sent = Clock::now();
+    auto next_due = Clock::time_point::max();
+    auto current = Timing();
+    auto timings = std::vector<Timing>();
+
+    set_output_observer([&](const std::string& line)
+	{
+        std::lock_guard<std::mutex> lock(mutex);
+        const auto elapsed_ms = milliseconds(Clock::now() - sent);
+
+        if (current.response_ms < 0.0 && !line.empty() && (line[0] == '=' || line[0] == '?'))
+            current.response_ms = elapsed_ms;
+        if (current.first_analysis_ms < 0.0 && line.compare(0, 5, "info ") == 0)
+            current.first_analysis_ms = elapsed_ms;
+    });
+
+    // Stops pondering and analysis when the next command is due, as new input on stdin would
+    set_input_pending([&]()
+	{
+        std::lock_guard<std::mutex> lock(mutex);
+        return Clock::now() >= next_due;
+    });
+
+    const auto start = Clock::now();
+
+    for (auto i = size_t{0}; i < m_commands.size() && !ends_session(m_commands[i].text); i++)
+	{
+        const auto& command = m_commands[i];
+        auto late_ms = 0.0;
+
+        if (!max_speed)
+		{
+            const auto due = after(start, command.seconds);
+            std::this_thread::sleep_until(due);
+            late_ms = milliseconds(Clock::now() - due);
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            current = Timing();
+            current.late_ms = late_ms;
+            sent = Clock::now();
+
+            if (i + 1 == m_commands.size())
+                next_due = sent;
+            else if (!max_speed)
+                next_due = after(start, m_commands[i + 1].seconds);
+            else
+                next_due = after(sent, is_analysis(command.text) ? m_commands[i + 1].seconds - command.seconds : 0.0);
+        }
+
+        log_input(command.text);
+        GTP::execute(game, command.text);
+
+        std::lock_guard<std::mutex> lock(mutex);
+        current.total_ms = milliseconds(Clock::now() - sent);
+        timings.emplace_back(current);
+    }
+
+    set_output_observer(nullptr);
+    set_input_pending(nullptr);
+
+    return report(timings, max_speed);
+}
+
+std::string Replay::report(const std::vector<Timing>& timings, const bool max_speed) const
+{
+    std::ostringstream out;
+    auto responses_ms = std::vector<double>();
+    auto first_analyses_ms = std::vector<double>();
+
+    out << boost::format("Replay of %s at %s speed, %d commands\n") % m_filename % (max_speed ? "maximum" : "original") % timings.size();
+    out << boost::format("%5s %9s %12s %14s %10s  %s\n") % "#" % "late ms" % "response ms" % "first info ms" % "total ms" % "command";
+
+    for (auto i = size_t{0}; i < timings.size(); i++)
+	{
+        const auto& timing = timings[i];
+        out << boost::format("%5d %9.1f %12s %14s %10.1f  %s\n")
+            % (i + 1) % timing.late_ms % format_ms(timing.response_ms) % format_ms(timing.first_analysis_ms) % timing.total_ms
+            % m_commands[i].text.substr(0, 60);
+
+        if (timing.response_ms >= 0.0)
+            responses_ms.emplace_back(timing.response_ms);
+        if (timing.first_analysis_ms >= 0.0)
+            first_analyses_ms.emplace_back(timing.first_analysis_ms);
+    }
+
+    out << summary("response ms", responses_ms);
+    out << summary("first info ms", first_analyses_ms);
+
+    return out.str();
+}
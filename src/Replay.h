@@ -0,0 +1,86 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2017-2019 Michael O and contributors
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+
+    Additional permission under GNU GPL version 3 section 7
+
+    If you modify this Program, or any covered work, by linking or
+    combining it with NVIDIA Corporation's libraries from the
+    NVIDIA CUDA Toolkit and/or the NVIDIA CUDA Deep Neural
+    Network library and/or the NVIDIA TensorRT inference library
+    (or a modified version of those libraries), containing parts covered
+    by the terms of the respective license agreement, the licensors of
+    this Program grant you additional permission to convey the resulting
+    work.
+*/
+
+#ifndef REPLAY_H_INCLUDED
+#define REPLAY_H_INCLUDED
+
+#include "config.h"
+
+#include <string>
+#include <vector>
+
+#include "GameState.h"
+
+/// Feeds a GTP session recorded with --capture back to the engine and measures how fast every command is answered, to
+/// reproduce latency spikes offline. At the original speed every command is sent at its recorded time, or as soon as
+/// the engine is done with the previous one when it is late. At maximum speed the idle time between commands is cut:
+/// a command is sent as soon as the previous one is answered, only an analysis still runs as long as it did in the
+/// capture, since it is stopped by the next command.
+class Replay
+{
+public:
+
+    /// Load the input lines of a capture, throws std::runtime_error when the file cannot be read
+    explicit Replay(const std::string& filename);
+
+    /// Execute the commands on the game, except quit and exit, returns the report of their latencies
+    std::string run(GameState& game, bool max_speed) const;
+
+private:
+
+    struct Command
+    {
+        /// Since the start of the capture
+        double seconds;
+        std::string text;
+    };
+
+    /// Milliseconds since the command was sent, negative when it did not happen
+    struct Timing
+    {
+        /// Behind its recorded time, at the original speed
+        double late_ms{0.0};
+        /// First line starting with = or ?
+        double response_ms{-1.0};
+        /// First analysis line, starting with info
+        double first_analysis_ms{-1.0};
+        /// Until the engine took the next command
+        double total_ms{0.0};
+    };
+
+    static bool is_analysis(const std::string& command);
+    static bool ends_session(const std::string& command);
+    std::string report(const std::vector<Timing>& timings, bool max_speed) const;
+
+    std::string m_filename;
+    std::vector<Command> m_commands;
+	
+};
+
+#endif
@@ -29,11 +29,217 @@
 
 #include "SMP.h"
 
+#include <algorithm>
 #include <cassert>
 #include <thread>
 
+#ifdef __linux__
+#include <fstream>
+#include <new>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <linux/futex.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#else
+#include <condition_variable>
+#include <mutex>
+#endif
+
+namespace {
+    constexpr auto MAX_SPINS = 1000;
+    constexpr auto PARKING_BUCKETS = 256;
+
+    struct alignas(64) ParkingBucket {
+        std::atomic<std::uint32_t> sequence{0};
+        std::atomic<std::uint32_t> waiters{0};
+#ifndef __linux__
+        std::mutex mutex;
+        std::condition_variable condvar;
+#endif
+    };
+
+    ParkingBucket s_buckets[PARKING_BUCKETS];
+
+    SMP::Placement s_placement = SMP::Placement::NONE;
+    SMP::HugePages s_huge_pages = SMP::HugePages::OFF;
+    thread_local size_t s_node = 0;
+
+#ifdef __linux__
+    struct Topology {
+        // CPUs we may run on, grouped by node, and the node of each
+        std::vector<int> cpus;
+        std::vector<size_t> cpu_nodes;
+        std::vector<std::vector<int>> nodes;
+    };
+
+    // Parses the kernel format for CPU sets, "0-3,8-11"
+    std::vector<int> parse_cpu_list(const std::string& list) {
+        std::vector<int> cpus;
+        std::istringstream stream(list);
+        std::string range;
+        while (std::getline(stream, range, ',')) {
+            if (range.empty()) {
+                continue;
+            }
+            const auto dash = range.find('-');
+            const auto first = std::stoi(range.substr(0, dash));
+            const auto last = dash == std::string::npos
+                ? first : std::stoi(range.substr(dash + 1));
+            for (auto cpu = first; cpu <= last; cpu++) {
+                cpus.emplace_back(cpu);
+            }
+        }
+        return cpus;
+    }
+
+    Topology read_topology() {
+        cpu_set_t allowed;
+        CPU_ZERO(&allowed);
+        if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0) {
+            for (size_t cpu = 0; cpu < SMP::get_num_cpus(); cpu++) {
+                CPU_SET(cpu, &allowed);
+            }
+        }
+
+        Topology topology;
+        for (auto node = 0; ; node++) {
+            std::ifstream file("/sys/devices/system/node/node"
+                               + std::to_string(node) + "/cpulist");
+            if (!file) {
+                break;
+            }
+            auto list = std::string{};
+            std::getline(file, list);
+
+            auto cpus = std::vector<int>{};
+            for (const auto cpu : parse_cpu_list(list)) {
+                if (CPU_ISSET(cpu, &allowed)) {
+                    cpus.emplace_back(cpu);
+                }
+            }
+            if (!cpus.empty()) {
+                topology.nodes.emplace_back(cpus);
+            }
+        }
+        // No NUMA information, all allowed CPUs make up one node.
+        if (topology.nodes.empty()) {
+            topology.nodes.emplace_back();
+            for (auto cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+                if (CPU_ISSET(cpu, &allowed)) {
+                    topology.nodes.back().emplace_back(cpu);
+                }
+            }
+        }
+        for (size_t node = 0; node < topology.nodes.size(); node++) {
+            for (const auto cpu : topology.nodes[node]) {
+                topology.cpus.emplace_back(cpu);
+                topology.cpu_nodes.emplace_back(node);
+            }
+        }
+        return topology;
+    }
+
+    const Topology& topology() {
+        static const auto topology = read_topology();
+        return topology;
+    }
+
+    void set_affinity(const std::vector<int>& cpus) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        for (const auto cpu : cpus) {
+            CPU_SET(cpu, &set);
+        }
+        // Failing leaves the thread where it was, which is only slower.
+        (void)sched_setaffinity(0, sizeof(set), &set);
+    }
+#endif
+
+    ParkingBucket& bucket_for(const void* address) {
+        // Drop the low bits, they are the same for most objects.
+        auto hash = reinterpret_cast<std::uintptr_t>(address) >> 4;
+        hash ^= hash >> 9;
+        return s_buckets[hash % PARKING_BUCKETS];
+    }
+
+    std::atomic<std::uint64_t> s_lock_waits{0};
+    std::atomic<std::uint64_t> s_lock_parks{0};
+    std::atomic<std::uint64_t> s_expand_waits{0};
+    std::atomic<std::uint64_t> s_expand_parks{0};
+}
+
+int SMP::spin_limit() {
+    static const auto limit = get_num_cpus() > 1 ? MAX_SPINS : 0;
+    return limit;
+}
+
+std::uint32_t SMP::park_begin(const void* address) {
+    auto& bucket = bucket_for(address);
+    bucket.waiters++;
+    return bucket.sequence.load();
+}
+
+void SMP::park_wait(const void* address, std::uint32_t sequence) {
+    auto& bucket = bucket_for(address);
+#ifdef __linux__
+    syscall(SYS_futex, reinterpret_cast<std::uint32_t*>(&bucket.sequence),
+            FUTEX_WAIT_PRIVATE, sequence, nullptr, nullptr, 0);
+#else
+    std::unique_lock<std::mutex> lock(bucket.mutex);
+    bucket.condvar.wait(lock, [&bucket, sequence] {
+        return bucket.sequence.load() != sequence;
+    });
+#endif
+}
+
+void SMP::park_end(const void* address) {
+    bucket_for(address).waiters--;
+}
+
+void SMP::unpark_all(const void* address) {
+    auto& bucket = bucket_for(address);
+    if (bucket.waiters.load() == 0) {
+        return;
+    }
+    // Other addresses can share the bucket, so everyone wakes up and
+    // rechecks its own state.
+#ifdef __linux__
+    bucket.sequence++;
+    syscall(SYS_futex, reinterpret_cast<std::uint32_t*>(&bucket.sequence),
+            FUTEX_WAKE_PRIVATE, INT32_MAX, nullptr, nullptr, 0);
+#else
+    {
+        std::lock_guard<std::mutex> lock(bucket.mutex);
+        bucket.sequence++;
+    }
+    bucket.condvar.notify_all();
+#endif
+}
+
+SMP::ContentionStats SMP::get_contention_stats() {
+    auto stats = ContentionStats{};
+    stats.lock_waits = s_lock_waits.load();
+    stats.lock_parks = s_lock_parks.load();
+    stats.expand_waits = s_expand_waits.load();
+    stats.expand_parks = s_expand_parks.load();
+    return stats;
+}
+
+void SMP::record_expand_wait(bool parked) {
+    s_expand_waits++;
+    if (parked) {
+        s_expand_parks++;
+    }
+}
+
 SMP::Mutex::Mutex() {
-    m_lock = false;
+    m_state = 0;
+    m_spins = 0;
 }
 
 SMP::Lock::Lock(Mutex & m) {
@@ -43,25 +249,52 @@ SMP::Lock::Lock(Mutex & m) {
 
 void SMP::Lock::lock() {
     assert(!m_owns_lock);
-    // Test and Test-and-Set reduces memory contention
-    // However, just trying to Test-and-Set first improves performance in almost
-    // all cases
-    while (m_mutex->m_lock.exchange(true, std::memory_order_acquire)) {
-      while (m_mutex->m_lock.load(std::memory_order_relaxed));
+    auto& state = m_mutex->m_state;
+    auto c = std::uint32_t{0};
+    if (!state.compare_exchange_strong(c, 1, std::memory_order_acquire)) {
+        s_lock_waits++;
+
+        // Spin for a bit longer than it usually took to get this lock,
+        // tracking that average like glibc's adaptive mutexes do.
+        const auto spins = m_mutex->m_spins.load(std::memory_order_relaxed);
+        const auto limit = std::min(spin_limit(), 2 * spins + 10);
+        auto rounds = 0;
+        auto acquired = false;
+        for (; rounds < limit && !acquired; rounds++) {
+            cpu_relax();
+            c = 0;
+            acquired = state.load(std::memory_order_relaxed) == 0
+                && state.compare_exchange_weak(c, 1, std::memory_order_acquire);
+        }
+        m_mutex->m_spins.store(spins + (rounds - spins) / 8,
+                               std::memory_order_relaxed);
+
+        if (!acquired) {
+            // Mark the lock as having sleepers, so unlock() wakes us.
+            s_lock_parks++;
+            while (state.exchange(2, std::memory_order_acquire) != 0) {
+                park_until(&state, [&state] {
+                    return state.load() != 2;
+                });
+            }
+        }
     }
     m_owns_lock = true;
 }
 
 void SMP::Lock::unlock() {
     assert(m_owns_lock);
-    auto lock_held = m_mutex->m_lock.exchange(false, std::memory_order_release);
+    auto& state = m_mutex->m_state;
+    // Sequentially consistent, so that either we see a sleeper or the
+    // sleeper sees the lock released before it goes to sleep.
+    auto previous = state.exchange(0);
 
     // If this fails it means we are unlocking an unlocked lock
-#ifdef NDEBUG
-    (void)lock_held;
-#else
-    assert(lock_held);
-#endif
+    assert(previous != 0);
+
+    if (previous == 2) {
+        unpark_all(&state);
+    }
     m_owns_lock = false;
 }
 
@@ -76,3 +309,100 @@ SMP::Lock::~Lock() {
 size_t SMP::get_num_cpus() {
     return std::thread::hardware_concurrency();
 }
+
+void SMP::set_placement(Placement placement) {
+    s_placement = placement;
+}
+
+SMP::Placement SMP::get_placement() {
+    return s_placement;
+}
+
+size_t SMP::get_num_nodes() {
+#ifdef __linux__
+    return topology().nodes.size();
+#else
+    return 1;
+#endif
+}
+
+void SMP::pin_current_thread(size_t index) {
+#ifdef __linux__
+    const auto& cpus = topology();
+    if (s_placement == Placement::CORES && !cpus.cpus.empty()) {
+        const auto slot = index % cpus.cpus.size();
+        set_affinity({cpus.cpus[slot]});
+        s_node = cpus.cpu_nodes[slot];
+    } else if (s_placement == Placement::NODES) {
+        s_node = index % cpus.nodes.size();
+        set_affinity(cpus.nodes[s_node]);
+    }
+#else
+    (void)index;
+#endif
+}
+
+size_t SMP::current_node() {
+    return s_node;
+}
+
+void SMP::run_on_node(size_t node, const std::function<void()>& work) {
+    std::thread worker([node, &work] {
+#ifdef __linux__
+        const auto& cpus = topology();
+        if (node < cpus.nodes.size()) {
+            set_affinity(cpus.nodes[node]);
+            s_node = node;
+        }
+#else
+        (void)node;
+#endif
+        work();
+    });
+    worker.join();
+}
+
+void SMP::set_huge_pages(HugePages mode) {
+    s_huge_pages = mode;
+}
+
+SMP::HugePages SMP::get_huge_pages() {
+    return s_huge_pages;
+}
+
+void* SMP::allocate_pages(size_t bytes) {
+    assert(bytes % HUGE_PAGE_SIZE == 0);
+#ifdef __linux__
+    if (s_huge_pages == HugePages::EXPLICIT) {
+        const auto pages = mmap(nullptr, bytes, PROT_READ | PROT_WRITE,
+                                MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB,
+                                -1, 0);
+        if (pages != MAP_FAILED) {
+            return pages;
+        }
+    }
+
+    // The kernel only puts transparent huge pages in aligned ranges, so
+    // map one page more than asked and trim both ends to the boundary.
+    const auto mapped = mmap(nullptr, bytes + HUGE_PAGE_SIZE,
+                             PROT_READ | PROT_WRITE,
+                             MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mapped == MAP_FAILED) {
+        throw std::bad_alloc();
+    }
+    const auto start = reinterpret_cast<std::uintptr_t>(mapped);
+    const auto aligned = (start + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1);
+    if (aligned > start) {
+        munmap(mapped, aligned - start);
+    }
+    if (start + HUGE_PAGE_SIZE > aligned) {
+        munmap(reinterpret_cast<void*>(aligned + bytes),
+               start + HUGE_PAGE_SIZE - aligned);
+    }
+    const auto pages = reinterpret_cast<void*>(aligned);
+    madvise(pages, bytes, MADV_HUGEPAGE);
+    return pages;
+#else
+    return ::operator new(bytes);
+#endif
+}
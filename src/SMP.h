@@ -33,18 +33,125 @@
 #include "config.h"
 
 #include <cstddef>
+#include <cstdint>
 #include <atomic>
+#include <functional>
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#include <immintrin.h>
+#endif
 
 namespace SMP {
     size_t get_num_cpus();
 
+    // Where worker threads run. CORES gives every thread a core of its
+    // own, filling the first NUMA node before the next. NODES spreads
+    // threads round robin over the nodes and lets each float between
+    // the cores of its node.
+    enum class Placement { NONE, CORES, NODES };
+    void set_placement(Placement placement);
+    Placement get_placement();
+
+    // Number of NUMA nodes this process may run on, 1 when unknown.
+    size_t get_num_nodes();
+
+    // Move the calling thread where the placement puts worker number
+    // index. Does nothing without a placement or off Linux.
+    void pin_current_thread(size_t index);
+
+    // Node the calling thread is pinned to, 0 for unpinned threads.
+    size_t current_node();
+
+    // Run work on a thread pinned to the node and wait for it, so the
+    // pages it touches first are allocated on that node.
+    void run_on_node(size_t node, const std::function<void()>& work);
+
+    // Memory for the search tree and the cache. TRANSPARENT asks the
+    // kernel to back it with huge pages when it can, EXPLICIT takes
+    // them from the reserved pool and falls back to TRANSPARENT when
+    // the pool is empty.
+    enum class HugePages { OFF, TRANSPARENT, EXPLICIT };
+    void set_huge_pages(HugePages mode);
+    HugePages get_huge_pages();
+
+    constexpr size_t HUGE_PAGE_SIZE = 2 * 1024 * 1024;
+
+    // Allocate bytes, a multiple of HUGE_PAGE_SIZE, aligned on a huge
+    // page boundary. Never returned to the system.
+    void* allocate_pages(size_t bytes);
+
+    // Tell the CPU we are in a spin-wait loop, so it can give the
+    // pipeline to the other hyperthread and save some power.
+    inline void cpu_relax() {
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+        _mm_pause();
+#elif defined(__aarch64__) || defined(__arm__)
+        __asm__ __volatile__("yield");
+#endif
+    }
+
+    // Maximum number of rounds a waiter spins before going to sleep.
+    // Zero on a single CPU, where the thread we wait for cannot run
+    // while we spin.
+    int spin_limit();
+
+    // Spin until stop_waiting() holds, for at most limit rounds.
+    template <class Predicate>
+    bool spin_until(Predicate stop_waiting, int limit) {
+        for (auto i = 0; i < limit; i++) {
+            if (stop_waiting()) {
+                return true;
+            }
+            cpu_relax();
+        }
+        return stop_waiting();
+    }
+
+    // Parking lot: a thread sleeps keyed on an address until another
+    // thread changes the state at that address and calls unpark_all().
+    // Waiters are hashed on a fixed table of futex words, so this needs
+    // no storage in the object that is waited on.
+    std::uint32_t park_begin(const void* address);
+    void park_wait(const void* address, std::uint32_t sequence);
+    void park_end(const void* address);
+    void unpark_all(const void* address);
+
+    template <class Predicate>
+    void park_until(const void* address, Predicate stop_waiting) {
+        for (;;) {
+            // Register before checking, an unpark_all() that comes after
+            // the check then changes the sequence and park_wait() returns.
+            const auto sequence = park_begin(address);
+            if (stop_waiting()) {
+                park_end(address);
+                return;
+            }
+            park_wait(address, sequence);
+            park_end(address);
+        }
+    }
+
+    // Counted on the slow paths only: how often a waiter found the lock
+    // taken or the node being expanded, and how often it had to sleep.
+    struct ContentionStats {
+        std::uint64_t lock_waits{0};
+        std::uint64_t lock_parks{0};
+        std::uint64_t expand_waits{0};
+        std::uint64_t expand_parks{0};
+    };
+    ContentionStats get_contention_stats();
+    void record_expand_wait(bool parked);
+
     class Mutex {
     public:
         Mutex();
         ~Mutex() = default;
         friend class Lock;
     private:
-        std::atomic<bool> m_lock;
+        // 0 unlocked, 1 locked, 2 locked and maybe threads sleeping on it
+        std::atomic<std::uint32_t> m_state;
+        // average number of spin rounds that got us the lock
+        std::atomic<std::int32_t> m_spins;
     };
 
     class Lock {
@@ -0,0 +1,140 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2017-2019 Michael O and contributors
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+
+    Additional permission under GNU GPL version 3 section 7
+
+    If you modify this Program, or any covered work, by linking or
+    combining it with NVIDIA Corporation's libraries from the
+    NVIDIA CUDA Toolkit and/or the NVIDIA CUDA Deep Neural
+    Network library and/or the NVIDIA TensorRT inference library
+    (or a modified version of those libraries), containing parts covered
+    by the terms of the respective license agreement, the licensors of
+    this Program grant you additional permission to convey the resulting
+    work.
+*/
+
+#include "config.h"
+
+#ifdef USE_OPENCL_SELFCHECK
+#include "SelfCheck.h"
+
+#include <utility>
+
+SelfCheck::SelfCheck(verify_function verify, const size_t capacity) : m_verify(std::move(verify)), m_capacity(capacity), m_thread(&SelfCheck::worker, this)
+{
+}
+
+SelfCheck::~SelfCheck()
+{
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_exit = true;
+    }
+	
+    m_condvar.notify_all();
+    m_thread.join();
+}
+
+bool SelfCheck::push(Job&& job, const bool force)
+{
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+
+        if (m_jobs.size() >= m_capacity) 
+		{
+            // A search thread never waits for the verifier, the check is skipped instead
+            if (!force)
+                return false;
+        	
+            m_condvar.wait(lock, [this] { return m_jobs.size() < m_capacity; });
+        }
+
+        m_jobs.emplace_back(std::move(job));
+    }
+	
+    m_condvar.notify_all();
+    return true;
+}
+
+void SelfCheck::wait_idle()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_condvar.wait(lock, [this] { return m_jobs.empty() && !m_busy; });
+}
+
+void SelfCheck::rethrow_failure()
+{
+    if (!m_failed.load(std::memory_order_acquire))
+        return;
+	
+    std::exception_ptr failure;
+	
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        std::swap(failure, m_failure);
+        m_failed.store(false, std::memory_order_relaxed);
+    }
+
+    if (failure != nullptr)
+        std::rethrow_exception(failure);
+}
+
+void SelfCheck::worker()
+{
+    while (true) 
+	{
+        Job job;
+    	
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_condvar.wait(lock, [this] { return m_exit || !m_jobs.empty(); });
+        	
+            if (m_exit)
+                return;
+
+            job = std::move(m_jobs.front());
+            m_jobs.pop_front();
+            m_busy = true;
+        }
+
+        std::exception_ptr failure;
+    	
+        try 
+		{
+            m_verify(job);
+        }
+    	catch (...) 
+		{
+            failure = std::current_exception();
+        }
+
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_busy = false;
+
+            // Only the first mismatch matters, it is fatal for the caller anyway
+            if (failure != nullptr && m_failure == nullptr) 
+			{
+                m_failure = failure;
+                m_failed.store(true, std::memory_order_release);
+            }
+        }
+    	
+        m_condvar.notify_all();
+    }
+}
+#endif
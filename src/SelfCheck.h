@@ -0,0 +1,94 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2017-2019 Michael O and contributors
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+
+    Additional permission under GNU GPL version 3 section 7
+
+    If you modify this Program, or any covered work, by linking or
+    combining it with NVIDIA Corporation's libraries from the
+    NVIDIA CUDA Toolkit and/or the NVIDIA CUDA Deep Neural
+    Network library and/or the NVIDIA TensorRT inference library
+    (or a modified version of those libraries), containing parts covered
+    by the terms of the respective license agreement, the licensors of
+    this Program grant you additional permission to convey the resulting
+    work.
+*/
+
+#ifndef SELFCHECK_H_INCLUDED
+#define SELFCHECK_H_INCLUDED
+
+#include "config.h"
+
+#ifdef USE_OPENCL_SELFCHECK
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "NNCache.h"
+
+/// Background verifier of network evaluations, so that a reference forward pass never stalls a search thread
+class SelfCheck
+{
+public:
+
+	/// An evaluation to verify, the input planes of the symmetry it was done with and its result
+    struct Job
+	{
+        std::vector<float> input_data;
+        int symmetry{0};
+        NNCache::Netresult result;
+    };
+
+	/// Recomputes the job with the reference implementation, throws on a mismatch
+    using verify_function = std::function<void(const Job&)>;
+
+    explicit SelfCheck(verify_function verify, size_t capacity = SELFCHECK_QUEUE_SIZE);
+    ~SelfCheck();
+
+	/// Queue a job for the verifier thread, when the queue is full it is dropped unless forced, in which case this waits for room
+    bool push(Job&& job, bool force = false);
+	/// Wait until every queued job has been verified
+    void wait_idle();
+	/// Throw the first mismatch found by the verifier thread on the calling thread, then forget it
+    void rethrow_failure();
+
+private:
+
+    void worker();
+
+    verify_function m_verify;
+    size_t m_capacity;
+
+    std::mutex m_mutex;
+    std::condition_variable m_condvar;
+    std::deque<Job> m_jobs;
+    bool m_busy{false};
+    bool m_exit{false};
+    std::exception_ptr m_failure;
+	/// Set with m_failure, so that the callers only lock when there is something to throw
+    std::atomic<bool> m_failed{false};
+
+	/// Last member, so that everything it uses exists before it starts
+    std::thread m_thread;
+};
+
+#endif
+#endif
@@ -27,20 +27,228 @@
 */
 
 #include <cstddef>
+#include <cstdint>
 #include <vector>
+#include <deque>
 #include <thread>
-#include <queue>
 #include <mutex>
 #include <condition_variable>
 #include <memory>
 #include <future>
 #include <functional>
+#include <atomic>
+#include <exception>
+#include <new>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
 
 namespace Utils {
 
+// A queued unit of work.  Callables up to INLINE_SIZE bytes live inside the
+// task itself, and finished tasks go back to a small per-thread free list,
+// so a warm pool schedules work without touching the allocator.
+class Task {
+public:
+    static constexpr std::size_t INLINE_SIZE = 48;
+
+    template<class F>
+    static Task* create(F&& f);
+
+    // run the callable, destroy it and recycle the task.
+    void run();
+
+private:
+    using storage_t = typename std::aligned_storage<INLINE_SIZE,
+                                                    alignof(std::max_align_t)>::type;
+
+    template<class Fn, bool Inline>
+    struct Ops;
+
+    class FreeList {
+    public:
+        static constexpr std::size_t MAX_CACHED = 256;
+        ~FreeList();
+        Task* acquire();
+        void release(Task* task);
+        static FreeList& local();
+    private:
+        Task* m_head{nullptr};
+        std::size_t m_count{0};
+    };
+
+    Task() = default;
+
+    storage_t m_storage;
+    void (*m_run)(void*){nullptr};
+    Task* m_next{nullptr};
+};
+
+template<class Fn>
+struct Task::Ops<Fn, true> {
+    template<class F>
+    static void construct(void* storage, F&& f) {
+        new (storage) Fn(std::forward<F>(f));
+    }
+    static void run(void* storage) {
+        auto fn = static_cast<Fn*>(storage);
+        struct Destroy {
+            Fn* fn;
+            ~Destroy() { fn->~Fn(); }
+        } destroy{fn};
+        (*fn)();
+    }
+};
+
+template<class Fn>
+struct Task::Ops<Fn, false> {
+    template<class F>
+    static void construct(void* storage, F&& f) {
+        *static_cast<Fn**>(storage) = new Fn(std::forward<F>(f));
+    }
+    static void run(void* storage) {
+        auto fn = std::unique_ptr<Fn>(*static_cast<Fn**>(storage));
+        (*fn)();
+    }
+};
+
+template<class F>
+Task* Task::create(F&& f) {
+    using Fn = typename std::decay<F>::type;
+    using FnOps = Ops<Fn, sizeof(Fn) <= INLINE_SIZE
+                          && alignof(Fn) <= alignof(std::max_align_t)>;
+
+    auto task = FreeList::local().acquire();
+    try {
+        FnOps::construct(&task->m_storage, std::forward<F>(f));
+    } catch (...) {
+        FreeList::local().release(task);
+        throw;
+    }
+    task->m_run = &FnOps::run;
+    return task;
+}
+
+inline void Task::run() {
+    struct Recycle {
+        Task* task;
+        ~Recycle() { FreeList::local().release(task); }
+    } recycle{this};
+    m_run(&m_storage);
+}
+
+inline Task::FreeList::~FreeList() {
+    while (m_head) {
+        auto next = m_head->m_next;
+        delete m_head;
+        m_head = next;
+    }
+}
+
+inline Task* Task::FreeList::acquire() {
+    if (!m_head) {
+        return new Task();
+    }
+    auto task = m_head;
+    m_head = task->m_next;
+    m_count--;
+    return task;
+}
+
+inline void Task::FreeList::release(Task* task) {
+    if (m_count >= MAX_CACHED) {
+        delete task;
+        return;
+    }
+    task->m_next = m_head;
+    m_head = task;
+    m_count++;
+}
+
+inline Task::FreeList& Task::FreeList::local() {
+    static thread_local FreeList free_list;
+    return free_list;
+}
+
+// Chase-Lev work-stealing deque (Le et al., "Correct and Efficient
+// Work-Stealing for Weak Memory Models", 2013).  The owning thread pushes
+// and pops at the bottom, any other thread steals from the top.  The ring
+// has a fixed size; push fails when it is full and the caller queues the
+// task elsewhere.
+class WorkDeque {
+public:
+    static constexpr std::int64_t CAPACITY = 1024;
+
+    bool push(Task* task);
+    Task* pop();
+    Task* steal();
+
+private:
+    static constexpr std::int64_t MASK = CAPACITY - 1;
+
+    std::atomic<std::int64_t> m_top{0};
+    std::atomic<std::int64_t> m_bottom{0};
+    std::atomic<Task*> m_tasks[CAPACITY] = {};
+};
+
+inline bool WorkDeque::push(Task* task) {
+    const auto bottom = m_bottom.load(std::memory_order_relaxed);
+    const auto top = m_top.load(std::memory_order_acquire);
+    if (bottom - top >= CAPACITY) {
+        return false;
+    }
+    m_tasks[bottom & MASK].store(task, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    m_bottom.store(bottom + 1, std::memory_order_relaxed);
+    return true;
+}
+
+inline Task* WorkDeque::pop() {
+    const auto bottom = m_bottom.load(std::memory_order_relaxed) - 1;
+    m_bottom.store(bottom, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    auto top = m_top.load(std::memory_order_relaxed);
+    if (top > bottom) {
+        m_bottom.store(bottom + 1, std::memory_order_relaxed);
+        return nullptr;
+    }
+    auto task = m_tasks[bottom & MASK].load(std::memory_order_relaxed);
+    if (top == bottom) {
+        // last task, race the thieves for it
+        if (!m_top.compare_exchange_strong(top, top + 1,
+                                           std::memory_order_seq_cst,
+                                           std::memory_order_relaxed)) {
+            task = nullptr;
+        }
+        m_bottom.store(bottom + 1, std::memory_order_relaxed);
+    }
+    return task;
+}
+
+inline Task* WorkDeque::steal() {
+    auto top = m_top.load(std::memory_order_acquire);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    const auto bottom = m_bottom.load(std::memory_order_acquire);
+    if (top >= bottom) {
+        return nullptr;
+    }
+    auto task = m_tasks[top & MASK].load(std::memory_order_relaxed);
+    if (!m_top.compare_exchange_strong(top, top + 1,
+                                       std::memory_order_seq_cst,
+                                       std::memory_order_relaxed)) {
+        return nullptr;
+    }
+    return task;
+}
+
+// Each worker owns a WorkDeque.  Tasks queued from inside a worker go to
+// its own deque, tasks queued from any other thread go to a shared list,
+// and idle workers steal from the others before going to sleep.
 class ThreadPool {
 public:
-    ThreadPool() = default;
+    static constexpr std::size_t MAX_THREADS = 512;
+
+    ThreadPool();
     ~ThreadPool();
 
     // create worker threads.  This version has no initializers.
@@ -52,31 +260,62 @@ public:
     template<class F, class... Args>
     auto add_task(F&& f, Args&&... args)
         -> std::future<typename std::result_of<F(Args...)>::type>;
+
+    // queue tasks without a future, the caller tracks their completion.
+    // A batch is queued under a single lock.
+    void submit(Task* task);
+    void submit(const std::vector<Task*>& tasks);
+
+    // called from one of our workers: run one queued task, if there is
+    // one, so that a worker waiting on other tasks keeps the pool moving.
+    bool run_pending_task();
+
 private:
+    struct Worker {
+        ThreadPool* pool{nullptr};
+        std::size_t index{0};
+    };
+    static Worker& current_worker();
+
+    void worker_loop(std::size_t index);
+    Task* find_task(std::size_t index);
+    void wake(std::size_t count);
+
     std::vector<std::thread> m_threads;
-    std::queue<std::function<void()>> m_tasks;
+    std::vector<std::unique_ptr<WorkDeque>> m_deques;
+    std::atomic<std::size_t> m_num_deques{0};
 
+    // tasks queued from outside the pool, and sleeping workers
+    std::deque<Task*> m_injected;
+    std::atomic<std::size_t> m_num_injected{0};
     std::mutex m_mutex;
     std::condition_variable m_condvar;
+    std::atomic<std::size_t> m_sleeping{0};
     bool m_exit{false};
+
+    // tasks queued anywhere and not yet taken by a worker
+    std::atomic<std::size_t> m_pending{0};
 };
 
+inline ThreadPool::ThreadPool() : m_deques(MAX_THREADS) {}
+
+inline ThreadPool::Worker& ThreadPool::current_worker() {
+    static thread_local Worker worker;
+    return worker;
+}
+
 inline void ThreadPool::add_thread(std::function<void()> initializer) {
-    m_threads.emplace_back([this, initializer] {
+    const auto index = m_threads.size();
+    if (index >= MAX_THREADS) {
+        throw std::runtime_error("Too many threads in the pool.");
+    }
+    m_deques[index].reset(new WorkDeque());
+    m_num_deques.store(index + 1, std::memory_order_release);
+
+    m_threads.emplace_back([this, index, initializer] {
+        current_worker() = Worker{this, index};
         initializer();
-        for (;;) {
-            std::function<void()> task;
-            {
-                std::unique_lock<std::mutex> lock(m_mutex);
-                m_condvar.wait(lock, [this]{ return m_exit || !m_tasks.empty(); });
-                if (m_exit && m_tasks.empty()) {
-                    return;
-                }
-                task = std::move(m_tasks.front());
-                m_tasks.pop();
-            }
-            task();
-        }
+        worker_loop(index);
     });
 }
 
@@ -86,21 +325,108 @@ inline void ThreadPool::initialize(size_t threads) {
     }
 }
 
+inline void ThreadPool::worker_loop(std::size_t index) {
+    for (;;) {
+        auto task = find_task(index);
+        if (task) {
+            task->run();
+            continue;
+        }
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_sleeping++;
+        m_condvar.wait(lock, [this]{ return m_exit || m_pending > 0; });
+        m_sleeping--;
+        if (m_exit && m_pending == 0) {
+            return;
+        }
+    }
+}
+
+inline Task* ThreadPool::find_task(std::size_t index) {
+    auto task = m_deques[index]->pop();
+    if (!task && m_num_injected > 0) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (!m_injected.empty()) {
+            task = m_injected.front();
+            m_injected.pop_front();
+            m_num_injected--;
+        }
+    }
+    if (!task) {
+        const auto num_deques = m_num_deques.load(std::memory_order_acquire);
+        for (auto i = size_t{1}; i < num_deques && !task; i++) {
+            task = m_deques[(index + i) % num_deques]->steal();
+        }
+    }
+    if (task) {
+        m_pending--;
+    }
+    return task;
+}
+
+inline void ThreadPool::wake(std::size_t count) {
+    if (m_sleeping == 0) {
+        return;
+    }
+    {
+        // a worker between checking for work and waiting holds the lock
+        std::lock_guard<std::mutex> lock(m_mutex);
+    }
+    if (count == 1) {
+        m_condvar.notify_one();
+    } else {
+        m_condvar.notify_all();
+    }
+}
+
+inline void ThreadPool::submit(Task* task) {
+    m_pending++;
+    const auto& worker = current_worker();
+    if (worker.pool != this || !m_deques[worker.index]->push(task)) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_injected.push_back(task);
+        m_num_injected++;
+    }
+    wake(1);
+}
+
+inline void ThreadPool::submit(const std::vector<Task*>& tasks) {
+    if (tasks.empty()) {
+        return;
+    }
+    m_pending += tasks.size();
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_injected.insert(end(m_injected), begin(tasks), end(tasks));
+        m_num_injected += tasks.size();
+    }
+    wake(tasks.size());
+}
+
+inline bool ThreadPool::run_pending_task() {
+    const auto& worker = current_worker();
+    if (worker.pool != this) {
+        return false;
+    }
+    auto task = find_task(worker.index);
+    if (!task) {
+        return false;
+    }
+    task->run();
+    return true;
+}
+
 template<class F, class... Args>
 auto ThreadPool::add_task(F&& f, Args&&... args)
     -> std::future<typename std::result_of<F(Args...)>::type> {
     using return_type = typename std::result_of<F(Args...)>::type;
 
-    auto task = std::make_shared< std::packaged_task<return_type()> >(
+    auto task = std::packaged_task<return_type()>(
         std::bind(std::forward<F>(f), std::forward<Args>(args)...)
     );
 
-    std::future<return_type> res = task->get_future();
-    {
-        std::unique_lock<std::mutex> lock(m_mutex);
-        m_tasks.emplace([task](){(*task)();});
-    }
-    m_condvar.notify_one();
+    std::future<return_type> res = task.get_future();
+    submit(Task::create(std::move(task)));
     return res;
 }
 
@@ -115,23 +441,74 @@ inline ThreadPool::~ThreadPool() {
     }
 }
 
+// Tasks of a group count down a shared counter, wait_all() sleeps until it
+// reaches zero and rethrows the first exception any task threw.
 class ThreadGroup {
 public:
-    ThreadGroup(ThreadPool & pool) : m_pool(pool) {}
+    ThreadGroup(ThreadPool & pool)
+        : m_pool(pool), m_state(std::make_shared<State>()) {}
     template<class F, class... Args>
     void add_task(F&& f, Args&&... args) {
-        m_taskresults.emplace_back(
-            m_pool.add_task(std::forward<F>(f), std::forward<Args>(args)...)
-        );
+        m_state->pending++;
+        m_pool.submit(make_task(
+            std::bind(std::forward<F>(f), std::forward<Args>(args)...)));
+    }
+    // queue count copies of f in one batch.
+    template<class F>
+    void add_tasks(std::size_t count, const F& f) {
+        auto tasks = std::vector<Task*>();
+        tasks.reserve(count);
+        for (auto i = size_t{0}; i < count; i++) {
+            tasks.emplace_back(make_task(f));
+        }
+        m_state->pending += count;
+        m_pool.submit(tasks);
     }
     void wait_all() {
-        for (auto && result : m_taskresults) {
-            result.get();
+        // a worker of the pool helps instead of sleeping, the tasks
+        // it waits for may well be queued in its own deque.
+        while (m_state->pending > 0) {
+            if (!m_pool.run_pending_task()) {
+                break;
+            }
+        }
+        std::unique_lock<std::mutex> lock(m_state->mutex);
+        m_state->condvar.wait(lock, [this]{ return m_state->pending == 0; });
+        if (m_state->exception) {
+            auto exception = m_state->exception;
+            m_state->exception = nullptr;
+            std::rethrow_exception(exception);
         }
     }
 private:
+    struct State {
+        std::atomic<std::size_t> pending{0};
+        std::mutex mutex;
+        std::condition_variable condvar;
+        std::exception_ptr exception;
+    };
+
+    template<class F>
+    Task* make_task(F&& f) {
+        auto state = m_state;
+        return Task::create([state, fn = std::forward<F>(f)]() mutable {
+            try {
+                fn();
+            } catch (...) {
+                std::lock_guard<std::mutex> lock(state->mutex);
+                if (!state->exception) {
+                    state->exception = std::current_exception();
+                }
+            }
+            if (--state->pending == 0) {
+                std::lock_guard<std::mutex> lock(state->mutex);
+                state->condvar.notify_all();
+            }
+        });
+    }
+
     ThreadPool & m_pool;
-    std::vector<std::future<void>> m_taskresults;
+    std::shared_ptr<State> m_state;
 };
 
 }
@@ -0,0 +1,185 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2017-2019 Michael O and contributors
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+
+    Additional permission under GNU GPL version 3 section 7
+
+    If you modify this Program, or any covered work, by linking or
+    combining it with NVIDIA Corporation's libraries from the
+    NVIDIA CUDA Toolkit and/or the NVIDIA CUDA Deep Neural
+    Network library and/or the NVIDIA TensorRT inference library
+    (or a modified version of those libraries), containing parts covered
+    by the terms of the respective license agreement, the licensors of
+    this Program grant you additional permission to convey the resulting
+    work.
+*/
+
+#include "config.h"
+
+#include <chrono>
+#include <cstdio>
+#include <mutex>
+#include <vector>
+
+#include "Trace.h"
+
+namespace
+{
+    struct Event
+	{
+        const char* name;
+        const char* arg_name;
+        std::int64_t arg;
+        std::int64_t start_ns;
+        /// Negative for an instant event
+        std::int64_t duration_ns;
+    };
+
+    /// Events of one thread, written only by that thread
+    struct Ring
+	{
+        explicit Ring(const int tid) : tid(tid), events(Trace::RING_CAPACITY) {}
+
+        const int tid;
+        std::vector<Event> events;
+        /// Events recorded since the last start, the slot of an event is its index modulo the capacity
+        std::atomic<std::uint64_t> head{0};
+        /// Generation of the events in the ring, older than the current one when the thread has not recorded since
+        std::atomic<std::uint32_t> generation{0};
+    };
+
+    const auto s_epoch = std::chrono::steady_clock::now();
+
+    /// Bumped by every start(), the rings left at an older one are empty
+    std::atomic<std::uint32_t> s_generation{0};
+
+    /// Rings of all threads that ever recorded, leaked on purpose so that threads exiting during static destruction
+    /// can still record
+    std::mutex& rings_mutex()
+	{
+        static auto mutex = new std::mutex();
+        return *mutex;
+    }
+
+    std::vector<Ring*>& all_rings()
+	{
+        static auto rings = new std::vector<Ring*>();
+        return *rings;
+    }
+
+    Ring& local_ring()
+	{
+        static thread_local Ring* ring = nullptr;
+        if (!ring)
+		{
+            std::lock_guard<std::mutex> lock(rings_mutex());
+            ring = new Ring(static_cast<int>(all_rings().size()) + 1);
+            all_rings().emplace_back(ring);
+        }
+        return *ring;
+    }
+
+    void push(const Event& event)
+	{
+        auto& ring = local_ring();
+
+        // Only the thread of the ring writes it, the first event since a start drops the older ones
+        const auto generation = s_generation.load(std::memory_order_acquire);
+        if (ring.generation.load(std::memory_order_relaxed) != generation)
+		{
+            ring.head.store(0, std::memory_order_relaxed);
+            ring.generation.store(generation, std::memory_order_release);
+        }
+
+        const auto head = ring.head.load(std::memory_order_relaxed);
+        ring.events[head % Trace::RING_CAPACITY] = event;
+        ring.head.store(head + 1, std::memory_order_release);
+    }
+
+    void write_event(FILE* file, const Event& event, const int tid)
+	{
+        fprintf(file, ",\n{\"name\":\"%s\",\"pid\":1,\"tid\":%d,\"ts\":%.3f", event.name, tid, event.start_ns / 1000.0);
+
+        if (event.duration_ns < 0)
+            fprintf(file, ",\"ph\":\"i\",\"s\":\"t\"");
+        else
+            fprintf(file, ",\"ph\":\"X\",\"dur\":%.3f", event.duration_ns / 1000.0);
+
+        if (event.arg_name)
+            fprintf(file, ",\"args\":{\"%s\":%lld}", event.arg_name, static_cast<long long>(event.arg));
+
+        fprintf(file, "}");
+    }
+}
+
+std::atomic<bool> Trace::s_enabled{false};
+
+void Trace::start()
+{
+    s_generation.fetch_add(1, std::memory_order_release);
+    s_enabled.store(true);
+}
+
+void Trace::stop()
+{
+    s_enabled.store(false);
+}
+
+bool Trace::write(const std::string& filename)
+{
+    const auto file = fopen(filename.c_str(), "w");
+    if (!file)
+        return false;
+
+    fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    fprintf(file, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"%s\"}}", PROGRAM_NAME);
+
+    {
+        const auto generation = s_generation.load(std::memory_order_acquire);
+
+        std::lock_guard<std::mutex> lock(rings_mutex());
+        for (const auto ring : all_rings())
+		{
+            if (ring->generation.load(std::memory_order_acquire) != generation)
+                continue;
+
+            const auto head = ring->head.load(std::memory_order_acquire);
+            const auto first = head > RING_CAPACITY ? head - RING_CAPACITY : 0;
+
+            for (auto i = first; i < head; i++)
+                write_event(file, ring->events[i % RING_CAPACITY], ring->tid);
+        }
+    }
+
+    fprintf(file, "\n]}\n");
+    return fclose(file) == 0;
+}
+
+void Trace::instant(const char* name)
+{
+    if (enabled())
+        push({name, nullptr, 0, now_ns(), -1});
+}
+
+std::int64_t Trace::now_ns()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - s_epoch).count();
+}
+
+void Trace::record(const char* name, const std::int64_t start_ns, const std::int64_t duration_ns, const char* arg_name, const std::int64_t arg)
+{
+    push({name, arg_name, arg, start_ns, duration_ns});
+}
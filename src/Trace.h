@@ -0,0 +1,107 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2017-2019 Michael O and contributors
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+
+    Additional permission under GNU GPL version 3 section 7
+
+    If you modify this Program, or any covered work, by linking or
+    combining it with NVIDIA Corporation's libraries from the
+    NVIDIA CUDA Toolkit and/or the NVIDIA CUDA Deep Neural
+    Network library and/or the NVIDIA TensorRT inference library
+    (or a modified version of those libraries), containing parts covered
+    by the terms of the respective license agreement, the licensors of
+    this Program grant you additional permission to convey the resulting
+    work.
+*/
+
+#ifndef TRACE_H_INCLUDED
+#define TRACE_H_INCLUDED
+
+#include "config.h"
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+/// Timeline of the search and inference activity, written as Chrome trace JSON for chrome://tracing or Perfetto. Every
+/// thread records its events into its own ring buffer, which keeps the last RING_CAPACITY of them. While tracing is off
+/// an event costs one relaxed load. Names and argument names must be string literals, only their pointers are kept.
+namespace Trace
+{
+	/// Events kept per thread, the older ones are overwritten
+	constexpr auto RING_CAPACITY = 1 << 16;
+
+	extern std::atomic<bool> s_enabled;
+
+	inline bool enabled()
+	{
+		return s_enabled.load(std::memory_order_relaxed);
+	}
+
+	/// Drop the events recorded so far and start recording
+	void start();
+	/// Stop recording, the events stay until the next start()
+	void stop();
+	/// Write the recorded events as Chrome trace JSON, call it after stop() so that no thread is recording.
+	/// Returns false when the file cannot be written.
+	bool write(const std::string& filename);
+
+	/// Event without duration, as the GTP output
+	void instant(const char* name);
+
+	/// Nanoseconds since the program started, the clock of the events
+	std::int64_t now_ns();
+	/// Duration event of the calling thread, whether tracing is on or not
+	void record(const char* name, std::int64_t start_ns, std::int64_t duration_ns, const char* arg_name = nullptr, std::int64_t arg = 0);
+
+	/// Duration event from construction to destruction, nested scopes show up as a stack
+	class Scope
+	{
+	public:
+
+		explicit Scope(const char* name) : m_name(enabled() ? name : nullptr)
+		{
+			if (m_name)
+				m_start_ns = now_ns();
+		}
+
+		~Scope()
+		{
+			// Not after a stop(), the ring may be written out already
+			if (m_name && enabled())
+				record(m_name, m_start_ns, now_ns() - m_start_ns, m_arg_name, m_arg);
+		}
+
+		Scope(const Scope&) = delete;
+		Scope& operator=(const Scope&) = delete;
+
+		/// Attach a value to the event, as the size of a batch
+		void set_arg(const char* name, const std::int64_t value)
+		{
+			m_arg_name = name;
+			m_arg = value;
+		}
+
+	private:
+
+		const char* m_name;
+		std::int64_t m_start_ns{0};
+		const char* m_arg_name{nullptr};
+		std::int64_t m_arg{0};
+	};
+}
+
+#endif
@@ -30,13 +30,19 @@
 #include "config.h"
 
 #ifdef USE_OPENCL
+#include <algorithm>
 #include <array>
 #include <cassert>
+#include <deque>
+#include <future>
 #include <sstream>
 #include <string>
 #include <map>
 #include <cmath>
 #include <fstream>
+#include <thread>
+#include <boost/filesystem.hpp>
+#include <boost/format.hpp>
 #ifndef USE_BLAS
 #include <Eigen/Dense>
 #endif
@@ -46,8 +52,13 @@
 #include "Tuner.h"
 #include "Utils.h"
 #include "Random.h"
+#include "ThreadPool.h"
 
 const auto TUNER_FILE_LOCAL = std::string("leelaz_opencl_tuning");
+/// Results of the tuning in progress, so that an interrupted tuning resumes where it stopped
+const auto TUNER_CHECKPOINT_FILE_LOCAL = std::string("leelaz_opencl_tuning.partial");
+/// Host threads compiling candidate kernels ahead of the device benchmarks
+static constexpr auto MAX_COMPILE_THREADS = 8u;
 
 template <typename net_t>
 std::vector<std::string> Tuner<net_t>::tuned_devices;
@@ -455,35 +466,125 @@ std::string Tuner<net_t>::tune_sgemm(const int m, const int n, const int k, cons
 
     std::string best_params;
     auto best_time = unsigned{0};
+    auto min_error = 100.0f;
+
+    auto defines = std::vector<std::string>{};
+    for (const auto& p : valid_params)
+        defines.emplace_back(parameters_to_defines(p));
+
+    // Resume from the results of an interrupted run of the same tuning
+    const auto checkpoint_key = str(boost::format("%s;%s;%d;%d;%d;%d;%d;%d;%d;%s") % std::to_string(TUNER_VERSION) % getTunerKernel<net_t>()
+        % m % n % k % batch_size % runs % int{cfg_sgemm_exhaustive} % valid_params.size() % m_opencl.get_device_name());
+    const auto checkpoint_file = leelaz_file(TUNER_CHECKPOINT_FILE_LOCAL);
+    auto done = std::vector<bool>(valid_params.size(), false);
+    auto resumed = size_t{0};
+    {
+        auto file = std::ifstream{checkpoint_file};
+        auto line = std::string{};
+        if (std::getline(file, line) && line == checkpoint_key)
+		{
+            auto index = size_t{0};
+            auto time = unsigned{0};
+            auto error = 0.0f;
+            auto separator = char{};
+
+            while (std::getline(file, line))
+			{
+                auto line_stream = std::istringstream{line};
+                if (!(line_stream >> index >> separator >> time >> separator >> error) || index >= valid_params.size())
+                    continue;
+
+                done[index] = true;
+                resumed++;
+                if (error < 0.0f)
+                    continue;
+
+                min_error = std::min(min_error, error);
+                if (error < getTunerMaxError<net_t>() && (best_time == 0 || time < best_time))
+				{
+                    best_time = time;
+                    best_params = defines[index];
+                }
+            }
+        }
+    }
+
+    auto checkpoint = std::ofstream{};
+    if (resumed > 0)
+	{
+        myprintf("Resuming the tuning, %zu configurations already tried.\n", resumed);
+        checkpoint.open(checkpoint_file, std::ios::app);
+    }
+	else
+	{
+        checkpoint.open(checkpoint_file, std::ios::trunc);
+        checkpoint << checkpoint_key << std::endl;
+    }
+
+    const auto record = [&checkpoint](const size_t index, const unsigned int time, const float error)
+	{
+        checkpoint << index << ";" << time << ";" << error << std::endl;
+    };
 
     const auto queue = cl::CommandQueue(m_context, m_device, CL_QUEUE_PROFILING_ENABLE);
     auto event = cl::Event();
-    auto program = cl::Program(m_context, sourceCode_common + sourceCode_sgemm);
+
+    // Compile the candidates on host threads while the device benchmarks the ones already built. Each candidate gets
+    // its own program, and only a few are built ahead to bound the memory they hold.
+    const auto compile_threads = std::max(1u, std::min(std::thread::hardware_concurrency(), MAX_COMPILE_THREADS));
+    Utils::ThreadPool compile_pool;
+    compile_pool.initialize(compile_threads);
+
+    const auto compile = [this, &defines](const size_t index)
+	{
+        try
+		{
+            auto program = cl::Program(m_context, sourceCode_common + sourceCode_sgemm);
+            program.build((m_opencl.m_cl_args + " " + defines[index]).c_str());
+            return program;
+        }
+        catch (const cl::Error&)
+		{
+            return cl::Program();
+        }
+    };
+
+    auto remaining = std::vector<size_t>{};
+    for (auto index = size_t{0}; index < valid_params.size(); index++)
+        if (!done[index])
+            remaining.push_back(index);
+
+    auto compiled = std::deque<std::future<cl::Program>>{};
+    auto next_to_compile = size_t{0};
 
     auto m_ceil_prev = 0;
     auto n_ceil_prev = 0;
     auto k_ceil_prev = 0;
-    auto param_counter = size_t{0};
-    auto min_error = 100.0f;
+    auto param_counter = resumed;
     auto failed_compile = 0;
     auto failed_enqueue = 0;
     auto failed_error = 0;
 
-    for (auto & p : valid_params) 
+    for (auto position = size_t{0}; position < remaining.size(); position++)
 	{
-        param_counter++;
-
-        auto defines = parameters_to_defines(p);
-
-        try 
+        while (next_to_compile < remaining.size() && next_to_compile < position + 2 * compile_threads)
 		{
-            auto args = m_opencl.m_cl_args + " " + defines;
-            program.build(args.c_str());
+            compiled.emplace_back(compile_pool.add_task(compile, remaining[next_to_compile]));
+            next_to_compile++;
         }
-    	catch (const cl::Error&) 
+
+        const auto index = remaining[position];
+        auto program = compiled.front().get();
+        compiled.pop_front();
+
+        auto& p = valid_params[index];
+        param_counter++;
+
+        if (program() == nullptr)
 		{
             // Failed to compile, get next parameter
             failed_compile++;
+            record(index, 0, -1.0f);
             continue;
         }
 
@@ -560,6 +661,7 @@ std::string Tuner<net_t>::tune_sgemm(const int m, const int n, const int k, cons
         }
 
         min_error = std::min(min_error, error);
+        record(index, static_cast<unsigned int>(sum), error);
 
         if (error >= getTunerMaxError<net_t>())
             failed_error++;
@@ -575,9 +677,15 @@ std::string Tuner<net_t>::tune_sgemm(const int m, const int n, const int k, cons
             myprintf("(%u/%u) %s %.4f ms (%.1f GFLOPS)\n", param_counter, valid_params.size(), param_str.c_str(), kernel_ms, kernel_giga_flops);
         	
             best_time = static_cast<unsigned int>(sum);
-            best_params = defines;
+            best_params = defines[index];
         }
     }
+
+    // The tuning is complete, the next one starts from scratch
+    checkpoint.close();
+    boost::system::error_code ignored;
+    boost::filesystem::remove(checkpoint_file, ignored);
+
     if (best_time == 0) 
 	{
         if (failed_compile > 0)
@@ -42,11 +42,14 @@
 #include <vector>
 
 #include "UCTNode.h"
+#include "BlockPool.h"
 #include "FastBoard.h"
 #include "FastState.h"
 #include "GTP.h"
 #include "GameState.h"
 #include "Network.h"
+#include "SMP.h"
+#include "Trace.h"
 #include "Utils.h"
 
 using namespace Utils;
@@ -54,6 +57,18 @@ using namespace Utils;
 UCTNode::UCTNode(const int vertex, const float policy) : m_move(vertex), m_policy(policy)
 { }
 
+void* UCTNode::operator new(const size_t size)
+{
+    assert(size == sizeof(UCTNode));
+    (void)size;
+    return BlockPool<UCTNode>::allocate();
+}
+
+void UCTNode::operator delete(void* pointer)
+{
+    BlockPool<UCTNode>::deallocate(pointer);
+}
+
 bool UCTNode::first_visit() const
 {
     return m_visits == 0;
@@ -61,6 +76,8 @@ bool UCTNode::first_visit() const
 
 bool UCTNode::create_children(Network & network, std::atomic<int>& node_count, GameState& state, float& eval, const float min_psa_ratio)
 {
+    const Trace::Scope trace("create_children");
+
     // No successors in final state
     if (state.get_passes() >= 2)
         return false;
@@ -503,6 +520,7 @@ bool UCTNode::acquire_expanding()
 void UCTNode::expand_done()
 {
     auto v = m_expand_state.exchange(ExpandState::EXPANDED);
+    SMP::unpark_all(&m_expand_state);
 	
 #ifdef NDEBUG
     (void)v;
@@ -514,6 +532,7 @@ void UCTNode::expand_done()
 void UCTNode::expand_cancel()
 {
     auto v = m_expand_state.exchange(ExpandState::INITIAL);
+    SMP::unpark_all(&m_expand_state);
 	
 #ifdef NDEBUG
     (void)v;
@@ -524,7 +543,18 @@ void UCTNode::expand_cancel()
 
 void UCTNode::wait_expanded() const
 {
-    while (m_expand_state.load() == ExpandState::EXPANDING) {}
+    const auto expanded = [this]() { return m_expand_state.load() != ExpandState::EXPANDING; };
+    if (!expanded())
+	{
+        // The expanding thread is usually waiting on the network, which takes far longer than a spin is worth,
+        // so spin only briefly and then sleep until expand_done() wakes us
+        const auto parked = !SMP::spin_until(expanded, SMP::spin_limit());
+        if (parked)
+            SMP::park_until(&m_expand_state, expanded);
+
+        SMP::record_expand_wait(parked);
+    }
+	
     auto v = m_expand_state.load();
 	
 #ifdef NDEBUG
@@ -53,6 +53,10 @@ public:
     UCTNode() = delete;
     ~UCTNode() = default;
 
+    /// Nodes come from a BlockPool, backed by huge pages when enabled
+    static void* operator new(size_t size);
+    static void operator delete(void* pointer);
+
     bool create_children(Network & network, std::atomic<int>& node_count, GameState& state, float& eval, float min_psa_ratio = 0.0f);
 
     const std::vector<UCTNodePointer>& get_children() const;
@@ -29,28 +29,113 @@
 
 #include "config.h"
 
+#include <algorithm>
 #include <atomic>
 #include <cassert>
+#include <cstdint>
 #include <cstring>
+#include <mutex>
+#include <vector>
 
 #include "UCTNode.h"
 
-std::atomic<size_t> UCTNodePointer::m_tree_size = {0};
+constexpr std::int64_t UCTNodePointer::TREE_SIZE_SLACK;
+
+namespace
+{
+    /// Bytes counted by one thread and not yet added to s_tree_size, only
+    /// ever updated by its own thread
+    struct TreeSizeCounter
+	{
+        std::atomic<std::int64_t> pending{0};
+    };
+
+    std::atomic<std::int64_t> s_tree_size{0};
+
+    /// Counters of all threads that ever touched the tree, leaked on purpose
+    /// so that threads exiting during static destruction can still use them
+    std::mutex& counters_mutex()
+	{
+        static auto mutex = new std::mutex();
+        return *mutex;
+    }
+
+    std::vector<TreeSizeCounter*>& all_counters()
+	{
+        static auto counters = new std::vector<TreeSizeCounter*>();
+        return *counters;
+    }
+
+    void flush(TreeSizeCounter& counter)
+	{
+        const auto pending = counter.pending.exchange(0, std::memory_order_relaxed);
+        s_tree_size.fetch_add(pending, std::memory_order_relaxed);
+    }
+
+    /// Adds the count of an exiting thread to the total
+    struct TreeSizeFlusher
+	{
+        TreeSizeCounter* counter{nullptr};
+
+        ~TreeSizeFlusher()
+		{
+            if (counter)
+                flush(*counter);
+        }
+    };
+
+    TreeSizeCounter& local_counter()
+	{
+        static thread_local TreeSizeCounter* counter = nullptr;
+        if (!counter)
+		{
+            counter = new TreeSizeCounter();
+            static thread_local TreeSizeFlusher flusher;
+            flusher.counter = counter;
+
+            std::lock_guard<std::mutex> lock(counters_mutex());
+            all_counters().emplace_back(counter);
+        }
+        return *counter;
+    }
+
+    void update_tree_size(const std::int64_t delta)
+	{
+        auto& counter = local_counter();
+        const auto pending = counter.pending.load(std::memory_order_relaxed) + delta;
+        counter.pending.store(pending, std::memory_order_relaxed);
+
+        if (pending >= UCTNodePointer::TREE_SIZE_SLACK || pending <= -UCTNodePointer::TREE_SIZE_SLACK)
+            flush(counter);
+    }
+}
 
 size_t UCTNodePointer::get_tree_size()
 {
-    return m_tree_size.load();
+    return static_cast<size_t>(std::max(std::int64_t{0}, s_tree_size.load(std::memory_order_relaxed)));
+}
+
+size_t UCTNodePointer::get_exact_tree_size()
+{
+    auto total = s_tree_size.load();
+    {
+        std::lock_guard<std::mutex> lock(counters_mutex());
+        for (const auto counter : all_counters())
+            total += counter->pending.load();
+    }
+
+    assert(total >= 0);
+    return static_cast<size_t>(std::max(std::int64_t{0}, total));
 }
 
 void UCTNodePointer::increment_tree_size(const size_t size)
 {
-    m_tree_size += size;
+    update_tree_size(static_cast<std::int64_t>(size));
 }
 
 void UCTNodePointer::decrement_tree_size(const size_t size)
 {
-    assert(UCTNodePointer::m_tree_size >= size);
-    m_tree_size -= size;
+    update_tree_size(-static_cast<std::int64_t>(size));
 }
 
 UCTNodePointer::~UCTNodePointer()
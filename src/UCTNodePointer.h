@@ -34,6 +34,7 @@
 
 #include <atomic>
 #include <cassert>
+#include <cstdint>
 #include <cstring>
 
 class UCTNode;
@@ -56,7 +57,9 @@ class UCTNodePointer
     static constexpr std::uint64_t POINTER = 1;
     static constexpr std::uint64_t UNINFLATED = 0;
 
-    static std::atomic<size_t> m_tree_size;
+    /// Tree size is counted per thread and each thread adds its count to the
+    /// shared total once it exceeds TREE_SIZE_SLACK, so the total is only
+    /// written every few hundred nodes instead of on every node
     static void increment_tree_size(size_t size);
     static void decrement_tree_size(size_t size);
 
@@ -97,8 +100,15 @@ class UCTNodePointer
 
 public:
 	
+    static constexpr std::int64_t TREE_SIZE_SLACK = 16 * 1024;
+
+    /// Cheap, for the checks during search: lags the real size by less than
+    /// TREE_SIZE_SLACK bytes for every thread that built or freed nodes
     static size_t get_tree_size();
 
+    /// Sums the counts of all threads, exact while no search is running
+    static size_t get_exact_tree_size();
+
     ~UCTNodePointer();
     UCTNodePointer(UCTNodePointer&& n) noexcept;
     UCTNodePointer(std::int16_t vertex, float policy);
@@ -45,8 +45,10 @@
 #include "FullBoard.h"
 #include "GTP.h"
 #include "GameState.h"
+#include "SMP.h"
 #include "TimeControl.h"
 #include "Timing.h"
+#include "Trace.h"
 #include "Training.h"
 #include "Utils.h"
 #ifdef USE_OPENCL
@@ -231,6 +233,7 @@ float UCTSearch::get_min_psa_ratio()
 
 SearchResult UCTSearch::play_simulation(GameState & current_state, UCTNode* const node)
 {
+    const Trace::Scope trace("play_simulation");
     const auto color = current_state.get_to_move();
     auto result = SearchResult{};
 
@@ -823,6 +826,8 @@ void UCTSearch::increment_playouts()
 
 int UCTSearch::think(const int color, const passflag_t passflag)
 {
+    const Trace::Scope trace("UCTSearch::think");
+
     // Start counting time for us
     m_root_state.start_clock(color);
 
@@ -843,11 +848,8 @@ int UCTSearch::think(const int color, const passflag_t passflag)
     m_root->prepare_root_node(m_network, color, m_nodes, m_root_state);
 
     m_run = true;
-    const auto cpu_number = static_cast<int>(cfg_num_threads);
-	
     ThreadGroup tg(thread_pool);
-    for (auto i = 1; i < cpu_number; i++)
-        tg.add_task(UCTWorker(m_root_state, this, m_root.get()));
+    tg.add_tasks(cfg_num_threads - 1, UCTWorker(m_root_state, this, m_root.get()));
 
     bool keep_running;
     auto last_update = 0;
@@ -916,6 +918,15 @@ int UCTSearch::think(const int color, const passflag_t passflag)
 #endif
 #endif
 
+#ifndef NDEBUG
+    const auto contention = SMP::get_contention_stats();
+    myprintf("contention: %llu expansion waits (%llu parked), %llu lock waits (%llu parked)\n",
+             static_cast<unsigned long long>(contention.expand_waits),
+             static_cast<unsigned long long>(contention.expand_parks),
+             static_cast<unsigned long long>(contention.lock_waits),
+             static_cast<unsigned long long>(contention.lock_parks));
+#endif
+
     const auto best_move = get_best_move(passflag);
 
     // Save the explanation.
@@ -937,6 +948,11 @@ std::string UCTSearch::explain_last_think() const
     return m_think_output;
 }
 
+int UCTSearch::get_playouts() const
+{
+    return m_playouts.load();
+}
+
 void UCTSearch::ponder()
 {
 	const auto disable_reuse = cfg_analyze_tags.has_move_restrictions();
@@ -949,8 +965,7 @@ void UCTSearch::ponder()
 
     m_run = true;
     ThreadGroup tg(thread_pool);
-    for (auto i = size_t{1}; i < cfg_num_threads; i++)
-        tg.add_task(UCTWorker(m_root_state, this, m_root.get()));
+    tg.add_tasks(cfg_num_threads - 1, UCTWorker(m_root_state, this, m_root.get()));
 
 	const Time start;
 	bool keep_running;
@@ -118,6 +118,8 @@ public:
     bool is_running() const;
     void increment_playouts();
     std::string explain_last_think() const;
+    /// Playouts of the last or running search
+    int get_playouts() const;
     SearchResult play_simulation(GameState& current_state, UCTNode* const node);
 
 private:
@@ -30,6 +30,7 @@
 #include "config.h"
 #include "Utils.h"
 
+#include <chrono>
 #include <mutex>
 #include <cstdarg>
 #include <cstdio>
@@ -47,6 +48,7 @@
 #endif
 
 #include "GTP.h"
+#include "Trace.h"
 
 Utils::ThreadPool thread_pool;
 
@@ -76,8 +78,13 @@ float Utils::cached_t_quantile(const int v)
     return z_lookup[z_entries - 1];
 }
 
+static std::function<bool()> s_input_pending;
+
 bool Utils::input_pending()
 {
+    if (s_input_pending)
+        return s_input_pending();
+
 #ifdef HAVE_SELECT
     fd_set read_fds;
     FD_ZERO(&read_fds);
@@ -125,6 +132,64 @@ bool Utils::input_pending()
 
 static std::mutex IOmutex;
 
+// Session capture and output observer, guarded by IOmutex
+static FILE* s_capture_handle = nullptr;
+static std::chrono::steady_clock::time_point s_capture_start;
+static std::function<void(const std::string&)> s_output_observer;
+/// Output since the last newline
+static std::string s_output_line;
+
+static double capture_seconds()
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - s_capture_start).count();
+}
+
+static std::string format_string(const char *fmt, va_list ap)
+{
+    va_list ap2;
+    va_copy(ap2, ap);
+    const auto size = vsnprintf(nullptr, 0, fmt, ap2);
+    va_end(ap2);
+
+    if (size <= 0)
+        return std::string();
+
+    auto result = std::string(size + 1, '\0');
+    vsnprintf(&result[0], result.size(), fmt, ap);
+    result.resize(size);
+    return result;
+}
+
+/// Hand the complete lines of GTP output to the capture and the observer
+static void observe_output(const std::string& text)
+{
+    std::lock_guard<std::mutex> lock(IOmutex);
+
+    for (const auto c : text)
+	{
+        if (c != '\n')
+		{
+            s_output_line += c;
+            continue;
+        }
+
+        if (s_capture_handle)
+            fprintf(s_capture_handle, "< %.3f %s\n", capture_seconds(), s_output_line.c_str());
+        if (s_output_observer)
+            s_output_observer(s_output_line);
+        s_output_line.clear();
+    }
+
+    if (s_capture_handle)
+        fflush(s_capture_handle);
+}
+
+static bool observing_output()
+{
+    std::lock_guard<std::mutex> lock(IOmutex);
+    return s_capture_handle || s_output_observer;
+}
+
 static void myprintf_base(const char *fmt, va_list ap)
 {
     va_list ap2;
@@ -171,6 +236,11 @@ static void gtp_base_printf(const int id, std::string prefix, const char *fmt, v
 {
     if (id != -1)
         prefix += std::to_string(id);
+
+    Trace::instant("GTP response");
+
+    va_list ap2;
+    va_copy(ap2, ap);
 	
     gtp_fprintf(stdout, prefix, fmt, ap);
 	
@@ -179,6 +249,10 @@ static void gtp_base_printf(const int id, std::string prefix, const char *fmt, v
         std::lock_guard<std::mutex> lock(IOmutex);
         gtp_fprintf(cfg_logfile_handle, prefix, fmt, ap);
     }
+
+    if (observing_output())
+        observe_output(prefix + " " + format_string(fmt, ap2) + "\n\n");
+    va_end(ap2);
 }
 
 void Utils::gtp_printf(const int id, const char *fmt, ...)
@@ -191,6 +265,8 @@ void Utils::gtp_printf(const int id, const char *fmt, ...)
 
 void Utils::gtp_printf_raw(const char *fmt, ...)
 {
+    Trace::instant("GTP output");
+
     va_list ap;
     va_start(ap, fmt);
     vfprintf(stdout, fmt, ap);
@@ -203,6 +279,13 @@ void Utils::gtp_printf_raw(const char *fmt, ...)
         vfprintf(cfg_logfile_handle, fmt, ap);
         va_end(ap);
     }
+
+    if (observing_output())
+	{
+        va_start(ap, fmt);
+        observe_output(format_string(fmt, ap));
+        va_end(ap);
+    }
 }
 
 void Utils::gtp_fail_printf(const int id, const char *fmt, ...)
@@ -215,13 +298,38 @@ void Utils::gtp_fail_printf(const int id, const char *fmt, ...)
 
 void Utils::log_input(const std::string& input)
 {
+    std::lock_guard<std::mutex> lock(IOmutex);
+
     if (cfg_logfile_handle) 
-	{
-        std::lock_guard<std::mutex> lock(IOmutex);
         fprintf(cfg_logfile_handle, ">>%s\n", input.c_str());
+
+    if (s_capture_handle)
+	{
+        fprintf(s_capture_handle, "> %.3f %s\n", capture_seconds(), input.c_str());
+        fflush(s_capture_handle);
     }
 }
 
+bool Utils::start_capture(const std::string& filename)
+{
+    std::lock_guard<std::mutex> lock(IOmutex);
+
+    s_capture_handle = fopen(filename.c_str(), "w");
+    s_capture_start = std::chrono::steady_clock::now();
+    return s_capture_handle != nullptr;
+}
+
+void Utils::set_input_pending(std::function<bool()> pending)
+{
+    s_input_pending = std::move(pending);
+}
+
+void Utils::set_output_observer(std::function<void(const std::string&)> observer)
+{
+    std::lock_guard<std::mutex> lock(IOmutex);
+    s_output_observer = std::move(observer);
+}
+
 size_t Utils::ceil_multiple(const size_t a, const size_t b)
 {
     if (a % b == 0)
@@ -33,6 +33,7 @@
 #include "config.h"
 
 #include <atomic>
+#include <functional>
 #include <limits>
 #include <string>
 
@@ -51,6 +52,14 @@ namespace Utils
     void log_input(const std::string& input);
     bool input_pending();
 
+    /// Record the GTP session with timestamps, every input line as "> seconds line" and every output line as
+    /// "< seconds line", returns false if the file cannot be opened
+    bool start_capture(const std::string& filename);
+    /// Replace stdin as what input_pending() checks, for a driver that feeds the commands itself. Empty restores stdin.
+    void set_input_pending(std::function<bool()> pending);
+    /// Called with every complete line of GTP output, by the thread writing it, empty removes it
+    void set_output_observer(std::function<void(const std::string&)> observer);
+
     template<class T>
     void atomic_add(std::atomic<T> &f, T d)
 	{
@@ -0,0 +1,234 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2017-2019 Michael O and contributors
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+
+    Additional permission under GNU GPL version 3 section 7
+
+    If you modify this Program, or any covered work, by linking or
+    combining it with NVIDIA Corporation's libraries from the
+    NVIDIA CUDA Toolkit and/or the NVIDIA CUDA Deep Neural
+    Network library and/or the NVIDIA TensorRT inference library
+    (or a modified version of those libraries), containing parts covered
+    by the terms of the respective license agreement, the licensors of
+    this Program grant you additional permission to convey the resulting
+    work.
+*/
+
+#ifndef WINOGRAD_H_INCLUDED
+#define WINOGRAD_H_INCLUDED
+
+#include "config.h"
+
+#include <array>
+
+/// Square root of 2
+constexpr auto SQ2 = 1.4142135623730951f;
+
+/// Winograd F(MxM, 3x3) convolution, the 3x3 filters are transformed to ALPHA x ALPHA tiles with ALPHA = M + 3 - 1.
+/// Every specialization gives the transformation matrices and hand unrolled multiplications by transpose(B) and transpose(A).
+template <int M>
+struct WinogradTransform;
+
+/// F(2x2, 3x3), interpolation points 0, 1, -1 and infinity
+template <>
+struct WinogradTransform<2>
+{
+    static constexpr auto ALPHA = 4;
+
+    static constexpr std::array<float, ALPHA * 3> G()
+	{
+        return {{ 1.0f,  0.0f, 0.0f,
+                  0.5f,  0.5f, 0.5f,
+                  0.5f, -0.5f, 0.5f,
+                  0.0f,  0.0f, 1.0f }};
+    }
+
+    static constexpr std::array<float, ALPHA * ALPHA> Bt()
+	{
+        return {{ 1.0f,  0.0f, -1.0f,  0.0f,
+                  0.0f,  1.0f,  1.0f,  0.0f,
+                  0.0f, -1.0f,  1.0f,  0.0f,
+                  0.0f,  1.0f,  0.0f, -1.0f }};
+    }
+
+    static constexpr std::array<float, 2 * ALPHA> At()
+	{
+        return {{ 1.0f, 1.0f,  1.0f,  0.0f,
+                  0.0f, 1.0f, -1.0f, -1.0f }};
+    }
+
+    static void multiply_bt(float* o, const float* i)
+	{
+        o[0] = i[0] - i[2];
+        o[1] = i[1] + i[2];
+        o[2] = i[2] - i[1];
+        o[3] = i[1] - i[3];
+    }
+
+    static void multiply_at(float* o, const float* i)
+	{
+        o[0] = i[0] + i[1] + i[2];
+        o[1] = i[1] - i[2] - i[3];
+    }
+};
+
+/// F(3x3, 3x3), interpolation points 0, 1, -1, 2 and infinity
+template <>
+struct WinogradTransform<3>
+{
+    static constexpr auto ALPHA = 5;
+
+    static constexpr std::array<float, ALPHA * 3> G()
+	{
+        return {{  1.0f/2.0f,  0.0f,       0.0f,
+                  -1.0f/2.0f, -1.0f/2.0f, -1.0f/2.0f,
+                  -1.0f/6.0f,  1.0f/6.0f, -1.0f/6.0f,
+                   1.0f/6.0f,  1.0f/3.0f,  2.0f/3.0f,
+                   0.0f,       0.0f,       1.0f }};
+    }
+
+    static constexpr std::array<float, ALPHA * ALPHA> Bt()
+	{
+        return {{ 2.0f, -1.0f, -2.0f,  1.0f, 0.0f,
+                  0.0f, -2.0f, -1.0f,  1.0f, 0.0f,
+                  0.0f,  2.0f, -3.0f,  1.0f, 0.0f,
+                  0.0f, -1.0f,  0.0f,  1.0f, 0.0f,
+                  0.0f,  2.0f, -1.0f, -2.0f, 1.0f }};
+    }
+
+    static constexpr std::array<float, 3 * ALPHA> At()
+	{
+        return {{ 1.0f, 1.0f,  1.0f, 1.0f, 0.0f,
+                  0.0f, 1.0f, -1.0f, 2.0f, 0.0f,
+                  0.0f, 1.0f,  1.0f, 4.0f, 1.0f }};
+    }
+
+    static void multiply_bt(float* o, const float* i)
+	{
+        const auto i3_m1 = i[3] - i[1];
+
+        o[0] = 2.0f * (i[0] - i[2]) + i3_m1;
+        o[1] = i3_m1 - i[1] - i[2];
+        o[2] = 2.0f * i[1] - 3.0f * i[2] + i[3];
+        o[3] = i3_m1;
+        o[4] = 2.0f * (i[1] - i[3]) - i[2] + i[4];
+    }
+
+    static void multiply_at(float* o, const float* i)
+	{
+        const auto i1_p2 = i[1] + i[2];
+
+        o[0] = i[0] + i1_p2 + i[3];
+        o[1] = i[1] - i[2] + 2.0f * i[3];
+        o[2] = i1_p2 + 4.0f * i[3] + i[4];
+    }
+};
+
+/// F(4x4, 3x3), interpolation points 0, +-sqrt(2), +-sqrt(2)/2 and infinity
+template <>
+struct WinogradTransform<4>
+{
+    static constexpr auto ALPHA = 6;
+
+    static constexpr std::array<float, ALPHA * 3> G()
+	{
+        return {{ 1.0f,        0.0f,      0.0f,
+                  -2.0f/3.0f, -SQ2/3.0f, -1.0f/3.0f,
+                  -2.0f/3.0f,  SQ2/3.0f, -1.0f/3.0f,
+                  1.0f/6.0f,   SQ2/6.0f,  1.0f/3.0f,
+                  1.0f/6.0f,  -SQ2/6.0f,  1.0f/3.0f,
+                  0.0f,        0.0f,      1.0f }};
+    }
+
+    static constexpr std::array<float, ALPHA * ALPHA> Bt()
+	{
+        return {{ 1.0f,  0.0f,     -5.0f/2.0f,  0.0f,      1.0f, 0.0f,
+                  0.0f, -SQ2,      -2.0f,       SQ2/2.0f,  1.0f, 0.0f,
+                  0.0f,  SQ2,      -2.0f,      -SQ2/2.0f,  1.0f, 0.0f,
+                  0.0f, -SQ2/2.0f, -1.0f/2.0f,  SQ2,       1.0f, 0.0f,
+                  0.0f,  SQ2/2.0f, -1.0f/2.0f, -SQ2,       1.0f, 0.0f,
+                  0.0f,  1.0f,      0.0f,      -5.0f/2.0f, 0.0f, 1.0f }};
+    }
+
+    static constexpr std::array<float, 4 * ALPHA> At()
+	{
+        return {{ 1.0f, 1.0f,      1.0f,       1.0f,      1.0f,     0.0f,
+                  0.0f, SQ2/2.0f, -SQ2/2.0f,   SQ2,      -SQ2,      0.0f,
+                  0.0f, 1.0f/2.0f, 1.0f/2.0f,  2.0f,      2.0f,     0.0f,
+                  0.0f, SQ2/4.0f, -SQ2/4.0f,   2.0f*SQ2, -2.0f*SQ2, 1.0f }};
+    }
+
+    static void multiply_bt(float* o, const float* i)
+	{
+        const auto i3_m1 = i[1] * -SQ2 + i[3] * (SQ2 / 2.0f);
+        const auto i4_m2 = i[2] * -2.0f + i[4] * 1.0f;
+
+        o[0] = i[0] + i[2] * (-5.0f/2.0f) + i[4];
+        o[1] = i3_m1 + i4_m2;
+        o[2] = -i3_m1 + i4_m2;
+
+        const auto i3_m1_2 = i[3] * (SQ2) + i[1] * (-SQ2/2.0f);
+        const auto i4_m2_2 = i[2] * (-1.0f/2.0f) + i[4];
+
+        o[3] = i3_m1_2 + i4_m2_2;
+        o[4] = -i3_m1_2 + i4_m2_2;
+
+        o[5] = i[1] + i[3] * (-5.0f/2.0f) + i[5];
+    }
+
+    static void multiply_at(float* o, const float* i)
+	{
+        const auto t1_p2 = (i[1] + i[2]) * (1.0f / 2.0f);
+        const auto t1_m2 = (i[1] - i[2]) * (SQ2/4.0f);
+        const auto t3_p4 = i[3] + i[4];
+        const auto t3_m4 = (i[3] - i[4]) * (SQ2);
+
+        o[0] = i[0] + t1_p2 + t1_p2 + t3_p4;
+        o[1] = t1_m2 + t1_m2 + t3_m4;
+        o[2] = t1_p2 + t3_p4 + t3_p4;
+        o[3] = t1_m2 + t3_m4 + t3_m4 + i[5];
+    }
+};
+
+/// Number of tiles needed to cover one side of the board with MxM output tiles
+constexpr int winograd_tiles(const int board_size, const int m)
+{
+    return board_size / m + (board_size % m != 0);
+}
+
+/// Work of one convolution with MxM output tiles, proportional to the size of the batched SGEMM
+constexpr int winograd_cost(const int board_size, const int m)
+{
+    return winograd_tiles(board_size, m) * winograd_tiles(board_size, m) * (m + 2) * (m + 2);
+}
+
+/// Pick the cheapest tile size for the board, preferring larger tiles on a tie.
+/// 9x9 gets F(3x3, 3x3) which covers the board exactly instead of padding it to 12x12, 13x13 and 19x19 keep F(4x4, 3x3).
+constexpr int winograd_select_m(const int board_size)
+{
+    return winograd_cost(board_size, 4) <= winograd_cost(board_size, 3) 
+		? (winograd_cost(board_size, 4) <= winograd_cost(board_size, 2) ? 4 : 2) 
+		: (winograd_cost(board_size, 3) <= winograd_cost(board_size, 2) ? 3 : 2);
+}
+
+/// Winograd output tile size for the compiled board size
+constexpr auto WINOGRAD_M = winograd_select_m(BOARD_SIZE);
+constexpr auto WINOGRAD_ALPHA = WINOGRAD_M + 3 - 1;
+constexpr auto WINOGRAD_W_TILES = winograd_tiles(BOARD_SIZE, WINOGRAD_M);
+constexpr auto WINOGRAD_TILE = WINOGRAD_ALPHA * WINOGRAD_ALPHA;
+constexpr auto WINOGRAD_P = WINOGRAD_W_TILES * WINOGRAD_W_TILES;
+
+#endif
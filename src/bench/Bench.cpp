@@ -0,0 +1,451 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2017-2019 Michael O and contributors
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+
+    Additional permission under GNU GPL version 3 section 7
+
+    If you modify this Program, or any covered work, by linking or
+    combining it with NVIDIA Corporation's libraries from the
+    NVIDIA CUDA Toolkit and/or the NVIDIA CUDA Deep Neural
+    Network library and/or the NVIDIA TensorRT inference library
+    (or a modified version of those libraries), containing parts covered
+    by the terms of the respective license agreement, the licensors of
+    this Program grant you additional permission to convey the resulting
+    work.
+*/
+
+#include "config.h"
+
+#include <algorithm>
+#include <atomic>
+#include <boost/filesystem.hpp>
+#include <boost/format.hpp>
+#include <boost/program_options.hpp>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <regex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <time.h>
+#endif
+
+#include "bench/Bench.h"
+#include "FastBoard.h"
+#include "GTP.h"
+#include "GameState.h"
+#include "Network.h"
+#include "Random.h"
+#include "SMP.h"
+#include "Utils.h"
+#include "Zobrist.h"
+
+using namespace Utils;
+
+/*
+    leelaz_bench runs the microbenchmarks of the board, the caches, the tree selection and the network kernels, and
+    writes the results as JSON to compare builds on the same hardware:
+
+        leelaz_bench --json before.json
+        compare.py benchmarks before.json after.json
+*/
+
+namespace
+{
+    /// Stop growing the iteration count once a run took this many
+    constexpr auto MAX_ITERATIONS = std::int64_t{1'000'000'000};
+
+    /// Shape of the made up network when no weights are given, the 9x9 production shape
+    constexpr auto RANDOM_NETWORK_BLOCKS = 6;
+    constexpr auto RANDOM_NETWORK_FILTERS = 64;
+
+    struct Entry
+	{
+        std::string name;
+        Bench::Function function;
+        std::vector<int> threads;
+    };
+
+    struct Result
+	{
+        std::string name;
+        int threads;
+        std::int64_t iterations;
+        double real_ns;
+        double cpu_ns;
+    };
+
+    std::vector<Entry>& registry()
+	{
+        static auto entries = std::vector<Entry>();
+        return entries;
+    }
+
+    std::string s_weights_file;
+
+    double wall_seconds()
+	{
+        return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    /// CPU time of the calling thread, of the whole process where that is not available
+    double thread_cpu_seconds()
+	{
+#if defined(__unix__) || defined(__APPLE__)
+        auto now = timespec{};
+        clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+        return static_cast<double>(now.tv_sec) + static_cast<double>(now.tv_nsec) * 1e-9;
+#else
+        return static_cast<double>(std::clock()) / CLOCKS_PER_SEC;
+#endif
+    }
+
+    /// Run every thread of a benchmark for the given iterations, returns the slowest wall time and the summed CPU time
+    std::pair<double, double> measure(const Entry& entry, const int threads, const std::int64_t iterations)
+	{
+        std::atomic<int> arrived{0};
+        const auto start_barrier = [&arrived, threads]()
+		{
+            ++arrived;
+            while (arrived.load() < threads)
+                std::this_thread::yield();
+        };
+
+        auto states = std::vector<Bench::State>();
+        for (auto i = 0; i < threads; i++)
+            states.emplace_back(iterations, threads, i, start_barrier);
+
+        auto workers = std::vector<std::thread>();
+        for (auto& state : states)
+            workers.emplace_back([&entry, &state]() { entry.function(state); });
+
+        for (auto& worker : workers)
+            worker.join();
+
+        auto real = 0.0;
+        auto cpu = 0.0;
+        for (const auto& state : states)
+		{
+            real = std::max(real, state.real_seconds());
+            cpu += state.cpu_seconds();
+        }
+
+        return {real, cpu};
+    }
+
+    /// Grow the iterations until a run lasts min_time, the way Google Benchmark does
+    Result run(const Entry& entry, const int threads, const double min_time)
+	{
+        auto iterations = std::int64_t{1};
+        for (;;)
+		{
+            const auto times = measure(entry, threads, iterations);
+            const auto real = times.first;
+
+            if (real >= min_time || iterations >= MAX_ITERATIONS)
+			{
+                auto name = entry.name;
+                if (entry.threads.size() > 1 || threads > 1)
+                    name += "/threads:" + std::to_string(threads);
+
+                return {name, threads, iterations, real * 1e9 / iterations, times.second * 1e9 / (iterations * threads)};
+            }
+
+            const auto multiplier = real > 0.0 ? std::min(10.0, std::max(2.0, 1.4 * min_time / real)) : 10.0;
+            iterations = std::min(MAX_ITERATIONS, static_cast<std::int64_t>(iterations * multiplier));
+        }
+    }
+
+    void write_json(std::ostream& out, const std::vector<Result>& results, const std::string& executable)
+	{
+        char date[64];
+        const auto now = std::time(nullptr);
+        std::strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%S", std::localtime(&now));
+
+        out << "{\n"
+            << "  \"context\": {\n"
+            << "    \"date\": \"" << date << "\",\n"
+            << "    \"executable\": \"" << executable << "\",\n"
+            << "    \"num_cpus\": " << SMP::get_num_cpus() << ",\n"
+            << "    \"board_size\": " << BOARD_SIZE << ",\n"
+            << "    \"weights\": \"" << (s_weights_file.empty() ? "random" : s_weights_file) << "\",\n"
+#ifdef NDEBUG
+            << "    \"library_build_type\": \"release\"\n"
+#else
+            << "    \"library_build_type\": \"debug\"\n"
+#endif
+            << "  },\n"
+            << "  \"benchmarks\": [";
+
+        for (auto i = size_t{0}; i < results.size(); i++)
+		{
+            const auto& result = results[i];
+            out << (i == 0 ? "\n" : ",\n")
+                << "    {\n"
+                << "      \"name\": \"" << result.name << "\",\n"
+                << "      \"run_name\": \"" << result.name << "\",\n"
+                << "      \"run_type\": \"iteration\",\n"
+                << "      \"threads\": " << result.threads << ",\n"
+                << "      \"iterations\": " << result.iterations << ",\n"
+                << "      \"real_time\": " << boost::format("%.3f") % result.real_ns << ",\n"
+                << "      \"cpu_time\": " << boost::format("%.3f") % result.cpu_ns << ",\n"
+                << "      \"time_unit\": \"ns\"\n"
+                << "    }";
+        }
+
+        out << "\n  ]\n}\n";
+    }
+
+    /// A v1 weights file of the given shape with small random weights, batch normalization left as identity
+    void write_random_network(const std::string& path, const int blocks, const int filters)
+	{
+        auto rng = std::mt19937(5489);
+        auto distribution = std::uniform_real_distribution<float>(-0.1f, 0.1f);
+        auto out = std::ofstream(path);
+
+        const auto random_line = [&](const int count)
+		{
+            for (auto i = 0; i < count; i++)
+                out << (i == 0 ? "" : " ") << distribution(rng);
+
+            out << "\n";
+        };
+        const auto constant_line = [&out](const int count, const float value)
+		{
+            for (auto i = 0; i < count; i++)
+                out << (i == 0 ? "" : " ") << value;
+
+            out << "\n";
+        };
+        // Weights, biases, batch normalization means and variances
+        const auto layer = [&](const int inputs, const int outputs, const int filter_size)
+		{
+            random_line(outputs * inputs * filter_size * filter_size);
+            constant_line(outputs, 0.0f);
+            constant_line(outputs, 0.0f);
+            constant_line(outputs, 1.0f);
+        };
+
+        out << "1\n";
+        layer(Network::INPUT_CHANNELS, filters, 3);
+        for (auto i = 0; i < 2 * blocks; i++)
+            layer(filters, filters, 3);
+
+        layer(filters, Network::OUTPUTS_POLICY, 1);
+        random_line(Network::OUTPUTS_POLICY * NUM_INTERSECTIONS * POTENTIAL_MOVES);
+        random_line(POTENTIAL_MOVES);
+
+        layer(filters, Network::OUTPUTS_VALUE, 1);
+        random_line(Network::OUTPUTS_VALUE * NUM_INTERSECTIONS * Network::VALUE_LAYER);
+        random_line(Network::VALUE_LAYER);
+        random_line(Network::VALUE_LAYER);
+        random_line(1);
+    }
+}
+
+Bench::State::State(const std::int64_t iterations, const int threads, const int thread_index, std::function<void()> start_barrier)
+    : m_remaining(iterations), m_threads(threads), m_thread_index(thread_index), m_start_barrier(std::move(start_barrier))
+{
+}
+
+bool Bench::State::keep_running()
+{
+    if (!m_started)
+	{
+        m_started = true;
+        m_start_barrier();
+        m_cpu_start = thread_cpu_seconds();
+        m_real_start = wall_seconds();
+    }
+
+    if (m_remaining-- > 0)
+        return true;
+
+    m_real_end = wall_seconds();
+    m_cpu_end = thread_cpu_seconds();
+    return false;
+}
+
+double Bench::State::real_seconds() const
+{
+    return m_real_end - m_real_start;
+}
+
+double Bench::State::cpu_seconds() const
+{
+    return m_cpu_end - m_cpu_start;
+}
+
+Bench::Registration::Registration(const std::string& name, Function function, std::vector<int> threads)
+{
+    registry().push_back({name, std::move(function), std::move(threads)});
+}
+
+Network& Bench::network()
+{
+    static auto network = std::unique_ptr<Network>();
+    if (!network)
+	{
+        auto weights_file = s_weights_file;
+        if (weights_file.empty())
+		{
+            weights_file = (boost::filesystem::temp_directory_path() / boost::filesystem::unique_path("leelaz_bench_%%%%%%%%.txt")).string();
+            write_random_network(weights_file, RANDOM_NETWORK_BLOCKS, RANDOM_NETWORK_FILTERS);
+        }
+
+        network = std::make_unique<Network>();
+        network->initialize(1, weights_file);
+
+        if (s_weights_file.empty())
+		{
+            auto error = boost::system::error_code{};
+            boost::filesystem::remove(weights_file, error);
+        }
+    }
+
+    return *network;
+}
+
+std::vector<int> Bench::play_random_moves(GameState& state, const int moves)
+{
+    auto rng = std::mt19937(5489);
+    auto played = std::vector<int>();
+    state.init_game(BOARD_SIZE, KOMI);
+
+    for (auto move = 0; move < moves; move++)
+	{
+        const auto color = state.get_to_move();
+        auto legal = std::vector<int>();
+        for (auto y = 0; y < BOARD_SIZE; y++)
+		{
+            for (auto x = 0; x < BOARD_SIZE; x++)
+			{
+                const auto vertex = state.board.get_vertex(x, y);
+                if (state.board.get_state(vertex) == FastBoard::EMPTY && state.is_move_legal(color, vertex))
+                    legal.emplace_back(vertex);
+            }
+        }
+
+        if (legal.empty())
+            break;
+
+        played.emplace_back(legal[std::uniform_int_distribution<size_t>(0, legal.size() - 1)(rng)]);
+        state.play_move(played.back());
+    }
+
+    return played;
+}
+
+int main(int argc, char *argv[])
+{
+    namespace po = boost::program_options;
+
+    po::options_description desc("leelaz_bench options");
+    desc.add_options()
+        ("help,h", "Show commandline options.")
+        ("filter", po::value<std::string>()->default_value(""), "Only run the benchmarks whose name matches this regular expression.")
+        ("min-time", po::value<double>()->default_value(0.5), "Seconds every benchmark runs at least.")
+        ("json", po::value<std::string>(), "Write the results as JSON to this file, - for the standard output.")
+        ("weights,w", po::value<std::string>(), "Network of the network benchmarks, random weights of the 9x9 production shape by default.")
+        ("list", "List the benchmarks and exit.")
+        ;
+
+    po::variables_map vm;
+    try
+	{
+        po::store(po::parse_command_line(argc, argv, desc), vm);
+        po::notify(vm);
+    }
+	catch (const boost::program_options::error& e)
+	{
+        printf("ERROR: %s\n", e.what());
+        std::cout << desc << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    if (vm.count("help"))
+	{
+        std::cout << desc << std::endl;
+        return EXIT_SUCCESS;
+    }
+
+    auto& entries = registry();
+    std::sort(begin(entries), end(entries), [](const Entry& a, const Entry& b) { return a.name < b.name; });
+
+    if (vm.count("list"))
+	{
+        for (const auto& entry : entries)
+            printf("%s\n", entry.name.c_str());
+
+        return EXIT_SUCCESS;
+    }
+
+    GTP::setup_default_parameters();
+    cfg_quiet = true;
+    cfg_cpu_only = true;
+    if (vm.count("weights"))
+        s_weights_file = vm["weights"].as<std::string>();
+
+    // Same hashes and random numbers on every run
+    auto rng = std::make_unique<Random>(5489);
+    Zobrist::init_zobrist(*rng);
+    Random::get_rng().random_seed(cfg_rng_seed);
+
+    const auto filter = std::regex(vm["filter"].as<std::string>());
+    const auto min_time = vm["min-time"].as<double>();
+    const auto json_file = vm.count("json") ? vm["json"].as<std::string>() : std::string();
+    // Keep the standard output for the JSON when it goes there
+    const auto console = json_file == "-" ? stderr : stdout;
+
+    auto results = std::vector<Result>();
+    fprintf(console, "%-48s %14s %14s %12s\n", "Benchmark", "Time", "CPU", "Iterations");
+    for (const auto& entry : entries)
+	{
+        if (!std::regex_search(entry.name, filter))
+            continue;
+
+        for (const auto threads : entry.threads)
+		{
+            results.emplace_back(run(entry, threads, min_time));
+            const auto& result = results.back();
+            fprintf(console, "%-48s %11.1f ns %11.1f ns %12lld\n",
+                    result.name.c_str(), result.real_ns, result.cpu_ns, static_cast<long long>(result.iterations));
+        }
+    }
+
+    if (json_file == "-")
+        write_json(std::cout, results, argv[0]);
+    else if (!json_file.empty())
+	{
+        auto out = std::ofstream(json_file);
+        write_json(out, results, argv[0]);
+        if (!out)
+		{
+            fprintf(stderr, "Could not write %s.\n", json_file.c_str());
+            return EXIT_FAILURE;
+        }
+    }
+
+    return EXIT_SUCCESS;
+}
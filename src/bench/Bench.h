@@ -0,0 +1,113 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2017-2019 Michael O and contributors
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+
+    Additional permission under GNU GPL version 3 section 7
+
+    If you modify this Program, or any covered work, by linking or
+    combining it with NVIDIA Corporation's libraries from the
+    NVIDIA CUDA Toolkit and/or the NVIDIA CUDA Deep Neural
+    Network library and/or the NVIDIA TensorRT inference library
+    (or a modified version of those libraries), containing parts covered
+    by the terms of the respective license agreement, the licensors of
+    this Program grant you additional permission to convey the resulting
+    work.
+*/
+
+#ifndef BENCH_H_INCLUDED
+#define BENCH_H_INCLUDED
+
+#include "config.h"
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+class GameState;
+class Network;
+
+/// Minimal microbenchmark harness of leelaz_bench. A benchmark registers a function that loops while State::keep_running()
+/// holds, the harness grows the iteration count until a run lasts long enough and reports the time per iteration. The JSON
+/// output follows the layout of Google Benchmark, so its compare.py can diff two runs.
+namespace Bench
+{
+	/// Iteration state of one thread of a benchmark run
+	class State
+	{
+	public:
+
+		State(std::int64_t iterations, int threads, int thread_index, std::function<void()> start_barrier);
+
+		/// True for as many calls as the run has iterations, the timer starts on the first call and stops on the last
+		bool keep_running();
+
+		int threads() const
+		{
+			return m_threads;
+		}
+
+		int thread_index() const
+		{
+			return m_thread_index;
+		}
+
+		/// Seconds between the first and the last keep_running(), of wall and of thread CPU time
+		double real_seconds() const;
+		double cpu_seconds() const;
+
+	private:
+
+		std::int64_t m_remaining;
+		int m_threads;
+		int m_thread_index;
+		std::function<void()> m_start_barrier;
+
+		bool m_started{false};
+		double m_real_start{0.0};
+		double m_real_end{0.0};
+		double m_cpu_start{0.0};
+		double m_cpu_end{0.0};
+	};
+
+	using Function = std::function<void(State&)>;
+
+	/// Adds a benchmark at static initialization, it runs once for every thread count
+	struct Registration
+	{
+		Registration(const std::string& name, Function function, std::vector<int> threads = {1});
+	};
+
+	/// Network of the benchmarks that need one, loaded on first use from --weights or made up with random weights
+	Network& network();
+
+	/// Keeps the compiler from dropping the computation of a value that is not used otherwise
+	template <typename T>
+	inline void do_not_optimize(const T& value)
+	{
+#if defined(__GNUC__)
+		asm volatile("" : : "r,m"(value) : "memory");
+#else
+		static const void* volatile sink;
+		sink = &value;
+#endif
+	}
+
+	/// Play the given number of random legal moves from a new game, the same ones on every run, returns their vertices
+	std::vector<int> play_random_moves(GameState& state, int moves);
+}
+
+#endif
@@ -0,0 +1,105 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2017-2019 Michael O and contributors
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+
+    Additional permission under GNU GPL version 3 section 7
+
+    If you modify this Program, or any covered work, by linking or
+    combining it with NVIDIA Corporation's libraries from the
+    NVIDIA CUDA Toolkit and/or the NVIDIA CUDA Deep Neural
+    Network library and/or the NVIDIA TensorRT inference library
+    (or a modified version of those libraries), containing parts covered
+    by the terms of the respective license agreement, the licensors of
+    this Program grant you additional permission to convey the resulting
+    work.
+*/
+
+#include "config.h"
+
+#include <vector>
+
+#include "bench/Bench.h"
+#include "FastBoard.h"
+#include "FullBoard.h"
+#include "GameState.h"
+#include "Network.h"
+
+namespace
+{
+    /// Moves of a game well into the middlegame, with some captures on the way
+    constexpr auto GAME_MOVES = 60;
+
+    /// One stone per iteration, the board starts over when the game runs out
+    void update_board(Bench::State& state)
+	{
+        GameState game;
+        const auto moves = Bench::play_random_moves(game, GAME_MOVES);
+
+        FullBoard board;
+        board.reset_board(BOARD_SIZE);
+        auto color = int{FastBoard::BLACK};
+        auto next = size_t{0};
+
+        while (state.keep_running())
+		{
+            if (next == moves.size())
+			{
+                board.reset_board(BOARD_SIZE);
+                color = int{FastBoard::BLACK};
+                next = 0;
+            }
+
+            Bench::do_not_optimize(board.update_board(color, moves[next++]));
+            color = !color;
+        }
+    }
+
+    void super_ko(Bench::State& state)
+	{
+        GameState game;
+        Bench::play_random_moves(game, GAME_MOVES);
+
+        while (state.keep_running())
+            Bench::do_not_optimize(game.super_ko());
+    }
+
+    void final_score(Bench::State& state)
+	{
+        GameState game;
+        Bench::play_random_moves(game, GAME_MOVES);
+
+        while (state.keep_running())
+            Bench::do_not_optimize(game.final_score());
+    }
+
+    void gather_features(Bench::State& state)
+	{
+        GameState game;
+        Bench::play_random_moves(game, GAME_MOVES);
+
+        auto symmetry = 0;
+        while (state.keep_running())
+		{
+            Bench::do_not_optimize(Network::gather_features(&game, symmetry));
+            symmetry = (symmetry + 1) % Network::NUM_SYMMETRIES;
+        }
+    }
+
+    const Bench::Registration update_board_registration("board/update_board", update_board);
+    const Bench::Registration super_ko_registration("board/super_ko", super_ko);
+    const Bench::Registration final_score_registration("board/final_score", final_score);
+    const Bench::Registration gather_features_registration("network/gather_features", gather_features);
+}
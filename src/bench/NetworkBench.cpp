@@ -0,0 +1,184 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2017-2019 Michael O and contributors
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+
+    Additional permission under GNU GPL version 3 section 7
+
+    If you modify this Program, or any covered work, by linking or
+    combining it with NVIDIA Corporation's libraries from the
+    NVIDIA CUDA Toolkit and/or the NVIDIA CUDA Deep Neural
+    Network library and/or the NVIDIA TensorRT inference library
+    (or a modified version of those libraries), containing parts covered
+    by the terms of the respective license agreement, the licensors of
+    this Program grant you additional permission to convey the resulting
+    work.
+*/
+
+#include "config.h"
+
+#include <algorithm>
+#include <cmath>
+#include <memory>
+#include <random>
+#include <vector>
+
+#include "bench/Bench.h"
+#include "CPUPipe.h"
+#include "Network.h"
+#include "Winograd.h"
+
+namespace
+{
+    std::vector<float> random_vector(const size_t size, std::mt19937& rng)
+	{
+        auto distribution = std::uniform_real_distribution<float>(-1.0f, 1.0f);
+        auto result = std::vector<float>(size);
+
+        for (auto& value : result)
+            value = distribution(rng);
+
+        return result;
+    }
+
+    /// Stone planes with the given fraction of the board occupied, then the side to move planes with black to move
+    std::vector<float> random_input_planes(const double occupied, std::mt19937& rng)
+	{
+        auto distribution = std::bernoulli_distribution(occupied);
+        auto result = std::vector<float>(Network::INPUT_CHANNELS * NUM_INTERSECTIONS, 0.0f);
+
+        for (auto i = 0; i < (Network::INPUT_CHANNELS - CPUPipe::CONSTANT_INPUT_PLANES) * NUM_INTERSECTIONS; i++)
+            result[i] = distribution(rng) ? 1.0f : 0.0f;
+
+        std::fill_n(result.begin() + (Network::INPUT_CHANNELS - 2) * NUM_INTERSECTIONS, NUM_INTERSECTIONS, 1.0f);
+
+        return result;
+    }
+
+    /// Network with batch norm scales that keep the activations around 1 through the tower, sparse_input gives
+    /// the pipe the raw input filters so that it can skip the empty intersections of the input convolution
+    std::shared_ptr<ForwardPipe::ForwardPipeWeights> random_network(const int blocks, const int filters, const bool sparse_input)
+	{
+        auto rng = std::mt19937(blocks * filters);
+        auto weights = std::make_shared<ForwardPipe::ForwardPipeWeights>();
+
+        for (auto layer = 0; layer < 1 + 2 * blocks; layer++)
+		{
+            const auto channels = layer == 0 ? Network::INPUT_CHANNELS : filters;
+            const auto filter_weights = random_vector(filters * channels * 9, rng);
+
+            if (layer == 0 && sparse_input)
+                weights->m_conv_input_weights = filter_weights;
+
+            weights->m_conv_weights.emplace_back(Network::winograd_transform_f<WINOGRAD_M>(filter_weights, filters, channels));
+            weights->m_batchnorm_means.emplace_back(filters, 0.0f);
+            weights->m_batchnorm_stddevs.emplace_back(filters, 1.7f / std::sqrt(channels * 9.0f));
+        }
+
+        weights->m_conv_pol_weights = random_vector(Network::OUTPUTS_POLICY * filters, rng);
+        weights->m_conv_val_weights = random_vector(Network::OUTPUTS_VALUE * filters, rng);
+
+        return weights;
+    }
+
+    /// Forward pass of a CPUPipe holding the given network, on a board with the given fraction of stones
+    void cpupipe_forward(Bench::State& state, const int blocks, const int filters, const bool sparse_input, const double occupied)
+	{
+        auto pipe = CPUPipe();
+        pipe.push_weights(WINOGRAD_ALPHA, Network::INPUT_CHANNELS, filters, random_network(blocks, filters, sparse_input));
+
+        auto rng = std::mt19937(1);
+        const auto input = random_input_planes(occupied, rng);
+        auto output_pol = std::vector<float>(Network::OUTPUTS_POLICY * NUM_INTERSECTIONS);
+        auto output_val = std::vector<float>(Network::OUTPUTS_VALUE * NUM_INTERSECTIONS);
+
+        while (state.keep_running())
+		{
+            pipe.forward(input, output_pol, output_val);
+            Bench::do_not_optimize(output_pol.data());
+        }
+    }
+
+    /// One 3x3 convolution of the residual tower: input transform, batched sgemm and output transform
+    void winograd_convolve3(Bench::State& state, const int filters)
+	{
+        auto rng = std::mt19937(filters);
+        const auto U = Network::winograd_transform_f<WINOGRAD_M>(random_vector(filters * filters * 9, rng), filters, filters);
+        const auto input = random_vector(filters * NUM_INTERSECTIONS, rng);
+        auto V = std::vector<float>(WINOGRAD_TILE * filters * WINOGRAD_P);
+        auto M = std::vector<float>(WINOGRAD_TILE * filters * WINOGRAD_P);
+        auto output = std::vector<float>(filters * NUM_INTERSECTIONS);
+
+        while (state.keep_running())
+		{
+            CPUPipe::winograd_convolve3(filters, input, U, V, M, output);
+            Bench::do_not_optimize(output.data());
+        }
+    }
+
+    /// The sgemm stage of winograd_convolve3 alone
+    void winograd_sgemm(Bench::State& state, const int filters)
+	{
+        auto rng = std::mt19937(filters);
+        const auto U = random_vector(WINOGRAD_TILE * filters * filters, rng);
+        const auto V = random_vector(WINOGRAD_TILE * filters * WINOGRAD_P, rng);
+        auto M = std::vector<float>(WINOGRAD_TILE * filters * WINOGRAD_P);
+
+        while (state.keep_running())
+		{
+            CPUPipe::winograd_sgemm(U, V, M, filters, filters);
+            Bench::do_not_optimize(M.data());
+        }
+    }
+
+    /// Policy and value heads of the benchmark network on the outputs of the head convolutions
+    void evaluate_heads(Bench::State& state)
+	{
+        const auto& network = Bench::network();
+        auto rng = std::mt19937(1);
+        const auto policy_data = random_vector(Network::OUTPUTS_POLICY * NUM_INTERSECTIONS, rng);
+        const auto value_data = random_vector(Network::OUTPUTS_VALUE * NUM_INTERSECTIONS, rng);
+        auto result = Network::netresult();
+
+        while (state.keep_running())
+		{
+            network.evaluate_heads(policy_data.data(), value_data.data(), Network::IDENTITY_SYMMETRY, result);
+            Bench::do_not_optimize(result);
+        }
+    }
+
+    // The input stage is a network without residual blocks, the input convolution followed by the 1x1 head convolutions.
+    // A tenth of the board occupied is typical of the opening and the middlegame, where the sparse convolution pays off.
+    const Bench::Registration input_sparse_registration("cpupipe/input/sparse",
+        [](Bench::State& state) { cpupipe_forward(state, 0, 64, true, 0.1); });
+    const Bench::Registration input_winograd_registration("cpupipe/input/winograd",
+        [](Bench::State& state) { cpupipe_forward(state, 0, 64, false, 0.1); });
+
+    const Bench::Registration convolve3_64_registration("cpupipe/winograd_convolve3/64",
+        [](Bench::State& state) { winograd_convolve3(state, 64); });
+    const Bench::Registration convolve3_128_registration("cpupipe/winograd_convolve3/128",
+        [](Bench::State& state) { winograd_convolve3(state, 128); });
+    const Bench::Registration sgemm_64_registration("cpupipe/winograd_sgemm/64",
+        [](Bench::State& state) { winograd_sgemm(state, 64); });
+    const Bench::Registration sgemm_128_registration("cpupipe/winograd_sgemm/128",
+        [](Bench::State& state) { winograd_sgemm(state, 128); });
+
+    const Bench::Registration forward_6x64_registration("cpupipe/forward/6x64",
+        [](Bench::State& state) { cpupipe_forward(state, 6, 64, true, 0.3); });
+    const Bench::Registration forward_10x128_registration("cpupipe/forward/10x128",
+        [](Bench::State& state) { cpupipe_forward(state, 10, 128, true, 0.3); });
+
+    const Bench::Registration evaluate_heads_registration("network/evaluate_heads", evaluate_heads);
+}
@@ -0,0 +1,131 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2017-2019 Michael O and contributors
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+
+    Additional permission under GNU GPL version 3 section 7
+
+    If you modify this Program, or any covered work, by linking or
+    combining it with NVIDIA Corporation's libraries from the
+    NVIDIA CUDA Toolkit and/or the NVIDIA CUDA Deep Neural
+    Network library and/or the NVIDIA TensorRT inference library
+    (or a modified version of those libraries), containing parts covered
+    by the terms of the respective license agreement, the licensors of
+    this Program grant you additional permission to convey the resulting
+    work.
+*/
+
+#include "config.h"
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <random>
+#include <vector>
+
+#include "bench/Bench.h"
+#include "GameState.h"
+#include "NNCache.h"
+#include "Network.h"
+#include "UCTNode.h"
+
+namespace
+{
+    /// Entries already in the cache when the lookups start, half of the lookups hit one of them
+    constexpr auto CACHED_ENTRIES = 20'000;
+
+    const std::vector<int> CACHE_THREADS = {1, 2, 4, 8};
+
+    std::uint64_t random_hash(std::mt19937_64& rng)
+	{
+        return rng();
+    }
+
+    /// Shared by the threads of a run, the way the search threads share the cache of the network
+    NNCache& filled_cache()
+	{
+        static auto cache = []()
+		{
+            auto result = std::make_unique<NNCache>(NNCache::MAX_CACHE_COUNT);
+            auto rng = std::mt19937_64(1);
+            for (auto i = 0; i < CACHED_ENTRIES; i++)
+                result->insert(random_hash(rng), NNCache::Netresult());
+
+            return result;
+        }();
+
+        return *cache;
+    }
+
+    void nncache_lookup(Bench::State& state)
+	{
+        auto& cache = filled_cache();
+        auto hits = std::mt19937_64(1);
+        auto misses = std::mt19937_64(2 + state.thread_index());
+        auto result = NNCache::Netresult();
+        auto count = 0;
+
+        while (state.keep_running())
+		{
+            // Start the sequence of cached hashes over before it runs out
+            if (count++ % (2 * CACHED_ENTRIES) == 0)
+                hits.seed(1);
+
+            const auto hash = count % 2 == 0 ? random_hash(hits) : random_hash(misses);
+            Bench::do_not_optimize(cache.lookup(hash, result));
+        }
+    }
+
+    void nncache_insert(Bench::State& state)
+	{
+        // Small enough that most inserts evict an entry
+        static NNCache cache(NNCache::MIN_CACHE_COUNT);
+        auto rng = std::mt19937_64(100 + state.thread_index());
+        const auto result = NNCache::Netresult();
+
+        while (state.keep_running())
+            cache.insert(random_hash(rng), result);
+    }
+
+    /// Root of a middlegame position with visits spread over its children the way a short search leaves them
+    void uct_select_child(Bench::State& state)
+	{
+        constexpr auto VISITS = 800;
+
+        GameState game;
+        Bench::play_random_moves(game, 30);
+        const auto color = game.get_to_move();
+
+        std::atomic<int> nodes{0};
+        auto eval = 0.0f;
+        UCTNode root(FastBoard::PASS, 0.0f);
+        root.create_children(Bench::network(), nodes, game, eval);
+
+        auto rng = std::mt19937(1);
+        auto evals = std::uniform_real_distribution<float>(0.3f, 0.7f);
+        for (auto i = 0; i < VISITS; i++)
+		{
+            root.uct_select_child(color, true)->update(evals(rng));
+            root.update(0.5f);
+        }
+
+        while (state.keep_running())
+            Bench::do_not_optimize(root.uct_select_child(color, false));
+    }
+
+    const Bench::Registration nncache_lookup_registration("nncache/lookup", nncache_lookup, CACHE_THREADS);
+    const Bench::Registration nncache_insert_registration("nncache/insert", nncache_insert, CACHE_THREADS);
+    const Bench::Registration uct_select_child_registration("uct/select_child", uct_select_child);
+}
@@ -134,6 +134,22 @@ static constexpr auto MAX_CPUS = 256;
 // implementation with some probability.
 #define USE_OPENCL_SELFCHECK
 static constexpr auto SELFCHECK_PROBABILITY = 2000;
+// Self-checks waiting for the verifier thread, more are skipped rather than stalling the search.
+static constexpr auto SELFCHECK_QUEUE_SIZE = 4;
+#endif
+
+/*
+ * USE_INFERENCE_SERVER: Allow forwarding the network evaluations to a
+ * leelaz-infer process shared by all the engines running on the host.
+ * Requests travel through POSIX shared memory and are signaled with futexes,
+ * so this is only available on Linux.
+ */
+#ifdef __linux__
+#define USE_INFERENCE_SERVER
+// Shared memory name used by leelaz-infer and --infer-server when none is given.
+static constexpr auto INFERENCE_SERVER_NAME = "/leelaz-infer";
+// Evaluations in flight at once over all the clients of a server.
+static constexpr auto INFERENCE_SERVER_SLOTS = 256;
 #endif
 
 #if (_MSC_VER >= 1400) /* VC8+ Disable all deprecation warnings */
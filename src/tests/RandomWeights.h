@@ -0,0 +1,78 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2017-2019 Michael O and contributors
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+
+    Additional permission under GNU GPL version 3 section 7
+
+    If you modify this Program, or any covered work, by linking or
+    combining it with NVIDIA Corporation's libraries from the
+    NVIDIA CUDA Toolkit and/or the NVIDIA CUDA Deep Neural
+    Network library and/or the NVIDIA TensorRT inference library
+    (or a modified version of those libraries), containing parts covered
+    by the terms of the respective license agreement, the licensors of
+    this Program grant you additional permission to convey the resulting
+    work.
+*/
+
+#ifndef RANDOMWEIGHTS_H_INCLUDED
+#define RANDOMWEIGHTS_H_INCLUDED
+
+#include <cmath>
+#include <cstddef>
+#include <memory>
+#include <random>
+#include <vector>
+
+#include "ForwardPipe.h"
+#include "Network.h"
+
+/// Values uniformly drawn in [-1, 1]
+inline std::vector<float> random_vector(const size_t size, std::mt19937& rng)
+{
+    auto distribution = std::uniform_real_distribution<float>(-1.0f, 1.0f);
+    auto result = std::vector<float>(size);
+
+    for (auto& value : result)
+        value = distribution(rng);
+
+    return result;
+}
+
+/// Residual tower of random 3x3 filters with the heads, scaled so that the activations neither vanish nor blow up
+inline std::shared_ptr<ForwardPipe::ForwardPipeWeights> random_network(const int blocks, const int filters, std::mt19937& rng)
+{
+    auto weights = std::make_shared<ForwardPipe::ForwardPipeWeights>();
+
+    for (auto layer = 0; layer < 1 + 2 * blocks; layer++)
+	{
+        const auto channels = layer == 0 ? Network::INPUT_CHANNELS : filters;
+        const auto filters_weights = random_vector(filters * channels * 9, rng);
+
+        if (layer == 0)
+            weights->m_conv_input_weights = filters_weights;
+
+        weights->m_conv_weights.emplace_back(Network::winograd_transform_f(filters_weights, filters, channels));
+        weights->m_batchnorm_means.emplace_back(filters, 0.0f);
+        weights->m_batchnorm_stddevs.emplace_back(filters, 1.7f / std::sqrt(channels * 9.0f));
+    }
+
+    weights->m_conv_pol_weights = random_vector(Network::OUTPUTS_POLICY * filters, rng);
+    weights->m_conv_val_weights = random_vector(Network::OUTPUTS_VALUE * filters, rng);
+
+    return weights;
+}
+
+#endif
@@ -0,0 +1,104 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2017-2019 Michael O and contributors
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+
+    Additional permission under GNU GPL version 3 section 7
+
+    If you modify this Program, or any covered work, by linking or
+    combining it with NVIDIA Corporation's libraries from the
+    NVIDIA CUDA Toolkit and/or the NVIDIA CUDA Deep Neural
+    Network library and/or the NVIDIA TensorRT inference library
+    (or a modified version of those libraries), containing parts covered
+    by the terms of the respective license agreement, the licensors of
+    this Program grant you additional permission to convey the resulting
+    work.
+*/
+
+#include <gtest/gtest.h>
+
+#include "config.h"
+
+#include <string>
+#include <vector>
+
+#include "BatchController.h"
+
+namespace
+{
+    constexpr auto MAX_BATCH_SIZE = size_t{16};
+    constexpr auto TARGET_MS = 5.0;
+
+    /// Batches taking 1 ms plus 0.5 ms per evaluation, each evaluation completing with the given latency
+    void record_linear_batches(BatchController& controller, const double latency_ms, const int repeats)
+	{
+        for (auto repeat = 0; repeat < repeats; repeat++)
+            for (auto size = size_t{1}; size <= MAX_BATCH_SIZE; size++)
+                controller.record_batch(size, 1.0 + 0.5 * size, std::vector<double>(size, latency_ms), TARGET_MS);
+    }
+}
+
+TEST(BatchControllerTest, WaitsForAFullBatchBeforeAnyMeasurement)
+{
+    BatchController controller(MAX_BATCH_SIZE, 1);
+
+    const auto decision = controller.decide(MAX_BATCH_SIZE, TARGET_MS);
+    EXPECT_EQ(decision.batch_size, MAX_BATCH_SIZE);
+    EXPECT_DOUBLE_EQ(decision.timeout_ms, TARGET_MS);
+}
+
+TEST(BatchControllerTest, PicksTheLargestBatchWithinTheBudget)
+{
+    BatchController controller(MAX_BATCH_SIZE, 1);
+    record_linear_batches(controller, 1.0, 1);
+
+    // Everything is queued already, so only the service time counts: 1 + 0.5 * 8 = 5 ms
+    const auto decision = controller.decide(MAX_BATCH_SIZE, TARGET_MS);
+    EXPECT_EQ(decision.batch_size, size_t{8});
+    EXPECT_NEAR(decision.timeout_ms, 0.0, 1e-9);
+
+    // A looser target allows larger batches and leaves time to wait for them
+    const auto relaxed = controller.decide(MAX_BATCH_SIZE, 20.0);
+    EXPECT_EQ(relaxed.batch_size, MAX_BATCH_SIZE);
+    EXPECT_NEAR(relaxed.timeout_ms, 20.0 - 9.0, 1e-9);
+}
+
+TEST(BatchControllerTest, ShrinksTheBudgetWhileP99MissesTheTarget)
+{
+    BatchController controller(MAX_BATCH_SIZE, 1);
+
+    record_linear_batches(controller, 2.0 * TARGET_MS, 20);
+    EXPECT_GT(controller.latency_p99_ms(), TARGET_MS);
+    const auto missed = controller.decide(MAX_BATCH_SIZE, TARGET_MS);
+    EXPECT_LT(missed.batch_size, size_t{8});
+
+    // Back under the target the budget recovers
+    record_linear_batches(controller, 0.1, 400);
+    EXPECT_LT(controller.latency_p99_ms(), TARGET_MS);
+    EXPECT_EQ(controller.decide(MAX_BATCH_SIZE, TARGET_MS).batch_size, size_t{8});
+}
+
+TEST(BatchControllerTest, ReportsTheBatchSizeHistogram)
+{
+    BatchController controller(4, 1);
+    controller.record_batch(3, 2.0, {1.0, 1.0, 1.0}, TARGET_MS);
+    controller.record_batch(3, 2.0, {1.0, 1.0, 1.0}, TARGET_MS);
+    controller.record_batch(1, 1.0, {1.0}, TARGET_MS);
+    controller.decide(0, TARGET_MS);
+
+    const auto report = controller.report();
+    EXPECT_NE(report.find("batch sizes: 1:1 2:0 3:2 4:0"), std::string::npos) << report;
+    EXPECT_NE(report.find("decision: batch"), std::string::npos) << report;
+}
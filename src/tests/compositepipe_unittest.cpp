@@ -0,0 +1,208 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2017-2019 Michael O and contributors
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+
+    Additional permission under GNU GPL version 3 section 7
+
+    If you modify this Program, or any covered work, by linking or
+    combining it with NVIDIA Corporation's libraries from the
+    NVIDIA CUDA Toolkit and/or the NVIDIA CUDA Deep Neural
+    Network library and/or the NVIDIA TensorRT inference library
+    (or a modified version of those libraries), containing parts covered
+    by the terms of the respective license agreement, the licensors of
+    this Program grant you additional permission to convey the resulting
+    work.
+*/
+
+#include <gtest/gtest.h>
+
+#include "config.h"
+
+#include <chrono>
+#include <cmath>
+#include <atomic>
+#include <memory>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include "CPUPipe.h"
+#include "CompositePipe.h"
+#include "Network.h"
+#include "RandomWeights.h"
+
+namespace
+{
+    constexpr auto BLOCKS = 2;
+    constexpr auto FILTERS = 32;
+    constexpr auto POLICY_SIZE = Network::OUTPUTS_POLICY * NUM_INTERSECTIONS;
+    constexpr auto VALUE_SIZE = Network::OUTPUTS_VALUE * NUM_INTERSECTIONS;
+
+    /// Time seen by a worker of the pipe, only the evaluations of that worker advance it
+    thread_local auto t_fake_seconds = 0.0;
+
+    double fake_clock()
+	{
+        return t_fake_seconds;
+    }
+
+    /// Backend taking a fixed time per evaluation, its outputs tell which backend did the evaluation. The pipe measures
+    /// exactly that time on the fake clock, whatever the load of the box, the sleep only keeps the workers busy.
+    class TimedPipe : public ForwardPipe
+	{
+    public:
+        TimedPipe(const std::chrono::microseconds time, const std::chrono::microseconds first_time, const float tag) : m_time(time), m_first_time(first_time), m_tag(tag) {}
+
+        void initialize(int) override {}
+        void push_weights(unsigned int, unsigned int, unsigned int, std::shared_ptr<const ForwardPipeWeights>) override {}
+
+        void forward(const std::vector<float>&, std::vector<float>& output_pol, std::vector<float>& output_val) override
+		{
+            const auto time = m_evaluations++ == 0 ? m_first_time : m_time;
+            std::this_thread::sleep_for(time);
+            t_fake_seconds += std::chrono::duration<double>(time).count();
+
+            std::fill(output_pol.begin(), output_pol.end(), m_tag);
+            std::fill(output_val.begin(), output_val.end(), m_tag);
+        }
+
+    private:
+        std::chrono::microseconds m_time;
+        std::chrono::microseconds m_first_time;
+        float m_tag;
+        std::atomic<int> m_evaluations{0};
+    };
+
+    /// Evaluations done by every backend when the given number of threads keep requesting. The slow backend takes four
+    /// units per evaluation and the fast one a single unit, except for its first evaluation.
+    std::vector<size_t> run_timed_backends(const int fast_batch_size, const int slow_batch_size, const int threads, const int evaluations,
+        const std::chrono::microseconds unit = std::chrono::microseconds(1000), const int fast_first_units = 1)
+	{
+        auto backends = std::vector<CompositePipe::Backend>{};
+        backends.push_back({"slow", std::make_unique<TimedPipe>(4 * unit, 4 * unit, 1.0f), slow_batch_size});
+        backends.push_back({"fast", std::make_unique<TimedPipe>(unit, fast_first_units * unit, 2.0f), fast_batch_size});
+        CompositePipe pipe(std::move(backends), fake_clock);
+
+        auto clients = std::vector<std::thread>{};
+        for (auto thread = 0; thread < threads; thread++)
+		{
+            clients.emplace_back([&pipe, evaluations]
+			{
+                const auto input = std::vector<float>(Network::INPUT_CHANNELS * NUM_INTERSECTIONS);
+                auto output_pol = std::vector<float>(POLICY_SIZE);
+                auto output_val = std::vector<float>(VALUE_SIZE);
+
+                for (auto i = 0; i < evaluations; i++)
+                    pipe.forward(input, output_pol, output_val);
+            });
+        }
+
+        for (auto& client : clients)
+            client.join();
+
+        auto result = std::vector<size_t>{};
+        for (const auto& statistics : pipe.get_statistics())
+            result.push_back(statistics.evaluations);
+
+        return result;
+    }
+}
+
+TEST(CompositePipeTest, MatchesSingleBackend)
+{
+    auto rng = std::mt19937(1);
+    const auto weights = random_network(BLOCKS, FILTERS, rng);
+
+    auto reference = CPUPipe();
+    reference.push_weights(WINOGRAD_ALPHA, Network::INPUT_CHANNELS, FILTERS, weights);
+
+    // Two CPU backends with their own batch size, as on a box without OpenCL
+    auto backends = std::vector<CompositePipe::Backend>{};
+    backends.push_back({"CPU 1", std::make_unique<CPUPipe>(), 2});
+    backends.push_back({"CPU 2", std::make_unique<CPUPipe>(), 1});
+    CompositePipe pipe(std::move(backends));
+    pipe.initialize(FILTERS);
+    pipe.push_weights(WINOGRAD_ALPHA, Network::INPUT_CHANNELS, FILTERS, weights);
+
+    constexpr auto clients = 4;
+    constexpr auto evaluations = 25;
+    auto inputs = std::vector<std::vector<float>>{};
+    for (auto i = 0; i < clients * evaluations; i++)
+        inputs.emplace_back(random_vector(Network::INPUT_CHANNELS * NUM_INTERSECTIONS, rng));
+
+    auto results_pol = std::vector<std::vector<float>>(inputs.size(), std::vector<float>(POLICY_SIZE));
+    auto results_val = std::vector<std::vector<float>>(inputs.size(), std::vector<float>(VALUE_SIZE));
+    auto threads = std::vector<std::thread>{};
+
+    for (auto client = 0; client < clients; client++)
+	{
+        threads.emplace_back([&, client]
+		{
+            for (auto i = client; i < clients * evaluations; i += clients)
+                pipe.forward(inputs[i], results_pol[i], results_val[i]);
+        });
+    }
+
+    for (auto& thread : threads)
+        thread.join();
+
+    auto expected_pol = std::vector<float>(POLICY_SIZE);
+    auto expected_val = std::vector<float>(VALUE_SIZE);
+    for (auto i = size_t{0}; i < inputs.size(); i++)
+	{
+        reference.forward(inputs[i], expected_pol, expected_val);
+
+        for (auto j = 0; j < POLICY_SIZE; j++)
+            ASSERT_NEAR(expected_pol[j], results_pol[i][j], 1e-3f * std::max(1.0f, std::abs(expected_pol[j]))) << "policy of evaluation " << i;
+        for (auto j = 0; j < VALUE_SIZE; j++)
+            ASSERT_NEAR(expected_val[j], results_val[i][j], 1e-3f * std::max(1.0f, std::abs(expected_val[j]))) << "value of evaluation " << i;
+    }
+
+    auto total = size_t{0};
+    for (const auto& statistics : pipe.get_statistics())
+        total += statistics.evaluations;
+
+    EXPECT_EQ(total, inputs.size());
+}
+
+TEST(CompositePipeTest, SequentialRequestsGoToFastestBackend)
+{
+    // Each backend is measured once, then the slow one is not picked again before it is due for a probe
+    const auto evaluations = run_timed_backends(1, 1, 1, 50);
+
+    EXPECT_LE(evaluations[0], 1u);
+    EXPECT_GE(evaluations[1], 49u);
+}
+
+TEST(CompositePipeTest, SlowFirstMeasurementIsCorrected)
+{
+    // The fast backend is ten times slower than the other one on its first evaluation, as a cold GPU can be, the probes
+    // bring its speed back and it takes over
+    const auto evaluations = run_timed_backends(1, 1, 1, 2000, std::chrono::microseconds(10), 40);
+
+    EXPECT_GT(evaluations[1], evaluations[0]);
+    EXPECT_EQ(evaluations[0] + evaluations[1], 2000u);
+}
+
+TEST(CompositePipeTest, SlowBackendTakesOverflow)
+{
+    // More requests than the fast backend can run at once, the slow one helps in proportion to its speed
+    const auto evaluations = run_timed_backends(2, 2, 8, 40);
+
+    EXPECT_GT(evaluations[0], 0u);
+    EXPECT_GT(evaluations[1], 2 * evaluations[0]);
+    EXPECT_EQ(evaluations[0] + evaluations[1], 8u * 40u);
+}
@@ -0,0 +1,296 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2017-2019 Michael O and contributors
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+
+    Additional permission under GNU GPL version 3 section 7
+
+    If you modify this Program, or any covered work, by linking or
+    combining it with NVIDIA Corporation's libraries from the
+    NVIDIA CUDA Toolkit and/or the NVIDIA CUDA Deep Neural
+    Network library and/or the NVIDIA TensorRT inference library
+    (or a modified version of those libraries), containing parts covered
+    by the terms of the respective license agreement, the licensors of
+    this Program grant you additional permission to convey the resulting
+    work.
+*/
+
+#include <gtest/gtest.h>
+
+#include "config.h"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "ForwardQueue.h"
+
+namespace
+{
+    constexpr auto BATCH_SIZE = size_t{8};
+
+    /// Worker doubling the inputs, the way a batch worker copies the outputs of the tower back
+    void run_worker(ForwardQueue& queue, const size_t min_count)
+	{
+        auto slots = std::vector<std::uint32_t>();
+
+        while (!queue.closed())
+		{
+            slots.clear();
+            if (queue.pop(slots, min_count, BATCH_SIZE) == 0)
+			{
+                if (!queue.wait_for(min_count, 5) && queue.size() > 0)
+                    queue.pop(slots, 1, BATCH_SIZE);
+
+                if (slots.empty())
+                    continue;
+            }
+
+            for (const auto slot : slots)
+			{
+                const auto& request = queue.request(slot);
+                (*request.output_pol)[0] = 2.0f * (*request.input)[0];
+                (*request.output_val)[0] = 3.0f * (*request.input)[0];
+                queue.complete(slot);
+            }
+        }
+    }
+
+    /// Submit count requests from each of callers threads and check every one got its own outputs
+    void check_round_trip(ForwardQueue& queue, const int callers, const int count)
+	{
+        std::atomic<int> errors{0};
+        auto threads = std::vector<std::thread>();
+
+        for (auto caller = 0; caller < callers; caller++)
+		{
+            threads.emplace_back([&queue, &errors, caller, count]()
+			{
+                auto input = std::vector<float>(1);
+                auto output_pol = std::vector<float>(1);
+                auto output_val = std::vector<float>(1);
+
+                for (auto i = 0; i < count; i++)
+				{
+                    input[0] = static_cast<float>(caller * count + i);
+                    queue.submit(input, output_pol, output_val);
+
+                    if (output_pol[0] != 2.0f * input[0] || output_val[0] != 3.0f * input[0])
+                        errors++;
+                }
+            });
+        }
+
+        for (auto& thread : threads)
+            thread.join();
+
+        EXPECT_EQ(errors.load(), 0);
+    }
+
+    /// The queue the OpenCL scheduler had before, one allocated entry with its own mutex and condition variable per
+    /// request in a list under a shared mutex, kept to compare the latencies
+    class LockedQueue
+	{
+    public:
+
+        void submit(const std::vector<float>& input, std::vector<float>& output)
+		{
+            auto entry = std::make_shared<Entry>(input, output);
+            std::unique_lock<std::mutex> entry_lock(entry->mutex);
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_queue.push_back(entry);
+            }
+            m_cv.notify_one();
+            entry->cv.wait(entry_lock, [&entry]() { return entry->done; });
+        }
+
+        void run_worker()
+		{
+            while (true)
+			{
+                auto batch = std::list<std::shared_ptr<Entry>>();
+                {
+                    std::unique_lock<std::mutex> lock(m_mutex);
+                    m_cv.wait_for(lock, std::chrono::milliseconds(5), [this]() { return !m_running || m_queue.size() >= BATCH_SIZE; });
+                    if (!m_running)
+                        return;
+
+                    while (!m_queue.empty() && batch.size() < BATCH_SIZE)
+					{
+                        batch.push_back(m_queue.front());
+                        m_queue.pop_front();
+                    }
+                }
+
+                for (auto& entry : batch)
+				{
+                    std::lock_guard<std::mutex> lock(entry->mutex);
+                    entry->output[0] = 2.0f * entry->input[0];
+                    entry->done = true;
+                    entry->cv.notify_all();
+                }
+            }
+        }
+
+        void close()
+		{
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_running = false;
+            }
+            m_cv.notify_all();
+        }
+
+    private:
+
+        struct Entry
+		{
+            Entry(const std::vector<float>& input, std::vector<float>& output) : input(input), output(output) {}
+
+            std::mutex mutex;
+            std::condition_variable cv;
+            const std::vector<float>& input;
+            std::vector<float>& output;
+            bool done{false};
+        };
+
+        std::mutex m_mutex;
+        std::condition_variable m_cv;
+        std::list<std::shared_ptr<Entry>> m_queue;
+        bool m_running{true};
+    };
+
+    template <typename Submit>
+    double mean_latency_us(const int callers, const int count, Submit submit)
+	{
+        std::atomic<long long> total_us{0};
+        auto threads = std::vector<std::thread>();
+
+        for (auto caller = 0; caller < callers; caller++)
+		{
+            threads.emplace_back([&total_us, &submit, count]()
+			{
+                auto input = std::vector<float>(1, 1.0f);
+                auto output_pol = std::vector<float>(1);
+                auto output_val = std::vector<float>(1);
+
+                for (auto i = 0; i < count; i++)
+				{
+                    const auto start = std::chrono::steady_clock::now();
+                    submit(input, output_pol, output_val);
+                    total_us += std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+                }
+            });
+        }
+
+        for (auto& thread : threads)
+            thread.join();
+
+        return static_cast<double>(total_us.load()) / (callers * count);
+    }
+}
+
+TEST(ForwardQueueTest, CompletesEveryRequestWithItsOwnOutputs)
+{
+    ForwardQueue queue(16);
+    auto workers = std::vector<std::thread>();
+    for (auto i = 0; i < 2; i++)
+        workers.emplace_back(run_worker, std::ref(queue), BATCH_SIZE);
+
+    check_round_trip(queue, 8, 200);
+
+    queue.close();
+    for (auto& worker : workers)
+        worker.join();
+
+    const auto statistics = queue.get_statistics();
+    EXPECT_EQ(statistics.evaluations, size_t{8 * 200});
+    EXPECT_GE(statistics.batches, statistics.evaluations / BATCH_SIZE);
+    EXPECT_GE(statistics.max_latency_ms, statistics.mean_latency_ms);
+}
+
+TEST(ForwardQueueTest, CallersBeyondCapacityWaitForASlot)
+{
+    ForwardQueue queue(2);
+    std::thread worker(run_worker, std::ref(queue), size_t{1});
+
+    check_round_trip(queue, 6, 100);
+
+    queue.close();
+    worker.join();
+    EXPECT_EQ(queue.get_statistics().evaluations, size_t{6 * 100});
+}
+
+TEST(ForwardQueueTest, PopTakesNothingBelowMinimum)
+{
+    ForwardQueue queue(8);
+    auto input = std::vector<float>(1, 1.0f);
+    auto output_pol = std::vector<float>(1);
+    auto output_val = std::vector<float>(1);
+
+    std::thread caller([&]() { queue.submit(input, output_pol, output_val); });
+
+    EXPECT_TRUE(queue.wait_for(1, 10000));
+    EXPECT_FALSE(queue.wait_for(2, 10));
+
+    auto slots = std::vector<std::uint32_t>();
+    EXPECT_EQ(queue.pop(slots, 2, BATCH_SIZE), size_t{0});
+    EXPECT_EQ(queue.size(), size_t{1});
+    EXPECT_EQ(queue.pop(slots, 1, BATCH_SIZE), size_t{1});
+    EXPECT_EQ(queue.size(), size_t{0});
+
+    (*queue.request(slots[0]).output_pol)[0] = 5.0f;
+    queue.complete(slots[0]);
+    caller.join();
+    EXPECT_EQ(output_pol[0], 5.0f);
+}
+
+// Not a correctness check, reports the request latency of the forward queue against a locked queue.
+// Run with --gtest_also_run_disabled_tests
+TEST(ForwardQueueTest, DISABLED_LatencyBenchmark)
+{
+    constexpr auto CALLERS = 16;
+    constexpr auto COUNT = 500;
+
+    LockedQueue locked;
+    std::thread locked_worker(&LockedQueue::run_worker, &locked);
+    const auto locked_us = mean_latency_us(CALLERS, COUNT, [&locked](const std::vector<float>& input, std::vector<float>& output_pol, std::vector<float>&)
+	{
+        locked.submit(input, output_pol);
+    });
+    locked.close();
+    locked_worker.join();
+
+    ForwardQueue queue(CALLERS);
+    std::thread worker(run_worker, std::ref(queue), BATCH_SIZE);
+    const auto queue_us = mean_latency_us(CALLERS, COUNT, [&queue](const std::vector<float>& input, std::vector<float>& output_pol, std::vector<float>& output_val)
+	{
+        queue.submit(input, output_pol, output_val);
+    });
+    queue.close();
+    worker.join();
+
+    const auto statistics = queue.get_statistics();
+    std::printf("%d callers, batches of %zu: locked queue %.1f us, forward queue %.1f us per request, %.2f requests per batch\n",
+                CALLERS, BATCH_SIZE, locked_us, queue_us, static_cast<double>(statistics.evaluations) / statistics.batches);
+    EXPECT_EQ(statistics.evaluations, size_t{CALLERS * COUNT});
+}
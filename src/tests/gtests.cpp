@@ -32,17 +32,28 @@
 
 #include <cstdint>
 #include <algorithm>
+#include <chrono>
+#include <fstream>
 #include <iostream>
+#include <iterator>
 #include <memory>
 #include <regex>
 #include <string>
+#include <thread>
 #include <vector>
 
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
 #include "GTP.h"
 #include "GameState.h"
 #include "NNCache.h"
 #include "Random.h"
 #include "ThreadPool.h"
+#include "UCTNodePointer.h"
 #include "Utils.h"
 #include "Zobrist.h"
 
@@ -372,3 +383,54 @@ TEST_F(LeelaTest, AnalyzeParseMinmoves)
     // Expect to see at least 5 move priors
     expect_regex(result.first, "info.*?(prior\\s+\\d+\\s+.*?){5,}.*");
 }
+
+#ifndef _WIN32
+TEST_F(LeelaTest, CommandsAreServedWhileWeightsLoad)
+{
+    // A pipe stands in for a slow disk, the load cannot finish before the weights are written into it
+    const auto pipe_name = std::string("pending_weights.fifo");
+    unlink(pipe_name.c_str());
+    ASSERT_EQ(mkfifo(pipe_name.c_str(), 0600), 0);
+    // Holding both ends lets the load open the pipe without blocking
+    const auto pipe = open(pipe_name.c_str(), O_RDWR);
+    ASSERT_GE(pipe, 0);
+
+    auto result = gtp_execute("lz-load_weights " + pipe_name);
+    expect_regex(result.first, "^=");
+
+    // The load is still pending, the command must be answered by the current network without waiting for it
+    result = gtp_execute("name");
+    expect_regex(result.first, "^=");
+    expect_regex(result.second, "Loaded weights", false);
+
+    // A search with the current network leaves a tree behind
+    result = gtp_execute("genmove b");
+    expect_regex(result.first, "^=");
+    EXPECT_GT(UCTNodePointer::get_exact_tree_size(), 0u);
+
+    std::ifstream weights_file("../src/tests/0k.txt", std::ios::binary);
+    const auto weights = std::string(std::istreambuf_iterator<char>(weights_file), std::istreambuf_iterator<char>());
+    for (size_t written = 0; written < weights.size();)
+	{
+        const auto count = write(pipe, weights.data() + written, weights.size() - written);
+        ASSERT_GT(count, 0);
+        written += count;
+    }
+    close(pipe);
+    weights_file.close();
+
+    // Committed by the first command after the load finished
+    auto loaded = false;
+    for (auto attempt = 0; attempt < 600 && !loaded; attempt++)
+	{
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        result = gtp_execute("name");
+        loaded = result.second.find("Loaded weights") != std::string::npos;
+    }
+    EXPECT_TRUE(loaded);
+    // Its priors and values come from the previous network, the commit drops it
+    EXPECT_EQ(UCTNodePointer::get_exact_tree_size(), 0u);
+
+    unlink(pipe_name.c_str());
+}
+#endif
@@ -0,0 +1,252 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2017-2019 Michael O and contributors
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+
+    Additional permission under GNU GPL version 3 section 7
+
+    If you modify this Program, or any covered work, by linking or
+    combining it with NVIDIA Corporation's libraries from the
+    NVIDIA CUDA Toolkit and/or the NVIDIA CUDA Deep Neural
+    Network library and/or the NVIDIA TensorRT inference library
+    (or a modified version of those libraries), containing parts covered
+    by the terms of the respective license agreement, the licensors of
+    this Program grant you additional permission to convey the resulting
+    work.
+*/
+
+#include <gtest/gtest.h>
+
+#include "config.h"
+
+#ifdef USE_INFERENCE_SERVER
+#include <functional>
+#include <memory>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "CPUPipe.h"
+#include "InferenceChannel.h"
+#include "InferenceServer.h"
+#include "Network.h"
+#include "RandomWeights.h"
+#include "RemotePipe.h"
+
+namespace
+{
+    constexpr auto BLOCKS = 2;
+    constexpr auto FILTERS = 32;
+
+    std::vector<float> random_input_planes(std::mt19937& rng)
+	{
+        auto distribution = std::bernoulli_distribution(0.3);
+        auto result = std::vector<float>(Network::INPUT_CHANNELS * NUM_INTERSECTIONS, 0.0f);
+
+        for (auto i = 0; i < (Network::INPUT_CHANNELS - 2) * NUM_INTERSECTIONS; i++)
+            result[i] = distribution(rng) ? 1.0f : 0.0f;
+
+        std::fill_n(result.end() - 2 * NUM_INTERSECTIONS, NUM_INTERSECTIONS, 1.0f);
+
+        return result;
+    }
+
+    std::string test_server_name()
+	{
+        return "/leelaz-infer-test-" + std::to_string(getpid());
+    }
+
+    /// Pid of a process that has already exited, what a crashed client or server leaves behind
+    pid_t exited_process(const std::function<void()>& body = []{})
+	{
+        const auto pid = fork();
+        if (pid == 0)
+		{
+            body();
+            _exit(0);
+        }
+
+        waitpid(pid, nullptr, 0);
+        return pid;
+    }
+
+    /// Server evaluating with a CPUPipe, as leelaz-infer does on a box without OpenCL
+    class CPUServer
+	{
+    public:
+        CPUServer(std::shared_ptr<const ForwardPipe::ForwardPipeWeights> weights, const int slots, const int threads)
+		{
+            m_pipe.push_weights(WINOGRAD_ALPHA, Network::INPUT_CHANNELS, FILTERS, weights);
+            m_server = std::make_unique<InferenceServer>(test_server_name(), slots, FILTERS, weights->fingerprint(),
+                [this](const std::vector<float>& input, std::vector<float>& output_pol, std::vector<float>& output_val)
+				{
+                    m_pipe.forward(input, output_pol, output_val);
+                }, threads);
+        }
+
+        CPUPipe& pipe()
+		{
+            return m_pipe;
+        }
+
+        InferenceServer& server()
+		{
+            return *m_server;
+        }
+
+    private:
+        CPUPipe m_pipe;
+        std::unique_ptr<InferenceServer> m_server;
+    };
+}
+
+TEST(InferenceServerTest, MatchesLocalPipe)
+{
+    auto rng = std::mt19937(1);
+    const auto weights = random_network(BLOCKS, FILTERS, rng);
+
+    // Fewer slots than clients, some of them have to wait for a slot
+    auto server = CPUServer(weights, 3, 2);
+    constexpr auto clients = 6;
+    constexpr auto evaluations = 20;
+
+    auto inputs = std::vector<std::vector<float>>{};
+    for (auto i = 0; i < clients * evaluations; i++)
+        inputs.emplace_back(random_input_planes(rng));
+
+    auto remote = RemotePipe(test_server_name());
+    remote.push_weights(WINOGRAD_ALPHA, Network::INPUT_CHANNELS, FILTERS, weights);
+
+    auto threads = std::vector<std::thread>{};
+    auto results_pol = std::vector<std::vector<float>>(inputs.size(), std::vector<float>(Network::OUTPUTS_POLICY * NUM_INTERSECTIONS));
+    auto results_val = std::vector<std::vector<float>>(inputs.size(), std::vector<float>(Network::OUTPUTS_VALUE * NUM_INTERSECTIONS));
+
+    for (auto client = 0; client < clients; client++)
+	{
+        threads.emplace_back([&, client]
+		{
+            for (auto i = client; i < clients * evaluations; i += clients)
+                remote.forward(inputs[i], results_pol[i], results_val[i]);
+        });
+    }
+
+    for (auto& thread : threads)
+        thread.join();
+
+    EXPECT_EQ(server.server().get_evaluations(), static_cast<std::uint64_t>(clients * evaluations));
+
+    auto expected_pol = std::vector<float>(Network::OUTPUTS_POLICY * NUM_INTERSECTIONS);
+    auto expected_val = std::vector<float>(Network::OUTPUTS_VALUE * NUM_INTERSECTIONS);
+    for (auto i = size_t{0}; i < inputs.size(); i++)
+	{
+        server.pipe().forward(inputs[i], expected_pol, expected_val);
+        ASSERT_EQ(expected_pol, results_pol[i]) << "policy of evaluation " << i;
+        ASSERT_EQ(expected_val, results_val[i]) << "value of evaluation " << i;
+    }
+}
+
+TEST(InferenceServerTest, RejectsAnotherNetwork)
+{
+    auto rng = std::mt19937(2);
+    const auto weights = random_network(BLOCKS, FILTERS, rng);
+    auto server = CPUServer(weights, 4, 1);
+
+    auto remote = RemotePipe(test_server_name());
+    EXPECT_THROW(remote.push_weights(WINOGRAD_ALPHA, Network::INPUT_CHANNELS, FILTERS, random_network(BLOCKS, FILTERS, rng)), std::runtime_error);
+    EXPECT_THROW(remote.initialize(FILTERS * 2), std::runtime_error);
+    EXPECT_NO_THROW(remote.push_weights(WINOGRAD_ALPHA, Network::INPUT_CHANNELS, FILTERS, weights));
+}
+
+TEST(InferenceServerTest, NoServer)
+{
+    EXPECT_THROW(RemotePipe{test_server_name()}, std::runtime_error);
+}
+TEST(InferenceServerTest, RefusesSecondServer)
+{
+    auto rng = std::mt19937(3);
+    const auto weights = random_network(BLOCKS, FILTERS, rng);
+    auto server = CPUServer(weights, 4, 1);
+
+    EXPECT_THROW(InferenceChannel::create(test_server_name(), 4, FILTERS, weights->fingerprint()), std::runtime_error);
+
+    // The running server keeps its segment
+    auto remote = RemotePipe(test_server_name());
+    EXPECT_NO_THROW(remote.push_weights(WINOGRAD_ALPHA, Network::INPUT_CHANNELS, FILTERS, weights));
+}
+
+TEST(InferenceServerTest, ReplacesStaleSegment)
+{
+    // A server that crashes never unlinks its segment
+    exited_process([]
+	{
+        InferenceChannel::create(test_server_name(), 2, FILTERS, 0).release();
+    });
+
+    auto channel = std::unique_ptr<InferenceChannel>{};
+    EXPECT_NO_THROW(channel = InferenceChannel::create(test_server_name(), 4, FILTERS, 0));
+    ASSERT_TRUE(channel->server_alive());
+    EXPECT_EQ(channel->slot_count(), 4);
+}
+
+TEST(InferenceServerTest, KeepsSegmentOfNextServer)
+{
+    auto channel = InferenceChannel::create(test_server_name(), 2, FILTERS, 0);
+
+    // What a server starting after this one was taken for dead leaves under the name
+    shm_unlink(test_server_name().c_str());
+    const auto fd = shm_open(test_server_name().c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+    ASSERT_GE(fd, 0);
+    close(fd);
+
+    channel.reset();
+
+    const auto remaining = shm_open(test_server_name().c_str(), O_RDONLY, 0);
+    EXPECT_GE(remaining, 0);
+    close(remaining);
+    shm_unlink(test_server_name().c_str());
+}
+
+TEST(InferenceServerTest, RecoversSlotsOfExitedClient)
+{
+    auto rng = std::mt19937(4);
+    const auto weights = random_network(BLOCKS, FILTERS, rng);
+    auto server = CPUServer(weights, 2, 1);
+
+    // A client that died while writing its request and one that died before reading its result
+    const auto client = exited_process();
+    const auto channel = InferenceChannel::open(test_server_name());
+    channel->slot(0).owner.store(client);
+    channel->slot(0).state.store(InferenceChannel::WRITING);
+    channel->slot(1).owner.store(client);
+    channel->slot(1).state.store(InferenceChannel::DONE);
+
+    auto remote = RemotePipe(test_server_name());
+    remote.push_weights(WINOGRAD_ALPHA, Network::INPUT_CHANNELS, FILTERS, weights);
+
+    auto output_pol = std::vector<float>(Network::OUTPUTS_POLICY * NUM_INTERSECTIONS);
+    auto output_val = std::vector<float>(Network::OUTPUTS_VALUE * NUM_INTERSECTIONS);
+    remote.forward(random_input_planes(rng), output_pol, output_val);
+
+    EXPECT_EQ(server.server().get_evaluations(), 1u);
+    for (auto index = 0; index < channel->slot_count(); index++)
+        EXPECT_EQ(channel->slot(index).owner.load(), 0) << "slot " << index;
+}
+#endif
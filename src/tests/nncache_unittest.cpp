@@ -0,0 +1,249 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2017-2019 Michael O and contributors
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+
+    Additional permission under GNU GPL version 3 section 7
+
+    If you modify this Program, or any covered work, by linking or
+    combining it with NVIDIA Corporation's libraries from the
+    NVIDIA CUDA Toolkit and/or the NVIDIA CUDA Deep Neural
+    Network library and/or the NVIDIA TensorRT inference library
+    (or a modified version of those libraries), containing parts covered
+    by the terms of the respective license agreement, the licensors of
+    this Program grant you additional permission to convey the resulting
+    work.
+*/
+
+#include <gtest/gtest.h>
+
+#include "config.h"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <memory>
+#include <numeric>
+#include <random>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "NNCache.h"
+
+namespace 
+{
+    bool cached(NNCache& cache, const std::uint64_t hash)
+	{
+        auto result = NNCache::Netresult{};
+        return cache.lookup(hash, result);
+    }
+
+    /// The eviction order NNCache used before, kept as the baseline of the replay benchmark
+    class FifoCache
+	{
+    public:
+        explicit FifoCache(const size_t size) : m_size(size) {}
+
+        bool lookup(const std::uint64_t hash) const
+		{
+            return m_cache.count(hash) > 0;
+        }
+
+        void insert(const std::uint64_t hash)
+		{
+            if (!m_cache.insert(hash).second)
+                return;
+
+            m_order.push_back(hash);
+            if (m_order.size() > m_size)
+			{
+                m_cache.erase(m_order.front());
+                m_order.pop_front();
+            }
+        }
+
+    private:
+        size_t m_size;
+        std::unordered_set<std::uint64_t> m_cache;
+        std::deque<std::uint64_t> m_order;
+    };
+
+    /// Node of the model search tree
+    struct ModelNode
+	{
+        std::uint64_t hash;
+        std::vector<int> moves;
+        std::vector<double> priors;
+        std::unordered_map<int, std::unique_ptr<ModelNode>> children;
+        int visits{0};
+    };
+
+    /// Replays the evaluations requested by a search over a full 9x9 game with tree reuse: every playout descends by the
+    /// priors and evaluates the first leaf it reaches, the subtree of the most visited move is kept for the next search.
+    /// Positions are hashed as the set of stones so that move orders transpose, captures are not modelled. The priors follow
+    /// a ranking of the points shared by the whole game, perturbed by the position hash so that transpositions agree.
+    std::vector<std::uint64_t> model_game_evaluations(const int moves, const int playouts)
+	{
+        constexpr auto points = 81;
+
+        auto rng = std::mt19937_64(1);
+        auto zobrist = std::array<std::array<std::uint64_t, points>, 2>{};
+        for (auto& color : zobrist)
+            for (auto& value : color)
+                value = rng();
+
+        auto ranking = std::vector<int>(points);
+        std::iota(ranking.begin(), ranking.end(), 0);
+        std::shuffle(ranking.begin(), ranking.end(), rng);
+
+        auto evaluations = std::vector<std::uint64_t>{};
+
+        const auto expand = [&](ModelNode& node, const std::vector<bool>& occupied) 
+		{
+            evaluations.push_back(node.hash);
+
+            auto position_rng = std::mt19937_64(node.hash);
+            auto noise = std::lognormal_distribution<double>(0.0, 1.0);
+
+            // Sharp policy, the best few moves take most of the visits as with a trained network
+            for (auto rank = 0; rank < points; rank++)
+			{
+                if (occupied[ranking[rank]])
+                    continue;
+
+                node.moves.push_back(ranking[rank]);
+                node.priors.push_back(noise(position_rng) / std::pow(rank + 1.0, 1.5));
+            }
+        };
+
+        auto occupied = std::vector<bool>(points, false);
+        auto root = std::make_unique<ModelNode>();
+        root->hash = 0;
+
+        for (auto move = 0; move < moves; move++)
+		{
+            for (auto playout = 0; playout < playouts; playout++)
+			{
+                auto node = root.get();
+                auto path_occupied = occupied;
+                auto color = move % 2;
+
+                while (node->visits > 0 && !node->moves.empty())
+				{
+                    node->visits++;
+
+                    const auto index = std::discrete_distribution<size_t>(node->priors.begin(), node->priors.end())(rng);
+                    const auto point = node->moves[index];
+                    auto& child = node->children[point];
+                    if (!child)
+					{
+                        child = std::make_unique<ModelNode>();
+                        child->hash = node->hash ^ zobrist[color][point];
+                    }
+
+                    path_occupied[point] = true;
+                    color = 1 - color;
+                    node = child.get();
+                }
+
+                if (node->visits++ == 0)
+                    expand(*node, path_occupied);
+            }
+
+            // Play the most visited move and keep its subtree
+            const auto best = std::max_element(root->children.begin(), root->children.end(), [](const auto& a, const auto& b) { return a.second->visits < b.second->visits; });
+            occupied[best->first] = true;
+            root = std::move(best->second);
+        }
+
+        return evaluations;
+    }
+}
+
+TEST(NNCacheTest, EvictsEntriesNotHitSinceLastPass)
+{
+    NNCache cache(3);
+    for (const auto hash : { 1, 2, 3 })
+        cache.insert(hash, NNCache::Netresult{});
+
+    // The oldest entry is hit, FIFO would evict it next
+    EXPECT_TRUE(cached(cache, 1));
+    cache.insert(4, NNCache::Netresult{});
+
+    EXPECT_TRUE(cached(cache, 1));
+    EXPECT_FALSE(cached(cache, 2));
+    EXPECT_TRUE(cached(cache, 3));
+    EXPECT_TRUE(cached(cache, 4));
+    EXPECT_EQ(cache.get_estimated_size(), 3 * NNCache::ENTRY_SIZE);
+}
+
+TEST(NNCacheTest, ResizeKeepsHitEntries)
+{
+    NNCache cache(4);
+    for (const auto hash : { 1, 2, 3, 4 })
+        cache.insert(hash, NNCache::Netresult{});
+
+    EXPECT_TRUE(cached(cache, 2));
+    EXPECT_TRUE(cached(cache, 4));
+    cache.resize(2);
+
+    EXPECT_FALSE(cached(cache, 1));
+    EXPECT_TRUE(cached(cache, 2));
+    EXPECT_FALSE(cached(cache, 3));
+    EXPECT_TRUE(cached(cache, 4));
+    EXPECT_EQ(cache.get_estimated_size(), 2 * NNCache::ENTRY_SIZE);
+
+    // The shrunk clock keeps evicting correctly
+    cache.insert(5, NNCache::Netresult{});
+    EXPECT_TRUE(cached(cache, 5));
+    EXPECT_EQ(cache.get_estimated_size(), 2 * NNCache::ENTRY_SIZE);
+}
+
+// Not a correctness check, reports the hit rates of FIFO and CLOCK eviction at fixed budgets over a model 9x9 game.
+// Run with --gtest_also_run_disabled_tests
+TEST(NNCacheTest, DISABLED_ReplayBenchmark)
+{
+    constexpr auto moves = 60;
+    constexpr auto playouts = 1600;
+
+    const auto evaluations = model_game_evaluations(moves, playouts);
+
+    printf("%d evaluations over %d moves with %d playouts and tree reuse\n", static_cast<int>(evaluations.size()), moves, playouts);
+    printf("entries     MiB      FIFO     CLOCK  hit rate\n");
+    for (const auto size : { 500, 1000, 2000, 4000, 8000, 1 << 20 }) 
+	{
+        auto fifo = FifoCache(size);
+        NNCache clock(size);
+        auto fifo_hits = 0;
+
+        for (const auto hash : evaluations)
+		{
+            if (fifo.lookup(hash))
+                fifo_hits++;
+            else
+                fifo.insert(hash);
+
+            if (!cached(clock, hash))
+                clock.insert(hash, NNCache::Netresult{});
+        }
+
+        const auto lookups = static_cast<double>(evaluations.size());
+        printf("%7d %7.1f %8.1f%% %8.1f%%\n", size, size * NNCache::ENTRY_SIZE / 1048576.0, 100.0 * fifo_hits / lookups, 100.0 * clock.hit_rate().first / lookups);
+    }
+}
@@ -0,0 +1,214 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2017-2019 Gian-Carlo Pascutto and contributors
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+
+    Additional permission under GNU GPL version 3 section 7
+
+    If you modify this Program, or any covered work, by linking or
+    combining it with NVIDIA Corporation's libraries from the
+    NVIDIA CUDA Toolkit and/or the NVIDIA CUDA Deep Neural
+    Network library and/or the NVIDIA TensorRT inference library
+    (or a modified version of those libraries), containing parts covered
+    by the terms of the respective license agreement, the licensors of
+    this Program grant you additional permission to convey the resulting
+    work.
+*/
+
+#include <gtest/gtest.h>
+
+#include "config.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <thread>
+#include <vector>
+
+#include "SMP.h"
+
+namespace
+{
+    /// The previous lock, spinning on the flag until it gets it
+    class SpinLock
+	{
+    public:
+        void lock()
+		{
+            while (m_lock.exchange(true, std::memory_order_acquire))
+                while (m_lock.load(std::memory_order_relaxed)) {}
+        }
+
+        void unlock()
+		{
+            m_lock.store(false, std::memory_order_release);
+        }
+
+    private:
+        std::atomic<bool> m_lock{false};
+    };
+
+    double elapsed_ms(const std::chrono::steady_clock::time_point start)
+	{
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    /// Milliseconds for threads threads to take the lock count times each
+    template <typename Lock, typename Unlock>
+    double lock_ms(const size_t threads, const int count, Lock lock, Unlock unlock)
+	{
+        auto counter = 0;
+        auto workers = std::vector<std::thread>();
+
+        const auto start = std::chrono::steady_clock::now();
+        for (auto i = size_t{0}; i < threads; i++)
+		{
+            workers.emplace_back([&counter, count, lock, unlock]()
+			{
+                for (auto j = 0; j < count; j++)
+				{
+                    lock();
+                    counter++;
+                    unlock();
+                }
+            });
+        }
+
+        for (auto& worker : workers)
+            worker.join();
+
+        EXPECT_EQ(counter, static_cast<int>(threads) * count);
+        return elapsed_ms(start);
+    }
+
+    /// Milliseconds one thread takes for work_ms of computation while waiters threads wait for it, the way
+    /// search threads wait on a node another thread is expanding
+    template <typename Wait>
+    double expansion_ms(const size_t waiters, const double work_ms, Wait wait)
+	{
+        std::atomic<bool> expanded{false};
+        auto threads = std::vector<std::thread>();
+        for (auto i = size_t{0}; i < waiters; i++)
+            threads.emplace_back([&expanded, wait]() { wait(expanded); });
+
+        const auto start = std::chrono::steady_clock::now();
+        auto sink = 0.0;
+        while (elapsed_ms(start) < work_ms)
+            sink += 1.0;
+
+        expanded = true;
+        SMP::unpark_all(&expanded);
+        for (auto& thread : threads)
+            thread.join();
+
+        return sink > 0.0 ? elapsed_ms(start) : 0.0;
+    }
+}
+
+TEST(SMPTest, LockIsMutuallyExclusive)
+{
+    SMP::Mutex mutex;
+    auto counter = 0;
+    auto workers = std::vector<std::thread>();
+    for (auto i = 0; i < 8; i++)
+	{
+        workers.emplace_back([&mutex, &counter]()
+		{
+            for (auto j = 0; j < 20000; j++)
+			{
+                LOCK(mutex, lock);
+                counter++;
+            }
+        });
+    }
+
+    for (auto& worker : workers)
+        worker.join();
+
+    EXPECT_EQ(counter, 8 * 20000);
+}
+
+TEST(SMPTest, ParkedWaitersWakeUp)
+{
+    std::atomic<int> state{0};
+    std::atomic<int> woken{0};
+
+    auto waiters = std::vector<std::thread>();
+    for (auto i = 0; i < 4; i++)
+	{
+        waiters.emplace_back([&state, &woken]()
+		{
+            SMP::park_until(&state, [&state]() { return state.load() == 1; });
+            ++woken;
+        });
+    }
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    EXPECT_EQ(woken.load(), 0);
+
+    state = 1;
+    SMP::unpark_all(&state);
+    for (auto& waiter : waiters)
+        waiter.join();
+
+    EXPECT_EQ(woken.load(), 4);
+}
+
+// Not a correctness check, reports spinning against parking waiters with more threads than cpus.
+// Run with --gtest_also_run_disabled_tests
+TEST(SMPTest, DISABLED_OversubscribedBenchmark)
+{
+    const auto cpus = std::max(size_t{1}, SMP::get_num_cpus());
+
+    for (auto threads = cpus; threads <= 8 * cpus; threads *= 2)
+	{
+        SpinLock spin;
+        const auto spin_ms = lock_ms(threads, 20000, [&spin]() { spin.lock(); }, [&spin]() { spin.unlock(); });
+
+        const auto before = SMP::get_contention_stats();
+        SMP::Mutex mutex;
+        const auto smp_ms = lock_ms(threads, 20000, [&mutex]()
+		{
+            SMP::Lock lock(mutex);
+            lock.unlock();
+        }, []() {});
+        const auto after = SMP::get_contention_stats();
+
+        std::printf("%3zu threads on %zu cpus: spin lock %7.1f ms, SMP::Lock %7.1f ms (%llu waits, %llu parked)\n",
+                    threads, cpus, spin_ms, smp_ms,
+                    static_cast<unsigned long long>(after.lock_waits - before.lock_waits),
+                    static_cast<unsigned long long>(after.lock_parks - before.lock_parks));
+    }
+
+    // A search thread computing for 2 ms while the others wait on the node it expands
+    constexpr auto WORK_MS = 2.0;
+    for (auto waiters = cpus; waiters <= 8 * cpus; waiters *= 2)
+	{
+        const auto spin_ms = expansion_ms(waiters, WORK_MS, [](const std::atomic<bool>& expanded)
+		{
+            while (!expanded.load()) {}
+        });
+        const auto park_ms = expansion_ms(waiters, WORK_MS, [](const std::atomic<bool>& expanded)
+		{
+            const auto done = [&expanded]() { return expanded.load(); };
+            if (!SMP::spin_until(done, SMP::spin_limit()))
+                SMP::park_until(&expanded, done);
+        });
+
+        std::printf("%3zu waiters on %zu cpus: %.1f ms of work takes %7.1f ms with spinning waiters, %7.1f ms with parking waiters\n",
+                    waiters, cpus, WORK_MS, spin_ms, park_ms);
+    }
+}
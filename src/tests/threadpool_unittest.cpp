@@ -0,0 +1,265 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2017-2019 Gian-Carlo Pascutto and contributors
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+
+    Additional permission under GNU GPL version 3 section 7
+
+    If you modify this Program, or any covered work, by linking or
+    combining it with NVIDIA Corporation's libraries from the
+    NVIDIA CUDA Toolkit and/or the NVIDIA CUDA Deep Neural
+    Network library and/or the NVIDIA TensorRT inference library
+    (or a modified version of those libraries), containing parts covered
+    by the terms of the respective license agreement, the licensors of
+    this Program grant you additional permission to convey the resulting
+    work.
+*/
+
+#include <gtest/gtest.h>
+
+#include "config.h"
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include "ThreadPool.h"
+
+using namespace Utils;
+
+namespace
+{
+    /// The previous pool: one locked queue, and a packaged_task plus a future for every task
+    class LockedPool
+	{
+    public:
+        explicit LockedPool(const size_t threads)
+		{
+            for (auto i = size_t{0}; i < threads; i++)
+			{
+                m_threads.emplace_back([this]
+				{
+                    for (;;)
+					{
+                        std::function<void()> task;
+                        {
+                            std::unique_lock<std::mutex> lock(m_mutex);
+                            m_condvar.wait(lock, [this] { return m_exit || !m_tasks.empty(); });
+                            if (m_exit && m_tasks.empty())
+                                return;
+
+                            task = std::move(m_tasks.front());
+                            m_tasks.pop();
+                        }
+                        task();
+                    }
+                });
+            }
+        }
+
+        ~LockedPool()
+		{
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_exit = true;
+            }
+            m_condvar.notify_all();
+            for (auto& thread : m_threads)
+                thread.join();
+        }
+
+        std::future<void> add_task(std::function<void()> f)
+		{
+            auto task = std::make_shared<std::packaged_task<void()>>(std::move(f));
+            auto result = task->get_future();
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_tasks.emplace([task]() { (*task)(); });
+            }
+            m_condvar.notify_one();
+            return result;
+        }
+
+    private:
+        std::vector<std::thread> m_threads;
+        std::queue<std::function<void()>> m_tasks;
+        std::mutex m_mutex;
+        std::condition_variable m_condvar;
+        bool m_exit{false};
+    };
+
+    /// Nanoseconds per empty task when queueing count tasks and waiting for all of them
+    template <typename Schedule>
+    double overhead_ns(const int count, Schedule schedule)
+	{
+        const auto start = std::chrono::steady_clock::now();
+        schedule(count);
+        const auto elapsed = std::chrono::steady_clock::now() - start;
+
+        return std::chrono::duration<double, std::nano>(elapsed).count() / count;
+    }
+}
+
+TEST(ThreadPoolTest, RunsEveryTaskOfAGroup)
+{
+    ThreadPool pool;
+    pool.initialize(4);
+
+    std::atomic<int> runs{0};
+    ThreadGroup group(pool);
+    for (auto i = 0; i < 1000; i++)
+        group.add_task([&runs]() { ++runs; });
+
+    group.add_tasks(1000, [&runs]() { ++runs; });
+    group.wait_all();
+
+    EXPECT_EQ(runs.load(), 2000);
+}
+
+TEST(ThreadPoolTest, TasksQueuedFromWorkersRun)
+{
+    ThreadPool pool;
+    pool.initialize(4);
+
+    // Every task spawns more work from inside the pool, which lands in the deque of its worker
+    std::atomic<int> runs{0};
+    ThreadGroup outer(pool);
+    outer.add_tasks(8, [&pool, &runs]()
+	{
+        ThreadGroup inner(pool);
+        for (auto i = 0; i < 2000; i++)
+            inner.add_task([&runs]() { ++runs; });
+
+        inner.wait_all();
+    });
+    outer.wait_all();
+
+    EXPECT_EQ(runs.load(), 8 * 2000);
+}
+
+TEST(ThreadPoolTest, WaitAllRethrowsTheFirstException)
+{
+    ThreadPool pool;
+    pool.initialize(2);
+
+    std::atomic<int> runs{0};
+    ThreadGroup group(pool);
+    group.add_tasks(10, [&runs]() { ++runs; });
+    group.add_task([]() { throw std::runtime_error("task failed"); });
+
+    EXPECT_THROW(group.wait_all(), std::runtime_error);
+    EXPECT_EQ(runs.load(), 10);
+
+    // The exception is reported once, the group can be waited on again
+    group.wait_all();
+}
+
+TEST(ThreadPoolTest, AddTaskReturnsTheResult)
+{
+    ThreadPool pool;
+    pool.initialize(2);
+
+    // Too large for the inline storage of a task
+    auto large = std::array<int, 64>();
+    large.fill(3);
+
+    auto small = pool.add_task([](const int a, const int b) { return a * b; }, 6, 7);
+    auto heap = pool.add_task([large]() { return large[0] + large[63]; });
+    auto failed = pool.add_task([]() -> int { throw std::runtime_error("task failed"); });
+
+    EXPECT_EQ(small.get(), 42);
+    EXPECT_EQ(heap.get(), 6);
+    EXPECT_THROW(failed.get(), std::runtime_error);
+}
+
+TEST(ThreadPoolTest, DestructorRunsQueuedTasks)
+{
+    std::atomic<int> runs{0};
+    {
+        ThreadPool pool;
+        pool.initialize(1);
+
+        for (auto i = 0; i < 100; i++)
+            pool.add_task([&runs]() { ++runs; });
+    }
+
+    EXPECT_EQ(runs.load(), 100);
+}
+
+// Not a correctness check, reports the cost per task from 1 to 128 threads. Run with --gtest_also_run_disabled_tests
+TEST(ThreadPoolTest, DISABLED_SchedulingBenchmark)
+{
+    constexpr auto COUNT = 20000;
+
+    for (auto threads = size_t{1}; threads <= 128; threads *= 2)
+	{
+        auto locked_ns = 0.0;
+        {
+            LockedPool pool(threads);
+            locked_ns = overhead_ns(COUNT, [&pool](const int count)
+			{
+                auto results = std::vector<std::future<void>>();
+                for (auto i = 0; i < count; i++)
+                    results.emplace_back(pool.add_task([]() {}));
+
+                for (auto& result : results)
+                    result.get();
+            });
+        }
+
+        ThreadPool pool;
+        pool.initialize(threads);
+        const auto single_ns = overhead_ns(COUNT, [&pool](const int count)
+		{
+            ThreadGroup group(pool);
+            for (auto i = 0; i < count; i++)
+                group.add_task([]() {});
+
+            group.wait_all();
+        });
+        const auto batch_ns = overhead_ns(COUNT, [&pool](const int count)
+		{
+            ThreadGroup group(pool);
+            group.add_tasks(count, []() {});
+            group.wait_all();
+        });
+        const auto nested_ns = overhead_ns(COUNT, [&pool, threads](const int count)
+		{
+            ThreadGroup group(pool);
+            group.add_tasks(threads, [&pool, count, threads]()
+			{
+                ThreadGroup inner(pool);
+                for (auto i = size_t{0}; i < count / threads; i++)
+                    inner.add_task([]() {});
+
+                inner.wait_all();
+            });
+            group.wait_all();
+        });
+
+        std::printf("%3zu threads: locked pool %7.0f ns, thread group %7.0f ns, batched %7.0f ns, from workers %7.0f ns per task\n",
+                    threads, locked_ns, single_ns, batch_ns, nested_ns);
+    }
+}
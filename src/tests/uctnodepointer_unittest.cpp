@@ -0,0 +1,125 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2017-2019 Gian-Carlo Pascutto and contributors
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+
+    Additional permission under GNU GPL version 3 section 7
+
+    If you modify this Program, or any covered work, by linking or
+    combining it with NVIDIA Corporation's libraries from the
+    NVIDIA CUDA Toolkit and/or the NVIDIA CUDA Deep Neural
+    Network library and/or the NVIDIA TensorRT inference library
+    (or a modified version of those libraries), containing parts covered
+    by the terms of the respective license agreement, the licensors of
+    this Program grant you additional permission to convey the resulting
+    work.
+*/
+
+#include <gtest/gtest.h>
+
+#include "config.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <thread>
+#include <vector>
+
+#include "UCTNodePointer.h"
+
+namespace
+{
+    /// Nanoseconds per node when threads threads each create and free count nodes
+    template <typename Work>
+    double node_ns(const size_t threads, const int count, Work work)
+	{
+        auto workers = std::vector<std::thread>();
+
+        const auto start = std::chrono::steady_clock::now();
+        for (auto i = size_t{0}; i < threads; i++)
+            workers.emplace_back([count, work]() { work(count); });
+
+        for (auto& worker : workers)
+            worker.join();
+
+        const auto elapsed = std::chrono::steady_clock::now() - start;
+        return std::chrono::duration<double, std::nano>(elapsed).count() / (static_cast<double>(threads) * count);
+    }
+}
+
+TEST(TreeSizeTest, CountsNodesOfEveryThread)
+{
+    constexpr auto THREADS = 8;
+    constexpr auto COUNT = 10000;
+
+    const auto baseline = UCTNodePointer::get_exact_tree_size();
+
+    // Nodes are built on worker threads and freed on this one, the way old trees are freed in the background
+    auto nodes = std::vector<std::vector<UCTNodePointer>>(THREADS);
+    auto workers = std::vector<std::thread>();
+    for (auto i = 0; i < THREADS; i++)
+	{
+        workers.emplace_back([&nodes, i]()
+		{
+            nodes[i].reserve(COUNT);
+            for (auto j = 0; j < COUNT; j++)
+                nodes[i].emplace_back(static_cast<std::int16_t>(j), 0.5f);
+        });
+    }
+
+    for (auto& worker : workers)
+        worker.join();
+
+    const auto expected = baseline + THREADS * COUNT * sizeof(UCTNodePointer);
+    EXPECT_EQ(UCTNodePointer::get_exact_tree_size(), expected);
+
+    // The cheap view lags by less than the slack of each thread
+    const auto slack = static_cast<size_t>(THREADS * UCTNodePointer::TREE_SIZE_SLACK);
+    EXPECT_LE(UCTNodePointer::get_tree_size(), expected);
+    EXPECT_GE(UCTNodePointer::get_tree_size() + slack, expected);
+
+    nodes.clear();
+    EXPECT_EQ(UCTNodePointer::get_exact_tree_size(), baseline);
+}
+
+// Not a correctness check, reports the shared counter against the per thread ones from 1 to 128 threads.
+// Run with --gtest_also_run_disabled_tests
+TEST(TreeSizeTest, DISABLED_ScalingBenchmark)
+{
+    constexpr auto COUNT = 200000;
+
+    for (auto threads = size_t{1}; threads <= 128; threads *= 2)
+	{
+        // What every node used to do: one shared atomic, written on each construction and destruction
+        std::atomic<size_t> shared{0};
+        const auto shared_ns = node_ns(threads, COUNT / static_cast<int>(threads), [&shared](const int count)
+		{
+            for (auto i = 0; i < count; i++)
+			{
+                shared += sizeof(UCTNodePointer);
+                shared -= sizeof(UCTNodePointer);
+            }
+        });
+
+        const auto counted_ns = node_ns(threads, COUNT / static_cast<int>(threads), [](const int count)
+		{
+            for (auto i = 0; i < count; i++)
+                UCTNodePointer node(static_cast<std::int16_t>(i), 0.5f);
+        });
+
+        std::printf("%3zu threads: shared atomic %6.1f ns, per thread counters %6.1f ns per node\n",
+                    threads, shared_ns, counted_ns);
+    }
+}
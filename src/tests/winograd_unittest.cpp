@@ -0,0 +1,399 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2017-2019 Michael O and contributors
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+
+    Additional permission under GNU GPL version 3 section 7
+
+    If you modify this Program, or any covered work, by linking or
+    combining it with NVIDIA Corporation's libraries from the
+    NVIDIA CUDA Toolkit and/or the NVIDIA CUDA Deep Neural
+    Network library and/or the NVIDIA TensorRT inference library
+    (or a modified version of those libraries), containing parts covered
+    by the terms of the respective license agreement, the licensors of
+    this Program grant you additional permission to convey the resulting
+    work.
+*/
+
+#include <gtest/gtest.h>
+
+#include "config.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <memory>
+#include <random>
+#include <vector>
+
+#ifdef USE_OPENBLAS
+#include <cblas.h>
+#endif
+#include <Eigen/Dense>
+
+#include "CPUPipe.h"
+#include "Network.h"
+#include "RandomWeights.h"
+#include "Winograd.h"
+
+namespace 
+{
+    constexpr auto CHANNELS = 64;
+
+    // Plain 3x3 convolution with zero padding, filters are [outputs][channels][3][3]
+    std::vector<float> direct_convolve3(const int outputs, const int channels, const std::vector<float>& input, const std::vector<float>& filters)
+	{
+        auto output = std::vector<float>(outputs * BOARD_SIZE * BOARD_SIZE, 0.0f);
+    	
+        for (auto o = 0; o < outputs; o++) 
+		{
+            for (auto c = 0; c < channels; c++) 
+			{
+                for (auto y = 0; y < BOARD_SIZE; y++) 
+				{
+                    for (auto x = 0; x < BOARD_SIZE; x++) 
+					{
+                        auto acc = 0.0f;
+                    	
+                        for (auto fy = 0; fy < 3; fy++) 
+						{
+                            for (auto fx = 0; fx < 3; fx++) 
+							{
+                                const auto in_y = y + fy - 1;
+                                const auto in_x = x + fx - 1;
+                            	
+                                if (in_y >= 0 && in_y < BOARD_SIZE && in_x >= 0 && in_x < BOARD_SIZE)
+                                    acc += filters[((o * channels + c) * 3 + fy) * 3 + fx] * input[c * BOARD_SIZE * BOARD_SIZE + in_y * BOARD_SIZE + in_x];
+                            }
+                        }
+                    	
+                        output[o * BOARD_SIZE * BOARD_SIZE + y * BOARD_SIZE + x] += acc;
+                    }
+                }
+            }
+        }
+    	
+        return output;
+    }
+
+    template <int M>
+    std::vector<float> winograd_convolve3(const int outputs, const int channels, const std::vector<float>& input, const std::vector<float>& filters)
+	{
+        constexpr auto tile = WinogradTransform<M>::ALPHA * WinogradTransform<M>::ALPHA;
+        constexpr auto tiles = winograd_tiles(BOARD_SIZE, M) * winograd_tiles(BOARD_SIZE, M);
+
+        const auto U = Network::winograd_transform_f<M>(filters, outputs, channels);
+        auto V = std::vector<float>(tile * channels * tiles);
+        auto M_buffer = std::vector<float>(tile * outputs * tiles);
+        auto output = std::vector<float>(outputs * BOARD_SIZE * BOARD_SIZE);
+
+        CPUPipe::winograd_convolve3<M>(outputs, input, U, V, M_buffer, output);
+    	
+        return output;
+    }
+
+    template <int M>
+    void expect_matches_direct()
+	{
+        auto rng = std::mt19937(BOARD_SIZE * M);
+        const auto input = random_vector(CHANNELS * BOARD_SIZE * BOARD_SIZE, rng);
+        const auto filters = random_vector(CHANNELS * CHANNELS * 9, rng);
+
+        const auto expected = direct_convolve3(CHANNELS, CHANNELS, input, filters);
+        const auto result = winograd_convolve3<M>(CHANNELS, CHANNELS, input, filters);
+
+        for (auto i = size_t{0}; i < expected.size(); i++)
+            ASSERT_NEAR(expected[i], result[i], 1e-3f) << "F(" << M << "x" << M << ", 3x3) at " << i;
+    }
+
+    void expect_all_tiles_match_direct()
+	{
+        expect_matches_direct<2>();
+        expect_matches_direct<3>();
+        expect_matches_direct<4>();
+    }
+
+    // Stone planes with the given fraction of the board occupied, then the side to move planes
+    std::vector<float> random_input_planes(const double occupied, const bool black_to_move, std::mt19937& rng)
+	{
+        constexpr auto num_intersections = BOARD_SIZE * BOARD_SIZE;
+        auto distribution = std::bernoulli_distribution(occupied);
+        auto result = std::vector<float>(Network::INPUT_CHANNELS * num_intersections, 0.0f);
+    	
+        for (auto i = 0; i < (Network::INPUT_CHANNELS - CPUPipe::CONSTANT_INPUT_PLANES) * num_intersections; i++)
+            result[i] = distribution(rng) ? 1.0f : 0.0f;
+
+        const auto to_move_plane = Network::INPUT_CHANNELS - (black_to_move ? 2 : 1);
+        std::fill_n(result.begin() + to_move_plane * num_intersections, num_intersections, 1.0f);
+    	
+        return result;
+    }
+
+    // Runs a network made of the input convolution and the heads, with or without the sparse input convolution
+    void expect_sparse_input_matches_winograd()
+	{
+        constexpr auto M = WINOGRAD_M;
+        auto rng = std::mt19937(BOARD_SIZE);
+        const auto filters = random_vector(CHANNELS * Network::INPUT_CHANNELS * 9, rng);
+
+        auto weights = std::make_shared<ForwardPipe::ForwardPipeWeights>();
+        weights->m_conv_weights.emplace_back(Network::winograd_transform_f<M>(filters, CHANNELS, Network::INPUT_CHANNELS));
+        // A very negative mean keeps the ReLU from hiding any difference
+        weights->m_batchnorm_means.emplace_back(CHANNELS, -100.0f);
+        weights->m_batchnorm_stddevs.emplace_back(CHANNELS, 1.0f);
+        weights->m_conv_pol_weights = random_vector(Network::OUTPUTS_POLICY * CHANNELS, rng);
+        weights->m_conv_val_weights = random_vector(Network::OUTPUTS_VALUE * CHANNELS, rng);
+
+        auto sparse_weights = std::make_shared<ForwardPipe::ForwardPipeWeights>(*weights);
+        sparse_weights->m_conv_input_weights = filters;
+
+        auto winograd_pipe = CPUPipe();
+        winograd_pipe.push_weights(M + 2, Network::INPUT_CHANNELS, CHANNELS, weights);
+        auto sparse_pipe = CPUPipe();
+        sparse_pipe.push_weights(M + 2, Network::INPUT_CHANNELS, CHANNELS, sparse_weights);
+
+        for (const auto black_to_move : { true, false }) 
+		{
+            const auto input = random_input_planes(0.1, black_to_move, rng);
+            auto expected_pol = std::vector<float>(Network::OUTPUTS_POLICY * NUM_INTERSECTIONS);
+            auto expected_val = std::vector<float>(Network::OUTPUTS_VALUE * NUM_INTERSECTIONS);
+            auto result_pol = expected_pol;
+            auto result_val = expected_val;
+
+            winograd_pipe.forward(input, expected_pol, expected_val);
+            sparse_pipe.forward(input, result_pol, result_val);
+
+            for (auto i = size_t{0}; i < expected_pol.size(); i++)
+                ASSERT_NEAR(expected_pol[i], result_pol[i], 1e-2f) << " policy at " << i;
+            for (auto i = size_t{0}; i < expected_val.size(); i++)
+                ASSERT_NEAR(expected_val[i], result_val[i], 1e-2f) << " value at " << i;
+        }
+    }
+
+    double input_convolutions_per_second(const bool sparse, const double occupied, const int iterations)
+	{
+        constexpr auto M = WINOGRAD_M;
+        auto rng = std::mt19937(BOARD_SIZE);
+        const auto filters = random_vector(CHANNELS * Network::INPUT_CHANNELS * 9, rng);
+
+        auto weights = std::make_shared<ForwardPipe::ForwardPipeWeights>();
+        weights->m_conv_weights.emplace_back(Network::winograd_transform_f<M>(filters, CHANNELS, Network::INPUT_CHANNELS));
+        weights->m_batchnorm_means.emplace_back(CHANNELS, 0.0f);
+        weights->m_batchnorm_stddevs.emplace_back(CHANNELS, 1.0f);
+        weights->m_conv_pol_weights = random_vector(Network::OUTPUTS_POLICY * CHANNELS, rng);
+        weights->m_conv_val_weights = random_vector(Network::OUTPUTS_VALUE * CHANNELS, rng);
+        if (sparse)
+            weights->m_conv_input_weights = filters;
+
+        auto pipe = CPUPipe();
+        pipe.push_weights(M + 2, Network::INPUT_CHANNELS, CHANNELS, weights);
+
+        const auto input = random_input_planes(occupied, true, rng);
+        auto output_pol = std::vector<float>(Network::OUTPUTS_POLICY * NUM_INTERSECTIONS);
+        auto output_val = std::vector<float>(Network::OUTPUTS_VALUE * NUM_INTERSECTIONS);
+
+        const auto start = std::chrono::steady_clock::now();
+    	
+        for (auto i = 0; i < iterations; i++)
+            pipe.forward(input, output_pol, output_val);
+    	
+        const auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    	
+        return iterations / elapsed;
+    }
+
+    template <int M>
+    void expect_sgemm_matches_reference(const int channels, const int outputs)
+	{
+        constexpr auto tile = WinogradTransform<M>::ALPHA * WinogradTransform<M>::ALPHA;
+        constexpr auto tiles = winograd_tiles(BOARD_SIZE, M) * winograd_tiles(BOARD_SIZE, M);
+        
+        auto rng = std::mt19937(channels * outputs);
+        const auto U = random_vector(tile * channels * outputs, rng);
+        const auto V = random_vector(tile * channels * tiles, rng);
+        auto M_out = std::vector<float>(tile * outputs * tiles);
+
+        CPUPipe::winograd_sgemm<M>(U, V, M_out, channels, outputs);
+
+        for (auto b = 0; b < tile; b++) 
+		{
+            for (auto k = 0; k < outputs; k++) 
+			{
+                for (auto p = 0; p < tiles; p++) 
+				{
+                    auto expected = 0.0f;
+                	
+                    for (auto c = 0; c < channels; c++)
+                        expected += U[(b * channels + c) * outputs + k] * V[(b * channels + c) * tiles + p];
+                	
+                    ASSERT_NEAR(expected, M_out[(b * outputs + k) * tiles + p], 1e-3f) << channels << "x" << outputs << " at " << b << "," << k << "," << p;
+                }
+            }
+        }
+    }
+
+    enum class Sgemm { Winograd, Eigen, OpenBLAS };
+
+    // Multiplications of the shape of this board size per second, every Winograd tile element counts as one
+    double sgemms_per_second(const Sgemm sgemm, const int channels, const int iterations)
+	{
+        constexpr auto tile = WINOGRAD_ALPHA * WINOGRAD_ALPHA;
+        constexpr auto tiles = WINOGRAD_P;
+
+        auto rng = std::mt19937(channels);
+        const auto U = random_vector(tile * channels * channels, rng);
+        const auto V = random_vector(tile * channels * tiles, rng);
+        auto M_out = std::vector<float>(tile * channels * tiles);
+
+        const auto start = std::chrono::steady_clock::now();
+    	
+        for (auto i = 0; i < iterations; i++) 
+		{
+            for (auto b = 0; b < tile; b++) 
+			{
+                const auto offset_u = b * channels * channels;
+                const auto offset_v = b * channels * tiles;
+                const auto offset_m = b * channels * tiles;
+
+                if (sgemm == Sgemm::Eigen) 
+				{
+                    using EigenMatrixMap = Eigen::Map<Eigen::Matrix<float, Eigen::Dynamic, Eigen::Dynamic>>;
+                    using ConstEigenMatrixMap = Eigen::Map<const Eigen::Matrix<float, Eigen::Dynamic, Eigen::Dynamic>>;
+                	
+                    auto C_mat = EigenMatrixMap(M_out.data() + offset_m, tiles, channels);
+                    C_mat.noalias() = ConstEigenMatrixMap(V.data() + offset_v, tiles, channels) * ConstEigenMatrixMap(U.data() + offset_u, channels, channels).transpose();
+                }
+#ifdef USE_OPENBLAS
+                else if (sgemm == Sgemm::OpenBLAS)
+                    cblas_sgemm(CblasRowMajor, CblasTrans, CblasNoTrans, channels, tiles, channels, 1.0f, &U[offset_u], channels, &V[offset_v], tiles, 0.0f, &M_out[offset_m], tiles);
+#endif
+            }
+        	
+            if (sgemm == Sgemm::Winograd)
+                CPUPipe::winograd_sgemm(U, V, M_out, channels, channels);
+        }
+    	
+        const auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    	
+        return iterations * tile / elapsed;
+    }
+
+    template <int M>
+    double convolutions_per_second(const int iterations)
+	{
+        auto rng = std::mt19937(M);
+        const auto input = random_vector(CHANNELS * BOARD_SIZE * BOARD_SIZE, rng);
+        const auto filters = random_vector(CHANNELS * CHANNELS * 9, rng);
+
+        constexpr auto tile = WinogradTransform<M>::ALPHA * WinogradTransform<M>::ALPHA;
+        constexpr auto tiles = winograd_tiles(BOARD_SIZE, M) * winograd_tiles(BOARD_SIZE, M);
+
+        const auto U = Network::winograd_transform_f<M>(filters, CHANNELS, CHANNELS);
+        auto V = std::vector<float>(tile * CHANNELS * tiles);
+        auto M_buffer = std::vector<float>(tile * CHANNELS * tiles);
+        auto output = std::vector<float>(CHANNELS * BOARD_SIZE * BOARD_SIZE);
+
+        const auto start = std::chrono::steady_clock::now();
+    	
+        for (auto i = 0; i < iterations; i++)
+            CPUPipe::winograd_convolve3<M>(CHANNELS, input, U, V, M_buffer, output);
+    	
+        const auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    	
+        return iterations / elapsed;
+    }
+}
+
+TEST(WinogradTest, TileSizeCoversBoard)
+{
+    EXPECT_GE(WINOGRAD_M * WINOGRAD_W_TILES, BOARD_SIZE);
+    EXPECT_LT(WINOGRAD_M * (WINOGRAD_W_TILES - 1), BOARD_SIZE);
+    EXPECT_EQ(WINOGRAD_ALPHA, WINOGRAD_M + 2);
+}
+
+TEST(WinogradTest, SelectedTileSizes)
+{
+    EXPECT_EQ(winograd_select_m(9), 3);
+    EXPECT_EQ(winograd_select_m(13), 4);
+    EXPECT_EQ(winograd_select_m(19), 4);
+}
+
+TEST(WinogradTest, MatchesDirectConvolution)
+{
+    expect_all_tiles_match_direct();
+}
+
+TEST(WinogradTest, SparseInputMatchesWinograd)
+{
+    expect_sparse_input_matches_winograd();
+}
+
+TEST(WinogradTest, SgemmMatchesReference)
+{
+    // Channel counts that leave partial register blocks too
+    expect_sgemm_matches_reference<WINOGRAD_M>(64, 64);
+    expect_sgemm_matches_reference<WINOGRAD_M>(18, 37);
+    expect_sgemm_matches_reference<WINOGRAD_M>(32, 48);
+    expect_sgemm_matches_reference<WINOGRAD_M>(24, 29);
+}
+
+// Not a correctness check, reports the throughput of every tile size. Run with --gtest_also_run_disabled_tests
+TEST(WinogradTest, DISABLED_Benchmark)
+{
+    constexpr auto iterations = 200;
+
+    // Warm up
+    convolutions_per_second<WINOGRAD_M>(iterations / 10);
+
+    printf("%d filters, compiled for %dx%d with F(%dx%d, 3x3)\n", CHANNELS, BOARD_SIZE, BOARD_SIZE, WINOGRAD_M, WINOGRAD_M);
+    printf("        F(2x2, 3x3) F(3x3, 3x3) F(4x4, 3x3)  convolutions/s\n");
+    printf("%2dx%-2d %11.0f %11.0f %11.0f\n", BOARD_SIZE, BOARD_SIZE, convolutions_per_second<2>(iterations), convolutions_per_second<3>(iterations), convolutions_per_second<4>(iterations));
+}
+
+// Not a correctness check, reports the input layer with and without skipping the empty intersections, heads included.
+// Run with --gtest_also_run_disabled_tests
+TEST(WinogradTest, DISABLED_SparseInputBenchmark)
+{
+    constexpr auto iterations = 500;
+
+    // Warm up
+    input_convolutions_per_second(false, 0.3, iterations);
+
+    printf("input layer, occupied  Winograd      sparse  forwards/s\n");
+    for (const auto occupied : { 0.05, 0.15, 0.3, 0.5 }) 
+        printf("%2dx%-2d %3.0f%%        %11.0f %11.0f\n", BOARD_SIZE, BOARD_SIZE, occupied * 100, input_convolutions_per_second(false, occupied, iterations), input_convolutions_per_second(true, occupied, iterations));
+}
+
+// Not a correctness check, reports the built-in Winograd SGEMM against Eigen and OpenBLAS on the shapes of this board size.
+// Run with --gtest_also_run_disabled_tests
+TEST(WinogradTest, DISABLED_SgemmBenchmark)
+{
+    constexpr auto iterations = 200;
+
+    // Warm up
+    sgemms_per_second(Sgemm::Winograd, 64, iterations);
+
+    printf("%dx%d F(%dx%d, 3x3) channels    built-in       Eigen    OpenBLAS  sgemms/s\n", BOARD_SIZE, BOARD_SIZE, WINOGRAD_M, WINOGRAD_M);
+    for (const auto channels : { 32, 64, 128, 192, 256 }) 
+	{
+#ifdef USE_OPENBLAS
+        const auto openblas = sgemms_per_second(Sgemm::OpenBLAS, channels, iterations);
+#else
+        const auto openblas = 0.0;
+#endif
+        printf("                %8d %11.0f %11.0f %11.0f\n", channels, sgemms_per_second(Sgemm::Winograd, channels, iterations), sgemms_per_second(Sgemm::Eigen, channels, iterations), openblas);
+    }
+}